@@ -63,14 +63,13 @@ extern TIM_HandleTypeDef htim12;
 /* Exported macro ------------------------------------------------------------*/
 /* USER CODE BEGIN EM */
 extern void ecuISRTimerTick(void);
-extern void ecuISRIgnitionTimer(void);
-extern void ecuISRInjectionATimer(void);
-extern void ecuISRInjectionBTimer(void);
-extern void ecuISRInjectionCTimer(void);
-extern void ecuISRInjectionDTimer(void);
+extern void ecuISREventQueue(void);
 extern void ecuISRHostUART(void);
 extern void ecuISRAuxUART(void);
 extern void ecuISRcrankshaftTrigger(void);
+extern void ecuISRcrankshaftDMA(void);
+extern void ecuISRangleADC(void);
+extern void ecuISROutputCompare(void);
 /* USER CODE END EM */
 
 void HAL_TIM_MspPostInit(TIM_HandleTypeDef *htim);
@@ -55,6 +55,7 @@ void SVC_Handler(void);
 void DebugMon_Handler(void);
 void PendSV_Handler(void);
 void SysTick_Handler(void);
+void ADC_IRQHandler(void);
 void TIM1_BRK_TIM9_IRQHandler(void);
 void TIM1_UP_TIM10_IRQHandler(void);
 void TIM1_TRG_COM_TIM11_IRQHandler(void);
@@ -65,6 +66,7 @@ void USART1_IRQHandler(void);
 void USART2_IRQHandler(void);
 void TIM8_UP_TIM13_IRQHandler(void);
 void TIM5_IRQHandler(void);
+void DMA1_Stream5_IRQHandler(void);
 void DMA2_Stream0_IRQHandler(void);
 /* USER CODE BEGIN EFP */
 
@@ -0,0 +1,291 @@
+/*
+ *
+ * Crank angle synchronous ADC acquisition.
+ *
+ * Samples analog inputs at fixed crank angles, rather than at the HF task's fixed times: MAP at intake valve closing, the
+ * knock window start & end, lambda at a fixed angle. Each request is an ADC input & an angle after the firing TDC of each
+ * cylinder, so it's sampled once per cylinder per engine cycle. aqSetRequest() builds a table of the sample points through
+ * the engine cycle (angle clock angles, from each cylinder's TDC in the trigger wheel handler's firing table), sorted by angle
+ * & double buffered like the event table. The cylinders are numbered by their position in the firing order.
+ *
+ * The samples are timed by hardware. At each in-sync edge, the crankshaft pulse handler calls aqEdge() after the angle clock
+ * is updated. If the next sample point is before the next edge, its time is extrapolated by the angle clock & the ADC
+ * trigger (a TIM2 compare, see ecu_services.c) is armed for that time. The conversion runs without the CPU; the tooth
+ * interrupt only sets the compare. The ADC interrupt stores the result in the request's buffer for the cylinder & arms the
+ * next sample point if it's also before the next edge. A sample point still armed when the next edge arrives (the engine
+ * accelerated) is triggered immediately; sample points whose time had passed by more than AQ_MAX_LATE when they would be
+ * armed (e.g. pulses decoded late in DMA capture mode) are missed & counted.
+ *
+ * The HF task reads the latest sample for each cylinder with aqGetSample(), or the mean over the engine cycle with
+ * aqGetCycleMean(). The samples are cleared when the angle clock stops, so the consumer can fall back to the time based input.
+ *
+ * Until the camshaft pulse sets the engine phase, the cylinder a sample is stored against may be 360 degrees out, as the
+ * angle clock is.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "angle_acquisition.h"
+#include "angle_clock.h"
+#include "ecu_services.h"
+#include "trigger_wheel_handler.h"
+#include "cfg_data.h"
+#include "utility_functions.h"
+
+
+// a sample point is missed if its time has passed by more than this when it's armed (uS)
+#define AQ_MAX_LATE 20
+
+#define AQ_MAX_POINTS (AQ_MAX_REQUESTS * AQ_CYLINDERS)
+
+typedef struct {
+	int16_t angle;						// engine cycle angle (tenths of a degree)
+	uint8_t request;
+	uint8_t cylinder;
+	uint8_t adcIndex;
+} aqPointStruct;
+
+typedef struct {
+	int points;
+	aqPointStruct point[AQ_MAX_POINTS];
+} aqTableStruct;
+
+volatile uint32_t aqSamples = 0;
+volatile uint32_t aqMissedSamples = 0;
+
+// the requests
+static int aqAngle[AQ_MAX_REQUESTS] = { AQ_DISABLED, AQ_DISABLED, AQ_DISABLED, AQ_DISABLED };
+static int aqAdcIndex[AQ_MAX_REQUESTS];
+
+// the latest samples
+static aqSampleStruct aqSample[AQ_MAX_REQUESTS][AQ_CYLINDERS];
+
+// the sample point tables, aqActiveTable is switched to a new table when it's built & picked up by the interrupts at the next edge
+static aqTableStruct aqTables[2];
+static aqTableStruct * volatile aqActiveTable = &aqTables[0];
+
+// interrupt state
+static aqTableStruct *aqTable = &aqTables[0];			// the table in use
+static int aqNext = -1;									// the next sample point, -1 if not located
+static int aqArmed = 0;									// non-zero if the next sample point is armed & not yet converted
+static int aqEdgeAngleN_1 = 0;							// the angle of the previous edge
+
+
+static inline int aqNextPoint(int point) {
+	return point + 1 < aqTable->points ? point + 1 : 0;
+}
+
+
+// the angle from one engine cycle angle forward to another
+static inline int aqAngleFrom(int from, int to) {
+	return to >= from ? to - from : to + AC_ENGINE_CYCLE - from;
+}
+
+
+// arms the next sample point, if it's before the next edge. Sample points whose time has passed are missed.
+static void aqArmNext(void) {
+
+	uint32_t time;
+
+	for (int i = 0; i < aqTable->points; i++) {
+
+		aqPointStruct *point = &aqTable->point[aqNext];
+
+		if (acTimeAtAngle(point->angle, &time) == 0) {
+			// after the next edge
+			return;
+		}
+		if ((int32_t)(CRANKSHAFT_TRIGGER_TIMER->CNT - time) <= AQ_MAX_LATE) {
+			startAngleSampleTimer(time, point->adcIndex);
+			aqArmed = 1;
+			return;
+		}
+
+		aqMissedSamples++;
+		aqArmed = 0;
+		aqNext = aqNextPoint(aqNext);
+	}
+}
+
+
+void aqEdge() {
+
+	int span;
+	int edgeAngle = acGetEdgeAngle(&span);
+	aqTableStruct *table = aqActiveTable;
+
+	if ( (edgeAngle == AC_NO_ANGLE) || (table->points == 0) ) {
+		if (aqNext >= 0) {
+			aqStop();
+		}
+		return;
+	}
+
+	if ( (table != aqTable) || (aqNext < 0) ) {
+
+		// (re)start at the first sample point at or after the edge
+		stopAngleSampleTimer();
+		aqTable = table;
+		aqArmed = 0;
+		aqNext = 0;
+		for (int i = 1; i < table->points; i++) {
+			if (aqAngleFrom(edgeAngle, table->point[i].angle) < aqAngleFrom(edgeAngle, table->point[aqNext].angle)) {
+				aqNext = i;
+			}
+		}
+	}
+	else {
+
+		// sample points from the previous edge to this edge haven't been converted. If armed, the engine accelerated & it's
+		// triggered now. Otherwise it's been missed.
+		int interval = aqAngleFrom(aqEdgeAngleN_1, edgeAngle);
+		for (int i = 0; (i < table->points) && (aqAngleFrom(aqEdgeAngleN_1, table->point[aqNext].angle) < interval); i++) {
+			if (aqArmed != 0) {
+				startAngleSampleTimer(CRANKSHAFT_TRIGGER_TIMER->CNT, table->point[aqNext].adcIndex);
+				aqEdgeAngleN_1 = edgeAngle;
+				return;
+			}
+			aqMissedSamples++;
+			aqNext = aqNextPoint(aqNext);
+		}
+	}
+
+	aqEdgeAngleN_1 = edgeAngle;
+	aqArmNext();
+}
+
+
+int aqNextToothHasSample() {
+
+	int span;
+	int edgeAngle = acGetEdgeAngle(&span);
+
+	if ( (edgeAngle == AC_NO_ANGLE) || (aqActiveTable->points == 0) ) {
+		return 0;
+	}
+	if ( (aqNext < 0) || (aqActiveTable != aqTable) ) {
+		return 1;
+	}
+	// allows for a missing tooth gap after the next edge
+	return aqAngleFrom(edgeAngle, aqTable->point[aqNext].angle) < 3 * span;
+}
+
+
+void aqSampleComplete(uint16_t value) {
+
+	if ( (aqNext < 0) || (aqArmed == 0) ) {
+		return;
+	}
+
+	aqPointStruct *point = &aqTable->point[aqNext];
+	aqSampleStruct *sample = &aqSample[point->request][point->cylinder];
+	sample->value = value;
+	sample->count = sample->count + 1 != 0 ? sample->count + 1 : 1;
+	aqSamples++;
+
+	aqArmed = 0;
+	aqNext = aqNextPoint(aqNext);
+	aqArmNext();
+}
+
+
+void aqStop() {
+	stopAngleSampleTimer();
+	aqNext = -1;
+	aqArmed = 0;
+	for (int r = 0; r < AQ_MAX_REQUESTS; r++) {
+		for (int c = 0; c < AQ_CYLINDERS; c++) {
+			aqSample[r][c].count = 0;
+		}
+	}
+}
+
+
+int aqGetSample(aqRequestType request, int cylinder, uint16_t *value) {
+	if ( (request >= AQ_MAX_REQUESTS) || (cylinder < 0) || (cylinder >= AQ_CYLINDERS) ) {
+		return 0;
+	}
+	int count = aqSample[request][cylinder].count;
+	*value = aqSample[request][cylinder].value;
+	return count;
+}
+
+
+int aqGetCycleMean(aqRequestType request, uint16_t *mean) {
+
+	uint32_t sum = 0;
+
+	if (request >= AQ_MAX_REQUESTS) {
+		return 0;
+	}
+	int cylinders = twCylinders;
+	for (int c = 0; c < cylinders; c++) {
+		if (aqSample[request][c].count == 0) {
+			return 0;
+		}
+		sum += aqSample[request][c].value;
+	}
+	*mean = (uint16_t)((sum + cylinders / 2) / cylinders);
+	return 1;
+}
+
+
+// builds the sample point table from the requests & makes it active
+static void aqBuildTable(void) {
+
+	aqTableStruct *table = aqActiveTable == &aqTables[0] ? &aqTables[1] : &aqTables[0];
+	int n = 0;
+
+	for (int r = 0; r < AQ_MAX_REQUESTS; r++) {
+		if (aqAngle[r] == AQ_DISABLED) {
+			continue;
+		}
+		for (int c = 0; c < twCylinders; c++) {
+
+			aqPointStruct point;
+			point.angle = (twCylinderTDCAngle(c) + aqAngle[r]) % AC_ENGINE_CYCLE;
+			point.request = r;
+			point.cylinder = c;
+			point.adcIndex = aqAdcIndex[r];
+
+			// insert in angle order
+			int i = n++;
+			while ( (i > 0) && (table->point[i - 1].angle > point.angle) ) {
+				table->point[i] = table->point[i - 1];
+				i--;
+			}
+			table->point[i] = point;
+		}
+	}
+
+	table->points = n;
+	aqActiveTable = table;
+}
+
+
+void aqSetRequest(aqRequestType request, int adcIndex, int angle) {
+	if (request >= AQ_MAX_REQUESTS) {
+		return;
+	}
+	aqAngle[request] = angle >= 0 ? angle % AC_ENGINE_CYCLE : AQ_DISABLED;
+	aqAdcIndex[request] = adcIndex;
+	aqBuildTable();
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 15 Oct 2026 First version.
+2) 16 Oct 2026 Sample points at each cylinder's TDC from the firing table (twCylinderTDCAngle()), for up to CF_MAX_CYLINDERS.
++++REVISION_HISTORY_ENDS+++*/
@@ -0,0 +1,67 @@
+#ifndef _angleAcquisition
+#define _angleAcquisition
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <stdint.h>
+#include "cfg_data.h"
+
+
+// the sample requests, each is sampled once per cylinder per engine cycle
+typedef enum { AQ_MAP, AQ_KNOCK_START, AQ_KNOCK_END, AQ_LAMBDA, AQ_MAX_REQUESTS } aqRequestType;
+
+// the most cylinders, the firing TDCs are taken from the trigger wheel handler's firing table
+#define AQ_CYLINDERS CF_MAX_CYLINDERS
+
+// the request angle to disable a request
+#define AQ_DISABLED -1
+
+// the latest sample of a request for a cylinder
+typedef struct {
+	volatile uint16_t value;			// the raw ADC value
+	volatile uint16_t count;			// incremented at each sample, 0 if not sampled since the angle clock started
+} aqSampleStruct;
+
+// number of samples converted, & sample points missed because the sample time had passed when it was armed
+extern volatile uint32_t aqSamples;
+extern volatile uint32_t aqMissedSamples;
+
+// sets the ADC input (adcRawData[] index) & angle (tenths of a degree after each cylinder's firing TDC, 0 to 7199) of a
+// request, or disables it if the angle is AQ_DISABLED. Not called from an interrupt.
+extern void aqSetRequest(aqRequestType request, int adcIndex, int angle);
+
+// arms the ADC trigger for the next sample point before the next edge. Called from the crankshaft pulse handler after the
+// angle clock is updated.
+extern void aqEdge(void);
+
+// returns non-zero if the next sample point may be before the edge after the next edge, i.e. the next crankshaft pulse must
+// interrupt in DMA capture mode
+extern int aqNextToothHasSample(void);
+
+// stores the converted sample & arms the next sample point. Called from the ADC injected conversion interrupt.
+extern void aqSampleComplete(uint16_t value);
+
+// disarms the ADC trigger, until the angle clock restarts. Called when the crankshaft stalls.
+extern void aqStop(void);
+
+// sets value to the latest sample of the request for the cylinder (position in the firing order) & returns its count, 0 if
+// there's no sample
+extern int aqGetSample(aqRequestType request, int cylinder, uint16_t *value);
+
+// sets mean to the mean of the latest samples of the request for every cylinder, i.e. over the last engine cycle, & returns
+// non-zero, or returns 0 if any cylinder hasn't been sampled since the angle clock started
+extern int aqGetCycleMean(aqRequestType request, uint16_t *mean);
+
+#endif
@@ -0,0 +1,267 @@
+/*
+ *
+ * Crank angle clock.
+ *
+ * Provides the engine cycle angle, to 0.1 degree resolution, at any instant rather than only at the trigger wheel edges.
+ *
+ * At each in-sync edge, the crankshaft pulse handler calls acEdge() with the captured edge time, the period from the previous
+ * edge & the edge position. The clock's phase is locked to the edge angle, and its rate to the tooth period extrapolated from
+ * the last two tooth periods (normalised to one tooth spacing), so between edges the angle is extrapolated from the last edge:
+ *
+ * 		angle(t) = edge angle + (t - edge time) x tooth spacing / (2 x period(n) - period(n-1))
+ *
+ * The linear period extrapolation follows the speed variation within the engine cycle (compression & firing), which the
+ * tooth period predictor used for the event delays averages out. test_code/angle_clock_sim.c runs acEdge() & acAngleAt() on a
+ * 36-1 wheel with 8% speed ripple & +/-3 uS edge jitter: from 1000 to 3000 RPM the RMS error of the angle is 0.06 - 0.11
+ * degrees, against 0.12 - 0.13 degrees using the last period & 0.31 degrees using the predictor. The extrapolation doubles the
+ * jitter, so at 6000 RPM (0.18 against 0.16 degrees) & at +/-5000 RPM/s (0.14 degrees) it's no better than the last period.
+ * The extrapolated angle is held just before the angle of the next edge, so the angle never runs past an edge that hasn't
+ * arrived & never goes backwards when it does. The difference between the edge angle & the extrapolated angle (without the
+ * hold) at each edge is the phase error of the clock, recorded as a measure of its accuracy.
+ *
+ * Edges that aren't on a tooth position (e.g. the "+1" tooth) are located from the previous edge & the gap. Missing tooth
+ * gaps are spanned at the extrapolated rate. The clock stops when the decoder loses sync or the crankshaft stalls.
+ *
+ * acEdge() is called from the interrupt: integer arithmetic only, with a fixed number of 32 bit divides. Readers (acGetAngle()
+ * etc.) can be interrupted by acEdge(), so they retry if the clock was updated while reading.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "angle_clock.h"
+#include "trigger_decoder.h"
+#include "ecu_services.h"
+#include "utility_functions.h"
+
+
+// one revolution (tenths of a degree)
+#define AC_REVOLUTION (AC_ENGINE_CYCLE / 2)
+
+// the angle is held at the next edge after this time from the last edge (uS), also keeps (elapsed x AC_REVOLUTION) in 32 bits
+#define AC_MAX_ELAPSED 1000000UL
+
+// the phase error mean filter time constant is 2^AC_MEAN_SHIFT edges
+#define AC_MEAN_SHIFT 4
+
+static int acTeeth = 36;
+
+// clock state, written by acEdge()
+static volatile int acRunning = 0;
+static volatile uint32_t acEdgeTime = 0;				// time of the last edge (uS)
+static volatile int acEdgeAngle = 0;					// engine cycle angle of the last edge
+static volatile int acSpan = 0;							// angle from the last edge to the next edge
+static volatile uint32_t acDenominator = 1;				// teeth x the extrapolated tooth period, the rate is AC_REVOLUTION / acDenominator
+static volatile uint32_t acSequence = 0;				// incremented at each update
+static int acPosition = -1;								// position of the last edge (quarter tooth spacings from the start of the cycle)
+static uint32_t acPeriodN_1 = 0;						// the previous tooth period (uS), 0 if not known
+
+// phase error statistics
+volatile int acPhaseError = 0;
+volatile int acPhaseErrorMean = 0;
+volatile int acPhaseErrorMax = 0;
+static int acPhaseErrorMeanAcc = 0;
+
+
+// the angle of a position in quarter tooth spacings from the start of the engine cycle
+static inline int acPositionAngle(int position) {
+	return (position * AC_REVOLUTION) / (4 * acTeeth);
+}
+
+
+// the angle advanced in the time since the last edge, rounded to the nearest tenth of a degree
+static inline int acAdvance(uint32_t elapsed) {
+	return elapsed < AC_MAX_ELAPSED ? (int)((elapsed * AC_REVOLUTION + acDenominator / 2) / acDenominator) : AC_REVOLUTION;
+}
+
+
+void acEdge(uint32_t time, uint32_t period, int tooth, int gap, int nextGap, int revolution) {
+
+	int position;
+
+	if ( (gap == 0) || (period == 0) ) {
+		acStop();
+		return;
+	}
+
+	// the tooth period, normalised to one tooth spacing, and the period extrapolated to the next tooth
+	period = gap == 4 ? period : (period * 4) / gap;
+	uint32_t extrapolated = period;
+	if (acPeriodN_1 != 0) {
+		extrapolated = limitI(2 * (int32_t)period - (int32_t)acPeriodN_1, period / 2, period * 2);
+	}
+	acPeriodN_1 = period;
+
+	if (tooth != TD_NO_TOOTH) {
+		position = 4 * (tooth + (revolution != 0 ? acTeeth : 0));
+	}
+	else if (acPosition >= 0) {
+		position = acPosition + gap;
+		if (position >= 8 * acTeeth) {
+			position -= 8 * acTeeth;
+		}
+	}
+	else {
+		// not located yet
+		return;
+	}
+
+	int angle = acPositionAngle(position);
+
+	if (acRunning != 0) {
+		// the phase error, within +/- half a revolution as the engine phase can be changed by a camshaft pulse
+		int error = angle - (acEdgeAngle + acAdvance(time - acEdgeTime));
+		error = ((error % AC_REVOLUTION) + AC_REVOLUTION + AC_REVOLUTION / 2) % AC_REVOLUTION - AC_REVOLUTION / 2;
+		int absError = error < 0 ? -error : error;
+		acPhaseError = error;
+		acPhaseErrorMeanAcc += absError - (acPhaseErrorMeanAcc >> AC_MEAN_SHIFT);
+		acPhaseErrorMean = acPhaseErrorMeanAcc >> AC_MEAN_SHIFT;
+		if (absError > acPhaseErrorMax) {
+			acPhaseErrorMax = absError;
+		}
+	}
+
+	acPosition = position;
+	acEdgeTime = time;
+	acEdgeAngle = angle;
+	acSpan = acPositionAngle(position + (nextGap > 0 ? nextGap : 4)) - angle;
+	acDenominator = (uint32_t)acTeeth * extrapolated;
+	acRunning = 1;
+	acSequence++;
+}
+
+
+void acStop() {
+	acRunning = 0;
+	acPosition = -1;
+	acPeriodN_1 = 0;
+	acSequence++;
+}
+
+
+int acAngleAt(uint32_t time) {
+
+	uint32_t sequence;
+	int angle;
+
+	do {
+		sequence = acSequence;
+		if (acRunning == 0) {
+			angle = AC_NO_ANGLE;
+		}
+		else {
+			int advance = acAdvance(time - acEdgeTime);
+			angle = acEdgeAngle + (advance < acSpan ? advance : acSpan - 1);
+			if (angle >= AC_ENGINE_CYCLE) {
+				angle -= AC_ENGINE_CYCLE;
+			}
+		}
+	} while (sequence != acSequence);
+
+	return angle;
+}
+
+
+int acGetAngle() {
+
+	uint32_t sequence;
+	int angle;
+
+	// the time is read inside the loop, so it's never before the edge
+	do {
+		sequence = acSequence;
+		angle = acAngleAt(CRANKSHAFT_TRIGGER_TIMER->CNT);
+	} while (sequence != acSequence);
+
+	return angle;
+}
+
+
+int acGetEdgeAngle(int *span) {
+
+	uint32_t sequence;
+	int angle;
+
+	do {
+		sequence = acSequence;
+		angle = acRunning != 0 ? acEdgeAngle : AC_NO_ANGLE;
+		*span = acSpan;
+	} while (sequence != acSequence);
+
+	return angle;
+}
+
+
+int acTimeAtAngle(int angle, uint32_t *time) {
+
+	uint32_t sequence;
+	int found;
+
+	do {
+		sequence = acSequence;
+		found = 0;
+		if ( (acRunning != 0) && (angle >= 0) && (angle < AC_ENGINE_CYCLE) ) {
+			int delta = angle >= acEdgeAngle ? angle - acEdgeAngle : angle + AC_ENGINE_CYCLE - acEdgeAngle;
+			if (delta < acSpan) {
+				*time = acEdgeTime + (uint32_t)(((uint64_t)delta * acDenominator) / AC_REVOLUTION);
+				found = 1;
+			}
+		}
+	} while (sequence != acSequence);
+
+	return found;
+}
+
+
+int acTimeToAngle(int angle) {
+
+	uint32_t sequence;
+	int now;
+	uint32_t denominator;
+
+	do {
+		sequence = acSequence;
+		now = acAngleAt(CRANKSHAFT_TRIGGER_TIMER->CNT);
+		denominator = acDenominator;
+	} while (sequence != acSequence);
+
+	if ( (now == AC_NO_ANGLE) || (angle < 0) || (angle >= AC_ENGINE_CYCLE) ) {
+		return -1;
+	}
+
+	int delta = angle >= now ? angle - now : angle + AC_ENGINE_CYCLE - now;
+	return (int)(((uint64_t)delta * denominator) / AC_REVOLUTION);
+}
+
+
+void acResetStatistics() {
+	acPhaseError = 0;
+	acPhaseErrorMean = 0;
+	acPhaseErrorMeanAcc = 0;
+	acPhaseErrorMax = 0;
+}
+
+
+void acInitialise(int teeth) {
+	acTeeth = teeth > 0 ? teeth : 1;
+	acStop();
+	acResetStatistics();
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 15 Oct 2026 First version.
+2) 15 Oct 2026 acGetEdgeAngle() & acTimeAtAngle() added, for scheduling the angle synchronous ADC samples.
+3) 16 Oct 2026 Accuracy figures from the host simulation (test_code/angle_clock_sim.c).
++++REVISION_HISTORY_ENDS+++*/
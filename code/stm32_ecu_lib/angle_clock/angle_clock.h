@@ -0,0 +1,64 @@
+#ifndef _angleClock
+#define _angleClock
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <stdint.h>
+
+
+// angles are in tenths of a degree, the engine cycle is 0 to AC_ENGINE_CYCLE - 1
+#define AC_ENGINE_CYCLE 7200
+
+// returned when the clock isn't running, i.e. the trigger decoder is not in sync
+#define AC_NO_ANGLE -1
+
+// phase error at the last edge, the mean absolute & maximum absolute phase error (tenths of a degree). See angle_clock.c.
+extern volatile int acPhaseError;
+extern volatile int acPhaseErrorMean;
+extern volatile int acPhaseErrorMax;
+
+// locks the clock to an in-sync crankshaft edge. Called from the crankshaft pulse handler.
+// time - the captured time of the edge (uS), period - the time from the previous edge (uS), tooth - the tooth index
+// (TD_NO_TOOTH if not on a tooth position), gap & nextGap - the gaps from the previous & to the next edge (quarter tooth
+// spacings), revolution - the engine revolution (0 or 1)
+extern void acEdge(uint32_t time, uint32_t period, int tooth, int gap, int nextGap, int revolution);
+
+// stops the clock, until the next in-sync edge
+extern void acStop(void);
+
+// returns the engine cycle angle at the time (uS), or AC_NO_ANGLE. The time must not be before the last edge.
+extern int acAngleAt(uint32_t time);
+
+// returns the current engine cycle angle, or AC_NO_ANGLE
+extern int acGetAngle(void);
+
+// returns the time (uS) from now until the clock reaches the engine cycle angle at the current speed, or -1
+extern int acTimeToAngle(int angle);
+
+// returns the engine cycle angle of the last edge & sets span to the angle from the last edge to the next edge, or returns
+// AC_NO_ANGLE if the clock isn't running
+extern int acGetEdgeAngle(int *span);
+
+// if the engine cycle angle is between the last edge & the next edge, sets time to the time (uS) the clock reaches it at the
+// extrapolated rate & returns non-zero. Returns 0 if the angle is at or after the next edge, or the clock isn't running.
+extern int acTimeAtAngle(int angle, uint32_t *time);
+
+// clears the phase error statistics
+extern void acResetStatistics(void);
+
+// sets the number of tooth positions per revolution
+extern void acInitialise(int teeth);
+
+#endif
@@ -27,9 +27,12 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "sensors.h"
 #include "vvt_controller.h"
 #include "nvm.h"
+#include "string.h"
 
 // prototypes
 static uint16_t absAddr(int relAddr);
+static uint16_t absAddrExt(int relAddr);
+static void cfRestoreExtBlock(uint8_t *blkPtr, uint16_t eepromAddress, int blkSize);
 
 
 // NVM space has been allocated for up to 8 different configurations
@@ -67,7 +70,22 @@ page1Struct cfPage1 = {
 						{488.0F,496.0F,504.0F,512.0F,520.0F,528.0F,536.0F,548.0F},
 						{490.0F,500.0F,510.0F,520.0F,530.0F,540.0F,550.0F,565.0F},
 						{492.0F,504.0F,516.0F,528.0F,540.0F,552.0F,564.0F,582.0F},
-						{500.0F,514.0F,528.0F,542.0F,556.0F,570.0F,584.0F,600.0F}}};
+						{500.0F,514.0F,528.0F,542.0F,556.0F,570.0F,584.0F,600.0F}},
+	.p3 =			{0,0,10,0,4,1342,0,{0,0,0,0,0,0,0,0},{80,100,120,140,160},{6000,4800,4000,3400,3000},1,1500,0,{50,50,0},{3600,1800,900},1,1400,250,0,3600}};
+
+
+// Trigger wheel patterns, selected by cfPage1.p3.twPattern (1 to CF_NUMBER_OF_TRIGGER_PATTERNS)
+const cfTriggerPatternStruct cfTriggerPatterns[CF_NUMBER_OF_TRIGGER_PATTERNS] = {
+	// 1: 36-2-2-2, tooth positions 0,1 3,4 & 18,19 missing
+	{	.teeth = 36, .nEdges = 30, .camSync = 0, .firstTooth = 2,
+		.gap = {12,12,4,4,4,4,4,4,4,4,4,4,4,4,12,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4} },
+	// 2: 24+1, 24 crankshaft teeth, the cycle (720 degrees) is referenced to the camshaft pulse
+	{	.teeth = 24, .nEdges = 48, .camSync = 1, .firstTooth = 0,
+		.gap = {4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4,4} },
+	// 3: 4+1 camshaft wheel, 4 teeth at 180 crankshaft degrees with the "+1" tooth 45 degrees after tooth 0
+	{	.teeth = 2, .nEdges = 5, .camSync = 0, .firstTooth = 0,
+		.gap = {4,1,3,4,4} }
+};
 
 // Specifies data types for the configuration data.
 // '*' in the first character position means every item has the same type,
@@ -78,6 +96,9 @@ char p2DataTypes[] = "IIIFFFFFFIFIIFFIIIIIFFFFFFI";
 char veMapDataTypes[] = "*F";
 char ignMapDataTypes[] = "*F";
 char tgtAFRMapDataTypes[] = "*F";
+char p3DataTypes[] = "*I";
+char fuelTrimDataTypes[] = "*F";
+char sparkTrimDataTypes[] = "*F";
 
 
 // used to access data in either float or int format
@@ -114,6 +135,11 @@ int cfRestoreConfiguration(){
 	nvEEPROMBlockRead((uint8_t *)&cfPage1.ignitionMap, 	absAddr(IGNITION_MAP_NVM_ADDR),	sizeof(cfPage1.ignitionMap));
 	nvEEPROMBlockRead((uint8_t *)&cfPage1.targetAFRMap, absAddr(TGT_AFR_MAP_NVM_ADDR),	sizeof(cfPage1.targetAFRMap));
 
+	// restore the extension blocks
+	cfRestoreExtBlock((uint8_t *)&cfPage1.p3,			absAddrExt(PARAMETERS_3_NVM_ADDR),	sizeof(cfPage1.p3));
+	cfRestoreExtBlock((uint8_t *)&cfPage1.fuelTrim,		absAddrExt(FUEL_TRIM_NVM_ADDR),		sizeof(cfPage1.fuelTrim));
+	cfRestoreExtBlock((uint8_t *)&cfPage1.sparkTrim,	absAddrExt(SPARK_TRIM_NVM_ADDR),	sizeof(cfPage1.sparkTrim));
+
 	// check for errors
 	if ( ((ecuStatus & EEPROM_DATA_READ_ERROR) != 0) || ((ecuStatus & EEPROM_CHECKSUM_ERROR) != 0) ){
 		SET_INVALID_CONFIG;
@@ -123,6 +149,23 @@ int cfRestoreConfiguration(){
 }
 
 
+// The extension blocks were introduced after the original configuration page, so may never have been written to the EEPROM.
+// The block is read into a temporary store and only copied to the configuration data if it was read with a valid checksum.
+// Otherwise, the default values are retained and the read / checksum errors are not reported in the ecu status word.
+#define CF_EXT_BLOCK_MAX_SIZE 512
+static void cfRestoreExtBlock(uint8_t *blkPtr, uint16_t eepromAddress, int blkSize){
+	static uint8_t temp[CF_EXT_BLOCK_MAX_SIZE];
+	uint32_t statusN_1 = ecuStatus;
+	if (blkSize <= CF_EXT_BLOCK_MAX_SIZE) {
+		ecuStatus &= ~(EEPROM_DATA_READ_ERROR | EEPROM_CHECKSUM_ERROR);
+		if ( (nvEEPROMBlockRead(temp, eepromAddress, blkSize) == HAL_OK) && ((ecuStatus & (EEPROM_DATA_READ_ERROR | EEPROM_CHECKSUM_ERROR)) == 0) ) {
+			memcpy(blkPtr, temp, blkSize);
+		}
+		ecuStatus = statusN_1;
+	}
+}
+
+
 // updates a data block within configuration data from data received from the host via a "wf" command
 // data from the "wf" command is held in float and integer formats and only the required data type, defined by
 // the array typeStr, is copied to the data set.
@@ -216,6 +259,16 @@ cfErrorCode cfProcessNVMMessage(cfBlockID block, int nItems, paramType *data){
 		status = cfSaveConfig((uint32_t *)&cfPage1.targetAFRMap, sizeof(cfPage1.targetAFRMap), data, nItems, TGT_AFR_ITEMS, absAddr(TGT_AFR_MAP_NVM_ADDR), tgtAFRMapDataTypes);
 		cfSoftwareResetMaps();
 		break;
+	case PARAMETER_3_BLK:
+		status = cfSaveConfig((uint32_t *)&cfPage1.p3, sizeof(cfPage1.p3), data, nItems, PARAMETER_3_ITEMS, absAddrExt(PARAMETERS_3_NVM_ADDR), p3DataTypes);
+		cfSoftwareReset();
+		break;
+	case FUEL_TRIM_BLK:
+		status = cfSaveConfig((uint32_t *)&cfPage1.fuelTrim, sizeof(cfPage1.fuelTrim), data, nItems, FUEL_TRIM_ITEMS, absAddrExt(FUEL_TRIM_NVM_ADDR), fuelTrimDataTypes);
+		break;
+	case SPARK_TRIM_BLK:
+		status = cfSaveConfig((uint32_t *)&cfPage1.sparkTrim, sizeof(cfPage1.sparkTrim), data, nItems, SPARK_TRIM_ITEMS, absAddrExt(SPARK_TRIM_NVM_ADDR), sparkTrimDataTypes);
+		break;
 	default:
 		status = CF_UNKNOWN_BLOCK_ID;
 		break;
@@ -272,6 +325,11 @@ static uint16_t absAddr(int relAddr){
 	return (uint16_t) ((configurationDescriptor.currentConfiguration - 1) * CONFIGURATION_PAGE_SIZE + CONFIGURATION_PAGE_START_ADDR + relAddr);
 }
 
+// Returns the EEPROM absolute address from an extension block relative address, determined by the current configuration parameter
+static uint16_t absAddrExt(int relAddr){
+	return (uint16_t) ((configurationDescriptor.currentConfiguration - 1) * CONFIGURATION_EXT_PAGE_SIZE + CONFIGURATION_EXT_PAGE_START_ADDR + relAddr);
+}
+
 
 /*+++REVISION_HISTORY+++
 1) 05 Jan 2021 Preparing to remove Flash memory as an NVM data store.
@@ -282,4 +340,13 @@ static uint16_t absAddr(int relAddr){
 6) 02 Mar 2021 Multiple configuration capability added. Up to N different configuration pages can be saved to / restored from an address
    based on a new "current configuration" parameter. EEPROM addressing revised. Config Block ID's revised - no longer compatible with Arduino.
    New function added cfSetCurrentConfig() - sets the new config, restores data from new config addresses and invokes a software reset.
+7) 15 Oct 2026 Parameters 3 block (trigger wheel pattern selection) added in the configuration extension page. Trigger wheel pattern table added.
+8) 15 Oct 2026 Misfire detection threshold added to Parameters 3, default 1% of segment time.
+9) 15 Oct 2026 Output mode added to Parameters 3, default software.
+10) 16 Oct 2026 Cylinder count, firing order, cylinder outputs & TDC offsets added to Parameters 3, default 4 cylinders 1-3-4-2.
+11) 16 Oct 2026 Coil dwell table added to Parameters 3, default 6.0 mS at 8V to 3.0 mS at 16V (4.0 mS at 12V).
+12) 16 Oct 2026 Per-cylinder fuel & spark trim blocks added in the configuration extension page, default no trim.
+13) 16 Oct 2026 Split injection added to Parameters 3, default not split (1 pulse).
+14) 16 Oct 2026 Live pulse width update added to Parameters 3, default on, add-on pulses end by 140 degrees before TDC.
+15) 16 Oct 2026 End of injection angle targeting added to Parameters 3, default off (start angle timing), EOI 360 degrees.
 +++REVISION_HISTORY_ENDS+++*/
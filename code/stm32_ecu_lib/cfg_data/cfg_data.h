@@ -25,6 +25,19 @@
 #define VE_MAP_SIZE_RPM 8
 #define VE_MAP_SIZE_LOAD 8
 
+// maximum number of cylinders, see Parameters 3
+#define CF_MAX_CYLINDERS 8
+
+// number of points in the coil dwell table, see Parameters 3
+#define CF_DWELL_POINTS 5
+
+// maximum number of injection pulses per cycle when the injection is split, see Parameters 3
+#define CF_MAX_INJECTION_PULSES 3
+
+// per-cylinder trim table size. The trim axes span the VE map axes, with the points evenly spaced.
+#define CF_TRIM_SIZE_RPM 4
+#define CF_TRIM_SIZE_LOAD 2
+
 // This 64 byte block contains information about the selected configuration.
 // Only currentConfiguration is utilised at present, but 64 bytes (including the checksum) are reserved for future use.
 // NB the checksum is appended at the end of the data block by the NVM block write function, so is not explicitly specified here.
@@ -99,13 +112,16 @@ typedef struct {
 	float ignitionDwell;
 	int   twTeeth;
 	int   twMissingTeeth;
-	float twTDCAngle;
+	float twTDCAngle;						// TDC of the first cylinder in the firing order (see injectorSequenceReset) in
+										// revolution 0, 0 to 720 degrees.
+										// Adding 360 flips the engine phase set by the camshaft pulse.
 	float injectorStartAngle;
-	int   injectorIndex0;
+	int   injectorIndex0;					// injectorIndex0 - 3 not used, superseded by the Parameters 3 firing order
 	int   injectorIndex1;
 	int   injectorIndex2;
 	int   injectorIndex3;
-	int   injectorSequenceReset;
+	int   injectorSequenceReset;			// < 0 if there's no camshaft sensor, i.e. wasted spark & batch injection only.
+										// 1 to cylinders: the position in the firing order at twTDCAngle (limited to cylinders)
 	float thermistorT1;
 	float thermistorR1;
 	float thermistorT2;
@@ -115,6 +131,32 @@ typedef struct {
 	int   idleActuatorType;
 } parameters2Struct;
 
+typedef struct {
+	int   twPattern;
+	int   twCaptureMode;
+	int   mfThreshold;						// misfire slowdown threshold, 0.1% of the cylinder segment time, e.g. 5
+	int   outputMode;
+	int   cylinders;						// 1 to CF_MAX_CYLINDERS
+	int   firingOrder;						// cylinder numbers in firing order, one per decimal digit, e.g. 1342
+	int   cylinderOutputs;					// injector & coil output (1 - 4) of each cylinder, one per decimal digit from cylinder 1,
+										// e.g. 14232134 for a V8 with cylinders 360 degrees apart sharing an output. 0 = cylinder number.
+	int   cylinderTDCOffset[CF_MAX_CYLINDERS];	// TDC of each cylinder (from cylinder 1) from an even firing interval (0.1 degrees)
+	int   dwellVoltage[CF_DWELL_POINTS];	// battery voltage of each dwell table point, ascending (0.1 V)
+	int   dwellTime[CF_DWELL_POINTS];		// coil dwell at each voltage (uS), 0 = Parameters 2 ignitionDwell
+	int   splitPulses;						// injection pulses per cycle when split (1 to CF_MAX_INJECTION_PULSES), 1 = not split
+	int   splitRPM;							// the injection is split below this RPM...
+	int   splitLoad;						// ...and below this MAP (kPa), 0 = at any load
+	int   splitFraction[CF_MAX_INJECTION_PULSES];	// share of the fuel delivered by each pulse (%)
+	int   splitAngle[CF_MAX_INJECTION_PULSES];		// start of each pulse before TDC, in order (0.1 degrees). Parameters 2
+												// injectorStartAngle is used when the injection isn't split.
+	int   pwUpdate;							// 1 = an armed or in-flight injection pulse follows the pulse width, 0 = fixed when armed
+	int   pwAddOnAngle;					// an add-on pulse for a longer pulse width must end by this angle before TDC, e.g. the
+												// intake valve closing (0.1 degrees)
+	int   pwAddOnMin;						// the least fuel (pulse width less latency) of an add-on pulse (uS)
+	int   injectionTiming;					// 0 = injection starts at Parameters 2 injectorStartAngle, 1 = injection ends at eoiAngle
+	int   eoiAngle;							// end of injection before TDC (0.1 degrees), see injectionTiming
+} parameters3Struct;
+
 typedef struct {
 	filtersStruct filters;
 	parameters1Struct p1;
@@ -122,9 +164,36 @@ typedef struct {
 	float veMap[VE_MAP_SIZE_LOAD][VE_MAP_SIZE_RPM];
 	float ignitionMap[VE_MAP_SIZE_LOAD][VE_MAP_SIZE_RPM];
 	float targetAFRMap[VE_MAP_SIZE_LOAD][VE_MAP_SIZE_RPM];
+	parameters3Struct p3;
+	float fuelTrim[CF_MAX_CYLINDERS][CF_TRIM_SIZE_LOAD][CF_TRIM_SIZE_RPM];		// change to each cylinder's pulse width, less the
+																				// injector latency (%), by cylinder number
+	float sparkTrim[CF_MAX_CYLINDERS][CF_TRIM_SIZE_LOAD][CF_TRIM_SIZE_RPM];		// change to each cylinder's advance (degrees)
 } page1Struct;
 
 
+/*
+ * Trigger wheel pattern descriptions, used by the trigger decoder.
+ *
+ * A pattern is described by the gap preceding each edge in one pattern cycle, in quarters of a tooth spacing
+ * (tooth spacing = 360 / teeth degrees). e.g. a normal tooth has a gap of 4, the tooth after a single missing tooth has a gap of 8.
+ * Edge 0 is the first edge of the cycle and is at tooth position firstTooth. Edges that don't fall on a tooth
+ * position (e.g. the "+1" tooth on a 4+1 wheel) are not counted as teeth. A cycle may cover one or two crankshaft revolutions.
+ *
+ * Parameters 3 twPattern selects the pattern: 0 = an N-M missing tooth wheel defined by twTeeth & twMissingTeeth in
+ * Parameters 2, 1 to CF_NUMBER_OF_TRIGGER_PATTERNS selects an entry from cfTriggerPatterns.
+ */
+#define CF_MAX_PATTERN_EDGES 120
+#define CF_NUMBER_OF_TRIGGER_PATTERNS 3
+
+typedef struct {
+	int   teeth;							// tooth positions per crankshaft revolution
+	int   nEdges;							// number of edges in one pattern cycle
+	int   camSync;							// non-zero if a camshaft pulse, rather than the gap pattern, marks the start of the cycle
+	int   firstTooth;						// tooth position of edge 0
+	uint8_t gap[CF_MAX_PATTERN_EDGES];		// gap preceding each edge, in quarter tooth spacings
+} cfTriggerPatternStruct;
+
+
 
 /*
  * Defines the EEPROM on-device relative addresses for each of the configuration data blocks. Note that an additional 4 bytes must
@@ -140,6 +209,18 @@ typedef struct {
 #define TGT_AFR_MAP_NVM_ADDR 	1024
 
 
+/*
+ * Configuration blocks added after the original configuration page are held in an extension page. The extension pages
+ * start after the 8th configuration page. As with the configuration pages, there's one extension page per configuration.
+ */
+#define PARAMETERS_3_NVM_ADDR 	   0
+#define FUEL_TRIM_NVM_ADDR 		 192
+#define SPARK_TRIM_NVM_ADDR 	 512
+
+#define CONFIGURATION_EXT_PAGE_START_ADDR 11392
+#define CONFIGURATION_EXT_PAGE_SIZE 1024
+
+
 /*
  * The configuration blocks start at this EEPROM address
  */
@@ -161,6 +242,12 @@ typedef struct {
  */
 #define AFR_DATA_NVM_ADDR		64
 
+/*
+ * The learned tooth angle correction table (tooth_correction.c) is not part of the configuration data set either. It's held
+ * after the last configuration extension page.
+ */
+#define TOOTH_CORRECTION_NVM_ADDR	19584
+
 /*
  * A code number for each data block is used to identify the data block to/from the host computer.
  * The data block ID's are arbitrary but used to be the EEPROM address in the original Arduino code,
@@ -171,7 +258,10 @@ typedef enum {	FILTER_BLK 		= 100,
 				PARAMETER_2_BLK = 300,
 				VE_MAP_BLK 		= 400,
 				IGN_MAP_BLK 	= 500,
-				TGT_AFR_BLK 	= 600 } cfBlockID;
+				TGT_AFR_BLK 	= 600,
+				PARAMETER_3_BLK = 700,
+				FUEL_TRIM_BLK	= 800,
+				SPARK_TRIM_BLK	= 900 } cfBlockID;
 
 /*
  * Number of items in each configuration block
@@ -181,7 +271,10 @@ typedef enum { 	FILTER_ITEMS 		= 8,
 				PARAMETER_2_ITEMS 	= 27,
 				VE_MAP_ITEMS 		= 64,
 				IGN_MAP_ITEMS 		= 64,
-				TGT_AFR_ITEMS 		= 64 } cfDataBlockItems;
+				TGT_AFR_ITEMS 		= 64,
+				PARAMETER_3_ITEMS	= 39,
+				FUEL_TRIM_ITEMS		= 64,
+				SPARK_TRIM_ITEMS	= 64 } cfDataBlockItems;
 
 // result type from a config operation
 typedef enum { CF_SUCCESS, CF_INVALID, CF_ERASE_ERROR, CF_WRITE_ERROR, CF_DATA_SIZE_MISMATCH, CF_UNKNOWN_BLOCK_ID } cfErrorCode;
@@ -192,9 +285,13 @@ extern char p2DataTypes[];
 extern char veMapDataTypes[];
 extern char ignMapDataTypes[];
 extern char tgtAFRMapDataTypes[];
+extern char p3DataTypes[];
+extern char fuelTrimDataTypes[];
+extern char sparkTrimDataTypes[];
 
 extern configurationDesciptorStruct configurationDescriptor;
 extern page1Struct cfPage1;
+extern const cfTriggerPatternStruct cfTriggerPatterns[CF_NUMBER_OF_TRIGGER_PATTERNS];
 extern cfErrorCode cfSaveConfig(uint32_t *blkPtr, int blkSize, paramType newDataItems[], int nItemsSupplied, int itemsExpected, uint16_t eepromAddress, char dataTypes[]);
 extern int cfRestoreConfiguration(void);
 extern cfErrorCode cfProcessNVMMessage(cfBlockID block, int nItems, paramType *dataItems);
@@ -214,6 +311,19 @@ extern int cfSetCurrentConfig(int configNumber);
 5) 02 Mar 2021 EEPROM addressing and block codes revised. New function cfSetCurrentConfig() added.
 6) 06 Mar 2021 Idle actuator "Hold Power" variable in parameters1Struct changed to "reserved" as it's no longer utilised.
 7) 11 May 2021 Included "global.h"
+8) 15 Oct 2026 Parameters 3 block added, held in a new configuration extension page. Trigger wheel pattern descriptions added.
+9) 15 Oct 2026 twCaptureMode added to Parameters 3.
+10) 15 Oct 2026 mfThreshold added to Parameters 3.
+11) 15 Oct 2026 EEPROM address of the tooth angle correction table added.
+12) 15 Oct 2026 outputMode added to Parameters 3.
+13) 16 Oct 2026 Cylinder count, firing order, cylinder outputs & cylinder TDC offsets added to Parameters 3. CF_MAX_CYLINDERS added.
+14) 16 Oct 2026 Coil dwell table (dwell time against battery voltage) added to Parameters 3. CF_DWELL_POINTS added.
+15) 16 Oct 2026 Per-cylinder fuel & spark trim tables added in the configuration extension page, FUEL_TRIM_BLK & SPARK_TRIM_BLK.
+16) 16 Oct 2026 Split injection (up to CF_MAX_INJECTION_PULSES pulses per cycle) added to Parameters 3.
+17) 16 Oct 2026 Live pulse width update & add-on pulse settings added to Parameters 3.
+18) 16 Oct 2026 End of injection angle targeting (injectionTiming & eoiAngle) added to Parameters 3.
+19) 16 Oct 2026 twTDCAngle, injectorSequenceReset & mfThreshold documented: the cam phase flip, the firing order position at TDC
+    & the threshold units.
 +++REVISION_HISTORY_ENDS+++*/
 
 
@@ -24,6 +24,13 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "auto_idle.h"
 #include "fuel_injection.h"
 #include "auto_afr.h"
+#include "trigger_logger.h"
+#include "misfire.h"
+#include "angle_clock.h"
+#include "tooth_correction.h"
+#include "trigger_decoder.h"
+#include "trigger_wheel_handler.h"
+#include "event_queue.h"
 #include "stdio.h"
 #include "string.h"
 #include "math.h"
@@ -43,6 +50,14 @@ char SET_CONFIG_CMD[]		= "sc";
 char SEND_NVM_CMD[]			= "sn";
 char WRITE_FORMAT_CMD[]		= "wf";
 char RESET_AVE_CMD[]		= "ra";
+char TRIGGER_LOG_CMD[]		= "tl";
+char CPU_LOAD_CMD[]			= "cl";
+char TOOTH_HISTOGRAM_CMD[]	= "th";
+char SYNC_STATUS_CMD[]		= "ss";
+char ANGLE_CLOCK_CMD[]		= "ac";
+char TOOTH_CORRECTION_CMD[]	= "tc";
+char OUTPUT_LATENCY_CMD[]		= "ol";
+char DWELL_CMD[]				= "dw";
 char SET_LAMBDA[] = "sl";
 char SET_AIR_TEMP[] = "sa";
 char SET_COOLANT[] = "so";
@@ -59,6 +74,9 @@ char NVM_SUCCESS_P2_MSG[] 			= ">NVM: PAR 2 written successfully\r\n";
 char NVM_SUCCESS_VE_MSG[] 			= ">NVM: VE MAP written successfully\r\n";
 char NVM_SUCCESS_IG_MSG[] 			= ">NVM: IG MAP written successfully\r\n";
 char NVM_SUCCESS_TA_MSG[] 			= ">NVM: TGT AFR written successfully\r\n";
+char NVM_SUCCESS_P3_MSG[] 			= ">NVM: PAR 3 written successfully\r\n";
+char NVM_SUCCESS_FT_MSG[] 			= ">NVM: FUEL TRIM written successfully\r\n";
+char NVM_SUCCESS_ST_MSG[] 			= ">NVM: SPARK TRIM written successfully\r\n";
 char NVM_SUCCESS_MSG[] 				= ">NVM: Data written successfully\r\n";
 char NVM_ERASE_ERROR_MSG[] 			= ">NVM: Page erase error\r\n";
 char NVM_WRITE_ERROR_MSG[] 			= ">NVM: Page write error\r\n";
@@ -69,6 +87,13 @@ char LAMBDA_AFR_RESET_FAILED_MSG[]	= ">Lambda Sensor AFR data failed to store da
 char EFI_VERSION_MSG[]				= ">EFI Controller, stm32 MPU: ";
 char SENSORS_DISABLED_MSG[]			= " | SENSORS DISABLED";
 char SYNC_MSG[] 					= "<\r\n";
+char TRIGGER_LOG_ARMED_MSG[]		= ">TL: Trigger logger armed\r\n";
+char TOOTH_HISTOGRAM_RESET_MSG[]	= ">TH: Statistics reset\r\n";
+char ANGLE_CLOCK_RESET_MSG[]		= ">AC: Statistics reset\r\n";
+char TOOTH_CORRECTION_CLEAR_MSG[]	= ">TC: Table cleared\r\n";
+char TOOTH_CORRECTION_LEARN_MSG[]	= ">TC: Learning started\r\n";
+char OUTPUT_LATENCY_RESET_MSG[]		= ">OL: Statistics reset\r\n";
+char DWELL_RESET_MSG[]				= ">DW: Statistics reset\r\n";
 char CRLF[]							= "\r\n";
 
 // prototypes
@@ -227,6 +252,15 @@ void cdExecuteCommand(char cmd[], int length) {
 			case TGT_AFR_BLK:
 				hostPrint(NVM_SUCCESS_TA_MSG, sizeof(NVM_SUCCESS_TA_MSG));
 				break;
+			case PARAMETER_3_BLK:
+				hostPrint(NVM_SUCCESS_P3_MSG, sizeof(NVM_SUCCESS_P3_MSG));
+				break;
+			case FUEL_TRIM_BLK:
+				hostPrint(NVM_SUCCESS_FT_MSG, sizeof(NVM_SUCCESS_FT_MSG));
+				break;
+			case SPARK_TRIM_BLK:
+				hostPrint(NVM_SUCCESS_ST_MSG, sizeof(NVM_SUCCESS_ST_MSG));
+				break;
 			}
 		}
 		return;
@@ -264,6 +298,196 @@ void cdExecuteCommand(char cmd[], int length) {
 		return;
 	}
 
+	// TRIGGER_LOG_CMD Arm the trigger logger
+	// the 1st parameter is the number of pulses to record before the trigger
+	// the 2nd parameter is the number of pulses to record from the trigger
+	// the 3rd parameter is the trigger condition, any of the TL_xxx record flags. 0 triggers immediately.
+	// e.g. tl256,256,4# records 256 pulses either side of a sync error
+	// the log is sent by the background loop once recording is complete
+
+	if (stringStartsWith(cmd, TRIGGER_LOG_CMD) > 0) {
+		int n = getParameters(cmd, length, dataParams, 3);
+		if (n < 3) {
+			// default to a sync error trigger, centred in the log
+			dataParams[0].i = TL_BUFFER_SIZE / 2;
+			dataParams[1].i = TL_BUFFER_SIZE / 2;
+			dataParams[2].i = TL_SYNC_ERROR;
+		}
+		tlArm(dataParams[0].i, dataParams[1].i, dataParams[2].i);
+		hostPrint(TRIGGER_LOG_ARMED_MSG, sizeof(TRIGGER_LOG_ARMED_MSG));
+		return;
+	}
+
+	// CPU_LOAD_CMD Send the CPU load of the crankshaft interrupts & the misfire detector
+	// loads are measured over the last VLF task period
+
+	if (stringStartsWith(cmd, CPU_LOAD_CMD) > 0) {
+		sprintf(dataTxBuffer, ">CPU: crankshaft ISR %.2f%%, misfire %.2f%% (max %lu cycles)\r\n", crankshaftISRLoad, mfLoad, (unsigned long)mfMaxCycles);
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
+	// TOOTH_HISTOGRAM_CMD Send the trigger decoder noise rejection statistics
+	// th# sends the number of edges in the trigger pattern, the total rejected edges & the acceptance window margin (%)
+	// e.g. >TH:34,12,15
+	// thN# sends the tooth index, rejected edges & the tooth period ratio histogram for edge N (0 to edges - 1)
+	// e.g. >TH5:7,2,0,0,0,12,4051,16,0,0,0
+	// th-1# resets the statistics
+
+	if (stringStartsWith(cmd, TOOTH_HISTOGRAM_CMD) > 0) {
+		// the command length includes the terminator
+		int n = length > 3 ? getParameters(cmd, length, dataParams, 1) : 0;
+		if (n == 0) {
+			sprintf(dataTxBuffer, ">TH:%i,%lu,%i\r\n", tdGetEdges(), (unsigned long)tdRejectedEdges, tdGetWindowMargin());
+		}
+		else if (dataParams[0].i < 0) {
+			tdResetStatistics();
+			strcpy(dataTxBuffer, TOOTH_HISTOGRAM_RESET_MSG);
+		}
+		else {
+			uint16_t histogram[TD_HISTOGRAM_BINS];
+			uint16_t rejects = 0;
+			char tempStr[10];
+			memset(histogram, 0, sizeof(histogram));
+			int tooth = tdGetHistogram(dataParams[0].i, histogram, &rejects);
+			sprintf(dataTxBuffer, ">TH%i:%i,%u", dataParams[0].i, tooth, rejects);
+			for (int i = 0; i < TD_HISTOGRAM_BINS; i++) {
+				sprintf(tempStr, ",%u", histogram[i]);
+				strcat(dataTxBuffer, tempStr);
+			}
+			strcat(dataTxBuffer, CRLF);
+		}
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
+	// ANGLE_CLOCK_CMD Send the crank angle clock's engine cycle angle (tenths of a degree, -1 if not running), then its phase
+	// error at the last edge, mean absolute phase error & maximum absolute phase error (tenths of a degree)
+	// e.g. >AC:2715,-3,2,14
+	// ac-1# resets the phase error statistics
+
+	if (stringStartsWith(cmd, ANGLE_CLOCK_CMD) > 0) {
+		// the command length includes the terminator
+		int n = length > 3 ? getParameters(cmd, length, dataParams, 1) : 0;
+		if ( (n > 0) && (dataParams[0].i < 0) ) {
+			acResetStatistics();
+			strcpy(dataTxBuffer, ANGLE_CLOCK_RESET_MSG);
+		}
+		else {
+			sprintf(dataTxBuffer, ">AC:%i,%i,%i,%i\r\n", acGetAngle(), acPhaseError, acPhaseErrorMean, acPhaseErrorMax);
+		}
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
+	// OUTPUT_LATENCY_CMD Send the output mode (0 = software, 1 = output compare), the number of software edges (event queue
+	// events), their mean & maximum latency from the time they were due (uS), the maximum output compare re-arm latency (uS),
+	// then the most events queued at once, the most CPU cycles in one event queue interrupt, the events that couldn't be queued
+	// & the CPU cycles to switch all the injectors by HAL_GPIO_WritePin() & by BSRR (measured at initialisation)
+	// e.g. >OL:0,10452,1,4,0,6,1210,0,212,9
+	// ol-1# resets the statistics
+
+	if (stringStartsWith(cmd, OUTPUT_LATENCY_CMD) > 0) {
+		// the command length includes the terminator
+		int n = length > 3 ? getParameters(cmd, length, dataParams, 1) : 0;
+		if ( (n > 0) && (dataParams[0].i < 0) ) {
+			resetOutputLatency();
+			strcpy(dataTxBuffer, OUTPUT_LATENCY_RESET_MSG);
+		}
+		else {
+			sprintf(dataTxBuffer, ">OL:%i,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu,%lu\r\n", outputMode, (unsigned long)eqEvents, (unsigned long)eqLatencyMean,
+					(unsigned long)eqLatencyMax, (unsigned long)outputRearmLatencyMax, (unsigned long)eqDepthMax,
+					(unsigned long)eqISRCyclesMax, (unsigned long)eqOverflows, (unsigned long)ioCyclesHAL, (unsigned long)ioCyclesBSRR);
+		}
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
+	// DWELL_CMD Send the target coil dwell (uS), the last achieved dwell (uS), the mean achieved dwell error & the maximum
+	// absolute error (uS), then the number of dwells recorded
+	// e.g. >DW:4000,4002,1,6,18230
+	// dw-1# resets the statistics
+
+	if (stringStartsWith(cmd, DWELL_CMD) > 0) {
+		// the command length includes the terminator
+		int n = length > 3 ? getParameters(cmd, length, dataParams, 1) : 0;
+		if ( (n > 0) && (dataParams[0].i < 0) ) {
+			twResetDwellStatistics();
+			strcpy(dataTxBuffer, DWELL_RESET_MSG);
+		}
+		else {
+			sprintf(dataTxBuffer, ">DW:%lu,%lu,%li,%lu,%lu\r\n", (unsigned long)twDwellTarget, (unsigned long)twDwellAchieved,
+					(long)twDwellErrorMean, (unsigned long)twDwellErrorMax, (unsigned long)twDwellCount);
+		}
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
+	// TOOTH_CORRECTION_CMD Send the tooth angle correction status or table
+	// tc# sends the learning state (0 = idle, 1 = learning, 2 = last learned table rejected), the revolutions learned, whether
+	// the table is valid & the largest tooth angle error (0.01 degrees)
+	// e.g. >TC:1,112,0,0
+	// tcN# sends the angle errors (0.01 degrees, positive if the tooth is late) of up to 16 teeth from tooth N
+	// e.g. >TC16:-12,4,31,...
+	// tc-1# clears the table, tc-2# starts learning. The learned table is saved to NVM.
+
+	if (stringStartsWith(cmd, TOOTH_CORRECTION_CMD) > 0) {
+		// the command length includes the terminator
+		int n = length > 3 ? getParameters(cmd, length, dataParams, 1) : 0;
+		if (n == 0) {
+			sprintf(dataTxBuffer, ">TC:%i,%i,%i,%i\r\n", (int)tcState, tcLearnedRevolutions, tcTableValid, tcGetMaxError());
+		}
+		else if (dataParams[0].i == -1) {
+			tcClear();
+			strcpy(dataTxBuffer, TOOTH_CORRECTION_CLEAR_MSG);
+		}
+		else if (dataParams[0].i < 0) {
+			tcStartLearning();
+			strcpy(dataTxBuffer, TOOTH_CORRECTION_LEARN_MSG);
+		}
+		else {
+			char tempStr[10];
+			int tooth = dataParams[0].i;
+			sprintf(dataTxBuffer, ">TC%i:", tooth);
+			for (int i = tooth; (i < tooth + 16) && (i < triggerWheelTeeth); i++) {
+				sprintf(tempStr, "%i,", tcGetToothError(i));
+				strcat(dataTxBuffer, tempStr);
+			}
+			// replace the last separator with the line end
+			if (tooth < triggerWheelTeeth) {
+				dataTxBuffer[strlen(dataTxBuffer) - 1] = 0;
+			}
+			strcat(dataTxBuffer, CRLF);
+		}
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
+	// SYNC_STATUS_CMD Send the trigger wheel sync stage, the times from the first pulse of the last start to crank sync, the
+	// first spark & full sync (uS), the number of stalls, the time from the last pulse to the outputs being cut (uS) & the cycles
+	// taken by the timeout interrupt for the last stall, then the logged stage changes (stage@pulse time), oldest first
+	// stages: 0 = no sync, 1 = crank sync (wasted spark & batch injection), 2 = full sync (sequential)
+	// e.g. >SS:2,152340,171220,402160,1,41530,612;0@10342811,1@10495151,2@10745971
+
+	if (stringStartsWith(cmd, SYNC_STATUS_CMD) > 0) {
+		char tempStr[24];
+		sprintf(dataTxBuffer, ">SS:%i,%lu,%lu,%lu,%lu,%lu,%lu;", (int)twSyncStage, (unsigned long)twStartTimes.crankSync,
+				(unsigned long)twStartTimes.firstSpark, (unsigned long)twStartTimes.fullSync, (unsigned long)crankshaftStalls,
+				(unsigned long)crankshaftStallLatency, (unsigned long)crankshaftStallCycles);
+		uint32_t end = twSyncLogIndex;
+		uint32_t i = end > TW_SYNC_LOG_SIZE ? end - TW_SYNC_LOG_SIZE : 0;
+		for (; i < end; i++) {
+			twSyncLogEntry *e = &twSyncLog[i & (TW_SYNC_LOG_SIZE - 1)];
+			sprintf(tempStr, "%lu@%lu,", (unsigned long)e->stage, (unsigned long)e->time);
+			strcat(dataTxBuffer, tempStr);
+		}
+		// replace the last separator with the line end
+		dataTxBuffer[strlen(dataTxBuffer) - 1] = 0;
+		strcat(dataTxBuffer, CRLF);
+		hostPrint(dataTxBuffer, strlen(dataTxBuffer));
+		return;
+	}
+
 	// no command found
 	return;
 
@@ -372,4 +596,17 @@ int findSeparator(char *str, int strlen, int startFrom){
 4) 02 Mar 2021 SEND_SYNC command deleted. SET_CONFIG_CMD added. Identification message now includes current configuration parameter.
 5) 29 Apr 2021 SEND_SYNC command re-instated.
 6) 02 May 2021 sendIdentificationMessage() modified to send only one line. From now on, all ECU commands must only return a one line response (if any).
+7) 15 Oct 2026 NVM write success message added for the Parameters 3 block.
+8) 15 Oct 2026 TRIGGER_LOG_CMD added, arms the trigger logger.
+9) 15 Oct 2026 CPU_LOAD_CMD added, reports the CPU load of the crankshaft interrupts & misfire detector.
+10) 15 Oct 2026 TOOTH_HISTOGRAM_CMD added, reports the trigger decoder's noise rejection statistics.
+11) 15 Oct 2026 SYNC_STATUS_CMD added, reports the trigger wheel sync stage, cranking start times & stage changes.
+12) 15 Oct 2026 SYNC_STATUS_CMD reports the stall count & the latency of the last stall.
+13) 15 Oct 2026 ANGLE_CLOCK_CMD added, reports the crank angle clock & its phase error.
+14) 15 Oct 2026 TOOTH_CORRECTION_CMD added, starts tooth angle correction learning, clears & reports the table.
+15) 15 Oct 2026 OUTPUT_LATENCY_CMD added, reports the output mode & the output edge latency.
+16) 16 Oct 2026 OUTPUT_LATENCY_CMD reports the event queue statistics.
+17) 16 Oct 2026 OUTPUT_LATENCY_CMD reports the cycles to switch the injectors by HAL & by BSRR.
+18) 16 Oct 2026 DWELL_CMD added, reports the target & achieved coil dwell.
+19) 16 Oct 2026 NVM write success messages added for the fuel trim & spark trim blocks.
 +++REVISION_HISTORY_ENDS+++*/
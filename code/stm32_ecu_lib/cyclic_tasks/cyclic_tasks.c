@@ -29,6 +29,7 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "ecu_main.h"
 #include "global.h"
 #include "trigger_wheel_handler.h"
+#include "trigger_decoder.h"
 #include "fuel_injection.h"
 #include "ignition.h"
 #include "scheduler.h"
@@ -38,6 +39,8 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "vvt_controller.h"
 #include "aux_canbus.h"
 #include "ecu_services.h"
+#include "misfire.h"
+#include "tooth_correction.h"
 #include <stdio.h>
 #include <string.h>
 
@@ -53,9 +56,32 @@ void cyclicProcessingHFTasks() {
 
 	// use trigger wheel "In Sync" count to determine if the engine is running
 	if (triggerWheelInSync > 0) {
-		// calculate RPM, avoiding divide by 0
-		keyData.v.RPM = crankPulsePeriodF > 0 ? rpmFromPeriod / (float)crankPulsePeriodF : 0.0F;
+		// RPM over the last 180 degree segment. Until segment timing is available, calculate RPM from the filtered tooth period, avoiding divide by 0
+		float segmentRPM = twUpdateCrankSpeed();
+		if (segmentRPM > 0.0F) {
+			keyData.v.RPM = segmentRPM;
+		}
+		else {
+			keyData.v.RPM = crankPulsePeriodF > 0 ? rpmFromPeriod / (float)crankPulsePeriodF : 0.0F;
+		}
 	}
+	else {
+		// stalled, or the first revolution of a start
+		keyData.v.RPM = 0;
+	}
+
+	// process the segments completed since the last call for misfires
+	mfUpdate();
+
+	// learn the tooth angle correction from the completed revolutions
+	tcUpdate();
+
+	// pulses rejected as noise by the trigger decoder
+	keyData.v.rejectedPulses = (float)tdRejectedEdges;
+
+	// trigger wheel sync errors, counted by the crankshaft pulse handler
+	keyData.v.syncErrors = (float)twSyncErrors;
+	keyData.v.errorTooth = (float)twErrorTooth;
 
 	// read the analog inputs & store filtered results into the the keyData data array starting at the 2nd element.
 	// i.e. the 1st input is MAP, 2nd lambda, etc.
@@ -75,6 +101,9 @@ void cyclicProcessingHFTasks() {
 
 	// update the ignition timing
 	keyData.v.interpolatedAdvance = igGetIgnitionAngle();
+
+	// pass the new injection & ignition timing to the trigger wheel handler
+	twUpdateEventTable(keyData.v.injectorPW, keyData.v.interpolatedAdvance);
 	
 	// update the key variables object from fuel_injection
 	keyData.v.currentCell = (float)(currentCell.loadIndex * VE_MAP_SIZE_RPM + currentCell.rpmIndex);
@@ -143,22 +172,13 @@ void cyclicProcessingLFTasks(){
 	
 void cyclicProcessingVLFTasks() 
 	{
-	// N-1 in-sync count
-	static unsigned int triggerWheelInSyncLast = 0;
+	// a stationary crankshaft is detected by the stall timeout in the crankshaft pulse handler, which cuts the outputs
 
-	// test for changes in trigger wheel sync to determine if the engine is turning
-	if ( triggerWheelInSync == triggerWheelInSyncLast ) {
+	// measure the CPU load of the crankshaft interrupts
+	updateCrankshaftISRLoad();
 
-		// no change, so crankshaft must be stationary (or the trigger wheel is excessively out of sync)
-		// clear RPM, the sync count & sync error count
-		triggerWheelInSync = 0;
-		keyData.v.syncErrors = 0;
-		keyData.v.RPM = 0;
-
-		// and make sure power controls are turned off
-		injectorPowerReset();
-	}
-	triggerWheelInSyncLast = triggerWheelInSync;
+	// clear the misfire status flag if there were no misfires in the last second & measure the CPU load of the misfire detector
+	mfUpdateStatus();
 
 	// run the cooling fan control
 	coolingFanControl(keyData.v.coolantTemperature);
@@ -206,5 +226,14 @@ void coolingFanControl(float engineTemp){
 
 /*+++REVISION_HISTORY+++
 1) 03 May 2021 Sync message flag no longer set by cyclicProcessingVLFTasks()
+2) 15 Oct 2026 Injection & ignition timing passed to the trigger wheel handler from the HF task.
+3) 15 Oct 2026 CPU load of the crankshaft interrupts updated by the VLF task.
+4) 15 Oct 2026 RPM calculated from the last 180 degree segment time, the filtered tooth period is used until segment timing is available.
+5) 15 Oct 2026 Misfire detector called from the HF task, misfire status & CPU load updated by the VLF task.
+6) 15 Oct 2026 Rejected crankshaft pulse count copied to key data by the HF task.
+7) 15 Oct 2026 Trigger wheel sync stage reset when the crankshaft stops.
+8) 15 Oct 2026 Stall check removed from the VLF task, replaced by the stall timeout in the crankshaft pulse handler.
+9) 15 Oct 2026 Sync error count & error tooth copied to key data by the HF task.
+10) 15 Oct 2026 Tooth angle correction learning called from the HF task.
 +++REVISION_HISTORY_ENDS+++*/
 
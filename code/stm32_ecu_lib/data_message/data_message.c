@@ -19,8 +19,8 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "string.h"
 
 // digits after the DP in the data message for each item of key data
-// item index							 0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26
-uint8_t dmDADP[KEY_DATA_STRUCT_SIZE] = { 3, 1, 0, 1, 1, 0, 1, 0, 0, 1, 1, 1, 2, 2, 0, 0, 0, 0, 1, 1, 0, 1, 1, 0, 0, 0, 0 };
+// item index							 0  1  2  3  4  5  6  7  8  9 10 11 12 13 14 15 16 17 18 19 20 21 22 23 24 25 26 27 28 29 30 31 32 33 34 35 36 37
+uint8_t dmDADP[KEY_DATA_STRUCT_SIZE] = { 3, 1, 0, 1, 1, 0, 1, 0, 0, 1, 1, 1, 2, 2, 0, 0, 0, 0, 1, 1, 0, 1, 1, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0, 0 };
 
 // String length for a single converted data item.
 // Note this is sized for format +23456.890 - i.e. sign + 5 digits + dp + 3 digits chars + null = 11 in total.
@@ -133,6 +133,21 @@ int formatCfgDataMessage(cfBlockID blockID) {
 		typePtr = tgtAFRMapDataTypes;
 		strcpy(floatDataFmt, ",%.0f");
 		break;
+	case PARAMETER_3_BLK:
+		nItems = PARAMETER_3_ITEMS;
+		dataPtr = (uint32_t*) &cfPage1.p3.twPattern;
+		typePtr = p3DataTypes;
+		break;
+	case FUEL_TRIM_BLK:
+		nItems = FUEL_TRIM_ITEMS;
+		dataPtr = (uint32_t*) &cfPage1.fuelTrim;
+		typePtr = fuelTrimDataTypes;
+		break;
+	case SPARK_TRIM_BLK:
+		nItems = SPARK_TRIM_ITEMS;
+		dataPtr = (uint32_t*) &cfPage1.sparkTrim;
+		typePtr = sparkTrimDataTypes;
+		break;
 
 		default:
 		// data block not identified, so do nothing
@@ -187,5 +202,10 @@ int formatCfgDataMessage(cfBlockID blockID) {
 3) 11 Jan 2021 Type conversion added since ecuStatus type changed to uint32_t from unsigned int.
 4) 28 Feb 2021 Outputs currently selected configuration in NVM configuration message.
 5) 29 Apr 2021 Corrected error in line 116 - was PARAMETER_1_ITEMS, corrected to PARAMETER_2_ITEMS
+6) 15 Oct 2026 Parameters 3 block added.
+7) 15 Oct 2026 Data message digits after the DP extended for the crankshaft speed items (27 to 32).
+8) 15 Oct 2026 Data message digits after the DP extended for the misfire counters (33 to 36).
+9) 15 Oct 2026 Data message digits after the DP extended for the rejected pulse count (37).
+10) 16 Oct 2026 Fuel trim & spark trim blocks added.
 +++REVISION_HISTORY_ENDS+++*/
 
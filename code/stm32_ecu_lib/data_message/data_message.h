@@ -24,8 +24,8 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 // Total size of rx buffer should be 448 + 19 + 64 + 3 ~ 500
 #define NVM_TX_BUFFER_SIZE 500
 
-// similary for the data message buffer: 7 chars per item x 29 = 203 + preamble (1) + 29 separators + CRLF + NULL ~ 250
-#define DATA_TX_BUFFER_SIZE 250
+// similary for the data message buffer: 7 chars per item x 38 = 266 + preamble (1) + 38 separators + CRLF + NULL ~ 310, rounded up to 320
+#define DATA_TX_BUFFER_SIZE 320
 
 extern int formatCfgDataMessage(cfBlockID blockID);
 extern int formatDataMessage(float dataArray[], int nItems);
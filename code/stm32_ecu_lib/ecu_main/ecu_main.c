@@ -34,6 +34,8 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "scheduler.h"
 #include "aux_serial.h"
 #include "auto_afr.h"
+#include "trigger_logger.h"
+#include "tooth_correction.h"
 #include "string.h"
 #include <stdio.h>
 #if DIAGNOSTIC_MODE == 1
@@ -147,6 +149,12 @@ void ecuLoop(){
 			//}
 		}
 
+		// send the trigger log to the host, once recorded
+		tlService();
+
+		// save the tooth angle correction table to NVM once learned, the EEPROM write blocks so it's done as a background task
+		tcService();
+
 		// saving AFR data to NVM must be be done as a background task
 		if (saveAFRFlag > 0) {
 			saveAFRFlag = 0;
@@ -169,4 +177,6 @@ void ecuLoop(){
 4) 11 Jan 2021 Restore config data now first operation in ecuInitialisatio() after clearing the ecu status word.
 5) 03 May 2021 Period sync message timing no longer set by cyclicProcessingVLFTasks(). Instead, sync message timing obtained using HAL_GetTick().
 6) 11 May 2021 Removed all code relating to HSI adjustment as this was never fully tested or implemented (and probably not required).
+7) 15 Oct 2026 Trigger log sent to the host from the background loop.
+8) 15 Oct 2026 Tooth angle correction table saved to NVM from the background loop.
 +++REVISION_HISTORY_ENDS+++*/
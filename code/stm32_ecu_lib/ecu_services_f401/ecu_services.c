@@ -23,20 +23,29 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "utility_functions.h"
 #include "scheduler.h"
 #include "trigger_wheel_handler.h"
+#include "angle_acquisition.h"
+#include "event_queue.h"
+#include "cfg_data.h"
 #include "global.h"
 
 
+// the crankshaft pulse capture mode, CRANKSHAFT_CAPTURE_INTERRUPT or CRANKSHAFT_CAPTURE_DMA
+static int crankshaftCaptureMode = CRANKSHAFT_CAPTURE_INTERRUPT;
+
+
 /*
  * Interrupt Priorities, from highest to lowest:
  *
  * Peripheral	Function			Pri	Sub
  * ----------	--------			---	---
  * TIM2			Crankshaft Pulse	 0	 0
- * TIM9			Ignition			 1   0
- * TIM4			Injection A			 1   1
- * TIM10			Injection B			 1   2
- * TIM11			Injection C			 1   3
- * TIM13			Injection D			 1   4
+ *				& Camshaft Pulse
+ * DMA1 S5		Crankshaft Pulse	 0	 1
+ *				(DMA capture mode)
+ * ADC			Angle Sample		 0	 2
+ * TIM1 CC		Output Compare		 0	 3
+ * TIM5			Event Queue			 1	 0
+ *				(Ignition & Injection)
  * DMA1 CH1		Support for ADC		 2 	 0
  * USART6		Host Comms			 2	 1
  * USART1		Aux Comms			 2	 2
@@ -47,12 +56,10 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 void setInterruptPriorities(){
 
     HAL_NVIC_SetPriority(TIM2_IRQn, 				0, 0);
-	HAL_NVIC_SetPriority(TIM1_BRK_TIM9_IRQn, 		1, 0);
-	HAL_NVIC_SetPriority(TIM4_IRQn, 		1, 1);
-//	HAL_NVIC_SetPriority(TIM1_UP_TIM10_IRQn, 1, 2);
-//	HAL_NVIC_SetPriority(TIM1_TRG_COM_TIM11_IRQn, 1, 3);
-//	HAL_NVIC_SetPriority(TIM8_UP_TIM13_IRQn, 1, 4)
-	HAL_NVIC_SetPriority(TIM5_IRQn, 				1, 2);
+    HAL_NVIC_SetPriority(DMA1_Stream5_IRQn, 		0, 1);
+    HAL_NVIC_SetPriority(ADC_IRQn, 					0, 2);
+    HAL_NVIC_SetPriority(TIM1_CC_IRQn, 				0, 3);
+	HAL_NVIC_SetPriority(TIM5_IRQn, 				1, 0);
 //		HAL_NVIC_SetPriority(TIM6_DAC_IRQn, 		1, 1);
 //	HAL_NVIC_SetPriority(TIM7_IRQn, 	1, 3);
 	//	HAL_NVIC_SetPriority(TIM8_CC_IRQn, 	1, 2);
@@ -65,15 +72,11 @@ void setInterruptPriorities(){
 	
 	
 	HAL_NVIC_EnableIRQ(TIM2_IRQn);
+	if (crankshaftCaptureMode == CRANKSHAFT_CAPTURE_DMA) {
+		HAL_NVIC_EnableIRQ(DMA1_Stream5_IRQn);
+	}
 	HAL_NVIC_EnableIRQ(TIM5_IRQn);
-	HAL_NVIC_EnableIRQ(TIM1_BRK_TIM9_IRQn);
-	
-	HAL_NVIC_EnableIRQ(TIM8_UP_TIM13_IRQn);
 	//HAL_NVIC_EnableIRQ(TIM8_CC_IRQn);
-	HAL_NVIC_EnableIRQ(TIM4_IRQn);
-	HAL_NVIC_EnableIRQ(TIM1_UP_TIM10_IRQn);
-	HAL_NVIC_EnableIRQ(TIM1_TRG_COM_TIM11_IRQn);
-	HAL_NVIC_EnableIRQ(TIM8_UP_TIM13_IRQn);
 	
 	
 //	HAL_NVIC_EnableIRQ(TIM5_IRQn);
@@ -108,8 +111,37 @@ void ecuISRTimerTick(){
  *
  */
 
-GPIOPin injectorIO[4];
-GPIOPin coilIO[4];
+GPIOPin injectorIO[INJECTOR_OUTPUTS];
+GPIOPin coilIO[COIL_OUTPUTS];
+
+// the groups of outputs switched together, & the cycles to switch the injectors (see measureOutputSwitching()). Whether the
+// BSRR stores take fewer cycles than HAL_GPIO_WritePin() on the target hasn't been measured, these report it.
+GPIOGroup injectorGroup;
+GPIOGroup coilGroup;
+uint32_t ioCyclesHAL = 0;
+uint32_t ioCyclesBSRR = 0;
+
+// precompiles the BSRR set & reset values of each port of the group from its pins
+static void setIOGroup(GPIOGroup *group, GPIOPin *io, int outputs){
+	group->ports = 0;
+	for (int i = 0; i < outputs; i++) {
+		int p = 0;
+		while ( (p < group->ports) && (group->port[p] != io[i].port) ) {
+			p++;
+		}
+		if (p == group->ports) {
+			if (p >= IO_GROUP_MAX_PORTS) {
+				continue;
+			}
+			group->port[p] = io[i].port;
+			group->set[p] = 0;
+			group->reset[p] = 0;
+			group->ports++;
+		}
+		group->set[p] |= io[i].pin;
+		group->reset[p] |= (uint32_t)io[i].pin << 16;
+	}
+}
 
 void setIOPinMapping(){
 	injectorIO[0].port = Injector_A_GPIO_Port;
@@ -128,174 +160,575 @@ void setIOPinMapping(){
 	coilIO[2].pin = Coil_C_Pin;
 	coilIO[3].port = Coil_D_GPIO_Port;
 	coilIO[3].pin = Coil_D_Pin;
+
+	setIOGroup(&injectorGroup, injectorIO, INJECTOR_OUTPUTS);
+	setIOGroup(&coilGroup, coilIO, COIL_OUTPUTS);
+}
+
+
+// Measures the CPU cycles to switch all the injectors off, by HAL_GPIO_WritePin() for each injector & by ioWriteGroup(). Called
+// at initialisation with the injectors off & the cycle counter running.
+static void measureOutputSwitching(void){
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	uint32_t cyclesStart = DWT->CYCCNT;
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		HAL_GPIO_WritePin(injectorIO[i].port, injectorIO[i].pin, GPIO_PIN_RESET);
+	}
+	ioCyclesHAL = DWT->CYCCNT - cyclesStart;
+
+	cyclesStart = DWT->CYCCNT;
+	ioWriteGroup(&injectorGroup, GPIO_PIN_RESET);
+	ioCyclesBSRR = DWT->CYCCNT - cyclesStart;
+
+	__set_PRIMASK(primask);
 }
 
 
 /*
  * Ignition & injection timer services.
  *
- * Note that cubeMX / HAL need to configure these timers as follows:
+ * The injection & ignition delays and pulse widths are timed by the event queue (event_queue.c) on EVENT_QUEUE_TIMER, TIM5,
+ * which runs free at 1MHz with its 32 bit counter. cubeMX / HAL need to configure TIM5 as follows:
  *
  * 		Prescaler set to provide 1MHz timer clock input
- * 		One Pulse Mode
- * 		TRGO: Update Event (if applicable)
+ * 		Period 0xFFFFFFFF
+ *
+ * initialiseIgnInjTimers() clears one pulse mode & starts the counter. The one pulse timers previously used for each channel
+ * (TIM4, TIM5, TIM8, TIM11 & TIM13) aren't used, so TIM8 is free for the output compares & the others for other functions.
+ *
+ * startInjectionTimer(), startDwellTimer() & startIgnitionTimer() provide the functions to time the injection edges and pulse
+ * widths, and the start of dwell & the spark, of each injector & coil channel. Each channel queues its own events, so the channels can overlap, i.e. where the span of
+ * the injector open duration is greater than the firing interval. Restarting a channel moves its pending events.
  *
- * startIgnitionTimer() & startInjectionTimerA/B() provide the functions to time the ignition & injection delays and pulse widths.
- * A separate timer to injector channels A & B are provided. This allows injectors to overlap, i.e. where the span of the injector
- * open duration is greater than 180 degrees.
+ * setInjectionEnd() moves the off edge of an injector channel's pulse that's still to start or is in flight, on the event
+ * queue & on the compare, so the pulse width can be extended or truncated after the pulse is armed. An end that has passed
+ * switches the injector off now. Once the pulse has ended it returns 0 & the caller can add a pulse for any extra fuel.
  *
+ * The edge times are absolute 32 bit times on the crankshaft trigger timer (TIM2), as the captured crankshaft pulse time, so
+ * the caller doesn't have to allow for its own latency & there's no 16 bit limit on the delay or pulse width (e.g. cranking
+ * & flood clear). They're converted to the event queue timer when the events are queued.
  *
  */
 
-// references to ignition/injection callbacks
-void (*ignitionTimerCallback)() = NULL;
-void (*injectionTimerACallback1)() = NULL;
-void (*injectionTimerACallback2)() = NULL;
-void (*injectionTimerBCallback1)() = NULL;
-void (*injectionTimerBCallback2)() = NULL;
-void (*injectionTimerCCallback1)() = NULL;
-void (*injectionTimerCCallback2)() = NULL;
-void (*injectionTimerDCallback1)() = NULL;
-void (*injectionTimerDCallback2)() = NULL;
-
-// ignition timer ISR
-void ecuISRIgnitionTimer(){
-	// clear the interrupt flag
-	IGNITION_TIMER->SR = 0;
-	// call the callback if not null
-	if (ignitionTimerCallback != NULL) {
-		ignitionTimerCallback();
-	}
-}
-
-// injection timer A ISR
-void ecuISRInjectionATimer(){
-	uint16_t sr = INJECTION_TIMER_A->SR;
-	if ( (sr & 1) != 0 ) {
-		// update interrupt
-		if (injectionTimerACallback2 != NULL) {
-			injectionTimerACallback2();
-		}
-	}
-	if ( (sr & 2) != 0 ) {
-		// capture & compare interrupt
-		if (injectionTimerACallback1 != NULL) {
-			injectionTimerACallback1();
-		}
+// each injector channel's events & callbacks, [0] after delay1 & [1] after delay2, & each coil channel's dwell & spark events
+// & callbacks
+static eqEvent injectionEvent[INJECTOR_OUTPUTS][2];
+static void (*injectionCallback[INJECTOR_OUTPUTS][2])(int);
+static eqEvent dwellEvent[COIL_OUTPUTS];
+static void (*dwellCallback[COIL_OUTPUTS])(int);
+static eqEvent ignitionEvent[COIL_OUTPUTS];
+static void (*ignitionCallback[COIL_OUTPUTS])(int);
+
+static void setInjectorCompareEnd(int injector, uint32_t time);
+
+// event queue timer ISR
+void ecuISREventQueue(){
+	eqService();
+}
+
+// converts a crankshaft trigger timer time to the event queue timer. A time that has passed stays passed.
+static inline uint32_t eqTimeFromCrankshaftTime(uint32_t time){
+	return eqNow() + (time - CRANKSHAFT_TRIGGER_TIMER->CNT);
+}
+
+// calls the callback of the injector channel's event, the argument is 2 x channel + event
+static void injectionEventCallback(int arg){
+	void (*callback)(int) = injectionCallback[arg >> 1][arg & 1];
+	if (callback != NULL) {
+		callback(arg >> 1);
 	}
-	INJECTION_TIMER_A->SR = 0;
 }
 
-// injection timer B ISR
-void ecuISRInjectionBTimer(){
-	uint16_t sr = INJECTION_TIMER_B->SR;
-	if ( (sr & 1) != 0 ) {
-		// update interrupt
-		if (injectionTimerBCallback2 != NULL) {
-			injectionTimerBCallback2();
-		}
+// calls the callback of the coil channel's dwell event, the argument is the channel
+static void dwellEventCallback(int channel){
+	void (*callback)(int) = dwellCallback[channel];
+	if (callback != NULL) {
+		callback(channel);
 	}
-	if ( (sr & 2) != 0 ) {
-		// capture & compare interrupt
-		if (injectionTimerBCallback1 != NULL) {
-			injectionTimerBCallback1();
-		}
+}
+
+// calls the callback of the coil channel's spark event, the argument is the channel
+static void ignitionEventCallback(int channel){
+	void (*callback)(int) = ignitionCallback[channel];
+	if (callback != NULL) {
+		callback(channel);
 	}
-	INJECTION_TIMER_B->SR = 0;
 }
 
-// injection timer C ISR
-void ecuISRInjectionCTimer(){
-	uint16_t sr = INJECTION_TIMER_C->SR;
-	if ( (sr & 1) != 0 ) {
-		// update interrupt
-		if (injectionTimerCCallback2 != NULL) {
-			injectionTimerCCallback2();
-		}
+void initialiseIgnInjTimers(){
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		injectionEvent[i][0].index = EQ_NOT_QUEUED;
+		injectionEvent[i][1].index = EQ_NOT_QUEUED;
 	}
-	if ( (sr & 2) != 0 ) {
-		// capture & compare interrupt
-		if (injectionTimerCCallback1 != NULL) {
-			injectionTimerCCallback1();
-		}
+	for (int i = 0; i < COIL_OUTPUTS; i++) {
+		dwellEvent[i].index = EQ_NOT_QUEUED;
+		ignitionEvent[i].index = EQ_NOT_QUEUED;
 	}
-	INJECTION_TIMER_C->SR = 0;
+	EVENT_QUEUE_TIMER->CR1 &= ~(TIM_CR1_CEN | TIM_CR1_OPM);
+	EVENT_QUEUE_TIMER->ARR = 0xFFFFFFFF;
+	EVENT_QUEUE_TIMER->CCMR1 &= ~(TIM_CCMR1_CC1S | TIM_CCMR1_OC1M);		// channel 1 output compare, frozen
+	EVENT_QUEUE_TIMER->DIER = 0;
+	EVENT_QUEUE_TIMER->SR = 0;
+	EVENT_QUEUE_TIMER->CR1 |= TIM_CR1_CEN;
 }
 
-// injection timer D ISR
-void ecuISRInjectionDTimer(){
-	uint16_t sr = INJECTION_TIMER_D->SR;
-	if ( (sr & 1) != 0 ) {
-		// update interrupt
-		if (injectionTimerDCallback2 != NULL) {
-			injectionTimerDCallback2();
-		}
+/*
+ * The injection timers have two callbacks:
+ * callback #1 is called at time
+ * callback #2 is called width uS after time
+ *
+ * This provides he ability to specify the injector ON timing and pulse width
+ *
+ * The second event is queued first, so if the queue is full the first isn't queued without it.
+ *
+ */
+void startInjectionTimer(int channel, uint32_t time, uint32_t width, void (*callback1)(int), void (*callback2)(int)){
+	uint32_t onTime = eqTimeFromCrankshaftTime(time);
+	injectionCallback[channel][0] = callback1;
+	injectionCallback[channel][1] = callback2;
+	if (eqSchedule(&injectionEvent[channel][1], onTime + width, injectionEventCallback, 2 * channel + 1) == 0) {
+		eqCancel(&injectionEvent[channel][0]);
+		return;
 	}
-	if ( (sr & 2) != 0 ) {
-		// capture & compare interrupt
-		if (injectionTimerDCallback1 != NULL) {
-			injectionTimerDCallback1();
+	eqSchedule(&injectionEvent[channel][0], onTime, injectionEventCallback, 2 * channel);
+}
+
+// moves the end of the injector channel's pulse to the time (crankshaft trigger timer, uS). An end at or before a pulse that's
+// still to start removes the pulse. Returns 0 if the pulse has ended, i.e. it can't be changed.
+int setInjectionEnd(int channel, uint32_t time){
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	int pending = eqPending(&injectionEvent[channel][1]);
+	if (pending != 0) {
+		uint32_t offTime = eqTimeFromCrankshaftTime(time);
+		if ( (eqPending(&injectionEvent[channel][0]) != 0) && ((int32_t)(offTime - injectionEvent[channel][0].time) <= 0) ) {
+			eqCancel(&injectionEvent[channel][0]);
+			eqCancel(&injectionEvent[channel][1]);
+		}
+		else {
+			eqSchedule(&injectionEvent[channel][1], offTime, injectionEventCallback, 2 * channel + 1);
 		}
+		setInjectorCompareEnd(channel, time);
 	}
-	INJECTION_TIMER_D->SR = 0;
+	__set_PRIMASK(primask);
+	return pending;
 }
 
-void initialiseIgnInjTimers(){
-	IGNITION_TIMER->SR = 0;				// clear any pending interrupts
-	IGNITION_TIMER->DIER = 1;			// enable interrupt on update event
-	INJECTION_TIMER_A->SR = 0;
-	INJECTION_TIMER_A->DIER = 3;		// enable interrupt on update and capture & compare
-	INJECTION_TIMER_B->SR = 0;
-	INJECTION_TIMER_B->DIER = 3;
-	INJECTION_TIMER_C->SR = 0;
-	INJECTION_TIMER_C->DIER = 3;		// enable interrupt on update and capture & compare
-	INJECTION_TIMER_D->SR = 0;
-	INJECTION_TIMER_D->DIER = 3;
+void startDwellTimer(int channel, uint32_t time, void (*callback)(int)){
+	dwellCallback[channel] = callback;
+	eqSchedule(&dwellEvent[channel], eqTimeFromCrankshaftTime(time), dwellEventCallback, channel);
+}
+
+void startIgnitionTimer(int channel, uint32_t time, void (*callback)(int)){
+	ignitionCallback[channel] = callback;
+	eqSchedule(&ignitionEvent[channel], eqTimeFromCrankshaftTime(time), ignitionEventCallback, channel);
+}
+
+// cancels the pending injection & ignition events, so none can switch an output on
+void stopIgnInjTimers(){
+	if (outputMode == OUTPUT_MODE_COMPARE) {
+		// the compare timers run on, their outputs are forced off
+		stopOutputCompares();
+	}
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		eqCancel(&injectionEvent[i][0]);
+		eqCancel(&injectionEvent[i][1]);
+	}
+	for (int i = 0; i < COIL_OUTPUTS; i++) {
+		eqCancel(&dwellEvent[i]);
+		eqCancel(&ignitionEvent[i]);
+	}
 }
 
+
 /*
- * The injection timers have two callbacks:
- * callback #1 is called after delay1
- * callback #2 is called after delay2
+ * Output compare output mode, selected by Parameters 3 outputMode.
  *
- * This provides he ability to specify the injector ON timing and pulse width
+ * In the software mode (OUTPUT_MODE_SOFTWARE, default), the event queue interrupts at each edge & the callback switches the
+ * output with a GPIO write, so the edge is late by the interrupt latency, which varies with the other interrupts (e.g. the
+ * crankshaft pulse handler).
+ *
+ * In the output compare mode (OUTPUT_MODE_COMPARE), the outputs on timer channel pins are switched by the timer compare. TIM1 &
+ * TIM8 run free at 1 MHz, and the pins are switched to the timer alternate function, so GPIO writes don't affect them:
+ *
+ * 		Output		Pin		Channel
+ * 		Coil A		PA8		TIM1 CH1
+ * 		Coil B		PC9		TIM8 CH4
+ * 		Coil C		PC8		TIM8 CH3
+ * 		Coil D		PC7		TIM8 CH2
+ * 		Injector B	PE14	TIM1 CH4
+ * 		Injector C	PE13	TIM1 CH3
+ *
+ * A coil is forced active at its dwell event (startCoilCompareDwell()) & goes inactive, i.e. sparks, at the compare
+ * (startCoilCompareSpark()), so no ignition event is queued. The dwell event can follow the spark's tooth, so forcing the coil
+ * active sets a spark that's still to come on the compare again. An injector goes active at the compare (startInjectorCompare()),
+ * then the compare interrupt (ecuISROutputCompare(), from TIM1_CC_IRQHandler() in stm32xxxx_it.c) re-arms the channel to go
+ * inactive after the pulse width. The interrupt only re-arms, so its latency only has to be less than the pulse width.
+ * Injector A (PE15) isn't on a timer channel & injector D (PE12) is only on TIM1 CH3N, which follows injector C, so they're
+ * still switched by the queued injection events, in both modes.
+ *
+ * The latency of the software edges (the event queue statistics) & of the compare re-arm are recorded (uS), to compare the modes
+ * (the "ol" command). By design the compare edges are at the compare time to the timer resolution (1 uS), whatever the interrupt
+ * load. The jitter of the two modes hasn't been measured on the target, neither from these statistics nor at the pins.
+ *
+ * The compare timers are 16 bit. An edge's compare value is worked out when it's started, but an edge more than
+ * COMPARE_MAX_AHEAD ahead (a long delay or pulse width when cranking) isn't set on the compare until COMPARE_ARM_AHEAD before
+ * it's due, by an event on the 32 bit event queue. So the event queue timer extends the compare timers & the edge is still
+ * exact. Each injector & coil has one such event, as only its next edge is pending. On the host (test_code/output_timing_check.c)
+ * the edges are at their times to the uS either side of COMPARE_ARM_AHEAD & COMPARE_MAX_AHEAD, beyond 2^16 uS & across the
+ * wraps of the crankshaft trigger & event queue timers.
+ *
+ * setInjectionEnd() changes the pulse width of an injector whose on edge is still to come, or sets its new off edge if it's
+ * on. The end time of each injector's pulse is kept on the 32 bit crankshaft trigger timer, so a long pulse that's in flight
+ * is still handled correctly.
+ *
+ * The compare interrupt has the same pre-emption priority as TIM2, as both modify the channel modes.
  *
  */
-void startInjectionTimerA(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)()){
-	INJECTION_TIMER_A->CCR1 = delay1;
-	INJECTION_TIMER_A->ARR = delay1 + delay2;
-	injectionTimerACallback1 = callback1;
-	injectionTimerACallback2 = callback2;
-	INJECTION_TIMER_A->CR1 |= 1; // enable the timer counter
+
+int outputMode = OUTPUT_MODE_SOFTWARE;
+
+// compare re-arm latency statistics (uS), from the injector on edge to the re-arm of its off edge
+volatile uint32_t outputRearmLatencyMax = 0;
+
+typedef struct {
+	TIM_TypeDef *timer;
+	int channel;						// 1 to 4, 0 if the pin isn't on a timer channel
+	GPIO_TypeDef *port;
+	uint16_t pin;
+	uint8_t alternate;
+} OutputCompareChannel;
+
+static const OutputCompareChannel injectorCompare[INJECTOR_OUTPUTS] = {
+		{ NULL, 0, Injector_A_GPIO_Port, Injector_A_Pin, 0 },
+		{ TIM1, 4, Injector_B_GPIO_Port, Injector_B_Pin, GPIO_AF1_TIM1 },
+		{ TIM1, 3, Injector_C_GPIO_Port, Injector_C_Pin, GPIO_AF1_TIM1 },
+		{ NULL, 0, Injector_D_GPIO_Port, Injector_D_Pin, 0 } };
+
+static const OutputCompareChannel coilCompare[COIL_OUTPUTS] = {
+		{ TIM1, 1, Coil_A_GPIO_Port, Coil_A_Pin, GPIO_AF1_TIM1 },
+		{ TIM8, 4, Coil_B_GPIO_Port, Coil_B_Pin, GPIO_AF3_TIM8 },
+		{ TIM8, 3, Coil_C_GPIO_Port, Coil_C_Pin, GPIO_AF3_TIM8 },
+		{ TIM8, 2, Coil_D_GPIO_Port, Coil_D_Pin, GPIO_AF3_TIM8 } };
+
+// edges further ahead than COMPARE_MAX_AHEAD are set on the compare by an event COMPARE_ARM_AHEAD before they're due (uS). Both
+// are well inside the signed 16 bit range of the compare timers.
+#define COMPARE_MAX_AHEAD	0x6000
+#define COMPARE_ARM_AHEAD	0x3000
+
+// the pulse width (uS), the end time (crankshaft trigger timer, uS) & the on & off compare values of each injector's armed
+// pulse, & the spark compare value & time (crankshaft trigger timer, uS) of each coil
+static uint32_t injectorCompareWidth[INJECTOR_OUTPUTS];
+static uint32_t injectorCompareEnd[INJECTOR_OUTPUTS];
+static uint16_t injectorCompareOn[INJECTOR_OUTPUTS];
+static uint16_t injectorCompareOff[INJECTOR_OUTPUTS];
+static uint16_t coilCompareSpark[COIL_OUTPUTS];
+static uint32_t coilSparkTime[COIL_OUTPUTS];
+
+// the events that set the compares of the edges beyond COMPARE_MAX_AHEAD
+static eqEvent injectorCompareEvent[INJECTOR_OUTPUTS];
+static eqEvent coilCompareEvent[COIL_OUTPUTS];
+
+// output compare modes (OCxM)
+#define OC_ACTIVE_ON_MATCH		1
+#define OC_INACTIVE_ON_MATCH	2
+#define OC_FORCE_INACTIVE		4
+#define OC_FORCE_ACTIVE			5
+
+static inline void setCompareMode(const OutputCompareChannel *oc, uint32_t mode){
+	volatile uint32_t *ccmr = oc->channel <= 2 ? &oc->timer->CCMR1 : &oc->timer->CCMR2;
+	int shift = (oc->channel & 1) != 0 ? 4 : 12;
+	*ccmr = (*ccmr & ~(7UL << shift)) | (mode << shift);
+}
+
+static inline volatile uint32_t *compareRegister(const OutputCompareChannel *oc){
+	return &oc->timer->CCR1 + (oc->channel - 1);
+}
+
+static inline uint32_t compareFlag(const OutputCompareChannel *oc){
+	return TIM_SR_CC1IF << (oc->channel - 1);
+}
+
+// sets the injector's off edge on the compare. If that's passed, the injector is switched off now.
+static void setInjectorOff(int injector){
+	const OutputCompareChannel *oc = &injectorCompare[injector];
+	uint16_t offTime = injectorCompareOff[injector];
+	*compareRegister(oc) = offTime;
+	setCompareMode(oc, OC_INACTIVE_ON_MATCH);
+	if ((int16_t)(oc->timer->CNT - offTime) >= 0) {
+		setCompareMode(oc, OC_FORCE_INACTIVE);
+	}
+}
+
+// event queue callback, sets the injector's off edge on the compare once it's in range
+static void injectorOffEventCallback(int injector){
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	setInjectorOff(injector);
+	__set_PRIMASK(primask);
+}
+
+// arms the injector's off edge, the pulse width after its on edge
+static void armInjectorOff(int injector, uint16_t onTime){
+	const OutputCompareChannel *oc = &injectorCompare[injector];
+	uint32_t width = injectorCompareWidth[injector];
+	oc->timer->DIER &= ~compareFlag(oc);
+	injectorCompareOff[injector] = (uint16_t)(onTime + width);
+	uint32_t elapsed = (uint16_t)(oc->timer->CNT - onTime);
+	if (width > elapsed + COMPARE_MAX_AHEAD) {
+		// beyond the compare timer's range, the compare is set nearer the time
+		eqSchedule(&injectorCompareEvent[injector], eqNow() + (width - elapsed) - COMPARE_ARM_AHEAD, injectorOffEventCallback, injector);
+		return;
+	}
+	setInjectorOff(injector);
+}
+
+// sets the injector's on edge on the compare. If that's passed, the injector is switched on now & its off edge armed.
+static void setInjectorOn(int injector){
+	const OutputCompareChannel *oc = &injectorCompare[injector];
+	uint16_t onTime = injectorCompareOn[injector];
+	*compareRegister(oc) = onTime;
+	oc->timer->SR = ~compareFlag(oc);
+	setCompareMode(oc, OC_ACTIVE_ON_MATCH);
+	oc->timer->DIER |= compareFlag(oc);
+	if ((int16_t)(oc->timer->CNT - onTime) >= 0) {
+		// the compare was missed while it was set
+		setCompareMode(oc, OC_FORCE_ACTIVE);
+		armInjectorOff(injector, onTime);
+	}
+}
+
+// event queue callback, sets the injector's on edge on the compare once it's in range
+static void injectorOnEventCallback(int injector){
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	setInjectorOn(injector);
+	__set_PRIMASK(primask);
+}
+
+// switches the injector on at the time (crankshaft trigger timer, uS) for the pulse width (uS), if it's on a timer channel
+void startInjectorCompare(int injector, uint32_t time, uint32_t width){
+	const OutputCompareChannel *oc = &injectorCompare[injector];
+	if ( (outputMode != OUTPUT_MODE_COMPARE) || (oc->channel == 0) ) {
+		return;
+	}
+	eqCancel(&injectorCompareEvent[injector]);
+	setCompareMode(oc, OC_FORCE_INACTIVE);
+	oc->timer->DIER &= ~compareFlag(oc);
+	injectorCompareWidth[injector] = width;
+	injectorCompareEnd[injector] = time + width;
+	int32_t delay = (int32_t)(time - CRANKSHAFT_TRIGGER_TIMER->CNT);
+	injectorCompareOn[injector] = (uint16_t)(oc->timer->CNT + delay);
+	if (delay > COMPARE_MAX_AHEAD) {
+		// beyond the compare timer's range, the compare is set nearer the time
+		eqSchedule(&injectorCompareEvent[injector], eqNow() + delay - COMPARE_ARM_AHEAD, injectorOnEventCallback, injector);
+		return;
+	}
+	setInjectorOn(injector);
+}
+
+// switches all the injectors on timer channels on at the time (crankshaft trigger timer, uS) for the pulse width (uS)
+void startInjectorCompareAll(uint32_t time, uint32_t width){
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		startInjectorCompare(i, time, width);
+	}
 }
 
-void startInjectionTimerB(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)()){
-	INJECTION_TIMER_B->CCR1 = delay1;
-	INJECTION_TIMER_B->ARR = delay1 + delay2;
-	injectionTimerBCallback1 = callback1;
-	injectionTimerBCallback2 = callback2;
-	INJECTION_TIMER_B->CR1 |= 1; // enable the timer counter
+// moves the end of the injector's pulse to the time (crankshaft trigger timer, uS), if it's on a timer channel & the pulse
+// hasn't ended. Called with interrupts disabled.
+static void setInjectorCompareEnd(int injector, uint32_t time){
+	const OutputCompareChannel *oc = &injectorCompare[injector];
+	uint32_t now = CRANKSHAFT_TRIGGER_TIMER->CNT;
+	if ( (outputMode != OUTPUT_MODE_COMPARE) || (oc->channel == 0) || ((int32_t)(injectorCompareEnd[injector] - now) <= 0) ) {
+		return;
+	}
+	uint32_t onTime = injectorCompareEnd[injector] - injectorCompareWidth[injector];
+	uint32_t width = (int32_t)(time - onTime) > 0 ? time - onTime : 0;
+	injectorCompareWidth[injector] = width;
+	injectorCompareEnd[injector] = onTime + width;
+
+	// still to switch on, the off edge is armed from the new width. A pulse with no width is removed.
+	int onPending = (eqPending(&injectorCompareEvent[injector]) != 0)
+			&& (injectorCompareEvent[injector].callback == injectorOnEventCallback);
+	if ( (onPending != 0) || ( ((oc->timer->DIER & compareFlag(oc)) != 0) && ((oc->timer->SR & compareFlag(oc)) == 0) ) ) {
+		if (width == 0) {
+			eqCancel(&injectorCompareEvent[injector]);
+			oc->timer->DIER &= ~compareFlag(oc);
+			setCompareMode(oc, OC_FORCE_INACTIVE);
+		}
+		return;
+	}
+
+	// on, or its re-arm is pending - the off edge is set here instead. An end that has passed switches it off now.
+	oc->timer->DIER &= ~compareFlag(oc);
+	oc->timer->SR = ~compareFlag(oc);
+	eqCancel(&injectorCompareEvent[injector]);
+	int32_t delay = (int32_t)(onTime + width - now);
+	if (delay <= 0) {
+		setCompareMode(oc, OC_FORCE_INACTIVE);
+		return;
+	}
+	injectorCompareOff[injector] = (uint16_t)(oc->timer->CNT + delay);
+	if (delay > COMPARE_MAX_AHEAD) {
+		// beyond the compare timer's range, the compare is set nearer the time. The injector is held on until then, so the
+		// off edge already on the compare doesn't switch it off.
+		setCompareMode(oc, OC_FORCE_ACTIVE);
+		eqSchedule(&injectorCompareEvent[injector], eqNow() + delay - COMPARE_ARM_AHEAD, injectorOffEventCallback, injector);
+		return;
+	}
+	setInjectorOff(injector);
 }
-void startInjectionTimerC(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)()){
-	INJECTION_TIMER_C->CCR1 = delay1;
-	INJECTION_TIMER_C->ARR = delay1 + delay2;
-	injectionTimerCCallback1 = callback1;
-	injectionTimerCCallback2 = callback2;
-	INJECTION_TIMER_C->CR1 |= 1; // enable the timer counter
+
+// sets the coil's spark on the compare. If that's passed, the coil is switched off now.
+static void setCoilSpark(int coil){
+	const OutputCompareChannel *oc = &coilCompare[coil];
+	uint16_t sparkTime = coilCompareSpark[coil];
+	*compareRegister(oc) = sparkTime;
+	setCompareMode(oc, OC_INACTIVE_ON_MATCH);
+	if ((int16_t)(oc->timer->CNT - sparkTime) >= 0) {
+		setCompareMode(oc, OC_FORCE_INACTIVE);
+	}
+}
+
+// event queue callback, sets the coil's spark on the compare once it's in range
+static void coilSparkEventCallback(int coil){
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	setCoilSpark(coil);
+	__set_PRIMASK(primask);
+}
+
+// switches the coil on now, if it's on a timer channel. Forcing the output replaces the compare mode, so a spark that's been
+// set & is still to come (the dwell started after the spark's tooth) is set on the compare again. A spark beyond the compare
+// range is left to its event. A spark set on the compare is at most COMPARE_MAX_AHEAD ahead, so a spark time further ahead is
+// an old one the 32 bit timer has wrapped round to (the coil hasn't sparked for 2^31 uS, e.g. the engine was stopped).
+void startCoilCompareDwell(int coil){
+	const OutputCompareChannel *oc = &coilCompare[coil];
+	if ( (outputMode != OUTPUT_MODE_COMPARE) || (oc->channel == 0) ) {
+		return;
+	}
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	setCompareMode(oc, OC_FORCE_ACTIVE);
+	int32_t sparkDelay = (int32_t)(coilSparkTime[coil] - CRANKSHAFT_TRIGGER_TIMER->CNT);
+	if ( (eqPending(&coilCompareEvent[coil]) == 0) && (sparkDelay > 0) && (sparkDelay <= COMPARE_MAX_AHEAD) ) {
+		setCoilSpark(coil);
+	}
+	__set_PRIMASK(primask);
+}
+
+// switches the coil off, i.e. sparks, at the time (crankshaft trigger timer, uS), if it's on a timer channel
+void startCoilCompareSpark(int coil, uint32_t time){
+	const OutputCompareChannel *oc = &coilCompare[coil];
+	if ( (outputMode != OUTPUT_MODE_COMPARE) || (oc->channel == 0) ) {
+		return;
+	}
+	int32_t delay = (int32_t)(time - CRANKSHAFT_TRIGGER_TIMER->CNT);
+	coilSparkTime[coil] = time;
+	coilCompareSpark[coil] = (uint16_t)(oc->timer->CNT + delay);
+	if (delay > COMPARE_MAX_AHEAD) {
+		// beyond the compare timer's range, the compare is set nearer the time
+		eqSchedule(&coilCompareEvent[coil], eqNow() + delay - COMPARE_ARM_AHEAD, coilSparkEventCallback, coil);
+		return;
+	}
+	eqCancel(&coilCompareEvent[coil]);
+	setCoilSpark(coil);
+}
+
+// forces the compare outputs off & cancels the pending re-arms
+void stopOutputCompares(){
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		eqCancel(&injectorCompareEvent[i]);
+		if (injectorCompare[i].channel != 0) {
+			injectorCompare[i].timer->DIER &= ~compareFlag(&injectorCompare[i]);
+			setCompareMode(&injectorCompare[i], OC_FORCE_INACTIVE);
+		}
+	}
+	for (int i = 0; i < COIL_OUTPUTS; i++) {
+		eqCancel(&coilCompareEvent[i]);
+		coilSparkTime[i] = CRANKSHAFT_TRIGGER_TIMER->CNT;
+		if (coilCompare[i].channel != 0) {
+			setCompareMode(&coilCompare[i], OC_FORCE_INACTIVE);
+		}
+	}
+}
+
+// injector compare interrupt, re-arms the injectors that have switched on to switch off
+void ecuISROutputCompare(){
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		const OutputCompareChannel *oc = &injectorCompare[i];
+		if ( (oc->channel != 0) && ((oc->timer->SR & oc->timer->DIER & compareFlag(oc)) != 0) ) {
+			oc->timer->SR = ~compareFlag(oc);
+			uint16_t onTime = *compareRegister(oc);
+			uint32_t latency = (uint16_t)(oc->timer->CNT - onTime);
+			if (latency > outputRearmLatencyMax) {
+				outputRearmLatencyMax = latency;
+			}
+			armInjectorOff(i, onTime);
+		}
+	}
 }
 
-void startInjectionTimerD(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)()){
-	INJECTION_TIMER_D->CCR1 = delay1;
-	INJECTION_TIMER_D->ARR = delay1 + delay2;
-	injectionTimerDCallback1 = callback1;
-	injectionTimerDCallback2 = callback2;
-	INJECTION_TIMER_D->CR1 |= 1; // enable the timer counter
+void resetOutputLatency(){
+	eqResetStatistics();
+	outputRearmLatencyMax = 0;
 }
 
-void startIgnitionTimer(uint16_t period, void (*callback)()){
-	IGNITION_TIMER->ARR = period;
-	ignitionTimerCallback = callback;
-	IGNITION_TIMER->CR1 |= 1; // enable the timer counter
+// starts the compare timers & switches the pins on timer channels to them
+static void startOutputCompareMode(){
+
+	GPIO_InitTypeDef gpio = {0};
+
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		injectorCompareEvent[i].index = EQ_NOT_QUEUED;
+	}
+	for (int i = 0; i < COIL_OUTPUTS; i++) {
+		coilCompareEvent[i].index = EQ_NOT_QUEUED;
+	}
+
+	outputMode = OUTPUT_MODE_COMPARE;
+
+	// TIM1 & TIM8 free running
+	TIM1->CR1 &= ~(TIM_CR1_CEN | TIM_CR1_OPM);
+	TIM8->CR1 &= ~(TIM_CR1_CEN | TIM_CR1_OPM);
+	TIM1->ARR = 0xFFFF;
+	TIM8->ARR = 0xFFFF;
+	TIM1->DIER = 0;
+	TIM8->DIER = 0;
+	TIM1->SR = 0;
+	TIM8->SR = 0;
+
+	// each channel an output, forced inactive, then enabled. The injectors are active high. The coils are active at coilON, i.e.
+	// active low for inverted (electronic) coils (Parameters 2 ignitionFiringSense <= 0, as twInitialise()), so forced inactive
+	// is coilOFF. The advanced timers' outputs also need the main output enable.
+	for (int i = 0; i < INJECTOR_OUTPUTS + COIL_OUTPUTS; i++) {
+		const OutputCompareChannel *oc = i < INJECTOR_OUTPUTS ? &injectorCompare[i] : &coilCompare[i - INJECTOR_OUTPUTS];
+		if (oc->channel == 0) {
+			continue;
+		}
+		int activeLow = (i >= INJECTOR_OUTPUTS) && (cfPage1.p2.ignitionFiringSense <= 0);
+		volatile uint32_t *ccmr = oc->channel <= 2 ? &oc->timer->CCMR1 : &oc->timer->CCMR2;
+		*ccmr &= ~(0xFFUL << ((oc->channel & 1) != 0 ? 0 : 8));
+		setCompareMode(oc, OC_FORCE_INACTIVE);
+		oc->timer->CCER = (oc->timer->CCER & ~(TIM_CCER_CC1P << (4 * (oc->channel - 1))))
+				| ((activeLow != 0 ? TIM_CCER_CC1P | TIM_CCER_CC1E : TIM_CCER_CC1E) << (4 * (oc->channel - 1)));
+
+		gpio.Pin = oc->pin;
+		gpio.Mode = GPIO_MODE_AF_PP;
+		gpio.Pull = GPIO_NOPULL;
+		gpio.Speed = GPIO_SPEED_FREQ_HIGH;
+		gpio.Alternate = oc->alternate;
+		HAL_GPIO_Init(oc->port, &gpio);
+	}
+	TIM1->BDTR |= TIM_BDTR_MOE;
+	TIM8->BDTR |= TIM_BDTR_MOE;
+
+	TIM1->CR1 |= TIM_CR1_CEN;
+	TIM8->CR1 |= TIM_CR1_CEN;
+	HAL_NVIC_EnableIRQ(TIM1_CC_IRQn);
 }
 
 
@@ -385,37 +818,337 @@ void setDutyCyclePWM2(float dc){
 
 /*
  * TIMER #2 provides crankshaft trigger wheel pulse period measurement, using input capture on channel 1, pin PA15.
+ * Channel 2, pin PB3, captures the camshaft pulse.
  * ecuISRcrankshaftTrigger() is called from TIM2_IRQHandler() in stm32xxxx_it.h.
  *
  * This interrupt service function calculates the pulse period then calls the ECU crankshaft pulse handler.
+ * If a camshaft pulse has been captured, the camshaft pulse handler is called. When both have been captured, the handlers are
+ * called in the order the pulses arrived.
  * As of version 3200.064, a filter is applied to the input capture trigger in the configuration of the timer.
  *
+ * In DMA capture mode, DMA1 stream 5 (channel 3, TIM2_CH1) writes the channel 1 capture times to crankshaftCaptureBuffer.
+ * ecuISRcrankshaftDMA() is called from DMA1_Stream5_IRQHandler() when the buffer is half full & full. The channel 1 interrupt is
+ * only enabled when the next pulse has injection or ignition events, so the events are still scheduled from that pulse. The
+ * pulses in the buffer are decoded in the order they arrived. The event delays are timed from the captured time of the pulse
+ * (by the crankshaft pulse handler), so the event timing is the same as in interrupt mode.
+ *
+ * The time spent in both interrupts is measured with the DWT cycle counter.
+ *
+ * Channel 3 (output compare, no output pin) is the crankshaft stall timeout. The crankshaft pulse handler re-arms it at every
+ * accepted pulse with startCrankshaftStallTimer(). If the compare is reached before the next pulse, crankshaftStallHandler()
+ * cuts the outputs. In DMA capture mode, the pulses captured since the last decode are decoded first, so a running engine
+ * re-arms the timeout rather than stalling. The time from the last pulse to the outputs being off (uS) & the cycles from the
+ * interrupt entry are recorded for each stall.
+ *
  */
 
-void ecuISRcrankshaftTrigger(){
+static uint32_t crankshaftCaptureBuffer[CRANKSHAFT_CAPTURE_BUFFER_SIZE];
+static int crankshaftCaptureIndex = 0;				// the next buffer entry to be decoded
+
+// cycles spent in the crankshaft interrupts since the last load update
+static volatile uint32_t crankshaftISRCycles = 0;
+volatile float crankshaftISRLoad = 0;
+
+// number of times the DMA write position is read per decode, see processCrankshaftCaptureBuffer()
+#define CRANKSHAFT_DMA_CHECKS 2
+
+// stall timeout
+static uint32_t crankshaftStallPulseTime = 0;		// the time of the pulse that armed the timeout
+volatile uint32_t crankshaftStalls = 0;
+volatile uint32_t crankshaftStallLatency = 0;
+volatile uint32_t crankshaftStallCycles = 0;
+
+
+// calculates the period from the previous crankshaft pulse then calls the crankshaft pulse handler
+static void processCrankshaftPulse(uint32_t timeNow){
 
 	static uint32_t crankshaftPulseTime_1 = 0;
 	uint32_t period;
 
+	// calculate the pulse period
+	// ** note the variables used in the time difference calc must have the same width as the counter - i.e. 32 bits
+	if(timeNow > crankshaftPulseTime_1)  period = timeNow - crankshaftPulseTime_1;
+	 else period = timeNow + (0xffffffff - crankshaftPulseTime_1);
+	crankshaftPulseTime_1 = timeNow;
+
+	// call the crankshaft pulse handler function
+	crankPulseTime = timeNow;
+	crankshaftPulseHandler(period);
+}
+
+
+// decodes the crankshaft pulses in the DMA capture buffer. A captured camshaft pulse is handled in order of arrival.
+// The DMA write position (NDTR) is read at most CRANKSHAFT_DMA_CHECKS times: a pulse the DMA hasn't transferred yet (its capture
+// flag is still set) is left for the next interrupt rather than waited for.
+static void processCrankshaftCaptureBuffer(int camshaftPulse, uint32_t camshaftPulseTime){
+
+	for (int check = 0; check < CRANKSHAFT_DMA_CHECKS; check++) {
+
+		int writeIndex = CRANKSHAFT_CAPTURE_BUFFER_SIZE - CRANKSHAFT_DMA_STREAM->NDTR;
+		if (writeIndex >= CRANKSHAFT_CAPTURE_BUFFER_SIZE) {
+			writeIndex = 0;
+		}
+		if (crankshaftCaptureIndex == writeIndex) {
+			break;
+		}
+
+		while (crankshaftCaptureIndex != writeIndex) {
+
+			uint32_t timeNow = crankshaftCaptureBuffer[crankshaftCaptureIndex];
+
+			if ( (camshaftPulse != 0) && ((int32_t)(camshaftPulseTime - timeNow) <= 0) ) {
+				camshaftPulseHandler();
+				camshaftPulse = 0;
+			}
+
+			processCrankshaftPulse(timeNow);
+
+			if (++crankshaftCaptureIndex >= CRANKSHAFT_CAPTURE_BUFFER_SIZE) {
+				crankshaftCaptureIndex = 0;
+			}
+		}
+	}
+	if (camshaftPulse != 0) {
+		camshaftPulseHandler();
+	}
+
+	// only interrupt on the next pulse if it has events or arms an ADC sample. A pulse still waiting for the DMA (capture flag
+	// set) keeps the interrupt enabled, so it's decoded by the interrupt that follows, or at the latest the next half transfer.
+	if ( ((CRANKSHAFT_TRIGGER_TIMER->SR & TIM_SR_CC1IF) != 0) || (twNextToothHasEvents() != 0) || (aqNextToothHasSample() != 0) ) {
+		CRANKSHAFT_TRIGGER_TIMER->DIER |= TIM_DIER_CC1IE;
+	}
+	else {
+		CRANKSHAFT_TRIGGER_TIMER->DIER &= ~TIM_DIER_CC1IE;
+	}
+}
+
+
+void ecuISRcrankshaftTrigger(){
+
+	uint32_t cyclesStart = DWT->CYCCNT;
+	uint32_t crankshaftPulseTime = 0;
+	uint32_t camshaftPulseTime = 0;
+
+	// bit 1 of SR = channel 1 (crankshaft) interrupt flag, bit 2 = channel 2 (camshaft) interrupt flag
+	// reading the captured data clears the flag
+	uint32_t sr = CRANKSHAFT_TRIGGER_TIMER->SR;
+	int crankshaftPulse = (sr & 2) != 0;
+	int camshaftPulse = (sr & 4) != 0;
+
+	// bit 3 = channel 3 (stall timeout) compare flag, cleared by writing 0
+	if ( (sr & TIM_SR_CC3IF) != 0 ) {
+		CRANKSHAFT_TRIGGER_TIMER->SR = ~TIM_SR_CC3IF;
+	}
+
+	if (camshaftPulse != 0) {
+		camshaftPulseTime = CAMSHAFT_TRIGGER_CCR;
+	}
+
+	if (crankshaftCaptureMode == CRANKSHAFT_CAPTURE_DMA) {
+
+		// the capture flag is cleared when the DMA reads the captured time. The pulse isn't waited for if it's not in the buffer
+		// yet, processCrankshaftCaptureBuffer() leaves it for the next interrupt.
+		processCrankshaftCaptureBuffer(camshaftPulse, camshaftPulseTime);
+	}
+	else {
+
+		if (crankshaftPulse != 0) {
+			crankshaftPulseTime = CRANKSHAFT_TRIGGER_TIMER->CCR1;
+		}
+
+		// if the camshaft pulse arrived first, handle it first
+		if ( (camshaftPulse != 0) && ( (crankshaftPulse == 0) || ((int32_t)(camshaftPulseTime - crankshaftPulseTime) <= 0) ) ) {
+			camshaftPulseHandler();
+			camshaftPulse = 0;
+		}
+
+		// if TIM2 Channel 1 has invoked the ISR, handle the crankshaft pulse
+		if (crankshaftPulse != 0) {
+			processCrankshaftPulse(crankshaftPulseTime);
+		}
+
+		// the camshaft pulse arrived after the crankshaft pulse
+		if (camshaftPulse != 0) {
+			camshaftPulseHandler();
+		}
+	}
+
+	// the stall timeout has expired if it's still armed & no pulse has re-armed it
+	if ( ((CRANKSHAFT_TRIGGER_TIMER->DIER & TIM_DIER_CC3IE) != 0) && ((int32_t)(CRANKSHAFT_TRIGGER_TIMER->CNT - CRANKSHAFT_STALL_CCR) >= 0) ) {
+		CRANKSHAFT_TRIGGER_TIMER->DIER &= ~TIM_DIER_CC3IE;
+		crankshaftStallHandler();
+		crankshaftStallCycles = DWT->CYCCNT - cyclesStart;
+		crankshaftStallLatency = CRANKSHAFT_TRIGGER_TIMER->CNT - crankshaftStallPulseTime;
+		crankshaftStalls++;
+	}
+
+	crankshaftISRCycles += DWT->CYCCNT - cyclesStart;
+}
+
+
+// arms the stall timeout, called by the crankshaft pulse handler. The timeout (uS) is from the time of the pulse.
+void startCrankshaftStallTimer(uint32_t pulseTime, uint32_t timeout){
+	crankshaftStallPulseTime = pulseTime;
+	CRANKSHAFT_STALL_CCR = pulseTime + timeout;
+	CRANKSHAFT_TRIGGER_TIMER->DIER |= TIM_DIER_CC3IE;
+}
+
+
+// DMA half & full transfer interrupt, decodes the pulses in the capture buffer
+void ecuISRcrankshaftDMA(){
+
+	uint32_t cyclesStart = DWT->CYCCNT;
+
+	// clear the stream 5 interrupt flags
+	DMA1->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+
+	processCrankshaftCaptureBuffer(0, 0);
+
+	crankshaftISRCycles += DWT->CYCCNT - cyclesStart;
+}
+
+
+// starts the crankshaft pulse capture in the selected mode
+static void startCrankshaftCapture(int mode){
+
+	if (mode == CRANKSHAFT_CAPTURE_DMA) {
+
+		crankshaftCaptureMode = CRANKSHAFT_CAPTURE_DMA;
+		crankshaftCaptureIndex = 0;
+
+		// DMA1 stream 5, channel 3 (TIM2_CH1), peripheral to memory, 32 bit, circular, interrupts at half & full transfer
+		__HAL_RCC_DMA1_CLK_ENABLE();
+		CRANKSHAFT_DMA_STREAM->CR = 0;
+		while ( (CRANKSHAFT_DMA_STREAM->CR & DMA_SxCR_EN) != 0 );
+		CRANKSHAFT_DMA_STREAM->PAR = (uint32_t) &CRANKSHAFT_TRIGGER_TIMER->CCR1;
+		CRANKSHAFT_DMA_STREAM->M0AR = (uint32_t) crankshaftCaptureBuffer;
+		CRANKSHAFT_DMA_STREAM->NDTR = CRANKSHAFT_CAPTURE_BUFFER_SIZE;
+		CRANKSHAFT_DMA_STREAM->CR = DMA_SxCR_CHSEL_0 | DMA_SxCR_CHSEL_1 | DMA_SxCR_PL | DMA_SxCR_MSIZE_1 | DMA_SxCR_PSIZE_1 |
+									DMA_SxCR_MINC | DMA_SxCR_CIRC | DMA_SxCR_HTIE | DMA_SxCR_TCIE;
+		DMA1->HIFCR = DMA_HIFCR_CTCIF5 | DMA_HIFCR_CHTIF5 | DMA_HIFCR_CTEIF5 | DMA_HIFCR_CDMEIF5 | DMA_HIFCR_CFEIF5;
+		CRANKSHAFT_DMA_STREAM->CR |= DMA_SxCR_EN;
+
+		// start input capture on channel 1 with a DMA request on each capture
+		HAL_TIM_IC_Start(&htim2, TIM_CHANNEL_1);
+		CRANKSHAFT_TRIGGER_TIMER->DIER |= TIM_DIER_CC1DE;
+	}
+	else {
+		crankshaftCaptureMode = CRANKSHAFT_CAPTURE_INTERRUPT;
+
+		// Start input capture on timer 2, channel 1 for use by the crankshaft trigger pulse handler.
+		HAL_TIM_IC_Start_IT(&htim2, TIM_CHANNEL_1);
+	}
+}
+
+
+// starts the camshaft pulse capture. CubeMX configures the camshaft sensor pin (PB3) as the CMP_SIGNAL_CHECK GPIO input & doesn't
+// set up TIM2 channel 2, so both are done here, after MX_TIM2_Init() & MX_GPIO_Init(), and survive a CubeMX regeneration.
+static void startCamshaftCapture(){
+	GPIO_InitTypeDef gpio = {0};
+	TIM_IC_InitTypeDef ic = {0};
+
+	// channel 2 input capture on the rising edge, filtered as the crankshaft input
+	ic.ICPolarity = TIM_INPUTCHANNELPOLARITY_RISING;
+	ic.ICSelection = TIM_ICSELECTION_DIRECTTI;
+	ic.ICPrescaler = TIM_ICPSC_DIV1;
+	ic.ICFilter = 15;
+	if (HAL_TIM_IC_ConfigChannel(&htim2, &ic, TIM_CHANNEL_2) != HAL_OK) {
+		Error_Handler();
+	}
+
+	// PB3 as TIM2_CH2
+	__HAL_RCC_GPIOB_CLK_ENABLE();
+	gpio.Pin = CMP_SIGNAL_CHECK_Pin;
+	gpio.Mode = GPIO_MODE_AF_PP;
+	gpio.Pull = GPIO_PULLDOWN;
+	gpio.Speed = GPIO_SPEED_FREQ_LOW;
+	gpio.Alternate = GPIO_AF1_TIM2;
+	HAL_GPIO_Init(CMP_SIGNAL_CHECK_GPIO_Port, &gpio);
+
+	HAL_TIM_IC_Start_IT(&htim2, TIM_CHANNEL_2);
+}
+
 
-	// if TIM2 Channel 1 has invoked the ISR, read the captured data
-	// bit 1 of SR = channel 1 interrupt flag
-	if ( (CRANKSHAFT_TRIGGER_TIMER->SR & 2) != 0 ) {
+// calculates the CPU load of the crankshaft interrupts since the last call. Called from the VLF task.
+void updateCrankshaftISRLoad(){
+	static uint32_t cyclesN_1 = 0;
 
-		// get the captured time
-		// ** note the variables used in the time difference calc must have the same width as the counter - i.e. 16 bits
-		uint32_t timeNow = CRANKSHAFT_TRIGGER_TIMER->CCR1;
+	// the crankshaft interrupts add to the cycle count, so it's swapped out with interrupts disabled
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	uint32_t cyclesNow = DWT->CYCCNT;
+	uint32_t isrCycles = crankshaftISRCycles;
+	crankshaftISRCycles = 0;
+	__set_PRIMASK(primask);
+
+	crankshaftISRLoad = cyclesNow != cyclesN_1 ? 100.0F * (float)isrCycles / (float)(cyclesNow - cyclesN_1) : 0.0F;
+	cyclesN_1 = cyclesNow;
+}
 
-		// calculate the pulse period
-		if(timeNow > crankshaftPulseTime_1)  period = timeNow - crankshaftPulseTime_1;
-		 else period = timeNow + (0xffffffff - crankshaftPulseTime_1);
-		crankshaftPulseTime_1 = timeNow;
 
-		// call the crankshaft pulse handler function
-		crankshaftPulseHandler(period);
+/*
+ * Crank angle synchronous ADC samples (see angle_acquisition.c).
+ *
+ * TIM2 channel 4 (output compare, no output pin) triggers ADC1 injected conversions, so a sample is taken at the compare time
+ * whatever the interrupt latency. The channel 4 reference (OC4REF) is the TIM2 trigger output (TRGO), which is the ADC1
+ * injected trigger (JEXTSEL = TIM2_TRGO, rising edge). startAngleSampleTimer() forces OC4REF low, then sets it to go high at
+ * the compare, or forces it high at once if the time has passed. Each sample is a single injected conversion (JL = 0) of the
+ * channel in JSQ4, which is inserted into the continuous regular (DMA) sequence.
+ *
+ * ecuISRangleADC() is called from ADC_IRQHandler() in stm32xxxx_it.c at the injected end of conversion, and passes the result to
+ * aqSampleComplete(). The ADC interrupt has the same pre-emption priority as TIM2 & DMA1 stream 5, so it can't interrupt, or be
+ * interrupted by, the crankshaft pulse handler while the trigger is armed.
+ *
+ */
+
+// the ADC channel of each adcRawData[] index, as configured for the regular sequence ranks by CubeMX
+static const uint8_t adcChannel[7] = { 0, 1, 2, 3, 4, 14, 15 };
+
+// arms the ADC trigger to sample the input (adcRawData[] index) at the time (uS). Called from the crankshaft & ADC interrupts.
+void startAngleSampleTimer(uint32_t time, int adcIndex){
+	ADC_TypeDef *adc = (SENSOR_ADC)->Instance;
+	adc->JSQR = (uint32_t)adcChannel[adcIndex] << ADC_JSQR_JSQ4_Pos;
+
+	uint32_t ccmr2 = CRANKSHAFT_TRIGGER_TIMER->CCMR2 & ~TIM_CCMR2_OC4M;
+	CRANKSHAFT_TRIGGER_TIMER->CCMR2 = ccmr2 | TIM_CCMR2_OC4M_2;							// force inactive
+	ANGLE_SAMPLE_CCR = time;
+	CRANKSHAFT_TRIGGER_TIMER->CCMR2 = ccmr2 | TIM_CCMR2_OC4M_0;							// active on match
+	if ((int32_t)(CRANKSHAFT_TRIGGER_TIMER->CNT - time) >= 0) {
+		CRANKSHAFT_TRIGGER_TIMER->CCMR2 = ccmr2 | TIM_CCMR2_OC4M_2 | TIM_CCMR2_OC4M_0;	// force active
 	}
 }
 
+// disarms the ADC trigger
+void stopAngleSampleTimer(){
+	CRANKSHAFT_TRIGGER_TIMER->CCMR2 = (CRANKSHAFT_TRIGGER_TIMER->CCMR2 & ~TIM_CCMR2_OC4M) | TIM_CCMR2_OC4M_2;
+}
+
+// ADC injected end of conversion
+void ecuISRangleADC(){
+	ADC_TypeDef *adc = (SENSOR_ADC)->Instance;
+	if ( (adc->SR & ADC_SR_JEOC) != 0 ) {
+		adc->SR = ~(ADC_SR_JEOC | ADC_SR_JSTRT);
+		stopAngleSampleTimer();
+		aqSampleComplete((uint16_t)adc->JDR1);
+	}
+}
+
+// sets up TIM2 channel 4 & the ADC injected trigger
+static void startAngleSampling(){
+	ADC_TypeDef *adc = (SENSOR_ADC)->Instance;
+
+	// channel 4 output compare, forced inactive, OC4REF as TRGO
+	CRANKSHAFT_TRIGGER_TIMER->CCMR2 = (CRANKSHAFT_TRIGGER_TIMER->CCMR2 & ~(TIM_CCMR2_CC4S | TIM_CCMR2_OC4M)) | TIM_CCMR2_OC4M_2;
+	CRANKSHAFT_TRIGGER_TIMER->CR2 = (CRANKSHAFT_TRIGGER_TIMER->CR2 & ~TIM_CR2_MMS) | TIM_CR2_MMS_2 | TIM_CR2_MMS_1 | TIM_CR2_MMS_0;
+
+	// one injected conversion, triggered by the rising edge of TIM2 TRGO, interrupt at the end of conversion
+	adc->JSQR = 0;
+	adc->CR2 = (adc->CR2 & ~(ADC_CR2_JEXTEN | ADC_CR2_JEXTSEL)) | ADC_CR2_JEXTEN_0 | ADC_CR2_JEXTSEL_1 | ADC_CR2_JEXTSEL_0 | ADC_CR2_ADON;
+	adc->SR = ~(ADC_SR_JEOC | ADC_SR_JSTRT);
+	adc->CR1 |= ADC_CR1_JEOCIE;
+	HAL_NVIC_EnableIRQ(ADC_IRQn);
+}
+
 
 /*
  *
@@ -521,8 +1254,21 @@ void ecuServicesStart(){
 		// start pwm timer for fan control
 	HAL_TIM_PWM_Start(&htim12,TIM_CHANNEL_1);
 
-	// Start input capture on timer 2, channel 1 for use by the crankshaft trigger pulse handler.
-	HAL_TIM_IC_Start_IT(&htim2, TIM_CHANNEL_1);
+	// enable the cycle counter, used to measure the CPU load of the crankshaft interrupts
+	CoreDebug->DEMCR |= CoreDebug_DEMCR_TRCENA_Msk;
+	DWT->CTRL |= DWT_CTRL_CYCCNTENA_Msk;
+
+	// the cycles to switch the injectors by HAL & by BSRR, reported by the output latency command
+	measureOutputSwitching();
+
+	// Start input capture on timer 2, channel 1 for use by the crankshaft trigger pulse handler, in the configured mode
+	startCrankshaftCapture(cfPage1.p3.twCaptureMode);
+
+	// Start input capture on timer 2, channel 2 for use by the camshaft pulse handler.
+	startCamshaftCapture();
+
+	// timer 2, channel 4 triggers the crank angle synchronous ADC samples
+	startAngleSampling();
 
 	// start the USARTs for host & aux comms
 	startUSARTServices();
@@ -530,6 +1276,11 @@ void ecuServicesStart(){
 	// Initialise timers used for injection & ignition timing
 	initialiseIgnInjTimers();
 
+	// outputs on timer channel pins switched by the timer compares, in the configured mode
+	if (cfPage1.p3.outputMode == OUTPUT_MODE_COMPARE) {
+		startOutputCompareMode();
+	}
+
 	// set the interrupt priorities for peripherals used
 	setInterruptPriorities();
 	
@@ -542,4 +1293,28 @@ void ecuServicesStart(){
 /*+++REVISION_HISTORY+++
 1) 04 Nov 2020 Replaces host & aux serial comms mechanics with the async_serial package.
 2) 12 May 2021 Modified for F401CC MCU
+3) 15 Oct 2026 Camshaft pulse captured on TIM2 channel 2 and passed to camshaftPulseHandler(). startCamshaftCapture() sets up
+   the channel & PB3 outside the CubeMX generated code.
+4) 15 Oct 2026 DMA crankshaft pulse capture mode added (Parameters 3 twCaptureMode). CPU load of the crankshaft interrupts measured
+   with the DWT cycle counter.
+5) 15 Oct 2026 Crankshaft stall timeout on TIM2 channel 3 compare, replaces the stall check in the VLF task.
+6) 15 Oct 2026 crankPulseLatency removed, the crankshaft pulse handler times the events from the captured pulse time.
+7) 15 Oct 2026 Crank angle synchronous ADC samples, ADC1 injected conversions triggered by TIM2 channel 4 compare.
+8) 15 Oct 2026 Output compare output mode (Parameters 3 outputMode), coils & injectors on timer channel pins switched by
+   TIM1 & TIM8 compares. Software edge & compare re-arm latency measured.
+9) 16 Oct 2026 Injection & ignition timed by the event queue on free running TIM5, replaces the one pulse timers & their ISRs.
+10) 16 Oct 2026 startInjectionTimer() & startIgnitionTimer() queue events for each injector & coil channel, the callbacks are passed
+   the channel. Replace startInjectionTimerA-D() & the single ignition timer.
+11) 16 Oct 2026 setIOPinMapping() precompiles the injector & coil groups' BSRR values. measureOutputSwitching() measures the
+   cycles to switch the injectors by HAL & by BSRR.
+12) 16 Oct 2026 Output edges at absolute 32 bit crankshaft trigger timer times with 32 bit pulse widths. Compare edges beyond
+   the 16 bit compare timers' range are set on the compare by an event queue event shortly before they're due.
+13) 16 Oct 2026 startDwellTimer() queues a dwell event for each coil channel. startCoilCompareDwell() sets a spark still to come
+   on the compare again, as the dwell can start after the spark's tooth.
+14) 16 Oct 2026 setInjectionEnd() moves the end of an injector channel's pulse that's still to start or is in flight, on the
+   event queue & on the compare (setInjectorCompareEnd(), from the pulse's 32 bit end time).
+15) 16 Oct 2026 In output compare mode the coil channels are active low for inverted coils (ignitionFiringSense <= 0).
+16) 16 Oct 2026 The crankshaft ISR cycle count is swapped out with interrupts disabled. In DMA capture mode the crankshaft interrupt
+   no longer waits for the DMA to transfer the capture, a pulse not yet in the buffer is decoded by the next interrupt.
+17) 16 Oct 2026 Output compare mode comment: the jitter of the two output modes hasn't been measured on the target.
 +++REVISION_HISTORY_ENDS+++*/
@@ -34,11 +34,12 @@ or FITNESS FOR A PARTICULAR PURPOSE.
  *
  */
 #define CRANKSHAFT_TRIGGER_TIMER	TIM2
-#define IGNITION_TIMER 				TIM8
-#define INJECTION_TIMER_A			TIM4
-#define INJECTION_TIMER_B			TIM5
-#define INJECTION_TIMER_C			TIM11
-#define INJECTION_TIMER_D			TIM13
+#define CAMSHAFT_TRIGGER_CCR		TIM2->CCR2
+#define CRANKSHAFT_STALL_CCR		TIM2->CCR3
+#define ANGLE_SAMPLE_CCR			TIM2->CCR4
+#define CRANKSHAFT_DMA_STREAM		DMA1_Stream5
+#define EVENT_QUEUE_TIMER			TIM5
+#define EVENT_QUEUE_CCR				TIM5->CCR1
 #define PWM_TIMER 					TIM3
 #define SENSOR_ADC &hadc1
 
@@ -48,14 +49,39 @@ or FITNESS FOR A PARTICULAR PURPOSE.
  *
  */
 extern void ecuISRTimerTick(void);
-extern void ecuISRIgnitionTimer(void);
-extern void ecuISRInjectionATimer(void);
-extern void ecuISRInjectionBTimer(void);
-extern void ecuISRInjectionCTimer(void);
-extern void ecuISRInjectionDTimer(void);
+extern void ecuISREventQueue(void);
 extern void ecuISRHostUART(void);
 extern void ecuISRAuxUART(void);
 extern void ecuISRcrankshaftTrigger(void);
+extern void ecuISRcrankshaftDMA(void);
+extern void ecuISRangleADC(void);
+extern void ecuISROutputCompare(void);
+
+
+/*
+ * Crankshaft pulse capture modes, selected by Parameters 3 twCaptureMode.
+ *
+ * CRANKSHAFT_CAPTURE_INTERRUPT - an interrupt for every crankshaft pulse (default)
+ * CRANKSHAFT_CAPTURE_DMA - pulse times are written to a circular buffer by DMA. The buffer is decoded when half full & full,
+ * and at the pulses that have injection or ignition events.
+ */
+#define CRANKSHAFT_CAPTURE_INTERRUPT	0
+#define CRANKSHAFT_CAPTURE_DMA			1
+
+#define CRANKSHAFT_CAPTURE_BUFFER_SIZE	64
+
+// CPU load (%) of the crankshaft & camshaft pulse interrupts, measured with the cycle counter. Updated by updateCrankshaftISRLoad().
+extern volatile float crankshaftISRLoad;
+extern void updateCrankshaftISRLoad(void);
+
+// crankshaft stall timeout, the compare is at the pulse time + timeout (uS)
+extern void startCrankshaftStallTimer(uint32_t pulseTime, uint32_t timeout);
+
+// number of stalls detected, and for the last stall, the time from the last pulse to the stall handler completing (uS) and the
+// cycles from the timeout interrupt entry to the stall handler completing. The stall handler cuts the outputs first.
+extern volatile uint32_t crankshaftStalls;
+extern volatile uint32_t crankshaftStallLatency;
+extern volatile uint32_t crankshaftStallCycles;
 
 
 // set host & aux serial data rate
@@ -68,22 +94,83 @@ extern void ecuISRcrankshaftTrigger(void);
 extern void setDutyCyclePWM1(float dc);
 extern void setDutyCyclePWM2(float dc);
 
-// injector & ignition pin mapping
+// injector & ignition pin mapping, the outputs are referenced by channel number (the array index)
+#define INJECTOR_OUTPUTS 4
+#define COIL_OUTPUTS 4
+
 typedef struct {
 	GPIO_TypeDef *port;
 	uint16_t pin;
 } GPIOPin;
 extern void setIOPinMapping(void);
-extern GPIOPin injectorIO[4];
-extern GPIOPin coilIO[4];
+extern GPIOPin injectorIO[INJECTOR_OUTPUTS];
+extern GPIOPin coilIO[COIL_OUTPUTS];
 
-// three 16 bit timers are allocated to injection & ignition timing,
-// configured at 1uS resolution (1Mhz timer clock), in single pulse, count-up mode
-extern void startInjectionTimerA(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)());
-extern void startInjectionTimerB(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)());
-extern void startInjectionTimerC(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)());
-extern void startInjectionTimerD(uint16_t delay1, uint16_t delay2, void (*callback1)(), void (*callback2)());
-extern void startIgnitionTimer(uint16_t period, void (*callback)());
+// a group of outputs switched together, the pins of the group on each port are precompiled into the port's BSRR set & reset
+// values by setIOPinMapping()
+#define IO_GROUP_MAX_PORTS 4
+
+typedef struct {
+	int ports;
+	GPIO_TypeDef *port[IO_GROUP_MAX_PORTS];
+	uint32_t set[IO_GROUP_MAX_PORTS];
+	uint32_t reset[IO_GROUP_MAX_PORTS];
+} GPIOGroup;
+
+// all the injectors & all the coils
+extern GPIOGroup injectorGroup;
+extern GPIOGroup coilGroup;
+
+// switches an output with a single BSRR store. Used by the output interrupts in place of HAL_GPIO_WritePin().
+static inline void ioWritePin(const GPIOPin *io, GPIO_PinState state) {
+	io->port->BSRR = state != GPIO_PIN_RESET ? (uint32_t)io->pin : (uint32_t)io->pin << 16;
+}
+
+// switches every output in the group, one BSRR store per port. The stores aren't split by an interrupt, & the outputs on one
+// port switch together.
+static inline void ioWriteGroup(const GPIOGroup *group, GPIO_PinState state) {
+	const uint32_t *bsrr = state != GPIO_PIN_RESET ? group->set : group->reset;
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+	for (int i = 0; i < group->ports; i++) {
+		group->port[i]->BSRR = bsrr[i];
+	}
+	__set_PRIMASK(primask);
+}
+
+// CPU cycles to switch all the injectors off by HAL_GPIO_WritePin() & by ioWriteGroup(), measured at initialisation
+extern uint32_t ioCyclesHAL;
+extern uint32_t ioCyclesBSRR;
+
+// injection & ignition timing for each injector & coil channel, by events queued on the event queue timer at 1uS resolution
+// (1Mhz timer clock). The callbacks are passed the channel. Times are absolute crankshaft trigger timer times (uS, as
+// crankPulseTime), up to 2^31 uS ahead. A time that has passed is due at once.
+extern void startInjectionTimer(int channel, uint32_t time, uint32_t width, void (*callback1)(int), void (*callback2)(int));
+extern int setInjectionEnd(int channel, uint32_t time);
+extern void startDwellTimer(int channel, uint32_t time, void (*callback)(int));
+extern void startIgnitionTimer(int channel, uint32_t time, void (*callback)(int));
+extern void stopIgnInjTimers(void);
+
+/*
+ * Output modes, selected by Parameters 3 outputMode.
+ *
+ * OUTPUT_MODE_SOFTWARE - the outputs are switched by GPIO writes from the event queue interrupt (default)
+ * OUTPUT_MODE_COMPARE - the outputs on timer channel pins are switched by TIM1 & TIM8 output compares. See ecu_services.c.
+ *
+ */
+#define OUTPUT_MODE_SOFTWARE	0
+#define OUTPUT_MODE_COMPARE		1
+
+extern int outputMode;
+extern void startInjectorCompare(int injector, uint32_t time, uint32_t width);
+extern void startInjectorCompareAll(uint32_t time, uint32_t width);
+extern void startCoilCompareDwell(int coil);
+extern void startCoilCompareSpark(int coil, uint32_t time);
+extern void stopOutputCompares(void);
+
+// compare re-arm latency statistics (uS), the software edge latency is the event queue's. resetOutputLatency() resets both.
+extern volatile uint32_t outputRearmLatencyMax;
+extern void resetOutputLatency(void);
 
 extern void hostPrint(char *txBuffer, int strLen);
 extern void auxPrint(char *txBuffer, int strLen);
@@ -113,6 +200,10 @@ extern asseControlData auxIO;
 // analog raw data store
 extern uint16_t adcRawData[7];
 
+// crank angle synchronous ADC sample trigger, TIM2 channel 4
+extern void startAngleSampleTimer(uint32_t time, int adcIndex);
+extern void stopAngleSampleTimer(void);
+
 // analogue services
 extern int startADCConversion(void);
 extern int waitForADCCompletion(void);
@@ -129,4 +220,17 @@ extern void ecuServicesStart(void);
 
 /*+++REVISION_HISTORY+++
 1)	04 Nov 2020	Replaces host & aux serial comms mechanics with the async_serial package.
+2)	15 Oct 2026	CAMSHAFT_TRIGGER_CCR added, the camshaft pulse is captured on TIM2 channel 2.
+3)	15 Oct 2026	DMA crankshaft pulse capture mode & crankshaft interrupt CPU load measurement added.
+4)	15 Oct 2026	CRANKSHAFT_STALL_CCR & the crankshaft stall timeout added.
+5)	15 Oct 2026	ANGLE_SAMPLE_CCR & the crank angle synchronous ADC sample trigger added.
+6)	15 Oct 2026	Output compare output mode & the output latency statistics added.
+7)	16 Oct 2026	EVENT_QUEUE_TIMER replaces the ignition & injection timers & their ISRs.
+8)	16 Oct 2026	startInjectionTimer() & startIgnitionTimer() take the output channel, replace startInjectionTimerA-D().
+				INJECTOR_OUTPUTS & COIL_OUTPUTS added.
+9)	16 Oct 2026	ioWritePin() & ioWriteGroup() switch the outputs by BSRR stores, injectorGroup & coilGroup added.
+10)	16 Oct 2026	Injection, ignition & compare output timing take absolute 32 bit times & pulse widths.
+11)	16 Oct 2026	startDwellTimer() added, times the start of dwell of each coil channel.
+12)	16 Oct 2026	setInjectionEnd() added, moves the end of an injector channel's armed or in-flight pulse.
+13)	16 Oct 2026	ioWriteGroup() comment no longer gives the skew between the ports' stores in cycles, it hasn't been measured.
 +++REVISION_HISTORY_ENDS+++*/
@@ -0,0 +1,247 @@
+/*
+ *
+ * Event queue.
+ *
+ * Schedules callbacks at absolute times on the free running 32 bit event queue timer (TIM5, 1 MHz), so any number of injector,
+ * coil & auxiliary events share one timer rather than each output having its own one shot timer.
+ *
+ * The queued events are held in a binary min-heap ordered by due time, so the next event is always at the top: arming the
+ * compare is a single register write, and queueing, moving or cancelling an event is O(log n). The events are owned by the
+ * caller & hold their position in the heap, so an event can be moved (e.g. to extend a pulse) or cancelled without a search.
+ * Times are compared as signed differences, so the order is correct across the counter wrap for events up to 2^31 uS ahead.
+ *
+ * Channel 1 compare is set to the time of the top event. eqService() is called from the timer interrupt, runs the callbacks of
+ * the events that are due, in time order, then re-arms the compare. If the next event is due by the time the compare is set,
+ * the compare event is generated by software, so it's never missed.
+ *
+ * Events are queued from the crankshaft pulse handler, the event queue interrupt itself & the background. The heap is only
+ * changed with the interrupts disabled, for a bounded time (a heap of EQ_MAX_EVENTS is at most 5 levels deep). The callbacks
+ * run with the interrupts enabled.
+ *
+ * Each output channel owns its events & queues each at most once, so the outputs can't queue more than 24 events (2 injection,
+ * 1 compare re-arm per injector, dwell, spark & compare re-arm per coil), within EQ_MAX_EVENTS. On the host benchmark
+ * (test_code/event_queue_bench.c), 8 cylinders at 8000 RPM queue at most 7 at once (3 injection pulses a cycle, compare mode) at
+ * 2500 events a second, without an overflow. The latency on the target hasn't been measured.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "event_queue.h"
+#include "ecu_services.h"
+
+
+// the latency mean filter time constant is 2^EQ_MEAN_SHIFT events
+#define EQ_MEAN_SHIFT 4
+
+volatile uint32_t eqEvents = 0;
+volatile uint32_t eqLatencyMean = 0;
+volatile uint32_t eqLatencyMax = 0;
+volatile uint32_t eqDepthMax = 0;
+volatile uint32_t eqISRCyclesMax = 0;
+volatile uint32_t eqOverflows = 0;
+static uint32_t eqLatencyMeanAcc = 0;
+
+static eqEvent *eqHeap[EQ_MAX_EVENTS];
+static int eqDepth = 0;
+
+
+// non-zero if event a is due before event b
+static inline int eqBefore(eqEvent *a, eqEvent *b) {
+	return (int32_t)(a->time - b->time) < 0;
+}
+
+
+static inline void eqPlace(eqEvent *event, int index) {
+	eqHeap[index] = event;
+	event->index = index;
+}
+
+
+// moves the event at the index up or down the heap to its place
+static void eqSift(int index) {
+
+	eqEvent *event = eqHeap[index];
+
+	// up
+	while (index > 0) {
+		int parent = (index - 1) >> 1;
+		if (eqBefore(event, eqHeap[parent]) == 0) {
+			break;
+		}
+		eqPlace(eqHeap[parent], index);
+		index = parent;
+	}
+
+	// down
+	for (;;) {
+		int child = 2 * index + 1;
+		if (child >= eqDepth) {
+			break;
+		}
+		if ( (child + 1 < eqDepth) && (eqBefore(eqHeap[child + 1], eqHeap[child]) != 0) ) {
+			child++;
+		}
+		if (eqBefore(eqHeap[child], event) == 0) {
+			break;
+		}
+		eqPlace(eqHeap[child], index);
+		index = child;
+	}
+
+	eqPlace(event, index);
+}
+
+
+static void eqRemove(eqEvent *event) {
+	int index = event->index;
+	event->index = EQ_NOT_QUEUED;
+	if (--eqDepth > index) {
+		eqHeap[index] = eqHeap[eqDepth];
+		eqSift(index);
+	}
+}
+
+
+// sets the compare to the time of the next event. Called with the interrupts disabled.
+static void eqArm(void) {
+	if (eqDepth == 0) {
+		EVENT_QUEUE_TIMER->DIER &= ~TIM_DIER_CC1IE;
+		return;
+	}
+	EVENT_QUEUE_CCR = eqHeap[0]->time;
+	EVENT_QUEUE_TIMER->DIER |= TIM_DIER_CC1IE;
+	if ((int32_t)(EVENT_QUEUE_TIMER->CNT - eqHeap[0]->time) >= 0) {
+		// already due, the compare may have been passed
+		EVENT_QUEUE_TIMER->EGR = TIM_EGR_CC1G;
+	}
+}
+
+
+uint32_t eqNow() {
+	return EVENT_QUEUE_TIMER->CNT;
+}
+
+
+int eqSchedule(eqEvent *event, uint32_t time, eqCallback callback, int arg) {
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	event->time = time;
+	event->callback = callback;
+	event->arg = arg;
+
+	if (event->index == EQ_NOT_QUEUED) {
+		if (eqDepth >= EQ_MAX_EVENTS) {
+			eqOverflows++;
+			__set_PRIMASK(primask);
+			return 0;
+		}
+		eqPlace(event, eqDepth++);
+		if ((uint32_t)eqDepth > eqDepthMax) {
+			eqDepthMax = eqDepth;
+		}
+	}
+	eqSift(event->index);
+
+	if (eqHeap[0] == event) {
+		eqArm();
+	}
+
+	__set_PRIMASK(primask);
+	return 1;
+}
+
+
+void eqCancel(eqEvent *event) {
+
+	uint32_t primask = __get_PRIMASK();
+	__disable_irq();
+
+	if (event->index != EQ_NOT_QUEUED) {
+		int top = event->index == 0;
+		eqRemove(event);
+		if (top != 0) {
+			eqArm();
+		}
+	}
+
+	__set_PRIMASK(primask);
+}
+
+
+int eqPending(eqEvent *event) {
+	return event->index != EQ_NOT_QUEUED;
+}
+
+
+void eqService() {
+
+	uint32_t cyclesStart = DWT->CYCCNT;
+
+	EVENT_QUEUE_TIMER->SR = ~TIM_SR_CC1IF;
+
+	for (;;) {
+
+		__disable_irq();
+
+		eqEvent *event = eqDepth > 0 ? eqHeap[0] : NULL;
+		uint32_t now = EVENT_QUEUE_TIMER->CNT;
+		if ( (event == NULL) || ((int32_t)(now - event->time) < 0) ) {
+			eqArm();
+			__enable_irq();
+			break;
+		}
+		eqRemove(event);
+		eqCallback callback = event->callback;
+		int arg = event->arg;
+
+		__enable_irq();
+
+		uint32_t latency = now - event->time;
+		eqLatencyMeanAcc += latency - (eqLatencyMeanAcc >> EQ_MEAN_SHIFT);
+		eqLatencyMean = eqLatencyMeanAcc >> EQ_MEAN_SHIFT;
+		if (latency > eqLatencyMax) {
+			eqLatencyMax = latency;
+		}
+		eqEvents++;
+
+		if (callback != NULL) {
+			callback(arg);
+		}
+	}
+
+	uint32_t cycles = DWT->CYCCNT - cyclesStart;
+	if (cycles > eqISRCyclesMax) {
+		eqISRCyclesMax = cycles;
+	}
+}
+
+
+void eqResetStatistics() {
+	eqEvents = 0;
+	eqLatencyMean = 0;
+	eqLatencyMeanAcc = 0;
+	eqLatencyMax = 0;
+	eqDepthMax = eqDepth;
+	eqISRCyclesMax = 0;
+	eqOverflows = 0;
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 16 Oct 2026 First version.
+2) 16 Oct 2026 Queue depth from the host benchmark (test_code/event_queue_bench.c) added to the description.
++++REVISION_HISTORY_ENDS+++*/
@@ -0,0 +1,67 @@
+#ifndef _eventQueue
+#define _eventQueue
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <stdint.h>
+
+
+// maximum number of events queued at once
+#define EQ_MAX_EVENTS 32
+
+// the index of an event that isn't queued
+#define EQ_NOT_QUEUED -1
+
+// called when the event is due, with the event's argument
+typedef void (*eqCallback)(int arg);
+
+// an event, owned by the caller. Set index to EQ_NOT_QUEUED (or use EQ_EVENT_INIT) before it's first scheduled.
+typedef struct {
+	uint32_t time;						// the time the event is due (event queue timer, uS)
+	eqCallback callback;
+	int arg;
+	int index;							// position in the queue, EQ_NOT_QUEUED if not queued
+} eqEvent;
+
+#define EQ_EVENT_INIT { 0, 0, 0, EQ_NOT_QUEUED }
+
+// statistics: events run, the mean & maximum latency from the due time to the callback (uS), the most events queued at once,
+// the most cycles spent in one interrupt & the number of events that couldn't be queued
+extern volatile uint32_t eqEvents;
+extern volatile uint32_t eqLatencyMean;
+extern volatile uint32_t eqLatencyMax;
+extern volatile uint32_t eqDepthMax;
+extern volatile uint32_t eqISRCyclesMax;
+extern volatile uint32_t eqOverflows;
+
+// returns the time now (event queue timer, uS)
+extern uint32_t eqNow(void);
+
+// queues the event to call the callback at the time (uS), or moves it if it's already queued. Returns 0 if the queue is full.
+// Times up to 2^31 uS ahead are ordered correctly, a time that has passed is due at once.
+extern int eqSchedule(eqEvent *event, uint32_t time, eqCallback callback, int arg);
+
+// removes the event from the queue, if it's queued
+extern void eqCancel(eqEvent *event);
+
+// non-zero if the event is queued
+extern int eqPending(eqEvent *event);
+
+// runs the events that are due & arms the compare for the next. Called from the event queue timer interrupt.
+extern void eqService(void);
+
+extern void eqResetStatistics(void);
+
+#endif
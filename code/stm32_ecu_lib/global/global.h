@@ -291,6 +291,17 @@ typedef struct {
   float AFRIndex;				//24 - The map cell for which AFRCorrection, lambdaAverageVoltage & lambdaVoltageSamples applies, encoded as defined below
   float correctionSavedTime;	//25 - The number of times the AFR correction array was saved
   float lambdaVoltageSamples;	//26 - The number of samples of lambda voltage in each cell
+  float revolutionRPM;			//27 - RPM from the time for the last complete crankshaft revolution
+  float crankAcceleration;		//28 - Crankshaft acceleration (RPM / second) from the last two 180 degree segments
+  float segmentRPM1;			//29 - RPM over each 180 degree segment of the engine cycle.
+  float segmentRPM2;			//30   Segment 1 starts at TDC in engine revolution 0.
+  float segmentRPM3;			//31
+  float segmentRPM4;			//32
+  float misfireCount1;			//33 - Number of misfires detected for the first four cylinders in firing order
+  float misfireCount2;			//34
+  float misfireCount3;			//35
+  float misfireCount4;			//36
+  float rejectedPulses;			//37 - Number of crankshaft pulses rejected as noise by the trigger decoder's acceptance window
 } keyDataStruct;
 
 /*
@@ -300,7 +311,7 @@ typedef struct {
 
 
 // number of items in the key data structure
-#define KEY_DATA_STRUCT_SIZE 27
+#define KEY_DATA_STRUCT_SIZE 38
 
 // allows key data to be accessed as an array or as individual named items
 typedef union {
@@ -341,7 +352,8 @@ typedef enum {
 	IDLE_SWITCH_ON 			= 0x00001000,
 	COOLING_FAN_ON 			= 0x00002000,
 	AFR_ACTIVE_CONTROL		= 0x00004000,
-	INVALID_CONFIG			= 0x00008000
+	INVALID_CONFIG			= 0x00008000,
+	MISFIRE_DETECTED		= 0x00010000		// set by misfire.c when a misfire is detected, cleared after 1 second without misfires
 
 } ecuStatusEnum;
 
@@ -368,6 +380,9 @@ typedef enum {
 #define SET_COOLING_FAN_ON				STAT |= COOLING_FAN_ON
 #define CLEAR_COOLING_FAN_ON			STAT &= ~COOLING_FAN_ON
 
+#define SET_MISFIRE_DETECTED			STAT |= MISFIRE_DETECTED
+#define CLEAR_MISFIRE_DETECTED			STAT &= ~MISFIRE_DETECTED
+
 
 
 #define TRUE 1
@@ -0,0 +1,352 @@
+/*
+ *
+ * Misfire detector.
+ *
+ * A misfire is detected from the crankshaft slowing down over the power stroke of the misfiring cylinder. The crankshaft pulse
+ * handler times each cylinder's segment of the engine cycle, from its TDC to the next cylinder's TDC in the firing table
+ * (720 / twCylinders degrees for an even firing engine), and queues the segment times numbered in firing order. mfUpdate(),
+ * called from the HF task, reads the queue so the detection runs outside the crankshaft interrupt & uses integer arithmetic only.
+ *
+ * The 180 degree power stroke covers k = twCylinders / 4 segments (at least 1), from the cylinder's TDC. As the segment times
+ * are average speeds, the speed lost in a misfiring cylinder's power stroke is seen as a longer segment time in the segments
+ * around it. The cylinder's slowdown is the change in the time of its power stroke, the k segments from its TDC, from the k
+ * segments ending 2 segments before, relative to the power stroke time:
+ *
+ * 		slowdown = (S(n) - S(n-2)) / S(n)			S(n) = T(n) + ... + T(n-k+1), held as a fixed point value, MF_Q
+ * 													fractional bits, for cylinder n-k+1
+ *
+ * i.e. the negative of the crankshaft acceleration, normalised to the speed. With overlapping power strokes (more than 7
+ * cylinders) the whole stroke is timed, as a misfire's slowdown is too small for a single segment at part load. Each cylinder
+ * has a rolling baseline slowdown & a rolling mean absolute deviation (noise), both 1st order filters, the noise filter with
+ * the longer time constant. The baselines absorb differences between the segments that don't depend on combustion, e.g.
+ * different segment angles when the tooth at a TDC is missing, or an odd firing engine.
+ *
+ * A cylinder is a misfire candidate if its deviation from the baseline exceeds both the threshold (cfPage1.p3.mfThreshold, in
+ * 0.1% units of segment time, i.e. 1 / k of it relative to the power stroke) and MF_NOISE_FACTOR x the noise. Part of the lost
+ * speed is also seen by the neighbouring cylinders' slowdowns, so a larger deviation within the next k segments moves the
+ * candidate on. The cylinders after the misfire fire normally, so the crankshaft stops slowing down: the candidate is only
+ * counted as a misfire if the deviation MF_DECISION_SEGMENT segments after its power stroke is less than half the candidate's
+ * deviation, and the deviations from 2 segments before to 2 segments after it add up to no more than MF_WINDOW_LIMIT x its
+ * deviation. With overlapping power strokes a misfire's deviations are spread over about 4 segments (mfProfile), so the
+ * misfire is counted against the candidate or its neighbour whose deviations best fit the profile, & only if the deviations
+ * either side of it aren't from another misfire. Otherwise the crankshaft is still slowing down (e.g. after the throttle is
+ * closed) or the lost speed is spread over more than one cylinder (e.g. misfires in neighbouring cylinders, which can't be
+ * told apart), and no new candidate is taken until the deviations have fallen back below the candidate limits.
+ * Misfire candidates & the segments following them up to the decision are not used to update the baselines.
+ *
+ * Detection is suspended until each cylinder's baseline & noise have been learned from MF_LEARN_SEGMENTS segments, and restarts
+ * when segment timing restarts (lost sync or change of phase) or below MF_MINIMUM_RPM. Without a camshaft pulse, the cylinders
+ * are only identified to within 360 degrees. Up to MF_CYLINDERS cylinders are counted, keyData shows the first four.
+ *
+ * Operating limits, from the host replay (test_code/misfire_replay.c), which has no false or wrong cylinder counts in any case:
+ *
+ * 		- A misfire is only seen if its slowdown exceeds the threshold (0.5% of segment time by default) & the noise. With 3 to
+ * 		8 cylinders at idle & low RPM, 3000 RPM part load, and with 4 cylinders at 6000 RPM full load, over 85% of misfires are
+ * 		detected & over 99% of isolated misfires. The slowdown falls with the combustion work per cylinder & with RPM, so the
+ * 		margin is least with 8 cylinders at 3000 RPM part load (86%), and detection is nil at 6000 RPM light load.
+ * 		- Rapid load changes raise the noise, so few misfires are detected while the load steps.
+ * 		- Misfires within about 2 power strokes of each other aren't counted (the cluster & decision tests).
+ * 		- Weak combustion beyond about MF_NOISE_FACTOR standard deviations of the cycle to cycle variation is counted as a
+ * 		misfire; the replay sees up to 2 in 200000 segments with other random seeds.
+ *
+ * The time taken by mfUpdate() is measured with the DWT cycle counter.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "misfire.h"
+#include "global.h"
+#include "cfg_data.h"
+#include "trigger_wheel_handler.h"
+#include "utility_functions.h"
+#include "string.h"
+
+
+// fractional bits of the slowdown
+#define MF_Q 14
+
+// the baseline filter time constant is 2^MF_FILTER_SHIFT segments (of each cylinder), the noise filter's 2^MF_NOISE_SHIFT
+#define MF_FILTER_SHIFT 3
+#define MF_NOISE_SHIFT 6
+
+// segments of each cylinder used to learn the baseline & noise before detection starts, 2 noise filter time constants
+#define MF_LEARN_SEGMENTS (2 << MF_NOISE_SHIFT)
+
+// the deviation must exceed this multiple of the noise
+#define MF_NOISE_FACTOR 6
+
+// detection is suspended below this RPM, i.e. above this segment time (uS)
+#define MF_MINIMUM_RPM 500
+#define MF_MAX_SEGMENT_TIME ((uint32_t)(120000000 / (MF_MINIMUM_RPM * twCylinders)))
+
+// the misfire decision is made at this segment after the candidate, plus the segments of a power stroke after the first
+#define MF_DECISION_SEGMENT 2
+
+// the most segments in a power stroke
+#define MF_STROKE_SEGMENTS ((MF_CYLINDERS + 3) / 4)
+
+// the segment times held, a power stroke & one segment before it
+#define MF_TIMES (MF_STROKE_SEGMENTS + 1)
+
+// deviations held for the misfire decision, must be a power of 2 & at least MF_DECISION_SEGMENT + MF_STROKE_SEGMENTS + 4
+// (from 4 segments before the candidate to the decision)
+#define MF_DEVIATIONS 8
+
+// the deviations from 2 segments before to 2 segments after a misfire add up to at most this multiple of its deviation
+// (about 2 for a single misfire, 4 for two misfires a cylinder apart)
+#define MF_WINDOW_LIMIT 3
+
+// with power strokes over more than one segment, the deviations of a misfire from 2 segments before it to 1 after have about
+// this profile (see misfire_replay.c), used to find the misfiring cylinder among the candidate & its neighbours
+static const int32_t mfProfile[4] = { 1, 3, 5, 2 };
+
+// no misfire candidate
+#define MF_NONE -1
+
+// per-cylinder state
+static int32_t mfBaselineAcc[MF_CYLINDERS];			// baseline slowdown x 2^MF_FILTER_SHIFT
+static int32_t mfNoiseAcc[MF_CYLINDERS];			// mean absolute deviation x 2^MF_NOISE_SHIFT
+static int mfLearnCount[MF_CYLINDERS];
+volatile uint32_t mfMisfireCount[MF_CYLINDERS];
+
+// detector state, the last segment times & their cylinders, oldest first
+static uint32_t mfTime[MF_TIMES];
+static int mfTimeCylinder[MF_TIMES];
+static int mfTimes = 0;								// the number of segment times available
+static int mfCandidate = MF_NONE;					// the cylinder with a misfire candidate
+static int32_t mfCandidateDeviation = 0;			// ...its deviation from the baseline
+static int mfCandidateAge = 0;						// ...and the number of segments since the candidate
+static uint32_t mfCandidateIndex = 0;				// ...and its index in mfDeviation
+static int32_t mfDeviation[MF_DEVIATIONS];			// the last deviations, indexed by mfDeviationIndex
+static uint32_t mfDeviationIndex = 0;
+static int mfHoldoff = 0;							// set while the crankshaft is still slowing down after a candidate
+static volatile int mfMisfireFlag = 0;				// set when a misfire is detected, cleared by mfUpdateStatus()
+
+// CPU load
+static volatile uint32_t mfCycles = 0;
+volatile float mfLoad = 0;
+volatile uint32_t mfMaxCycles = 0;
+
+
+// the deviation at an index in mfDeviation
+static inline int32_t mfDeviationAt(uint32_t index) {
+	return mfDeviation[index & (MF_DEVIATIONS - 1)];
+}
+
+
+// processes one segment
+static void mfProcessSegment(int cylinder, uint32_t time) {
+
+	if ( (cylinder < 0) || (cylinder >= twCylinders) || (cylinder >= MF_CYLINDERS) || (time == 0) || (time > MF_MAX_SEGMENT_TIME) ) {
+		// start again from the next segment
+		mfTimes = 0;
+		mfCandidate = MF_NONE;
+		mfHoldoff = 0;
+		memset(mfDeviation, 0, sizeof(mfDeviation));
+		return;
+	}
+
+	// the segments in a power stroke
+	int k = limitI(twCylinders / 4, 1, MF_STROKE_SEGMENTS);
+	if (mfTimes < k + 1) {
+		mfTime[mfTimes] = time;
+		mfTimeCylinder[mfTimes] = cylinder;
+		mfTimes++;
+		return;
+	}
+
+	// the time of the power stroke ending with this segment & of the power stroke 2 segments before, for the cylinder of the
+	// power stroke's first segment
+	uint32_t stroke = time;
+	uint32_t strokeBefore = mfTime[0];
+	for (int i = 1; i < k; i++) {
+		stroke += mfTime[i + 1];
+		strokeBefore += mfTime[i];
+	}
+	int strokeCylinder = mfTimeCylinder[1];
+	for (int i = 1; i <= k; i++) {
+		mfTime[i - 1] = mfTime[i];
+		mfTimeCylinder[i - 1] = mfTimeCylinder[i];
+	}
+	mfTime[k] = time;
+	mfTimeCylinder[k] = cylinder;
+
+	// power strokes are up to 2^17 uS (a cylinder at MF_MINIMUM_RPM), so the shift is 64 bit
+	int32_t slowdown = limitI((int32_t)((((int64_t)stroke - (int64_t)strokeBefore) << MF_Q) / (int64_t)stroke), -(1 << MF_Q),
+			1 << MF_Q);
+	int32_t deviation = slowdown - (mfBaselineAcc[strokeCylinder] >> MF_FILTER_SHIFT);
+	int32_t noise = mfNoiseAcc[strokeCylinder] >> MF_NOISE_SHIFT;
+	// the threshold is in segment time, the slowdown relative to the power stroke time
+	int32_t threshold = ((int32_t)cfPage1.p3.mfThreshold << MF_Q) / (1000 * k);
+	mfDeviation[++mfDeviationIndex & (MF_DEVIATIONS - 1)] = deviation;
+
+	if (mfCandidate != MF_NONE) {
+		++mfCandidateAge;
+		if ( (mfCandidateAge <= k) && (deviation > mfCandidateDeviation) ) {
+			// the neighbouring cylinder has the larger share of the lost speed
+			mfCandidate = strokeCylinder;
+			mfCandidateDeviation = deviation;
+			mfCandidateAge = 0;
+			mfCandidateIndex = mfDeviationIndex;
+		}
+		// the candidate was a misfire if the crankshaft has stopped slowing down by the MF_DECISION_SEGMENT'th segment after
+		// the power stroke, & the deviations around it are from a single misfire
+		else if (mfCandidateAge >= MF_DECISION_SEGMENT + k - 1) {
+			int32_t window = 0;
+			for (int i = -2; i <= 2; i++) {
+				window += mfDeviationAt(mfCandidateIndex + i);
+			}
+			int single = (deviation < mfCandidateDeviation / 2) && (window <= MF_WINDOW_LIMIT * mfCandidateDeviation);
+
+			// with overlapping power strokes, the misfire is the candidate or a neighbour, whichever deviations best fit the
+			// profile. Its deviation 3 segments before must be no more than half its own, & its neighbours' add up to no more
+			// than 1.5 x its own, otherwise it's more than one misfire, e.g. two misfires 2 cylinders apart look like one
+			// between them
+			int offset = 0;
+			if (k > 1) {
+				static const int neighbours[3] = { 0, -1, 1 };
+				int32_t best = 0;
+				for (int n = 0; n < 3; n++) {
+					int32_t fit = 0;
+					for (int i = 0; i < 4; i++) {
+						fit += mfProfile[i] * mfDeviationAt(mfCandidateIndex + neighbours[n] + i - 2);
+					}
+					if ( (n == 0) || (fit > best) ) {
+						best = fit;
+						offset = neighbours[n];
+					}
+				}
+				uint32_t misfireIndex = mfCandidateIndex + offset;
+				int32_t misfireDeviation = mfDeviationAt(misfireIndex);
+				single = single && (2 * mfDeviationAt(misfireIndex - 3) <= misfireDeviation)
+						&& (2 * (mfDeviationAt(misfireIndex - 1) + mfDeviationAt(misfireIndex + 1)) <= 3 * misfireDeviation);
+			}
+
+			if (single != 0) {
+				mfMisfireCount[(mfCandidate + offset + twCylinders) % twCylinders]++;
+				mfMisfireFlag = 1;
+			}
+			else {
+				mfHoldoff = 1;
+			}
+			mfCandidate = MF_NONE;
+		}
+		// segments following the candidate are affected by it, so aren't used for the baseline
+		return;
+	}
+
+	int candidate = (mfLearnCount[strokeCylinder] >= MF_LEARN_SEGMENTS) && (threshold > 0) && (deviation > threshold)
+			&& (deviation > MF_NOISE_FACTOR * noise);
+
+	if (mfHoldoff != 0) {
+		// no new candidate or baseline update until the deviations have fallen back
+		mfHoldoff = candidate;
+		return;
+	}
+
+	if (candidate != 0) {
+		mfCandidate = strokeCylinder;
+		mfCandidateDeviation = deviation;
+		mfCandidateAge = 0;
+		mfCandidateIndex = mfDeviationIndex;
+		return;
+	}
+
+	// update the baseline & noise
+	mfBaselineAcc[strokeCylinder] += slowdown - (mfBaselineAcc[strokeCylinder] >> MF_FILTER_SHIFT);
+	mfNoiseAcc[strokeCylinder] += (deviation < 0 ? -deviation : deviation) - noise;
+	if (mfLearnCount[strokeCylinder] < MF_LEARN_SEGMENTS) {
+		mfLearnCount[strokeCylinder]++;
+	}
+}
+
+
+// processes the completed segments
+void mfUpdate() {
+
+	uint32_t cyclesStart = DWT->CYCCNT;
+	int segment;
+	uint32_t time;
+
+	while (twReadSegment(&segment, &time) != 0) {
+		if (segment == TW_SEGMENT_RESTART) {
+			// the baselines are kept, only the previous segment time is lost
+			mfProcessSegment(MF_NONE, 0);
+		}
+		else {
+			mfProcessSegment(segment, time);
+		}
+	}
+
+	keyData.v.misfireCount1 = (float)mfMisfireCount[0];
+	keyData.v.misfireCount2 = (float)mfMisfireCount[1];
+	keyData.v.misfireCount3 = (float)mfMisfireCount[2];
+	keyData.v.misfireCount4 = (float)mfMisfireCount[3];
+	if (mfMisfireFlag != 0) {
+		SET_MISFIRE_DETECTED;
+	}
+
+	uint32_t cycles = DWT->CYCCNT - cyclesStart;
+	mfCycles += cycles;
+	if (cycles > mfMaxCycles) {
+		mfMaxCycles = cycles;
+	}
+}
+
+
+// clears the misfire flag if there were no misfires since the last call & calculates the CPU load
+void mfUpdateStatus() {
+
+	static uint32_t cyclesN_1 = 0;
+
+	if (mfMisfireFlag == 0) {
+		CLEAR_MISFIRE_DETECTED;
+	}
+	mfMisfireFlag = 0;
+
+	uint32_t cyclesNow = DWT->CYCCNT;
+	uint32_t cycles = mfCycles;
+	mfCycles = 0;
+	mfLoad = cyclesNow != cyclesN_1 ? 100.0F * (float)cycles / (float)(cyclesNow - cyclesN_1) : 0.0F;
+	cyclesN_1 = cyclesNow;
+}
+
+
+// resets the detector
+void mfInitialise() {
+	memset(mfBaselineAcc, 0, sizeof(mfBaselineAcc));
+	memset(mfNoiseAcc, 0, sizeof(mfNoiseAcc));
+	memset(mfLearnCount, 0, sizeof(mfLearnCount));
+	mfTimes = 0;
+	mfCandidate = MF_NONE;
+	mfHoldoff = 0;
+	memset(mfDeviation, 0, sizeof(mfDeviation));
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 15 Oct 2026 First version.
+2) 16 Oct 2026 Cylinder segments from the firing table (twCylinders, up to MF_CYLINDERS) in place of four 180 degree segments.
+   Each cylinder's slowdown is measured from the segment before its TDC to the segment after its power stroke, so power strokes
+   spanning more than one segment (more than 4 cylinders) are measured whole.
+3) 16 Oct 2026 Slowdown over 1 segment with 8 cylinders, so neighbouring misfires aren't counted against the cylinder between
+   them. Misfires counted only if the deviations around the candidate are from a single misfire, with a hold off after a
+   rejected candidate. Longer noise filter, noise factor 7 & learning period of 2 noise time constants, so the noise has
+   settled before detection starts. Operating limits documented.
+4) 16 Oct 2026 Slowdown of the whole power stroke (k segments), threshold in segment time & 14 fractional bits, so 8 cylinders
+   are detected at 3000 RPM part load. With overlapping power strokes, the misfire is counted against the cylinder whose
+   deviations best fit a single misfire's profile, and not at all if its neighbours' deviations are from another misfire.
+   Noise filter of 2^6 segments & noise factor 6. Decision MF_DECISION_SEGMENT segments after the power stroke.
++++REVISION_HISTORY_ENDS+++*/
@@ -0,0 +1,42 @@
+#ifndef _misfire
+#define _misfire
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <stdint.h>
+#include "cfg_data.h"
+
+
+// maximum number of cylinders monitored, one per cylinder segment of the engine cycle
+#define MF_CYLINDERS CF_MAX_CYLINDERS
+
+// number of misfires detected for each cylinder (in firing order) since power on, the first four are shown in keyData
+extern volatile uint32_t mfMisfireCount[MF_CYLINDERS];
+
+// CPU load (%) of the misfire detector & the maximum cycles taken by one call of mfUpdate(), updated by mfUpdateStatus()
+extern volatile float mfLoad;
+extern volatile uint32_t mfMaxCycles;
+
+// processes the completed cylinder segments & updates the misfire counters in keyData. Called from the HF task.
+extern void mfUpdate(void);
+
+// clears the misfire flag in the ecu status word if there were no misfires since the last call & updates the CPU load.
+// Called from the VLF task.
+extern void mfUpdateStatus(void);
+
+// resets the detector, the per-cylinder baselines are learned again
+extern void mfInitialise(void);
+
+#endif
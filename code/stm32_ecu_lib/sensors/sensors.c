@@ -24,6 +24,7 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 #include "utility_functions.h"
 #include "cfg_data.h"
 #include "ecu_services.h"
+#include "angle_acquisition.h"
 
 /*
  *
@@ -47,6 +48,10 @@ float temperatureFromThermistorVoltage(uint16_t ADCOutput);
 // this factor converts the raw Analog to Digital Converter (ADC) output to volts = 3.3 / 1023
 //#define CONVERT_ADC_TO_VOLTS 0.0032258064516129F
 #define CONVERT_ADC_TO_VOLTS 0.0008058608058608F
+// the crank angle MAP is sampled at (tenths of a degree after the cylinder's firing TDC), intake valve closing at about 50
+// degrees after bottom dead centre
+#define SE_MAP_SAMPLE_ANGLE 5900
+
 // low pass filter co-efficients
 lpfParameterStruct lpf[MAX_ANALOG_INPUTS];
 
@@ -99,7 +104,17 @@ void readAnalog(float sensorDataArray[]){
 
 		// process each signal using the pin number / raw data slot defined for the EEPROM version of the adapter board in ecu_services.h
 		// the conversion factors for the following sensors are defined in the separate spreadsheet "conversions.ods"
-		sensorDataArray[MAP_INDEX] 		= applyFilter(0.1075258065F * ((float)adcRawData[ADC_MAP]) + 9.4444F, MAP_INDEX);
+		// while the engine runs, MAP is the mean of each cylinder's sample at intake valve closing over the last engine cycle
+		// (see angle_acquisition.c). It's free of the intake pulsation, so it isn't filtered. The filter follows it, so the
+		// filtered MAP carries on from it when the samples stop.
+		uint16_t mapSample;
+		if (aqGetCycleMean(AQ_MAP, &mapSample) != 0) {
+			sensorDataArray[MAP_INDEX] = 0.1075258065F * ((float)mapSample) + 9.4444F;
+			lpf[MAP_INDEX].xN_1 = sensorDataArray[MAP_INDEX];
+		}
+		else {
+			sensorDataArray[MAP_INDEX] = applyFilter(0.1075258065F * ((float)adcRawData[ADC_MAP]) + 9.4444F, MAP_INDEX);
+		}
 		sensorDataArray[LAMBDA_INDEX] 	= applyFilter(3.2258064516F * ((float)adcRawData[ADC_LAMBDA]), LAMBDA_INDEX);
 		sensorDataArray[AIR_TEMP_INDEX] = applyFilter(0.3225806452F * ((float)adcRawData[ADC_AIR_TEMP]), AIR_TEMP_INDEX);
 		sensorDataArray[TPS_V_INDEX] 	= applyFilter(4.8387096774F * ((float)adcRawData[ADC_TPSV]), TPS_V_INDEX);
@@ -136,6 +151,9 @@ void seInitialise(int disable){
 	lpf[VOLTS_INDEX].alpha = cfPage1.filters.voltageFilter;
 
 
+	// sample MAP at intake valve closing
+	aqSetRequest(AQ_MAP, ADC_MAP, SE_MAP_SAMPLE_ANGLE);
+
 	// set the NTC conversion factors
 	initNTC(cfPage1.p2.thermistorT1, cfPage1.p2.thermistorR1, cfPage1.p2.thermistorT2, cfPage1.p2.thermistorR2);
 
@@ -0,0 +1,217 @@
+/*
+ *
+ * Host simulation of the crank angle clock (angle_clock.c).
+ *
+ * The crankshaft turns with a speed ripple (two speed dips per revolution, as a 4 cylinder engine) & a constant acceleration.
+ * The edges of a 36-1 wheel are captured with jitter & passed to acEdge() as the crankshaft pulse handler does, with the tooth
+ * position, the gaps & the engine revolution. Between the edges, the angle from acAngleAt() is compared with the true engine
+ * cycle angle at random times, on average 16 times a tooth:
+ *
+ * 		clock - the angle clock, the rate from the last two tooth periods extrapolated to the next tooth
+ * 		last period - the same clock with the rate from the last tooth period
+ * 		predictor - the same clock with the rate from the tooth period predictor (tooth_period_predictor.h)
+ *
+ * The last period & predictor clocks are modelled here, with the angle clock's hold just before the next edge, for comparison.
+ * The errors are in degrees, with the angle clock's phase error statistics (acPhaseErrorMean & acPhaseErrorMax, at each edge).
+ *
+ * The extrapolation doubles the capture jitter of the last period, so at high speed, where +/-3 uS is a larger part of the tooth
+ * period, or under hard acceleration with jitter, the clock is no more accurate than the last period. The angle clock's RMS
+ * error must be below the predictor's in every case & below the last period's in the cases marked, & its error & phase error
+ * within MAX_ERROR. The program returns non-zero otherwise.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../angle_clock -I../ecu_services_f401 -o angle_clock_sim angle_clock_sim.c -lm
+ * ./angle_clock_sim
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_ecu.h"
+#include "angle_clock.c"
+#include "tooth_period_predictor.h"
+
+
+#define TEETH 36
+#define MISSING 1
+#define RUN_TIME 1.0					// seconds per case
+#define STEP 1.0						// integration step (uS)
+#define SAMPLE_RATE 16					// samples per tooth, on average
+#define MAX_ERROR 2						// degrees
+
+
+typedef struct {
+	const char *name;
+	double rpm;							// at the start
+	double acceleration;				// RPM/s
+	double ripple;						// peak speed variation, fraction of the mean speed
+	double jitter;						// peak capture jitter (uS)
+	int beatsLastPeriod;				// the clock must be more accurate than the last period clock
+} SimCase;
+
+static const SimCase cases[] = {
+	{ "800 RPM, 15% ripple", 800, 0.0, 0.15, 3.0, 1 },
+	{ "1000 RPM", 1000, 0.0, 0.08, 3.0, 1 },
+	{ "3000 RPM", 3000, 0.0, 0.08, 3.0, 1 },
+	{ "6000 RPM", 6000, 0.0, 0.08, 3.0, 0 },
+	{ "6000 RPM, no jitter", 6000, 0.0, 0.08, 0.0, 1 },
+	{ "1000 RPM, +5000 RPM/s", 1000, 5000.0, 0.08, 3.0, 0 },
+	{ "6000 RPM, -5000 RPM/s", 6000, -5000.0, 0.08, 3.0, 0 },
+	{ "1000 RPM, +5000 RPM/s, no jitter", 1000, 5000.0, 0.08, 0.0, 1 },
+};
+
+// a modelled clock: the last edge's angle & time, the angle to the next edge & the rate (uS per revolution)
+typedef struct {
+	int edgeAngle;
+	uint32_t edgeTime;
+	int span;
+	uint32_t denominator;
+	double errorSum2, errorMax;
+} ModelClock;
+
+
+static double uniform(void) {
+	return (double)rand() / RAND_MAX;
+}
+
+
+static int modelAngleAt(const ModelClock *m, uint32_t time) {
+	uint32_t elapsed = time - m->edgeTime;
+	int advance = (int)(((uint64_t)elapsed * AC_REVOLUTION + m->denominator / 2) / m->denominator);
+	int angle = m->edgeAngle + (advance < m->span ? advance : m->span - 1);
+	return angle >= AC_ENGINE_CYCLE ? angle - AC_ENGINE_CYCLE : angle;
+}
+
+
+// the error of an angle (tenths) from the true angle (degrees), in degrees within +/- half the engine cycle
+static double angleError(int angle, double trueAngle) {
+	double error = fmod(angle / 10.0 - trueAngle + 1080.0, 720.0) - 360.0;
+	return error;
+}
+
+
+static void accumulate(double error, double *sum2, double *max) {
+	*sum2 += error * error;
+	*max = fabs(error) > *max ? fabs(error) : *max;
+}
+
+
+// runs one case, returns non-zero if it fails
+static int simulate(const SimCase *c) {
+
+	acInitialise(TEETH);
+	ModelClock last = { 0 }, predictor = { 0 };
+	tpHistory history = { { 0 }, 0, 0 };
+	double clockSum2 = 0.0, clockMax = 0.0;
+	long samples = 0;
+
+	srand(1);
+	double toothAngle = 360.0 / TEETH;
+	double angle = 0.0;					// true crank angle, from the start of the engine cycle (degrees)
+	int nextPosition = MISSING;			// the next tooth position in the engine cycle (0 to 2 x TEETH - 1)
+	double nextAngle = MISSING * toothAngle;
+	int gap = 4 * (MISSING + 1);
+	int pending = 0;					// an edge has been captured & not yet passed to the clock
+	uint32_t captureTime = 0, lastCapture = 0;
+	int captureTooth = 0, captureRevolution = 0, captureGap = 0, captureNextGap = 0;
+	int edges = 0;
+	double sampleProbability = 0.0;
+
+	for (double t = 0.0; t < RUN_TIME * 1E6; t += STEP) {
+
+		double rpm = (c->rpm + c->acceleration * t / 1E6) * (1.0 + c->ripple * sin(2.0 * angle * M_PI / 180.0));
+		double step = rpm * 6.0 * STEP / 1E6;
+
+		// an edge crossed in this step is captured with jitter
+		if (angle + step >= nextAngle) {
+			double crossing = t + (nextAngle - angle) / step * STEP;
+			captureTime = (uint32_t)lrint(crossing + (uniform() * 2.0 - 1.0) * c->jitter + 1000.0);
+			captureTooth = nextPosition % TEETH;
+			captureRevolution = nextPosition >= TEETH;
+			captureGap = gap;
+			int following = nextPosition + 1;
+			while (following % TEETH < MISSING) {
+				following++;
+			}
+			captureNextGap = 4 * (following - nextPosition);
+			gap = captureNextGap;
+			nextPosition = following % (2 * TEETH);
+			nextAngle += captureNextGap * toothAngle / 4.0;
+			pending = 1;
+			sampleProbability = (double)SAMPLE_RATE / ((captureNextGap / 4.0) * toothAngle / (rpm * 6.0 * STEP / 1E6));
+		}
+		angle += step;
+		uint32_t now = (uint32_t)lrint(t) + 1000;
+
+		// the edge is passed to the clocks once it's been captured
+		if ( (pending != 0) && ((int32_t)(now - captureTime) >= 0) ) {
+			pending = 0;
+			uint32_t period = captureTime - lastCapture;
+			lastCapture = captureTime;
+			if (++edges > 2) {
+				acEdge(captureTime, period, captureTooth, captureGap, captureNextGap, captureRevolution);
+
+				uint32_t normalised = (period * 4) / captureGap;
+				tpRecordPeriod(&history, normalised);
+				int edgeAngle = acPositionAngle(4 * (captureTooth + (captureRevolution != 0 ? TEETH : 0)));
+				int span = acPositionAngle(4 * (captureTooth + (captureRevolution != 0 ? TEETH : 0)) + captureNextGap) - edgeAngle;
+				last = (ModelClock) { edgeAngle, captureTime, span, TEETH * normalised, last.errorSum2, last.errorMax };
+				predictor = (ModelClock) { edgeAngle, captureTime, span, TEETH * tpPredictPeriod(&history, 1), predictor.errorSum2,
+						predictor.errorMax };
+			}
+		}
+
+		// a sample at a random time, once the clocks have run for a revolution
+		if ( (edges > 2 * TEETH) && (pending == 0) && (uniform() < sampleProbability) ) {
+			double trueAngle = fmod(angle, 720.0);
+			accumulate(angleError(acAngleAt(now), trueAngle), &clockSum2, &clockMax);
+			accumulate(angleError(modelAngleAt(&last, now), trueAngle), &last.errorSum2, &last.errorMax);
+			accumulate(angleError(modelAngleAt(&predictor, now), trueAngle), &predictor.errorSum2, &predictor.errorMax);
+			samples++;
+		}
+		if (edges == 2 * TEETH) {
+			acResetStatistics();
+		}
+	}
+
+	double clockRMS = sqrt(clockSum2 / samples), lastRMS = sqrt(last.errorSum2 / samples);
+	double predictorRMS = sqrt(predictor.errorSum2 / samples);
+	printf("%-33s %7ld   %5.3f %5.2f   %5.3f %5.2f   %5.3f %5.2f   %5.1f %5.1f\n", c->name, samples, clockRMS, clockMax,
+			lastRMS, last.errorMax, predictorRMS, predictor.errorMax, acPhaseErrorMean / 10.0, acPhaseErrorMax / 10.0);
+
+	return ((c->beatsLastPeriod != 0) && (clockRMS >= lastRMS)) || (clockRMS >= predictorRMS) || (clockMax > MAX_ERROR)
+			|| (acPhaseErrorMax > 10 * MAX_ERROR);
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("                                              clock      last period     predictor    phase error\n");
+	printf("                                           rms    max     rms    max     rms    max    mean   max\n");
+	printf("case                              samples (deg)  (deg)   (deg)  (deg)   (deg)  (deg)   (deg) (deg)\n");
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		failures += simulate(&cases[c]);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases where the clock isn't more accurate than the last period or the predictor, or its error is over %d deg\n",
+				failures, MAX_ERROR);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
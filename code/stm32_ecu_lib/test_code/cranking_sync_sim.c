@@ -0,0 +1,278 @@
+/*
+ *
+ * Host simulation of a cranking start through the staged sync (trigger_wheel_handler.c) & the trigger decoder (trigger_decoder.c).
+ *
+ * The crankshaft turns at cranking speed with the compression ripple of a 4 cylinder engine (two speed dips per revolution).
+ * The tooth edges of the trigger wheel are captured with jitter & a camshaft pulse, if the engine has a camshaft sensor, is
+ * captured once per engine cycle in revolution 0. Each start is from a random crank angle, and ends in a stall. The pulses are fed
+ * to the firmware's crankshaft interrupt (host/host_engine.h) & the HF task updates the event table every 5 mS, so the start
+ * runs through the decoder's sync, TW_SYNC_CRANK (wasted spark & batch injection) & TW_SYNC_FULL as on the target:
+ *
+ * 		crank sync - crank degrees from the first tooth edge to crank sync (twStartTimes.crankSync)
+ * 		first spark - crank degrees & mS from the first tooth edge to the first spark (twStartTimes.firstSpark)
+ * 		full sync - mS from the first tooth edge to full sync (twStartTimes.fullSync), only with a camshaft sensor
+ * 		spark error - the largest difference of the first spark from a cylinder's TDC less the advance (degrees)
+ *
+ * Every start must spark after crank sync, within SPARK_TOLERANCE degrees of a firing angle. With a camshaft sensor every start
+ * must reach full sync, without one (Parameters 2 injectorSequenceReset < 0) none may. The program returns non-zero otherwise.
+ * TIM2 wraps during the first start.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o cranking_sync_sim cranking_sync_sim.c -lm
+ * ./cranking_sync_sim
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_engine.h"
+
+
+#define RUNS 100						// starts per case
+#define RUN_REVOLUTIONS 6				// crankshaft revolutions per start
+#define MAX_EDGES (RUN_REVOLUTIONS * 64 + 16)
+#define CAM_ANGLE 60.0					// engine cycle angle of the camshaft pulse (revolution 0)
+#define HF_PERIOD 5000					// uS
+#define STALL_TIME 400000				// uS without pulses between starts
+#define PW 6000.0F						// cranking pulse width (uS)
+#define ADVANCE 10.0F					// degrees
+#define SPARK_TOLERANCE 5.0				// degrees
+
+
+typedef struct {
+	const char *name;
+	int teeth, missing;					// N-M wheel
+} SimPattern;
+
+typedef struct {
+	const char *name;
+	double rpm;
+	double ripple;						// peak speed variation, fraction of the mean speed
+	double jitter;						// capture jitter (standard deviation, uS)
+	int camSensor;
+} SimCase;
+
+// an edge of the start, in time order
+typedef struct {
+	double time;						// the true time (uS from the start)
+	double angle;						// engine cycle angle from the start (degrees)
+	int cam;							// 1 = camshaft pulse
+} SimEdge;
+
+static const SimPattern patterns[] = {
+	{ "36-1", 36, 1 },
+	{ "60-2", 60, 2 },
+};
+
+static const SimCase cases[] = {
+	{ "250 RPM, jitter 2 uS", 250, 0.20, 2.0, 0 },
+	{ "250 RPM, jitter 20 uS", 250, 0.20, 20.0, 0 },
+	{ "150 RPM, jitter 20 uS", 150, 0.30, 20.0, 0 },
+	{ "250 RPM, jitter 2 uS, cam", 250, 0.20, 2.0, 1 },
+	{ "150 RPM, jitter 20 uS, cam", 150, 0.30, 20.0, 1 },
+};
+
+static SimEdge edges[MAX_EDGES];
+static uint32_t simTime = 0xFFF00000u;	// TIM2, so it wraps in the first start
+static uint32_t nextHF;
+
+
+static double uniform(void) {
+	return (double)rand() / RAND_MAX;
+}
+
+static double gaussian(void) {
+	double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+// the time (uS) the crankshaft takes to turn from one angle to another (degrees)
+static double turnTime(const SimCase *c, double from, double to) {
+	double time = 0.0;
+	double step = (to - from) / 16.0;
+	for (int i = 0; i < 16; i++) {
+		double angle = from + (i + 0.5) * step;
+		double rpm = c->rpm * (1.0 + c->ripple * sin(2.0 * angle * M_PI / 180.0));
+		time += step / (rpm * 6.0) * 1E6;
+	}
+	return time;
+}
+
+
+// the engine cycle angle from the start at a time (uS from the start), between the edges either side
+static double angleAt(int nEdges, double time) {
+	for (int i = 1; i < nEdges; i++) {
+		if (edges[i].time >= time) {
+			return edges[i - 1].angle + (edges[i].angle - edges[i - 1].angle) * (time - edges[i - 1].time) / (edges[i].time - edges[i - 1].time);
+		}
+	}
+	return edges[nEdges - 1].angle;
+}
+
+
+// runs the HF task up to the time
+static void runTo(uint32_t time) {
+	while ((int32_t)(nextHF - time) <= 0) {
+		hostRunTo(nextHF);
+		hostHFTask(PW, ADVANCE);
+		nextHF += HF_PERIOD;
+	}
+	hostRunTo(time);
+}
+
+
+static double smallest(double a, double b) {
+	return a < b ? a : b;
+}
+
+static double largest(double a, double b) {
+	return a > b ? a : b;
+}
+
+
+// runs the starts of one case, returns non-zero if it fails
+static int simulate(const SimPattern *p, const SimCase *c) {
+
+	cfPage1.p3.twPattern = 0;
+	cfPage1.p2.twTeeth = p->teeth;
+	cfPage1.p2.twMissingTeeth = p->missing;
+	cfPage1.p2.injectorSequenceReset = c->camSensor != 0 ? 0 : -1;
+	hostStart(simTime);
+	nextHF = simTime + HF_PERIOD;
+	double toothAngle = 360.0 / p->teeth;
+	double tdcAngle = cfPage1.p2.twTDCAngle;
+
+	int sparked = 0, late = 0, inaccurate = 0, fullSyncs = 0, fullWithoutCam = 0;
+	double syncSum = 0.0, syncMax = 0.0, sparkSum = 0.0, sparkMax = 0.0, sparkTimeSum = 0.0, sparkTimeMax = 0.0;
+	double fullSum = 0.0, fullMax = 0.0, errorMax = 0.0;
+
+	srand(1);
+	for (int run = 0; run < RUNS; run++) {
+
+		// the tooth edges from a random engine cycle angle, & a camshaft pulse each cycle
+		double startAngle = uniform() * 720.0;
+		int nEdges = 0;
+		double wheelAngle = ceil(fmod(startAngle, 360.0) / toothAngle) * toothAngle;
+		double angle = startAngle + (wheelAngle - fmod(startAngle, 360.0));
+		double time = 0.0, angleN_1 = startAngle;
+		double camAngle = CAM_ANGLE + (startAngle > CAM_ANGLE ? 720.0 : 0.0);
+		while (angle < startAngle + RUN_REVOLUTIONS * 360.0) {
+			int tooth = (int)lrint(fmod(angle, 360.0) / toothAngle) % p->teeth;
+			if ( (c->camSensor != 0) && (camAngle < angle) ) {
+				time += turnTime(c, angleN_1, camAngle);
+				edges[nEdges++] = (SimEdge) { time, camAngle - startAngle, 1 };
+				angleN_1 = camAngle;
+				camAngle += 720.0;
+			}
+			// the missing teeth are at tooth positions 0 to missing - 1 (trigger_decoder.c), the first tooth follows the gap
+			if (tooth >= p->missing) {
+				time += turnTime(c, angleN_1, angle);
+				edges[nEdges++] = (SimEdge) { time, angle - startAngle, 0 };
+				angleN_1 = angle;
+			}
+			angle += toothAngle;
+		}
+
+		// the start
+		uint32_t startTime = simTime;
+		uint32_t firstEdge = 0;
+		for (int i = 0; i < nEdges; i++) {
+			uint32_t edgeTime = startTime + (uint32_t)lrint(edges[i].time + c->jitter * gaussian());
+			runTo(edgeTime);
+			if (edges[i].cam != 0) {
+				hostCamshaftPulse(edgeTime);
+			}
+			else {
+				if (firstEdge == 0) {
+					firstEdge = i + 1;
+				}
+				hostCrankshaftPulse(edgeTime);
+				fullWithoutCam += (c->camSensor == 0) && (twSyncStage == TW_SYNC_FULL);
+			}
+		}
+
+		// the start times are from the first crankshaft edge
+		double firstAngle = edges[firstEdge - 1].angle;
+		double firstTime = edges[firstEdge - 1].time;
+		if ( (twStartTimes.crankSync != 0) && (twStartTimes.firstSpark != 0) ) {
+			double syncAngle = angleAt(nEdges, firstTime + twStartTimes.crankSync) - firstAngle;
+			double sparkAt = firstTime + twStartTimes.firstSpark;
+			double sparkAngle = angleAt(nEdges, sparkAt) - firstAngle;
+			sparked++;
+			late += twStartTimes.firstSpark < twStartTimes.crankSync;
+			syncSum += syncAngle;
+			syncMax = largest(syncMax, syncAngle);
+			sparkSum += sparkAngle;
+			sparkMax = largest(sparkMax, sparkAngle);
+			sparkTimeSum += twStartTimes.firstSpark / 1000.0;
+			sparkTimeMax = largest(sparkTimeMax, twStartTimes.firstSpark / 1000.0);
+
+			// 4 cylinders, so a spark is due every 180 degrees from cylinder 1's TDC less the advance
+			double offset = fmod(startAngle + angleAt(nEdges, sparkAt) - (tdcAngle - ADVANCE) + 7200.0, 180.0);
+			double error = smallest(offset, 180.0 - offset);
+			errorMax = largest(errorMax, error);
+			inaccurate += error > SPARK_TOLERANCE;
+		}
+		if (twStartTimes.fullSync != 0) {
+			fullSyncs++;
+			fullSum += twStartTimes.fullSync / 1000.0;
+			fullMax = largest(fullMax, twStartTimes.fullSync / 1000.0);
+		}
+
+		// the engine stops & the stall timeout ends the start
+		simTime = startTime + (uint32_t)lrint(edges[nEdges - 1].time) + STALL_TIME;
+		runTo(simTime);
+	}
+
+	printf("%-6s %-28s %4d  %5.0f %5.0f  %5.0f %5.0f  %6.1f %6.1f", p->name, c->name, sparked,
+			sparked > 0 ? syncSum / sparked : 0.0, syncMax, sparked > 0 ? sparkSum / sparked : 0.0, sparkMax,
+			sparked > 0 ? sparkTimeSum / sparked : 0.0, sparkTimeMax);
+	if (fullSyncs > 0) {
+		printf("  %6.1f %6.1f", fullSum / fullSyncs, fullMax);
+	}
+	else {
+		printf("  %6s %6s", "-", "-");
+	}
+	printf("  %5.1f\n", errorMax);
+
+	int failed = (sparked != RUNS) || (late != 0) || (inaccurate != 0);
+	failed |= c->camSensor != 0 ? fullSyncs != RUNS : (fullSyncs != 0) || (fullWithoutCam != 0);
+	return failed;
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("                                            crank sync     first spark          first spark      full sync    spark\n");
+	printf("                                              (deg)           (deg)                (mS)             (mS)      error\n");
+	printf("wheel  case                         starts  mean   max   mean   max    mean    max    mean    max   (deg)\n");
+	for (int p = 0; p < (int)(sizeof(patterns) / sizeof(patterns[0])); p++) {
+		for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+			failures += simulate(&patterns[p], &cases[c]);
+		}
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases with a start that didn't spark, sparked before crank sync or away from a firing angle, or with the wrong full sync\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
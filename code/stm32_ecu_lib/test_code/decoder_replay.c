@@ -0,0 +1,225 @@
+/*
+ *
+ * Host replay test of the trigger pattern decoder (trigger_decoder.c) with synthetic tooth streams & injected noise.
+ *
+ * The edges of a trigger pattern are generated from the pattern's gap list as the crankshaft turns at a mean speed with the
+ * compression ripple of a 4 cylinder engine (two speed dips per revolution) & capture jitter. Noise glitches are added at
+ * random: a glitch is an extra edge at a random point between two real edges. Camshaft referenced patterns get their camshaft
+ * pulse before the first edge of each cycle. Each run starts at a random point in the pattern & the edge periods are fed to
+ * tdProcessEdge():
+ *
+ * 		time to sync - crank degrees (and mS) from the first edge to the first real edge decoded in sync at the right edge
+ * 		lost sync - sync errors per run, e.g. a glitch decoded while the acceptance window is disabled (cranking)
+ * 		glitches - glitches decoded as a tooth in sync per run, i.e. not rejected by the acceptance window
+ * 		slipped - real edges per run decoded in sync but ahead of the right edge by the glitches decoded since the decoder found
+ * 		its position, i.e. until a class mismatch exposes the glitch (see the limitation in trigger_decoder.c)
+ * 		max slip - the longest run of slipped edges
+ * 		false syncs - real edges decoded in sync at an edge the decoded glitches don't explain, e.g. sync gained on a glitch.
+ * 		This would fire events at an arbitrary angle, so must be 0.
+ *
+ * The cranking cases run with the acceptance window disabled, as the trigger wheel handler does below the cranking threshold,
+ * the running cases with the window enabled once in sync.
+ *
+ * trigger_decoder.c is compiled in to this file with the ECU globals (cfPage1, cfTriggerPatterns) from host/host_ecu.h. The
+ * program returns non-zero if any case has a false sync or a run that doesn't sync.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -o decoder_replay decoder_replay.c -lm
+ * ./decoder_replay
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_ecu.h"
+#include "trigger_decoder.c"
+
+
+#define RUNS 200						// runs per case, each from a random point in the pattern
+#define RUN_REVOLUTIONS 40				// crankshaft revolutions per run
+
+
+typedef struct {
+	const char *name;
+	int pattern;						// cfPage1.p3.twPattern
+	int teeth, missing;					// N-M wheel, pattern 0 only
+} ReplayPattern;
+
+typedef struct {
+	const char *name;
+	double rpm;
+	double ripple;						// peak speed variation, fraction of the mean speed
+	double noise;						// probability of a glitch between two edges
+	int window;							// enable the acceptance window once in sync
+} ReplayCase;
+
+static const ReplayPattern patterns[] = {
+	{ "36-1", 0, 36, 1 },
+	{ "60-2", 0, 60, 2 },
+	{ "36-2-2-2", 1, 0, 0 },
+	{ "24+1", 2, 0, 0 },
+	{ "4+1", 3, 0, 0 },
+};
+
+static const ReplayCase cases[] = {
+	{ "cranking", 250, 0.20, 0.0, 0 },
+	{ "cranking, noise 1%", 250, 0.20, 0.01, 0 },
+	{ "cranking, noise 2%", 250, 0.20, 0.02, 0 },
+	{ "running, noise 1%", 3000, 0.02, 0.01, 1 },
+	{ "running, noise 2%", 3000, 0.02, 0.02, 1 },
+};
+
+
+static double uniform(void) {
+	return (double)rand() / RAND_MAX;
+}
+
+
+// the time (uS) the crankshaft takes to turn from one angle to another (degrees) at the case speed
+static double turnTime(const ReplayCase *c, double from, double to) {
+	double time = 0.0;
+	double step = (to - from) / 16.0;
+	for (int i = 0; i < 16; i++) {
+		double angle = from + (i + 0.5) * step;
+		double rpm = c->rpm * (1.0 + c->ripple * sin(2.0 * angle * M_PI / 180.0));
+		time += step / (rpm * 6.0) * 1E6;
+	}
+	return time;
+}
+
+
+// replays one case, returns the number of false syncs or runs that didn't sync
+static int replay(const ReplayPattern *p, const ReplayCase *c) {
+
+	cfPage1.p2.twTeeth = p->teeth;
+	cfPage1.p2.twMissingTeeth = p->missing;
+	tdInitialise(p->pattern);
+
+	// the pattern cycle, in quarter tooth spacings
+	int cycle = 0;
+	for (int i = 0; i < tdEdges; i++) {
+		cycle += tdEdgeGap[i];
+	}
+	double quarterAngle = 360.0 / (4 * tdTeeth);
+
+	int synced = 0, lostSyncs = 0, glitchesDecoded = 0, slippedEdges = 0, maxSlip = 0, falseSyncs = 0;
+	double syncAngleSum = 0.0, syncAngleMax = 0.0, syncTimeSum = 0.0, syncTimeMax = 0.0;
+
+	srand(1);
+	for (int run = 0; run < RUNS; run++) {
+
+		tdResetSync();
+		int edge = rand() % tdEdges;
+		double angle = 0.0;
+		double time = 0.0, lastEdgeTime = 0.0;
+		int glitches = 0;				// glitches decoded since the decoder found its position
+		int slip = 0;
+		int edges = RUN_REVOLUTIONS * 360.0 / (cycle * quarterAngle) * tdEdges;
+
+		for (int n = 0; n < edges; n++) {
+
+			int next = edge + 1 < tdEdges ? edge + 1 : 0;
+			double gapAngle = tdEdgeGap[next] * quarterAngle;
+			double edgeTime = time + turnTime(c, angle, angle + gapAngle) + (uniform() - 0.5) * 4.0;
+
+			// a glitch at a random point before the next edge, then the next edge
+			int glitch = uniform() < c->noise;
+			double glitchTime = time + turnTime(c, angle, angle + uniform() * gapAngle);
+			for (int g = glitch; g >= 0; g--) {
+
+				// camshaft referenced patterns see the camshaft pulse before the first edge of the cycle
+				if ( (g == 0) && (next == 0) ) {
+					tdCamshaftEdge();
+				}
+
+				int searching = (tdInSync == 0) && (tdConfirmEdges == 0);
+				int inSync = tdInSync;
+				tdEdgeResult r;
+				tdProcessEdge((uint32_t)lrint((g != 0 ? glitchTime : edgeTime) - lastEdgeTime), &r);
+				lastEdgeTime = g != 0 ? glitchTime : edgeTime;
+				lostSyncs += r.syncError;
+				if (r.rejected != 0) {
+					continue;
+				}
+
+				// a decoded glitch can put the decoder an edge ahead, for each glitch decoded since the decoder found its position
+				if ( (searching != 0) || (r.syncError != 0) || (tdConfirmEdges == TD_CONFIRM_EDGES) ) {
+					glitches = 0;
+				}
+				glitches += g;
+				int ahead = (tdEdgeIndex + g - next + tdEdges) % tdEdges;
+
+				if (tdInSync == 0) {
+					slip = 0;
+				}
+				else if (ahead > glitches) {
+					// decoded at an edge that the decoded glitches don't explain
+					falseSyncs++;
+				}
+				else if (g != 0) {
+					glitchesDecoded++;
+				}
+				else if (ahead > 0) {
+					slippedEdges++;
+					maxSlip = ++slip > maxSlip ? slip : maxSlip;
+				}
+				else {
+					slip = 0;
+					if ( (inSync == 0) && (synced <= run) ) {
+						synced++;
+						syncAngleSum += angle + gapAngle;
+						syncTimeSum += edgeTime / 1000.0;
+						syncAngleMax = angle + gapAngle > syncAngleMax ? angle + gapAngle : syncAngleMax;
+						syncTimeMax = edgeTime / 1000.0 > syncTimeMax ? edgeTime / 1000.0 : syncTimeMax;
+					}
+				}
+			}
+
+			time += turnTime(c, angle, angle + gapAngle);
+			angle += gapAngle;
+			edge = next;
+			if (tdInSync != 0) {
+				tdEnableWindow(c->window);
+			}
+		}
+	}
+
+	printf("%-10s %-20s %5d  %6.0f %6.0f  %6.0f %6.0f  %8.2f %8.2f %8.2f %6d %8d\n", p->name, c->name, synced,
+			synced > 0 ? syncAngleSum / synced : 0.0, syncAngleMax, synced > 0 ? syncTimeSum / synced : 0.0, syncTimeMax,
+			lostSyncs / (double)RUNS, glitchesDecoded / (double)RUNS, slippedEdges / (double)RUNS, maxSlip, falseSyncs);
+
+	return falseSyncs + (RUNS - synced);
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("                                     time to sync (deg)  time to sync (mS)  ------------ per run ----------   max    false\n");
+	printf("pattern    case                 synced    mean    max     mean    max   lost sync glitches  slipped   slip    syncs\n");
+	for (int p = 0; p < (int)(sizeof(patterns) / sizeof(patterns[0])); p++) {
+		for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+			failures += replay(&patterns[p], &cases[c]) != 0;
+		}
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases with false syncs or runs that didn't sync\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
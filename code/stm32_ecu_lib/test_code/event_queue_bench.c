@@ -0,0 +1,209 @@
+/*
+ *
+ * Host benchmark of the event queue (event_queue.c) at the highest event rate: 8 cylinders at 8000 RPM.
+ *
+ * A V8 (firing order 1-5-4-8-6-3-7-2, each output shared by two cylinders 360 degrees apart: cylinderOutputs 14323134) runs
+ * on a 36-1 wheel with a camshaft sensor, so it's in full sync with sequential injection & ignition. The pulses are fed to the
+ * firmware's crankshaft interrupt (host/host_engine.h), the HF task updates the event table every 5 mS & the event queue runs on
+ * the simulated TIM5, so the injection, dwell, spark & compare re-arm events are queued, moved & cancelled as on the target.
+ * The split case starts its pulses 420, 240 & 60 degrees before TDC, so the 3 pulses fit at 8000 RPM:
+ *
+ * 		pulses / cycle - the injection pulses per cylinder per cycle (twInjectionPulses)
+ * 		events per s - the event callbacks run per second, from full sync
+ * 		depth - the most events queued at once (eqDepthMax), against EQ_MAX_EVENTS
+ * 		overflows - events that couldn't be queued (eqOverflows)
+ * 		latency - the mean & maximum time from an event's due time to its callback (eqLatencyMean & eqLatencyMax). On the host
+ * 		the interrupts are taken at once, so this is only the latency added by the queue itself; the target's interrupt latency
+ * 		hasn't been measured.
+ * 		sparks / cycle - in the compare output mode, the coil compare sparks per engine cycle over the last second
+ *
+ * Each event is owned by its output channel & queued at most once, so the queue can't hold more than the injection (2 per
+ * injector), dwell, spark & compare re-arm events of the outputs (EQ_STRUCTURAL_DEPTH, 24), well inside EQ_MAX_EVENTS (32).
+ * The depth must stay within that, without an overflow, & every cylinder must spark once a cycle (the sparks are counted over a
+ * whole number of cycles, give or take one spark). The program returns non-zero otherwise.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o event_queue_bench event_queue_bench.c -lm
+ * ./event_queue_bench
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_engine.h"
+
+
+#define ENGINE_RPM 8000.0
+#define RIPPLE 0.01						// peak speed variation, fraction of the mean speed
+#define RUN_TIME 3000000				// uS per case
+#define WINDOW 1000000					// uS at the end of the run the sparks are counted over
+#define CAM_ANGLE 60.0					// engine cycle angle of the camshaft pulse (revolution 0)
+#define HF_PERIOD 5000					// uS
+#define ADVANCE 30.0F					// degrees
+#define CYLINDERS 8
+
+// the most events the outputs can have queued at once
+#define EQ_STRUCTURAL_DEPTH (2 * INJECTOR_OUTPUTS + 2 * COIL_OUTPUTS + INJECTOR_OUTPUTS + COIL_OUTPUTS)
+
+
+typedef struct {
+	const char *name;
+	float pw;							// injection pulse width (uS)
+	int splitPulses;					// Parameters 3 splitPulses, split at any speed if > 1
+	int outputMode;						// Parameters 3 outputMode
+} BenchCase;
+
+static const BenchCase cases[] = {
+	{ "PW 3 mS", 3000.0F, 1, OUTPUT_MODE_SOFTWARE },
+	{ "PW 3 mS, compare", 3000.0F, 1, OUTPUT_MODE_COMPARE },
+	{ "PW 7 mS, compare", 7000.0F, 1, OUTPUT_MODE_COMPARE },
+	{ "PW 14 mS (overlapping), compare", 14000.0F, 1, OUTPUT_MODE_COMPARE },
+	{ "PW 6 mS split in 3, compare", 6000.0F, 3, OUTPUT_MODE_COMPARE },
+};
+
+static uint32_t nextHF;
+static uint32_t windowStart;
+static int sparks;
+
+
+// the time (uS) the crankshaft takes to turn from one angle to another (degrees)
+static double turnTime(double from, double to) {
+	double time = 0.0;
+	double step = (to - from) / 16.0;
+	for (int i = 0; i < 16; i++) {
+		double angle = from + (i + 0.5) * step;
+		time += step / (ENGINE_RPM * (1.0 + RIPPLE * sin(2.0 * angle * M_PI / 180.0)) * 6.0) * 1E6;
+	}
+	return time;
+}
+
+
+// runs the HF task up to the time
+static void runTo(uint32_t time, float pw) {
+	while ((int32_t)(nextHF - time) <= 0) {
+		hostRunTo(nextHF);
+		hostHFTask(pw, ADVANCE);
+		nextHF += HF_PERIOD;
+	}
+	hostRunTo(time);
+}
+
+
+// counts the coil compare sparks (the coil going inactive at its compare) in the window
+static void countSpark(TIM_TypeDef *timer, int channel, int level, uint32_t time) {
+	for (int i = 0; i < COIL_OUTPUTS; i++) {
+		if ( (coilCompare[i].timer == timer) && (coilCompare[i].channel == channel) && (level == 0)
+				&& ((int32_t)(time - windowStart) >= 0) ) {
+			sparks++;
+		}
+	}
+}
+
+
+// runs one case, returns non-zero if it fails
+static int bench(const BenchCase *c) {
+
+	uint32_t start = 0x20000000u;
+	cfPage1.p2.twTeeth = 36;
+	cfPage1.p2.twMissingTeeth = 1;
+	cfPage1.p2.injectorSequenceReset = 0;
+	cfPage1.p3.cylinders = CYLINDERS;
+	cfPage1.p3.firingOrder = 15486372;
+	cfPage1.p3.cylinderOutputs = 14323134;
+	cfPage1.p3.outputMode = c->outputMode;
+	cfPage1.p3.splitPulses = c->splitPulses;
+	cfPage1.p3.splitRPM = c->splitPulses > 1 ? 20000 : 0;
+	cfPage1.p3.splitLoad = 0;
+	cfPage1.p3.splitFraction[0] = 34;
+	cfPage1.p3.splitFraction[1] = 33;
+	cfPage1.p3.splitFraction[2] = 33;
+	cfPage1.p3.splitAngle[0] = 4200;
+	cfPage1.p3.splitAngle[1] = 2400;
+	cfPage1.p3.splitAngle[2] = 600;
+	hostStart(start);
+	nextHF = start + HF_PERIOD;
+	windowStart = start + RUN_TIME - WINDOW;
+	sparks = 0;
+	hostCompareEdge = countSpark;
+	int compare = c->outputMode == OUTPUT_MODE_COMPARE;
+
+	// run up to full sync, then time the queue
+	double toothAngle = 360.0 / 36;
+	double angle = 0.0, time = 0.0;
+	double camAngle = CAM_ANGLE;
+	int reset = 0;
+	uint32_t events = 0;
+	double resetTime = 0.0;
+	while (time < RUN_TIME) {
+		double nextAngle = angle + toothAngle;
+		if (camAngle < nextAngle) {
+			uint32_t camTime = start + (uint32_t)lrint(time + turnTime(angle, camAngle));
+			runTo(camTime, c->pw);
+			hostCamshaftPulse(camTime);
+			camAngle += 720.0;
+		}
+		time += turnTime(angle, nextAngle);
+		angle = nextAngle;
+		uint32_t edgeTime = start + (uint32_t)lrint(time);
+		runTo(edgeTime, c->pw);
+		if ((int)lrint(angle / toothAngle) % 36 != 0) {
+			hostCrankshaftPulse(edgeTime);
+		}
+		if ( (reset == 0) && (twSyncStage == TW_SYNC_FULL) ) {
+			reset = 1;
+			eqResetStatistics();
+			events = eqEvents;
+			resetTime = time;
+		}
+	}
+	events = eqEvents - events;
+	int pulses = twInjectionPulses;
+	double cycles = (WINDOW / 1E6) * ENGINE_RPM / 120.0;
+
+	printf("%-34s %6d %8.0f  %5lu %5d  %9lu  %5lu %5lu", c->name, pulses, events / ((RUN_TIME - resetTime) / 1E6), (unsigned long)eqDepthMax,
+			EQ_MAX_EVENTS, (unsigned long)eqOverflows, (unsigned long)eqLatencyMean, (unsigned long)eqLatencyMax);
+	if (compare != 0) {
+		printf("  %6.2f\n", sparks / cycles);
+	}
+	else {
+		printf("  %6s\n", "-");
+	}
+	hostCompareEdge = NULL;
+
+	int failed = (reset == 0) || (pulses != c->splitPulses) || (eqDepthMax > EQ_STRUCTURAL_DEPTH) || (eqOverflows != 0);
+	failed |= (compare != 0) && (fabs(sparks / cycles - CYLINDERS) > CYLINDERS / cycles + 0.01);
+	return failed;
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("8 cylinders, 8000 RPM             pulses /  events  depth          overflows    latency    sparks\n");
+	printf("case                                 cycle     per s   max limit               mean   max   / cycle\n");
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		failures += bench(&cases[c]);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases that didn't sync or split, with a queue deeper than %d, an overflow or a missed spark\n", failures,
+				EQ_STRUCTURAL_DEPTH);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
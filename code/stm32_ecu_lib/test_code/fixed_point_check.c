@@ -0,0 +1,228 @@
+/*
+ *
+ * Host check of the fixed point angle & time conversions of the trigger wheel handler against the floating point code they
+ * replaced (trigger_wheel_handler.c before revision 14) & an exact reference.
+ *
+ * 		tooth index & vernier - angleToIndexAndVernier() converts an angle (degrees scaled by 2^16) to a tooth & a vernier (a
+ * 		fraction of a tooth spacing scaled by 2^16). The float code multiplied the angle by the float reciprocal of the tooth
+ * 		spacing. The reference is the exact tooth position of the angle. Swept over -720 to 720 degrees every 97 / 2^16 degrees,
+ * 		plus each tooth position & one step either side, for 4 to 72 teeth.
+ * 		event delay - the time from the tooth to the event, tooth period x vernier (uS) as the crankshaft pulse handler does, over
+ * 		50 to 12000 RPM & the engine cycle. The float code's vernier was scaled to the same fixed point in the event table.
+ * 		camshaft angle - the engine cycle angle of the camshaft pulse in tenths of a degree, against the float degrees.
+ *
+ * The tooth indices must match the reference exactly (the float code's don't, at some tooth positions) & the verniers must be
+ * within 1 / 2^16 of a tooth of the reference (both round towards zero). The delays must be within 1 uS of the reference plus
+ * the vernier's resolution, 1 / 2^16 of the tooth period, e.g. 4.6 uS for a 4 tooth wheel at 50 RPM, & the camshaft angles
+ * within 0.1 degree below it. The program returns non-zero otherwise.
+ *
+ * The host time per call of each conversion is printed for comparison. It says nothing about the target: the Cortex-M4 cycles of
+ * the crankshaft interrupt, before & after, haven't been measured.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o fixed_point_check fixed_point_check.c -lm
+ * ./fixed_point_check
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+#include <time.h>
+
+#include "host_engine.h"
+
+
+#define ANGLE_STEP 97					// angle sweep step, degrees scaled by 2^16
+#define DELAY_ANGLES 4096				// engine cycle angles per speed for the delay check
+#define TIMING_CALLS 10000000
+
+
+static const int teeth[] = { 4, 12, 24, 36, 60, 72 };
+
+// the float code, as removed
+static float triggerWheelToothSpacingReciprocal;
+
+static void floatAngleToIndexAndVernier(float angle, int *index, float *vernier) {
+	// calculate the tooth number from angle
+	*index = angle * triggerWheelToothSpacingReciprocal;
+	// calculate the proportional distance to next tooth
+	*vernier = angle * triggerWheelToothSpacingReciprocal - *index;
+}
+
+static uint32_t floatEventVernier(float vernier) {
+	return (uint32_t)(limitF(vernier, 0.0F, 8.0F) * 65536.0F);
+}
+
+// the delay of an event from its vernier, as the crankshaft pulse handler
+static inline uint32_t eventDelay(uint32_t period, uint32_t vernier) {
+	return (uint32_t)(((uint64_t)period * vernier) >> TW_VERNIER_SHIFT);
+}
+
+
+typedef struct {
+	long angles;
+	long indexErrors;					// tooth indices that differ from the reference
+	double vernierLow, vernierHigh;		// vernier error range (1 / 2^16 tooth)
+} AngleResult;
+
+
+// the tooth position of an angle (degrees scaled by 2^16) in whole teeth & 2^-16 teeth, as an exact rational, the index rounded
+// towards zero. Returns the index & sets the exact vernier.
+static int referenceIndex(int32_t angle, int nTeeth, double *vernier) {
+	int64_t numerator = (int64_t)angle * nTeeth;
+	const int64_t denominator = 360LL * 65536;
+	int64_t index = numerator / denominator;
+	*vernier = (double)(numerator - index * denominator) / denominator;
+	return (int)index;
+}
+
+
+static void checkAngle(int32_t angle, int nTeeth, AngleResult *fixed, AngleResult *flt) {
+	double vernierRef;
+	int indexRef = referenceIndex(angle, nTeeth, &vernierRef);
+
+	int index;
+	int32_t vernier;
+	angleToIndexAndVernier(angle, &index, &vernier);
+	double error = vernier - vernierRef * 65536.0;
+	fixed->angles++;
+	fixed->indexErrors += index != indexRef;
+	fixed->vernierLow = error < fixed->vernierLow ? error : fixed->vernierLow;
+	fixed->vernierHigh = error > fixed->vernierHigh ? error : fixed->vernierHigh;
+
+	float vernierF;
+	floatAngleToIndexAndVernier((float)angle / 65536.0F, &index, &vernierF);
+	error = (index - indexRef + vernierF - vernierRef) * 65536.0;
+	flt->angles++;
+	flt->indexErrors += index != indexRef;
+	flt->vernierLow = error < flt->vernierLow ? error : flt->vernierLow;
+	flt->vernierHigh = error > flt->vernierHigh ? error : flt->vernierHigh;
+}
+
+
+static double nanoseconds(void) {
+	struct timespec t;
+	clock_gettime(CLOCK_MONOTONIC, &t);
+	return t.tv_sec * 1E9 + t.tv_nsec;
+}
+
+
+int main(void) {
+
+	int failed = 0;
+
+	// tooth index & vernier
+	printf("tooth index & vernier, -720 to 720 degrees\n");
+	printf("teeth     angles   fixed: index errors  vernier error (2^-16 tooth)   float: index errors  vernier error (2^-16 tooth)\n");
+	for (int t = 0; t < (int)(sizeof(teeth) / sizeof(teeth[0])); t++) {
+		triggerWheelTeeth = teeth[t];
+		triggerWheelToothSpacingReciprocal = ((float) teeth[t]) / 360.0F;
+		AngleResult fixed = { 0, 0, 0.0, 0.0 }, flt = { 0, 0, 0.0, 0.0 };
+		for (int32_t angle = -720 * 65536; angle <= 720 * 65536; angle += ANGLE_STEP) {
+			checkAngle(angle, teeth[t], &fixed, &flt);
+		}
+		for (int k = -2 * teeth[t]; k <= 2 * teeth[t]; k++) {
+			int32_t position = (int32_t)(((int64_t)k * 360 * 65536) / teeth[t]);
+			for (int d = -1; d <= 1; d++) {
+				checkAngle(position + d, teeth[t], &fixed, &flt);
+			}
+		}
+		printf("%5d  %9ld  %19ld  %12.3f %12.3f  %19ld  %12.3f %12.3f\n", teeth[t], fixed.angles, fixed.indexErrors,
+				fixed.vernierLow, fixed.vernierHigh, flt.indexErrors, flt.vernierLow, flt.vernierHigh);
+		failed |= (fixed.indexErrors != 0) || (fixed.vernierLow <= -1.0) || (fixed.vernierHigh >= 1.0);
+	}
+
+	// event delays over the RPM range, from an engine cycle angle as the event table
+	printf("\nevent delay, 50 to 12000 RPM\n");
+	printf("teeth      delays   fixed: max error (uS)   float: max error (uS)\n");
+	for (int t = 0; t < (int)(sizeof(teeth) / sizeof(teeth[0])); t++) {
+		triggerWheelTeeth = teeth[t];
+		triggerWheelToothSpacingReciprocal = ((float) teeth[t]) / 360.0F;
+		long delays = 0;
+		double fixedMax = 0.0, floatMax = 0.0;
+		for (int rpm = 50; rpm <= 12000; rpm += 10) {
+			uint32_t period = (uint32_t)lrint(60E6 / ((double)rpm * teeth[t]));
+			for (int i = 0; i < DELAY_ANGLES; i++) {
+				int32_t angle = (int32_t)(((int64_t)i * 720 * 65536) / DELAY_ANGLES) + i % 65536;
+				double vernierRef;
+				referenceIndex(angle, teeth[t], &vernierRef);
+				double delayRef = period * vernierRef;
+
+				int index;
+				int32_t vernier;
+				angleToIndexAndVernier(angle, &index, &vernier);
+				double error = fabs(eventDelay(period, (uint32_t)vernier) - delayRef);
+				fixedMax = error > fixedMax ? error : fixedMax;
+				failed |= error >= 1.0 + period / 65536.0;
+
+				float vernierF;
+				floatAngleToIndexAndVernier((float)angle / 65536.0F, &index, &vernierF);
+				error = fabs(eventDelay(period, floatEventVernier(vernierF)) - delayRef);
+				floatMax = error > floatMax ? error : floatMax;
+				delays++;
+			}
+		}
+		printf("%5d  %10ld  %21.3f  %21.3f\n", teeth[t], delays, fixedMax, floatMax);
+	}
+
+	// camshaft pulse angle
+	printf("\ncamshaft pulse angle\n");
+	printf("teeth   fixed: max error (deg)   float: max error (deg)\n");
+	for (int t = 0; t < (int)(sizeof(teeth) / sizeof(teeth[0])); t++) {
+		double fixedMax = 0.0, floatMax = 0.0;
+		for (int revolution = 0; revolution <= 1; revolution++) {
+			for (int tooth = 0; tooth < teeth[t]; tooth++) {
+				double reference = 360.0 * (revolution * teeth[t] + tooth) / teeth[t];
+				double error = reference - ((3600 * (revolution * teeth[t] + tooth)) / teeth[t]) / 10.0;
+				fixedMax = error > fixedMax ? error : fixedMax;
+				failed |= (error < 0.0) || (error >= 0.1);
+				error = fabs(reference - 360.0F * (revolution * teeth[t] + tooth) / teeth[t]);
+				floatMax = error > floatMax ? error : floatMax;
+			}
+		}
+		printf("%5d  %23.4f  %23.6f\n", teeth[t], fixedMax, floatMax);
+	}
+
+	// host time per call
+	triggerWheelTeeth = 36;
+	triggerWheelToothSpacingReciprocal = 36.0F / 360.0F;
+	volatile uint32_t sink = 0;
+	volatile uint32_t period = 3333;
+	double start = nanoseconds();
+	for (uint32_t i = 0; i < TIMING_CALLS; i++) {
+		int index;
+		int32_t vernier;
+		angleToIndexAndVernier((int32_t)((i * 4099u) % (720u * 65536)), &index, &vernier);
+		sink += index + eventDelay(period, (uint32_t)vernier);
+	}
+	double fixedTime = (nanoseconds() - start) / TIMING_CALLS;
+	start = nanoseconds();
+	for (uint32_t i = 0; i < TIMING_CALLS; i++) {
+		int index;
+		float vernier;
+		floatAngleToIndexAndVernier((float)((i * 4099u) % (720u * 65536)) / 65536.0F, &index, &vernier);
+		sink += index + eventDelay(period, floatEventVernier(vernier));
+	}
+	double floatTime = (nanoseconds() - start) / TIMING_CALLS;
+	printf("\nhost time per angle to tooth, vernier & delay conversion: fixed %.2f nS, float %.2f nS (target cycles not measured)\n",
+			fixedTime, floatTime);
+
+	if (failed != 0) {
+		printf("FAIL: a fixed point tooth index, vernier, delay or camshaft angle differs from the reference\n");
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
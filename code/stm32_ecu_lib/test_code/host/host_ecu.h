@@ -0,0 +1,36 @@
+#ifndef _hostECU
+#define _hostECU
+
+/*
+ *
+ * The ECU globals & configuration data for the host test programs in test_code/.
+ *
+ * global.c, cfg_data.c (cfPage1 with the Parameters defaults & cfTriggerPatterns) & utility_functions.c are compiled in to the
+ * program, the EEPROM & the modules cfg_data.c initialises are replaced by the no-op definitions below. A program that
+ * compiles in trigger_wheel_handler.c defines HOST_TRIGGER_WHEEL_HANDLER first, so its twInitialise() is used.
+ *
+ * Include this before the module source under test, with the stand-in HAL in test_code/host/ on the include path.
+ *
+ */
+
+#include "global.c"
+#include "cfg_data.c"
+#include "utility_functions.c"
+
+float AFRCorrection[VE_MAP_SIZE_LOAD][VE_MAP_SIZE_RPM];
+
+int nvTestEEPROMReady(void) { return 0; }
+HAL_StatusTypeDef nvEEPROMBlockWrite(uint8_t *data, uint16_t eepromAddress, int nBytes) { return HAL_ERROR; }
+HAL_StatusTypeDef nvEEPROMBlockRead(uint8_t *destPtr, uint16_t eepromAddress, int nBytes) { return HAL_ERROR; }
+
+void afInitialise(float cyclicPeriod, float correctionArray[VE_MAP_SIZE_LOAD][VE_MAP_SIZE_RPM]) {}
+void aiInitialise(float cyclicPeriod) {}
+void fuInitialise(float cyclicPeriod) {}
+void seInitialise(int disable) {}
+void vvInitialise(void) {}
+
+#ifndef HOST_TRIGGER_WHEEL_HANDLER
+void twInitialise(void) {}
+#endif
+
+#endif
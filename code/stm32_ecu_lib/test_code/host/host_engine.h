@@ -0,0 +1,262 @@
+#ifndef _hostEngine
+#define _hostEngine
+
+/*
+ *
+ * The crankshaft pulse to output path for the host test programs in test_code/.
+ *
+ * The trigger decoder, the trigger wheel handler, the event queue & the F401 ECU services (ecu_services.c), with the modules
+ * they call, are compiled in to the program on the stand-in HAL, so a program drives the firmware's own interrupt handlers.
+ *
+ * The timers are simulated. TIM2 (crankshaft trigger & stall timeout), TIM5 (event queue), TIM1 & TIM8 (compare outputs) all
+ * count at 1 MHz, from different counts as on the target. hostRunTo() advances them to a time, a compare at a time, and calls
+ * the interrupt handlers at their compares in time order, at once & without pre-emption:
+ *
+ * 		TIM2 CC3						ecuISRcrankshaftTrigger(), the stall timeout
+ * 		TIM1 CC1 - CC4 (enabled)		ecuISROutputCompare()
+ * 		TIM5 CC1, or a software CC1G	ecuISREventQueue()
+ *
+ * A TIM1 or TIM8 channel's output follows its compare mode: it's latched at a compare match in the active or inactive on
+ * match modes, and follows a forced mode. Each change latched at a match is passed to hostCompareEdge, if set. A forced change
+ * is seen by hostOutputLevel() but not passed on, as the mode may be changed again within the same call. The forced level is
+ * latched each time hostRunTo() runs on, i.e. after each interrupt, so a match mode set afterwards (e.g. the spark after the
+ * coil's dwell was forced on) changes the output from it. A forced mode replaced within the same call isn't seen.
+ *
+ * hostCrankshaftPulse() & hostCamshaftPulse() capture a pulse on TIM2 at a time & call the crankshaft interrupt.
+ * hostHFTask() does the trigger wheel part of the HF task. All times are on TIM2 (uS).
+ *
+ * Include this in place of host_ecu.h.
+ *
+ */
+
+#define HOST_TRIGGER_WHEEL_HANDLER
+#include "host_ecu.h"
+
+// the DMA addresses are 32 bit on the target
+#pragma GCC diagnostic ignored "-Wpointer-to-int-cast"
+
+#include "async_serial.c"
+#include "scheduler.c"
+#include "trigger_decoder.c"
+#include "angle_clock.c"
+#include "angle_acquisition.c"
+#include "tooth_correction.c"
+#include "trigger_logger.c"
+#include "event_queue.c"
+#include "ecu_services.c"
+#include "trigger_wheel_handler.c"
+
+// the CubeMX handles & error handler of main.c
+ADC_HandleTypeDef hadc1;
+TIM_HandleTypeDef htim2, htim3, htim12;
+CAN_HandleTypeDef hcan1;
+
+void Error_Handler(void) {
+}
+
+// the counts of TIM5, TIM1 & TIM8 from TIM2, at the start
+#define HOST_TIM5_OFFSET 0x5A5A0000u
+#define HOST_TIM1_OFFSET 0x1234u
+#define HOST_TIM8_OFFSET 0x9876u
+
+// the output of each TIM1 & TIM8 channel latched at the last compare match, 1 = active, & the edge callback
+static int hostCompareLevel[2][4];
+void (*hostCompareEdge)(TIM_TypeDef *timer, int channel, int level, uint32_t time) = NULL;
+
+
+// the compare mode (OCxM) of a timer channel, 1 to 4
+static uint32_t hostCompareMode(TIM_TypeDef *timer, int channel) {
+	uint32_t ccmr = channel <= 2 ? timer->CCMR1 : timer->CCMR2;
+	return (ccmr >> ((channel & 1) != 0 ? 4 : 12)) & 7;
+}
+
+
+// the output of a TIM1 or TIM8 channel now, 1 = active
+int hostOutputLevel(TIM_TypeDef *timer, int channel) {
+	uint32_t mode = hostCompareMode(timer, channel);
+	return mode == 5 ? 1 : (mode == 4 ? 0 : hostCompareLevel[timer == TIM8][channel - 1]);
+}
+
+
+// latches the level of each TIM1 & TIM8 channel in a forced mode
+static void hostLatchForcedLevels(void) {
+	for (int t = 0; t < 2; t++) {
+		for (int c = 1; c <= 4; c++) {
+			uint32_t mode = hostCompareMode(t == 0 ? TIM1 : TIM8, c);
+			if ( (mode == 4) || (mode == 5) ) {
+				hostCompareLevel[t][c - 1] = mode == 5;
+			}
+		}
+	}
+}
+
+
+// the time to the next match of a 16 bit compare, 1 to 65536 uS. A compare equal to the count has just been passed.
+static uint32_t hostCompareDelay16(TIM_TypeDef *timer, int channel) {
+	uint16_t delay = (uint16_t)(*(&timer->CCR1 + (channel - 1)) - timer->CNT);
+	return delay != 0 ? delay : 0x10000;
+}
+
+
+// the time to the next match of a 32 bit compare, 0 if it's passed
+static uint32_t hostCompareDelay32(uint32_t ccr, uint32_t cnt) {
+	return (int32_t)(ccr - cnt) > 0 ? ccr - cnt : 0;
+}
+
+
+// advances the timers to the time (TIM2, uS), calling the interrupt handlers at their compares
+void hostRunTo(uint32_t time) {
+
+	for (;;) {
+
+		hostLatchForcedLevels();
+
+		// an event queue compare generated by software is serviced at once
+		if ( (TIM5->EGR & TIM_EGR_CC1G) != 0 ) {
+			TIM5->EGR = 0;
+			TIM5->SR |= TIM_SR_CC1IF;
+			ecuISREventQueue();
+			continue;
+		}
+
+		// the next compare match
+		uint32_t span = time - TIM2->CNT;
+		if ((int32_t)span < 0) {
+			return;
+		}
+		uint32_t stall = (TIM2->DIER & TIM_DIER_CC3IE) != 0 ? hostCompareDelay32(TIM2->CCR3, TIM2->CNT) : 0;
+		uint32_t queue = (TIM5->DIER & TIM_DIER_CC1IE) != 0 ? hostCompareDelay32(TIM5->CCR1, TIM5->CNT) : 0;
+		uint32_t step = span;
+		if ( (stall != 0) && (stall < step) ) {
+			step = stall;
+		}
+		if ( (queue != 0) && (queue < step) ) {
+			step = queue;
+		}
+		uint32_t compare[2][4];
+		for (int t = 0; t < 2; t++) {
+			for (int c = 1; c <= 4; c++) {
+				compare[t][c - 1] = hostCompareDelay16(t == 0 ? TIM1 : TIM8, c);
+				if (compare[t][c - 1] < step) {
+					step = compare[t][c - 1];
+				}
+			}
+		}
+
+		TIM2->CNT += step;
+		TIM5->CNT += step;
+		TIM1->CNT = (TIM1->CNT + step) & 0xFFFF;
+		TIM8->CNT = (TIM8->CNT + step) & 0xFFFF;
+		hostTick = TIM2->CNT / 1000;
+		if (step == 0) {
+			return;
+		}
+
+		// the interrupts of the compares at this time, in priority order
+		if (stall == step) {
+			TIM2->SR |= TIM_SR_CC3IF;
+			ecuISRcrankshaftTrigger();
+		}
+		int outputInterrupt = 0;
+		for (int t = 0; t < 2; t++) {
+			TIM_TypeDef *timer = t == 0 ? TIM1 : TIM8;
+			for (int c = 1; c <= 4; c++) {
+				if (compare[t][c - 1] != step) {
+					continue;
+				}
+				timer->SR |= TIM_SR_CC1IF << (c - 1);
+				outputInterrupt |= (t == 0) && ((timer->DIER & (TIM_DIER_CC1IE << (c - 1))) != 0);
+				uint32_t mode = hostCompareMode(timer, c);
+				if ( ((mode == 1) || (mode == 2)) && (hostCompareLevel[t][c - 1] != (mode == 1)) ) {
+					hostCompareLevel[t][c - 1] = mode == 1;
+					if (hostCompareEdge != NULL) {
+						hostCompareEdge(timer, c, mode == 1, TIM2->CNT);
+					}
+				}
+			}
+		}
+		if (outputInterrupt != 0) {
+			ecuISROutputCompare();
+		}
+		if (queue == step) {
+			TIM5->SR |= TIM_SR_CC1IF;
+			ecuISREventQueue();
+		}
+	}
+}
+
+
+// a crankshaft pulse captured at the time (TIM2, uS)
+void hostCrankshaftPulse(uint32_t time) {
+	hostRunTo(time);
+	TIM2->CCR1 = time;
+	TIM2->SR |= TIM_SR_CC1IF;
+	ecuISRcrankshaftTrigger();
+	TIM2->SR &= ~TIM_SR_CC1IF;
+}
+
+
+// a camshaft pulse captured at the time (TIM2, uS)
+void hostCamshaftPulse(uint32_t time) {
+	hostRunTo(time);
+	TIM2->CCR2 = time;
+	TIM2->SR |= TIM_SR_CC2IF;
+	ecuISRcrankshaftTrigger();
+	TIM2->SR &= ~TIM_SR_CC2IF;
+}
+
+
+// the trigger wheel part of the HF task (cyclic_tasks.c): the RPM, then the injection pulse width (uS) & the advance (degrees)
+void hostHFTask(float pw, float advance) {
+	if (triggerWheelInSync > 0) {
+		float segmentRPM = twUpdateCrankSpeed();
+		if (segmentRPM > 0.0F) {
+			keyData.v.RPM = segmentRPM;
+		}
+		else {
+			keyData.v.RPM = crankPulsePeriodF > 0 ? rpmFromPeriod / (float)crankPulsePeriodF : 0.0F;
+		}
+	}
+	else {
+		keyData.v.RPM = 0;
+	}
+	twUpdateEventTable(pw, advance);
+}
+
+
+// starts the timers at the time (TIM2, uS) & initialises the output pins, the output services & the trigger wheel handler from cfPage1.
+// The target initialises the output services once, with the event queue empty, so the events a previous run left queued are
+// cancelled first (the events' indices are only valid once they've been initialised: the compare events in the compare mode).
+void hostStart(uint32_t time) {
+	static int started = 0;
+	for (int i = 0; (started != 0) && (i < INJECTOR_OUTPUTS); i++) {
+		eqCancel(&injectionEvent[i][0]);
+		eqCancel(&injectionEvent[i][1]);
+		if (outputMode == OUTPUT_MODE_COMPARE) {
+			eqCancel(&injectorCompareEvent[i]);
+		}
+	}
+	for (int i = 0; (started != 0) && (i < COIL_OUTPUTS); i++) {
+		eqCancel(&dwellEvent[i]);
+		eqCancel(&ignitionEvent[i]);
+		if (outputMode == OUTPUT_MODE_COMPARE) {
+			eqCancel(&coilCompareEvent[i]);
+		}
+	}
+	started = 1;
+	TIM2->CNT = time;
+	TIM5->CNT = time + HOST_TIM5_OFFSET;
+	TIM1->CNT = (time + HOST_TIM1_OFFSET) & 0xFFFF;
+	TIM8->CNT = (time + HOST_TIM8_OFFSET) & 0xFFFF;
+	hostTick = time / 1000;
+	memset(hostCompareLevel, 0, sizeof(hostCompareLevel));
+	setIOPinMapping();
+	initialiseIgnInjTimers();
+	outputMode = OUTPUT_MODE_SOFTWARE;
+	if (cfPage1.p3.outputMode == OUTPUT_MODE_COMPARE) {
+		startOutputCompareMode();
+	}
+	twInitialise();
+}
+
+#endif
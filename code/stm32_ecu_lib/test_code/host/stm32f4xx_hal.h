@@ -0,0 +1,192 @@
+#ifndef _hostHAL
+#define _hostHAL
+
+/*
+ *
+ * Host stand-in for the STM32 HAL, used by the host test programs in test_code/ in place of the CubeMX HAL (the firmware is
+ * built with USE_HAL_DRIVER defined & the real HAL on the include path).
+ *
+ * Provides the types, peripheral instances & constants the ECU library headers & the modules under test use, so a host
+ * program can include the real module source (& main.h, global.h, cfg_data.h, ecu_services.h) in a single translation unit.
+ * The peripherals are plain memory: a timer counts only when the test program writes its CNT & the HAL functions do nothing.
+ *
+ * gcc ... -Ihost -I../../Core/Inc -I<module directories> ...
+ *
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+#define __IO volatile
+
+typedef struct { __IO uint32_t MODER, OTYPER, OSPEEDR, PUPDR, IDR, ODR, BSRR, LCKR, AFR[2]; } GPIO_TypeDef;
+typedef struct { __IO uint32_t CR1, CR2, SMCR, DIER, SR, EGR, CCMR1, CCMR2, CCER, CNT, PSC, ARR, RCR, CCR1, CCR2, CCR3, CCR4, BDTR, DCR, DMAR, OR; } TIM_TypeDef;
+typedef struct { __IO uint32_t SR, DR, BRR, CR1, CR2, CR3, GTPR; } USART_TypeDef;
+typedef struct { __IO uint32_t CTRL, CYCCNT; } DWT_Type;
+typedef struct { __IO uint32_t DHCSR, DCRSR, DCRDR, DEMCR; } CoreDebug_Type;
+typedef struct { __IO uint32_t SR, CR1, CR2, SMPR1, SMPR2, JOFR1, JOFR2, JOFR3, JOFR4, HTR, LTR, SQR1, SQR2, SQR3, JSQR, JDR1, JDR2, JDR3, JDR4, DR; } ADC_TypeDef;
+typedef struct { __IO uint32_t CR, NDTR, PAR, M0AR, M1AR, FCR; } DMA_Stream_TypeDef;
+typedef struct { __IO uint32_t LISR, HISR, LIFCR, HIFCR; } DMA_TypeDef;
+
+// the peripherals, defined here as each host program is a single translation unit
+GPIO_TypeDef hostGPIO[5];
+TIM_TypeDef hostTIM[15];
+DWT_Type hostDWT;
+CoreDebug_Type hostCoreDebug;
+USART_TypeDef hostUSART[2];
+DMA_Stream_TypeDef hostDMAStream[2];
+DMA_TypeDef hostDMA[2];
+uint32_t hostTick;						// the HAL tick (mS)
+
+#define GPIOA (&hostGPIO[0])
+#define GPIOB (&hostGPIO[1])
+#define GPIOC (&hostGPIO[2])
+#define GPIOD (&hostGPIO[3])
+#define GPIOE (&hostGPIO[4])
+#define TIM1 (&hostTIM[1])
+#define TIM2 (&hostTIM[2])
+#define TIM3 (&hostTIM[3])
+#define TIM4 (&hostTIM[4])
+#define TIM5 (&hostTIM[5])
+#define TIM8 (&hostTIM[8])
+#define DWT (&hostDWT)
+#define CoreDebug (&hostCoreDebug)
+#define USART1 (&hostUSART[0])
+#define USART2 (&hostUSART[1])
+#define DMA1 (&hostDMA[0])
+#define DMA2 (&hostDMA[1])
+#define DMA1_Stream5 (&hostDMAStream[0])
+#define DMA2_Stream0 (&hostDMAStream[1])
+
+typedef enum { GPIO_PIN_RESET = 0, GPIO_PIN_SET } GPIO_PinState;
+typedef enum { HAL_OK = 0, HAL_ERROR, HAL_BUSY, HAL_TIMEOUT } HAL_StatusTypeDef;
+
+typedef enum { SysTick_IRQn = -1, DMA1_Stream5_IRQn = 16, ADC_IRQn = 18, TIM1_CC_IRQn = 27, TIM2_IRQn = 28, USART1_IRQn = 37,
+		USART2_IRQn = 38, TIM5_IRQn = 50, DMA2_Stream0_IRQn = 56 } IRQn_Type;
+
+typedef struct { ADC_TypeDef *Instance; } ADC_HandleTypeDef;
+typedef struct { DMA_Stream_TypeDef *Instance; } DMA_HandleTypeDef;
+typedef struct { TIM_TypeDef *Instance; } TIM_HandleTypeDef;
+typedef struct { USART_TypeDef *Instance; } UART_HandleTypeDef;
+typedef struct { void *Instance; } I2C_HandleTypeDef;
+typedef struct { void *Instance; } CAN_HandleTypeDef;
+typedef struct { uint32_t Pin, Mode, Pull, Speed, Alternate; } GPIO_InitTypeDef;
+typedef struct { uint32_t ICPolarity, ICSelection, ICPrescaler, ICFilter; } TIM_IC_InitTypeDef;
+
+#define GPIO_PIN_0 ((uint16_t)0x0001)
+#define GPIO_PIN_1 ((uint16_t)0x0002)
+#define GPIO_PIN_2 ((uint16_t)0x0004)
+#define GPIO_PIN_3 ((uint16_t)0x0008)
+#define GPIO_PIN_4 ((uint16_t)0x0010)
+#define GPIO_PIN_5 ((uint16_t)0x0020)
+#define GPIO_PIN_6 ((uint16_t)0x0040)
+#define GPIO_PIN_7 ((uint16_t)0x0080)
+#define GPIO_PIN_8 ((uint16_t)0x0100)
+#define GPIO_PIN_9 ((uint16_t)0x0200)
+#define GPIO_PIN_10 ((uint16_t)0x0400)
+#define GPIO_PIN_11 ((uint16_t)0x0800)
+#define GPIO_PIN_12 ((uint16_t)0x1000)
+#define GPIO_PIN_13 ((uint16_t)0x2000)
+#define GPIO_PIN_14 ((uint16_t)0x4000)
+#define GPIO_PIN_15 ((uint16_t)0x8000)
+
+#define TIM_CHANNEL_1 0x00000000U
+#define TIM_CHANNEL_2 0x00000004U
+#define TIM_CHANNEL_3 0x00000008U
+#define TIM_CHANNEL_4 0x0000000CU
+
+#define GPIO_MODE_AF_PP 0x00000002U
+#define GPIO_NOPULL 0x00000000U
+#define GPIO_PULLDOWN 0x00000002U
+#define GPIO_SPEED_FREQ_LOW 0x00000000U
+#define GPIO_SPEED_FREQ_HIGH 0x00000002U
+#define GPIO_AF1_TIM1 0x01U
+#define GPIO_AF1_TIM2 0x01U
+#define GPIO_AF3_TIM8 0x03U
+
+// register bits, as the CMSIS device header
+#define TIM_CR1_CEN (1u << 0)
+#define TIM_CR1_OPM (1u << 3)
+#define TIM_CR2_MMS (7u << 4)
+#define TIM_CR2_MMS_0 (1u << 4)
+#define TIM_CR2_MMS_1 (1u << 5)
+#define TIM_CR2_MMS_2 (1u << 6)
+#define TIM_DIER_CC1DE (1u << 9)
+#define TIM_EGR_CC1G (1u << 1)
+#define TIM_CCMR1_CC1S (3u << 0)
+#define TIM_CCMR1_OC1M (7u << 4)
+#define TIM_CCMR2_CC4S (3u << 8)
+#define TIM_CCMR2_OC4M (7u << 12)
+#define TIM_CCMR2_OC4M_0 (1u << 12)
+#define TIM_CCMR2_OC4M_2 (4u << 12)
+#define TIM_CCER_CC1E (1u << 0)
+#define TIM_CCER_CC1P (1u << 1)
+#define TIM_BDTR_MOE (1u << 15)
+#define TIM_ICPSC_DIV1 0x00000000U
+#define TIM_ICSELECTION_DIRECTTI 0x00000001U
+#define TIM_INPUTCHANNELPOLARITY_RISING 0x00000000U
+#define DMA_SxCR_EN (1u << 0)
+#define DMA_SxCR_HTIE (1u << 3)
+#define DMA_SxCR_TCIE (1u << 4)
+#define DMA_SxCR_CIRC (1u << 8)
+#define DMA_SxCR_MINC (1u << 10)
+#define DMA_SxCR_PSIZE_1 (1u << 12)
+#define DMA_SxCR_MSIZE_1 (1u << 14)
+#define DMA_SxCR_PL (3u << 16)
+#define DMA_SxCR_CHSEL_0 (1u << 25)
+#define DMA_SxCR_CHSEL_1 (1u << 26)
+#define DMA_HIFCR_CFEIF5 (1u << 6)
+#define DMA_HIFCR_CDMEIF5 (1u << 8)
+#define DMA_HIFCR_CTEIF5 (1u << 9)
+#define DMA_HIFCR_CHTIF5 (1u << 10)
+#define DMA_HIFCR_CTCIF5 (1u << 11)
+#define ADC_SR_JEOC (1u << 2)
+#define ADC_SR_JSTRT (1u << 3)
+#define ADC_CR1_JEOCIE (1u << 7)
+#define ADC_CR2_ADON (1u << 0)
+#define ADC_CR2_JEXTSEL (15u << 16)
+#define ADC_CR2_JEXTSEL_0 (1u << 16)
+#define ADC_CR2_JEXTSEL_1 (1u << 17)
+#define ADC_CR2_JEXTEN (3u << 20)
+#define ADC_CR2_JEXTEN_0 (1u << 20)
+#define ADC_JSQR_JSQ4_Pos 15
+#define CoreDebug_DEMCR_TRCENA_Msk (1u << 24)
+#define DWT_CTRL_CYCCNTENA_Msk (1u << 0)
+#define CAN_IT_RX_FIFO0_MSG_PENDING (1u << 1)
+
+#define TIM_DIER_CC1IE (1u << 1)
+#define TIM_DIER_CC2IE (1u << 2)
+#define TIM_DIER_CC3IE (1u << 3)
+#define TIM_DIER_CC4IE (1u << 4)
+#define TIM_SR_CC1IF (1u << 1)
+#define TIM_SR_CC2IF (1u << 2)
+#define TIM_SR_CC3IF (1u << 3)
+#define TIM_SR_CC4IF (1u << 4)
+
+// interrupts are never pre-empted on the host
+#define __disable_irq() do {} while (0)
+#define __enable_irq() do {} while (0)
+static inline uint32_t __get_PRIMASK(void) { return 0; }
+static inline void __set_PRIMASK(uint32_t primask) { (void)primask; }
+
+static inline void HAL_GPIO_WritePin(GPIO_TypeDef *port, uint16_t pin, GPIO_PinState state) {
+	port->ODR = state != GPIO_PIN_RESET ? port->ODR | pin : port->ODR & ~(uint32_t)pin;
+}
+static inline GPIO_PinState HAL_GPIO_ReadPin(GPIO_TypeDef *port, uint16_t pin) {
+	return (port->IDR & pin) != 0 ? GPIO_PIN_SET : GPIO_PIN_RESET;
+}
+static inline uint32_t HAL_GetTick(void) { return hostTick; }
+static inline void HAL_GPIO_Init(GPIO_TypeDef *port, GPIO_InitTypeDef *init) {}
+static inline void HAL_NVIC_SetPriority(IRQn_Type irq, uint32_t preempt, uint32_t sub) {}
+static inline void HAL_NVIC_EnableIRQ(IRQn_Type irq) {}
+static inline HAL_StatusTypeDef HAL_TIM_IC_ConfigChannel(TIM_HandleTypeDef *htim, TIM_IC_InitTypeDef *config, uint32_t channel) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_TIM_IC_Start(TIM_HandleTypeDef *htim, uint32_t channel) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_TIM_IC_Start_IT(TIM_HandleTypeDef *htim, uint32_t channel) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_TIM_PWM_Start(TIM_HandleTypeDef *htim, uint32_t channel) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_ADC_Start_DMA(ADC_HandleTypeDef *hadc, uint32_t *data, uint32_t length) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_CAN_Start(CAN_HandleTypeDef *hcan) { return HAL_OK; }
+static inline HAL_StatusTypeDef HAL_CAN_ActivateNotification(CAN_HandleTypeDef *hcan, uint32_t interrupts) { return HAL_OK; }
+#define __HAL_RCC_DMA1_CLK_ENABLE() do {} while (0)
+#define __HAL_RCC_GPIOB_CLK_ENABLE() do {} while (0)
+
+#endif
@@ -0,0 +1,310 @@
+/*
+ *
+ * Host simulation of the live pulse width update (twUpdateInjections() in trigger_wheel_handler.c, setInjectionEnd() in
+ * ecu_services.c): the injection pulse delivered when the pulse width steps at a time around an armed pulse.
+ *
+ * A 4 cylinder engine turns at a steady 1500 RPM on a 36-1 wheel with a camshaft sensor, in full sync with sequential
+ * injection starting 355 degrees before TDC. The pulses are fed to the firmware's crankshaft interrupt (host/host_engine.h) &
+ * the HF task runs every 5 mS at a 4 mS pulse width. Then the HF task runs at a time from the start of injector B's next pulse
+ * (the step) with a new pulse width, & every 5 mS from then on:
+ *
+ * 		step - uS from the start of the pulse to the step, & the new pulse width (uS)
+ * 		pulse - the width of the pulse (uS), expected & delivered. A pulse that's armed or in flight follows the new width, an
+ * 		end that has passed switches the injector off at the step. A pulse that has ended is left.
+ * 		add-on - the width of the add-on pulse from the step (uS), expected & delivered, 0 if there's none. One is added for
+ * 		more fuel after the pulse has ended, if it's at least pwAddOnMin (250 uS), plus the injector latency (500 uS), cut
+ * 		short to end by pwAddOnAngle (140 degrees) before TDC, i.e. 215 degrees after the start of the pulse.
+ * 		next - the width of the cylinder's pulse in the next cycle (uS)
+ * 		pulses - injector B's pulses from just before the pulse to half a cycle after the next, expected & delivered, i.e. the
+ * 		pulse, any add-on & the next pulse
+ *
+ * Each case is run in both output modes. The delivered pulses are timed from injector B's injection event callbacks, & in the
+ * compare mode the compare output on TIM1 CH4 must deliver the same pulse (the stand-in timers don't see an add-on pulse on
+ * the compare, as it's forced on & its end set in the same call, so the add-on is only timed from the callbacks).
+ *
+ * The pulses must be the expected widths, to the uS, or to 10 uS for an add-on cut short by the deadline, which is worked out
+ * from the filtered tooth period. The program returns non-zero otherwise.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o live_update_sim live_update_sim.c -lm
+ * ./live_update_sim
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_engine.h"
+
+
+#define ENGINE_RPM 1500.0
+#define TEETH 36
+#define CAM_ANGLE 60.0					// engine cycle angle of the camshaft pulse (revolution 0)
+#define HF_PERIOD 5000					// uS
+#define ADVANCE 10.0F					// degrees
+#define PW 4000							// pulse width before the step (uS)
+#define START_ANGLE 3550				// injection start before TDC (0.1 degrees)
+#define ADD_ON_ANGLE 1400				// Parameters 3 pwAddOnAngle (0.1 degrees)
+#define ADD_ON_MIN 250					// Parameters 3 pwAddOnMin (uS)
+#define SETTLE 1000000					// uS run before the step
+#define INJECTOR 1						// injector B, TIM1 CH4
+#define DEADLINE_TOLERANCE 10			// uS
+#define MAX_PULSES 8
+
+
+typedef struct {
+	const char *name;
+	int offset;							// uS from the start of the pulse to the step
+	int pw;								// the pulse width from the step (uS)
+} SimCase;
+
+static const SimCase cases[] = {
+	{ "armed, longer", -200, 6000 },
+	{ "armed, shorter", -200, 2500 },
+	{ "in flight, longer", 2000, 6000 },
+	{ "in flight, shorter", 2000, 3000 },
+	{ "in flight, end passed", 3000, 2000 },
+	{ "in flight, beyond compare range", 2000, 40000 },
+	{ "ended, add-on", 6000, 5000 },
+	{ "ended, add-on below minimum", 6000, 4200 },
+	{ "ended, add-on to deadline", 22000, 8000 },
+	{ "ended, too late for add-on", 23600, 8000 },
+	{ "ended, shorter", 6000, 3000 },
+};
+
+typedef struct {
+	uint32_t on[MAX_PULSES], off[MAX_PULSES];
+	int count;
+	int level;
+} PulseLog;
+
+static float enginePW;
+static uint32_t nextHF;
+
+// the engine: the next tooth & camshaft pulse
+static double engineAngle, engineTime, camAngle;
+static uint32_t engineStart;
+
+// injector B's pulses from the callbacks & from the compare, & the start of its last pulse
+static PulseLog callbackPulses, comparePulses;
+static uint32_t lastOn;
+
+
+static void logLevel(PulseLog *log, int level, uint32_t time) {
+	if (level == log->level) {
+		return;
+	}
+	log->level = level;
+	if ( (level != 0) && (log->count < MAX_PULSES) ) {
+		log->on[log->count] = time;
+	}
+	else if ( (level == 0) && (log->count < MAX_PULSES) ) {
+		log->off[log->count++] = time;
+	}
+}
+
+
+// the injection event callbacks, timing injector B's pulses
+static void recordOn(int channel) {
+	injectorPowerOn(channel);
+	if (channel == INJECTOR) {
+		lastOn = TIM2->CNT;
+		logLevel(&callbackPulses, 1, TIM2->CNT);
+	}
+}
+
+static void recordOff(int channel) {
+	injectorPowerOff(channel);
+	if (channel == INJECTOR) {
+		logLevel(&callbackPulses, 0, TIM2->CNT);
+	}
+}
+
+// the injection events just armed call the recording callbacks
+static void instrument(void) {
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		if (injectionCallback[i][0] == injectorPowerOn) {
+			injectionCallback[i][0] = recordOn;
+		}
+		if (injectionCallback[i][1] == injectorPowerOff) {
+			injectionCallback[i][1] = recordOff;
+		}
+	}
+}
+
+// injector B's compare edges, & its forced level after the HF task
+static void compareEdge(TIM_TypeDef *timer, int channel, int level, uint32_t time) {
+	if ( (timer == injectorCompare[INJECTOR].timer) && (channel == injectorCompare[INJECTOR].channel) ) {
+		logLevel(&comparePulses, level, time);
+	}
+}
+
+static void pollCompare(void) {
+	if (outputMode == OUTPUT_MODE_COMPARE) {
+		logLevel(&comparePulses, hostOutputLevel(injectorCompare[INJECTOR].timer, injectorCompare[INJECTOR].channel), TIM2->CNT);
+	}
+}
+
+
+// runs the HF task up to the time
+static void runTo(uint32_t time) {
+	while ((int32_t)(nextHF - time) <= 0) {
+		hostRunTo(nextHF);
+		hostHFTask(enginePW, ADVANCE);
+		instrument();
+		pollCompare();
+		nextHF += HF_PERIOD;
+	}
+	hostRunTo(time);
+}
+
+
+// turns the engine at a steady speed up to the time
+static void turnTo(uint32_t time) {
+	double toothAngle = 360.0 / TEETH;
+	double usPerDegree = 1E6 / (ENGINE_RPM * 6.0);
+	for (;;) {
+		double nextAngle = engineAngle + toothAngle;
+		if (camAngle < nextAngle) {
+			uint32_t camTime = engineStart + (uint32_t)lrint(engineTime + (camAngle - engineAngle) * usPerDegree);
+			if ((int32_t)(camTime - time) > 0) {
+				break;
+			}
+			runTo(camTime);
+			hostCamshaftPulse(camTime);
+			instrument();
+			camAngle += 720.0;
+		}
+		uint32_t edgeTime = engineStart + (uint32_t)lrint(engineTime + toothAngle * usPerDegree);
+		if ((int32_t)(edgeTime - time) > 0) {
+			break;
+		}
+		engineTime += toothAngle * usPerDegree;
+		engineAngle = nextAngle;
+		runTo(edgeTime);
+		if ((int)lrint(engineAngle / toothAngle) % TEETH != 0) {
+			hostCrankshaftPulse(edgeTime);
+			instrument();
+		}
+	}
+	runTo(time);
+}
+
+
+// the pulse in the log starting within 100 uS of the time, returns its width or -1
+static int pulseAt(const PulseLog *log, uint32_t time) {
+	for (int p = 0; p < log->count; p++) {
+		if (abs((int32_t)(log->on[p] - time)) <= 100) {
+			return (int)(log->off[p] - log->on[p]);
+		}
+	}
+	return -1;
+}
+
+
+// runs one case in the output mode, returns non-zero if it fails
+static int simulate(const SimCase *c, int mode) {
+
+	cfPage1.p3.twPattern = 0;
+	cfPage1.p2.twTeeth = TEETH;
+	cfPage1.p2.twMissingTeeth = 1;
+	cfPage1.p2.injectorSequenceReset = 0;
+	cfPage1.p2.injectorStartAngle = START_ANGLE / 10.0F;
+	cfPage1.p3.outputMode = mode;
+	cfPage1.p3.splitPulses = 1;
+	cfPage1.p3.injectionTiming = 0;
+	cfPage1.p3.pwUpdate = 1;
+	cfPage1.p3.pwAddOnAngle = ADD_ON_ANGLE;
+	cfPage1.p3.pwAddOnMin = ADD_ON_MIN;
+
+	engineStart = 0x40000000u;
+	engineAngle = 0.0;
+	engineTime = 0.0;
+	camAngle = CAM_ANGLE;
+	enginePW = PW;
+	hostStart(engineStart);
+	nextHF = engineStart + HF_PERIOD;
+	hostCompareEdge = compareEdge;
+	lastOn = 0;
+
+	// the step, from the start of injector B's next pulse a cycle on from its last
+	uint32_t cycle = (uint32_t)lrint(120E6 / ENGINE_RPM);
+	turnTo(engineStart + SETTLE);
+	uint32_t pulseOn = lastOn + cycle;
+	uint32_t step = pulseOn + c->offset;
+	turnTo(pulseOn - 500);
+	callbackPulses = (PulseLog) { { 0 }, { 0 }, 0, 0 };
+	comparePulses = (PulseLog) { { 0 }, { 0 }, 0, 0 };
+	turnTo(step - 1);
+	nextHF = step;
+	enginePW = (float)c->pw;
+	turnTo(pulseOn + cycle + cycle / 2);
+	hostCompareEdge = NULL;
+
+	// the expected pulse & add-on
+	int latency = (int)lrint(cfPage1.p2.injectorLatency * 1000.0);
+	int deadline = (int)lrint((START_ANGLE - ADD_ON_ANGLE) / 10.0 * 1E6 / (ENGINE_RPM * 6.0)) - c->offset;
+	int pulse = PW, addOn = 0, limited = 0;
+	if (c->offset < PW) {
+		pulse = c->pw > c->offset ? c->pw : c->offset;
+	}
+	else if ( (c->pw - PW >= ADD_ON_MIN) && (deadline - latency >= ADD_ON_MIN) ) {
+		limited = c->pw - PW > deadline - latency;
+		addOn = (limited != 0 ? deadline - latency : c->pw - PW) + latency;
+	}
+
+	// the delivered pulse, add-on & next pulse
+	int delivered = pulseAt(&callbackPulses, pulseOn);
+	int deliveredAddOn = pulseAt(&callbackPulses, step);
+	deliveredAddOn = (c->offset >= PW) && (deliveredAddOn >= 0) ? deliveredAddOn : 0;
+	int next = pulseAt(&callbackPulses, pulseOn + cycle);
+	int compare = mode == OUTPUT_MODE_COMPARE ? pulseAt(&comparePulses, pulseOn) : delivered;
+	int pulses = 2 + (addOn != 0);
+
+	printf("%-32s %-8s %6d %5d   %5d %5d   %5d %5d   %5d", c->name, mode == OUTPUT_MODE_COMPARE ? "compare" : "software",
+			c->offset, c->pw, pulse, delivered, addOn, deliveredAddOn, next);
+	if (mode == OUTPUT_MODE_COMPARE) {
+		printf(" %7d", compare);
+	}
+	else {
+		printf(" %7s", "-");
+	}
+	printf("   %5d %5d\n", pulses, callbackPulses.count);
+
+	int failed = (delivered != pulse) || (next != c->pw) || (compare != delivered) || (callbackPulses.count != pulses);
+	failed |= limited != 0 ? abs(deliveredAddOn - addOn) > DEADLINE_TOLERANCE : deliveredAddOn != addOn;
+	return failed;
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("                                           step             pulse          add-on      next  compare    pulses\n");
+	printf("case                             mode      (uS)  PW      expect  got    expect  got     pulse  pulse   expect got\n");
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		failures += simulate(&cases[c], OUTPUT_MODE_SOFTWARE);
+		failures += simulate(&cases[c], OUTPUT_MODE_COMPARE);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases where a pulse, add-on or next pulse wasn't the expected width, or a pulse was missing or extra\n",
+				failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,287 @@
+/*
+ *
+ * Host replay test of the misfire detector (misfire.c) with synthetic dropped combustion events.
+ *
+ * The cylinder segment times (720 / cylinders degrees) of an even firing engine are generated from the crankshaft kinetic
+ * energy, a degree at a time. Each firing delivers its combustion work (with cycle to cycle variation) over the 180 degrees
+ * after its TDC & the load takes a constant work per degree, so a dropped combustion event slows the crankshaft down. With
+ * more than 4 cylinders the power strokes overlap. The segment times include a fixed offset per segment (trigger wheel
+ * tolerances) & tooth capture jitter.
+ * Misfires are dropped at random. The segment times are fed to mfUpdate() through twReadSegment() & every misfire count is
+ * matched to an undetected dropped event of its cylinder within the last REPLAY_WINDOW segments:
+ *
+ * 		detection rate - misfires counted against the right cylinder / misfires dropped
+ * 		wrong cylinder - misfires counted against another cylinder while a dropped event was undetected
+ * 		false positives - misfires counted that weren't dropped, per 1000 segments
+ *
+ * 		isolated - detection rate of the misfires without another misfire in the REPLAY_WINDOW segments before or after,
+ * 		a misfire during the decision on another isn't a candidate
+ *
+ * Each case must have no wrong cylinder counts & no false positives. The cases within the operating limits in misfire.c must
+ * also detect at least their minimum rate & at least MIN_ISOLATED of the isolated misfires, the others are run to show the
+ * limits. The program returns non-zero if any case fails.
+ *
+ * misfire.c is compiled in to this file, with the ECU globals it uses replaced by the definitions below. The misfire threshold
+ * (cfPage1.p3.mfThreshold, 0.1% of segment time) is the Parameters 3 default, or the first argument.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -I../global -I../cfg_data -I../utility_functions -I../trigger_wheel_handler -I../misfire -o misfire_replay misfire_replay.c -lm
+ * ./misfire_replay [threshold]
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+
+// the ECU globals used by misfire.c, in place of global.h, cfg_data.h & utility_functions.h
+#define _global
+#define _cfg_data
+#define _utilityFunctions
+
+static struct {
+	struct {
+		float misfireCount1, misfireCount2, misfireCount3, misfireCount4;
+	} v;
+} keyData;
+
+static struct {
+	uint32_t CYCCNT;
+} dwt;
+#define DWT (&dwt)
+
+static int misfireDetected;
+#define SET_MISFIRE_DETECTED	misfireDetected = 1
+#define CLEAR_MISFIRE_DETECTED	misfireDetected = 0
+
+#define CF_MAX_CYLINDERS 8
+int twCylinders;
+
+static struct {
+	struct {
+		int mfThreshold;
+	} p3;
+} cfPage1 = { { 5 } };					// the Parameters 3 default
+
+static int limitI(int x, int lower, int upper) {
+	return x < lower ? lower : (x > upper ? upper : x);
+}
+
+#include "trigger_wheel_handler.h"
+
+// the segment queue read by mfUpdate(), one segment at a time
+static int replaySegment;
+static uint32_t replayTime;
+static int replayPending;
+
+int twReadSegment(int *segment, uint32_t *time) {
+	if (replayPending == 0) {
+		return 0;
+	}
+	replayPending = 0;
+	*segment = replaySegment;
+	*time = replayTime;
+	return 1;
+}
+
+#include "misfire.c"
+
+
+#define SEGMENTS 200000					// segments replayed for each case
+#define REPLAY_WINDOW (4 * MF_DECISION_SEGMENT * MF_STROKE_SEGMENTS)	// segments from a dropped event to its decision, at most
+#define MIN_ISOLATED 99.0				// minimum isolated detection rate (%) of the cases within the operating limits
+
+
+typedef struct {
+	const char *name;
+	int cylinders;
+	double rpm;
+	double firingEnergy;				// combustion work per 180 degrees, fraction of the crankshaft kinetic energy
+	double variation;					// cycle to cycle variation of the combustion work (standard deviation, fraction)
+	double jitter;						// segment time capture jitter (standard deviation, uS)
+	double misfireRate;					// fraction of firings dropped
+	double loadStep;					// the load work steps by this fraction of the firing work ...
+	int loadStepInterval;				// ... & back again, every loadStepInterval segments (0 = constant load)
+	double minDetection;				// minimum detection rate (%), 0 = outside the operating limits
+} ReplayCase;
+
+
+static double gaussian(void) {
+	double u1 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	double u2 = (rand() + 1.0) / (RAND_MAX + 2.0);
+	return sqrt(-2.0 * log(u1)) * cos(2.0 * M_PI * u2);
+}
+
+
+// replays one case, returns non-zero if it fails
+static int replay(const ReplayCase *c) {
+	static const double segmentOffset[CF_MAX_CYLINDERS] = { 0.004, -0.002, 0.001, -0.003, 0.002, -0.001, 0.003, -0.004 };
+	int cylinders = c->cylinders;
+	int segmentAngle = 720 / cylinders;
+	double omega = c->rpm * M_PI / 30.0;
+	double inertia = 1.0;
+	double energy0 = 0.5 * inertia * omega * omega;
+	double energy = energy0;
+	double firingWork = c->firingEnergy * energy0 * 720.0 / (180.0 * cylinders);
+	double strokeWork[CF_MAX_CYLINDERS];			// the work per degree of each cylinder's power stroke
+	static char droppedAt[SEGMENTS];				// 1 = dropped, 2 = dropped & detected
+	int dropped = 0, detected = 0, falsePositives = 0, wrongCylinder = 0, isolated = 0, isolatedDetected = 0;
+	uint32_t countN_1[MF_CYLINDERS] = { 0 };
+
+	srand(1);
+	twCylinders = cylinders;
+	mfInitialise();
+	memset((void *)mfMisfireCount, 0, sizeof(mfMisfireCount));
+	memset(droppedAt, 0, sizeof(droppedAt));
+	for (int i = 0; i < cylinders; i++) {
+		strokeWork[i] = firingWork / 180.0;
+	}
+
+	for (int n = 0; n < SEGMENTS; n++) {
+		int cylinder = n % cylinders;
+
+		// learn the baselines before misfires are dropped
+		int misfire = (n > 100 * cylinders) && ((double)rand() / RAND_MAX < c->misfireRate);
+		strokeWork[cylinder] = misfire != 0 ? 0.0 : firingWork * (1.0 + c->variation * gaussian()) / 180.0;
+
+		// the load holds the mean speed, as the engine & load torque curves or an idle speed controller would
+		double load = firingWork + (energy - energy0) * 0.1;
+		if ( (c->loadStepInterval > 0) && ((n / c->loadStepInterval) & 1) != 0 ) {
+			load += c->loadStep * firingWork;
+		}
+		load /= segmentAngle;
+
+		// a degree at a time, each cylinder's combustion work is delivered over the 180 degrees after its TDC
+		double segmentTime = 0.0;
+		for (int angle = 0; angle < segmentAngle; angle++) {
+			double work = -load;
+			for (int i = 0; i < cylinders; i++) {
+				int afterTDC = (((n - i) % cylinders + cylinders) % cylinders) * segmentAngle + angle;
+				if (afterTDC < 180) {
+					work += strokeWork[i];
+				}
+			}
+			double omegaStart = sqrt(2.0 * energy / inertia);
+			energy += work;
+			double omegaEnd = sqrt(2.0 * energy / inertia);
+			segmentTime += (M_PI / 180.0) / ((omegaStart + omegaEnd) / 2.0) * 1E6;
+		}
+
+		replaySegment = cylinder;
+		replayTime = (uint32_t)lrint(segmentTime * (1.0 + segmentOffset[cylinder]) + c->jitter * gaussian());
+		replayPending = 1;
+		mfUpdate();
+
+		droppedAt[n] = (char)misfire;
+		dropped += misfire;
+		for (int i = 0; i < MF_CYLINDERS; i++) {
+			uint32_t counted = mfMisfireCount[i] - countN_1[i];
+			countN_1[i] = mfMisfireCount[i];
+			if (counted == 0) {
+				continue;
+			}
+			// the oldest undetected dropped event of the cylinder, or of any cylinder
+			int match = -1, other = -1;
+			for (int m = n - REPLAY_WINDOW > 0 ? n - REPLAY_WINDOW : 0; m <= n; m++) {
+				if ( (droppedAt[m] == 1) && (m % cylinders == i) && (match < 0) ) {
+					match = m;
+				}
+				if ( (droppedAt[m] == 1) && (other < 0) ) {
+					other = m;
+				}
+			}
+			if (match >= 0) {
+				droppedAt[match] = 2;
+				detected++;
+			}
+			else if (other >= 0) {
+				wrongCylinder++;
+			}
+			else {
+				falsePositives++;
+			}
+		}
+	}
+
+	for (int n = 0; n < SEGMENTS; n++) {
+		if (droppedAt[n] == 0) {
+			continue;
+		}
+		int alone = 1;
+		for (int m = n - REPLAY_WINDOW; m <= n + REPLAY_WINDOW; m++) {
+			if ( (m != n) && (m >= 0) && (m < SEGMENTS) && (droppedAt[m] != 0) ) {
+				alone = 0;
+			}
+		}
+		isolated += alone;
+		isolatedDetected += alone && (droppedAt[n] == 2);
+	}
+
+	double detectionRate = dropped > 0 ? 100.0 * detected / dropped : 0.0;
+	double isolatedRate = isolated > 0 ? 100.0 * isolatedDetected / isolated : 0.0;
+	printf("%-40s dropped %5d", c->name, dropped);
+	if (dropped > 0) {
+		printf("  detection rate %5.1f%%  isolated %5.1f%%  wrong cylinder %3d", detectionRate, isolatedRate, wrongCylinder);
+	}
+	else {
+		printf("%56s", "");
+	}
+	printf("  false positives %5.2f per 1000 segments\n", 1000.0 * falsePositives / SEGMENTS);
+
+	int failed = (wrongCylinder != 0) || (falsePositives != 0);
+	if ( (dropped > 0) && (c->minDetection > 0.0) ) {
+		failed |= (detectionRate < c->minDetection) || (isolatedRate < MIN_ISOLATED);
+	}
+	return failed;
+}
+
+
+int main(int argc, char *argv[]) {
+	static const ReplayCase cases[] = {
+		{ "4 cyl idle 800 RPM, 2% misfires", 4, 800.0, 0.19, 0.05, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "4 cyl idle 800 RPM, no misfires", 4, 800.0, 0.19, 0.05, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "4 cyl idle 800 RPM, 15% comb. variation", 4, 800.0, 0.19, 0.15, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "4 cyl 3000 RPM part load, 2% misfires", 4, 3000.0, 0.034, 0.03, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "4 cyl 3000 RPM part load, no misfires", 4, 3000.0, 0.034, 0.03, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "4 cyl 3000 RPM, load steps, 2% misfires", 4, 3000.0, 0.034, 0.03, 2.0, 0.02, 0.5, 40, 0.0 },
+		{ "4 cyl 3000 RPM, load steps, no misfires", 4, 3000.0, 0.034, 0.03, 2.0, 0.0, 0.5, 40, 0.0 },
+		{ "4 cyl 6000 RPM full load, 2% misfires", 4, 6000.0, 0.02, 0.03, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "4 cyl 6000 RPM full load, no misfires", 4, 6000.0, 0.02, 0.03, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "4 cyl 6000 RPM light load, 2% misfires", 4, 6000.0, 0.005, 0.03, 2.0, 0.02, 0.0, 0, 0.0 },
+		{ "3 cyl idle 800 RPM, 2% misfires", 3, 800.0, 0.19, 0.05, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "3 cyl idle 800 RPM, no misfires", 3, 800.0, 0.19, 0.05, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "6 cyl idle 800 RPM, 2% misfires", 6, 800.0, 0.19, 0.05, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "6 cyl idle 800 RPM, no misfires", 6, 800.0, 0.19, 0.05, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "6 cyl 3000 RPM part load, 2% misfires", 6, 3000.0, 0.034, 0.03, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "8 cyl idle 800 RPM, 2% misfires", 8, 800.0, 0.19, 0.05, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "8 cyl idle 800 RPM, no misfires", 8, 800.0, 0.19, 0.05, 2.0, 0.0, 0.0, 0, 0.0 },
+		{ "8 cyl 3000 RPM part load, 2% misfires", 8, 3000.0, 0.034, 0.03, 2.0, 0.02, 0.0, 0, 85.0 },
+		{ "8 cyl 3000 RPM, load steps, no misfires", 8, 3000.0, 0.034, 0.03, 2.0, 0.0, 0.5, 40, 0.0 },
+	};
+
+	if (argc > 1) {
+		cfPage1.p3.mfThreshold = atoi(argv[1]);
+	}
+	printf("misfire threshold %.1f%% of segment time\n", cfPage1.p3.mfThreshold / 10.0);
+
+	int failures = 0;
+	for (unsigned int i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		failures += replay(&cases[i]);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases with wrong cylinder counts, false positives or detection below the minimum\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,202 @@
+/*
+ *
+ * Host check of the 32 bit output times (ecu_services.c): the edges of an injection pulse & a spark, started at an absolute
+ * crankshaft trigger timer time, against the time asked for.
+ *
+ * Each case starts the outputs at one time, with a delay to the on edge (the spark) & a pulse width, on the stand-in timers of
+ * host/host_engine.h. There are no crankshaft pulses, the outputs are started directly:
+ *
+ * 		software - injector A by startInjectionTimer(), its on & off callbacks on the event queue (TIM5, 32 bit)
+ * 		TIM1 inj - injector B by startInjectorCompare(), on & off by the TIM1 CH4 compare
+ * 		TIM1 coil, TIM8 coil - coils A & B forced on by startCoilCompareDwell(), then sparked by startCoilCompareSpark() on the
+ * 		TIM1 CH1 & TIM8 CH4 compares
+ *
+ * The delays & widths are either side of the compare extension's limits, COMPARE_ARM_AHEAD (0x3000) & COMPARE_MAX_AHEAD
+ * (0x6000): an edge further ahead than COMPARE_MAX_AHEAD is set on the 16 bit compare by an event COMPARE_ARM_AHEAD before it's
+ * due. Others are beyond the 16 bit compare timers (2^16 uS & more), up to the 2^31 uS limit. Each case is run from three
+ * start times, so the pulse spans the wrap of the 32 bit crankshaft trigger timer (TIM2), the wrap of the event queue timer
+ * (TIM5), or neither. The compare timers wrap many times in the longer cases. The outputs aren't stopped between the runs, so
+ * each run sees the last run's spark times from far round the 32 bit timer, as the first dwell after the engine has been
+ * stopped for 2^31 uS or more.
+ *
+ * 		error - the largest difference (uS) between an edge & its time over the three runs, of each output's on & off edge
+ * 		edges - edges that were missing or extra, over the three runs
+ *
+ * Every edge must be at its time exactly (the timers' resolution is 1 uS), once, & the outputs must be off at the end of each
+ * run. The program returns non-zero otherwise.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o output_timing_check output_timing_check.c -lm
+ * ./output_timing_check
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_engine.h"
+
+
+#define SOFTWARE_INJECTOR 0				// injector A, not on a timer channel
+#define COMPARE_INJECTOR 1				// injector B, TIM1 CH4
+#define TIM1_COIL 0						// coil A, TIM1 CH1
+#define TIM8_COIL 1						// coil B, TIM8 CH4
+#define SETTLE 1000						// uS run on after the last edge
+#define MID_START 0x10000000u			// start time of the run that doesn't span a wrap
+
+// the outputs checked, & their on & off edges
+#define OUTPUTS 4
+#define EDGES (2 * OUTPUTS)
+
+
+typedef struct {
+	uint32_t delay;						// uS from the start to the on edge, or the spark
+	uint32_t width;						// uS pulse width
+} CheckCase;
+
+static const CheckCase cases[] = {
+	{ 1, 1 },
+	{ 0x2FFF, 0x2FFF },
+	{ 0x3000, 0x3000 },
+	{ 0x3001, 0x3001 },
+	{ 0x5FFF, 0x5FFF },
+	{ 0x6000, 0x6000 },
+	{ 0x6001, 0x6001 },
+	{ 0x6001, 0x6000 },
+	{ 0x6000, 0x6001 },
+	{ 0x7FFF, 0x8000 },
+	{ 0x8000, 0x7FFF },
+	{ 0xFFFF, 0xFFFF },
+	{ 0x10000, 0x10000 },
+	{ 0x10001, 0x10001 },
+	{ 0x12345, 0x1FFFF },
+	{ 1000000, 250000 },
+	{ 0x40000000, 0x100000 },
+	{ 0x7FF00000, 0x10000 },
+};
+
+// the edge times recorded in a run (TIM2, uS) & the number of each
+static uint32_t edgeTime[EDGES];
+static int edgeCount[EDGES];
+
+
+static void recordEdge(int edge) {
+	edgeTime[edge] = TIM2->CNT;
+	edgeCount[edge]++;
+}
+
+static void softwareOn(int channel) {
+	recordEdge(0);
+}
+
+static void softwareOff(int channel) {
+	recordEdge(1);
+}
+
+// the compare outputs' edges, the coils are on from their dwell so only the spark is seen
+static void compareEdge(TIM_TypeDef *timer, int channel, int level, uint32_t time) {
+	const OutputCompareChannel *outputs[3] = { &injectorCompare[COMPARE_INJECTOR], &coilCompare[TIM1_COIL], &coilCompare[TIM8_COIL] };
+	for (int i = 0; i < 3; i++) {
+		if ( (outputs[i]->timer == timer) && (outputs[i]->channel == channel) ) {
+			int edge = 2 * (i + 1) + (level == 0);
+			edgeTime[edge] = time;
+			edgeCount[edge]++;
+		}
+	}
+}
+
+
+// one run from the start time, adds each edge's error to the largest & returns the missing or extra edges
+static int run(const CheckCase *c, uint32_t start, uint32_t errorMax[EDGES]) {
+
+	hostStart(start);
+	hostCompareEdge = compareEdge;
+	for (int i = 0; i < EDGES; i++) {
+		edgeCount[i] = 0;
+	}
+
+	uint32_t on = start + c->delay;
+	startInjectionTimer(SOFTWARE_INJECTOR, on, c->width, softwareOn, softwareOff);
+	startInjectorCompare(COMPARE_INJECTOR, on, c->width);
+	startCoilCompareDwell(TIM1_COIL);
+	startCoilCompareDwell(TIM8_COIL);
+	hostRunTo(start);
+	startCoilCompareSpark(TIM1_COIL, on);
+	startCoilCompareSpark(TIM8_COIL, on);
+	hostRunTo(on + c->width + SETTLE);
+	hostCompareEdge = NULL;
+
+	// the expected edges, the coils only spark
+	const uint32_t expected[EDGES] = { on, on + c->width, on, on + c->width, 0, on, 0, on };
+	const int count[EDGES] = { 1, 1, 1, 1, 0, 1, 0, 1 };
+	int wrong = 0;
+	for (int i = 0; i < EDGES; i++) {
+		wrong += abs(edgeCount[i] - count[i]);
+		if ( (count[i] != 0) && (edgeCount[i] != 0) ) {
+			uint32_t error = (uint32_t)abs((int32_t)(edgeTime[i] - expected[i]));
+			errorMax[i] = error > errorMax[i] ? error : errorMax[i];
+		}
+	}
+	wrong += hostOutputLevel(injectorCompare[COMPARE_INJECTOR].timer, injectorCompare[COMPARE_INJECTOR].channel);
+	wrong += hostOutputLevel(coilCompare[TIM1_COIL].timer, coilCompare[TIM1_COIL].channel);
+	wrong += hostOutputLevel(coilCompare[TIM8_COIL].timer, coilCompare[TIM8_COIL].channel);
+	return wrong;
+}
+
+
+// runs one case from the three start times, returns non-zero if it fails
+static int check(const CheckCase *c) {
+
+	uint32_t half = (uint32_t)(((uint64_t)c->delay + c->width) / 2);
+	const uint32_t starts[3] = { MID_START, 0u - half, 0u - HOST_TIM5_OFFSET - half };
+	uint32_t errorMax[EDGES] = { 0 };
+	int wrong = 0;
+	for (int s = 0; s < 3; s++) {
+		wrong += run(c, starts[s], errorMax);
+	}
+
+	printf("0x%08lX 0x%08lX   %4lu %4lu   %4lu %4lu   %5lu   %5lu   %5d\n", (unsigned long)c->delay, (unsigned long)c->width,
+			(unsigned long)errorMax[0], (unsigned long)errorMax[1], (unsigned long)errorMax[2], (unsigned long)errorMax[3],
+			(unsigned long)errorMax[5], (unsigned long)errorMax[7], wrong);
+
+	int failed = wrong != 0;
+	for (int i = 0; i < EDGES; i++) {
+		failed |= errorMax[i] != 0;
+	}
+	return failed;
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	cfPage1.p3.outputMode = OUTPUT_MODE_COMPARE;
+	cfPage1.p2.ignitionFiringSense = 1;
+
+	printf("                        software     TIM1 inj    TIM1    TIM8\n");
+	printf("                        error (uS)  error (uS)   coil    coil\n");
+	printf("delay      width         on  off     on  off   spark   spark   edges\n");
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		failures += check(&cases[c]);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases with an edge off its time, a missing or extra edge, or an output left on\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
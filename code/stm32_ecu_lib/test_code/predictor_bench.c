@@ -0,0 +1,178 @@
+/*
+ *
+ * Host benchmark of the tooth period predictor (trigger_wheel_handler.c twPredictToothPeriod()) against the filtered period
+ * (crankPulsePeriodF) it replaced in the injection & ignition delay calculation.
+ *
+ * Crankshaft traces are generated on a 36-1 trigger wheel, with the firing ripple of a 4 cylinder engine. At each tooth an event
+ * is placed at 1/4, 1/2, 3/4 & all of the way to the next tooth, and the delay calculated from each period is compared with the
+ * time the crankshaft actually takes to reach the event. The errors are reported in crank degrees.
+ *
+ * The predictor is the firmware's (trigger_wheel_handler/tooth_period_predictor.h), with the firmware's fallback to the last
+ * period below the cranking threshold. The program returns non-zero if the predicted period has a larger maximum or rms error
+ * than the filtered period on any of the acceleration traces or the cranking trace.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -I../trigger_wheel_handler -o predictor_bench predictor_bench.c -lm && ./predictor_bench
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "tooth_period_predictor.h"
+
+
+#define WHEEL_TEETH 36
+#define MISSING_TOOTH 35				// tooth position with no tooth
+#define TOOTH_ANGLE (360.0 / WHEEL_TEETH)
+#define STEPS_PER_DEGREE 10				// resolution of the simulated crankshaft
+#define FILTER_SHIFT 3					// cfPage1.filters.crankshaftPulseFilter default
+
+#define CRANKING_THRESHOLD 500.0		// cfPage1.p1.crankingThreshold default (RPM)
+
+static tpHistory twPeriodHistory;
+
+
+typedef struct {
+	const char *name;
+	double rpmStart;
+	double rpmEnd;
+	double duration;			// time to change from the start to the end RPM (s)
+	double ripple;				// peak firing ripple, fraction of the RPM
+	int checked;				// the predicted period must be no worse than the filtered period
+} Trace;
+
+typedef struct {
+	double max;
+	double sumSquares;
+	int n;
+} ErrorStats;
+
+
+static void addError(ErrorStats *stats, double error){
+	if (fabs(error) > stats->max) {
+		stats->max = fabs(error);
+	}
+	stats->sumSquares += error * error;
+	stats->n++;
+}
+
+
+// the crankshaft time (s) at every 1/STEPS_PER_DEGREE degree, the RPM ramps linearly in time with the firing ripple on top
+static double *simulateCrankshaft(const Trace *trace, long *steps){
+	long size = 1000000, n = 0;
+	double *time = malloc(size * sizeof(double));
+	double t = 0.0, dAngle = 1.0 / STEPS_PER_DEGREE;
+
+	// two revolutions to settle at the start RPM, then the ramp & two more revolutions
+	double settle = 720.0 / (6.0 * trace->rpmStart);
+	while (t < settle + trace->duration + 720.0 / (6.0 * trace->rpmEnd)) {
+		if (n == size) {
+			size *= 2;
+			time = realloc(time, size * sizeof(double));
+		}
+		time[n] = t;
+		double ramp = t < settle ? 0.0 : (t - settle < trace->duration ? (t - settle) / trace->duration : 1.0);
+		double rpm = trace->rpmStart + (trace->rpmEnd - trace->rpmStart) * ramp;
+		double angle = n * dAngle;
+		rpm *= 1.0 + trace->ripple * sin(2.0 * angle * M_PI / 180.0);
+		t += dAngle / (6.0 * rpm);
+		n++;
+	}
+	*steps = n;
+	return time;
+}
+
+
+// returns non-zero if the predicted period is worse than the filtered period on a checked trace
+static int runTrace(const Trace *trace){
+	long steps;
+	double *time = simulateCrankshaft(trace, &steps);
+	int stepsPerTooth = (int)(TOOTH_ANGLE * STEPS_PER_DEGREE);
+	ErrorStats oldPath = { 0 }, newPath = { 0 };
+	int filterN_1 = 0;
+	uint32_t lastTime = 0;
+	int lastTooth = -1;
+
+	tpRestart(&twPeriodHistory);
+
+	for (long step = 0; step + 3 * stepsPerTooth < steps; step += stepsPerTooth) {
+		int tooth = (int)((step / stepsPerTooth) % WHEEL_TEETH);
+		if (tooth == MISSING_TOOTH) {
+			continue;
+		}
+		uint32_t pulseTime = (uint32_t)lrint(time[step] * 1E6);
+		if (lastTooth >= 0) {
+			int gap = (tooth - lastTooth + WHEEL_TEETH) % WHEEL_TEETH;
+			int period = (int)(pulseTime - lastTime);
+			tpRecordPeriod(&twPeriodHistory, (uint32_t)period / gap);
+			if (gap == 1) {
+				// the filtered period, of full tooth periods only
+				int filterTemp = (((period << FILTER_SHIFT) - filterN_1) >> FILTER_SHIFT) + filterN_1;
+				filterN_1 = filterTemp;
+			}
+		}
+		lastTooth = tooth;
+		lastTime = pulseTime;
+
+		// start measuring after the filter & the predictor history have settled
+		if (time[step] < 360.0 / (6.0 * trace->rpmStart)) {
+			continue;
+		}
+
+		int filteredPeriod = filterN_1 >> FILTER_SHIFT;
+		// as twPredictToothPeriod(), the last period below the cranking threshold (the HF task's RPM is from the filtered period)
+		double rpm = filteredPeriod > 0 ? 60E6 / ((double)filteredPeriod * WHEEL_TEETH) : 0.0;
+		uint32_t predictedPeriod = tpPredictPeriod(&twPeriodHistory, rpm > CRANKING_THRESHOLD);
+
+		// events up to the next tooth, which is 2 tooth spacings on before the missing tooth
+		int span = (tooth + 1) % WHEEL_TEETH == MISSING_TOOTH ? 2 : 1;
+		for (int quarter = 1; quarter <= 4 * span; quarter++) {
+			long eventStep = step + (long)quarter * stepsPerTooth / 4;
+			double actualDelay = time[eventStep] - time[step];
+			double localPeriod = (time[eventStep] - time[eventStep - stepsPerTooth / 4]) * 4.0;
+			double vernier = quarter / 4.0;
+			addError(&oldPath, (filteredPeriod * vernier * 1E-6 - actualDelay) / localPeriod * TOOTH_ANGLE);
+			addError(&newPath, (predictedPeriod * vernier * 1E-6 - actualDelay) / localPeriod * TOOTH_ANGLE);
+		}
+	}
+
+	printf("%-38s filtered period: max %6.2f rms %5.2f deg   predicted period: max %6.2f rms %5.2f deg\n", trace->name,
+			oldPath.max, sqrt(oldPath.sumSquares / oldPath.n), newPath.max, sqrt(newPath.sumSquares / newPath.n));
+	free(time);
+
+	return (trace->checked != 0) && ( (newPath.max > oldPath.max) || (newPath.sumSquares > oldPath.sumSquares) );
+}
+
+
+int main(void){
+	static const Trace traces[] = {
+		{ "steady 3000 RPM, 2% ripple", 3000.0, 3000.0, 0.5, 0.02, 0 },
+		{ "free rev 1500 - 7000 RPM in 0.5s", 1500.0, 7000.0, 0.5, 0.0, 1 },
+		{ "free rev 1500 - 7000 RPM, 2% ripple", 1500.0, 7000.0, 0.5, 0.02, 1 },
+		{ "acceleration 1000 - 6000 RPM in 2s", 1000.0, 6000.0, 2.0, 0.02, 1 },
+		{ "deceleration 7000 - 1500 RPM in 1s", 7000.0, 1500.0, 1.0, 0.02, 1 },
+		{ "cranking 250 RPM, 20% ripple", 250.0, 250.0, 2.0, 0.20, 1 },
+	};
+
+	int failures = 0;
+	for (unsigned int i = 0; i < sizeof(traces) / sizeof(traces[0]); i++) {
+		failures += runTrace(&traces[i]);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: the predicted period is worse than the filtered period on %d traces\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,276 @@
+/*
+ *
+ * Host simulation of split injection (trigger_wheel_handler.c): the pulses per cycle chosen by twSplitPulsesFit() against a
+ * reference fit, & the pulses the injectors deliver.
+ *
+ * A 4 cylinder engine turns at a steady speed, with a small speed ripple, on an N-M wheel with a camshaft sensor, so it's in
+ * full sync with sequential injection. The pulses are fed to the firmware's crankshaft interrupt (host/host_engine.h) & the
+ * HF task runs every 5 mS. The injection is split below splitRPM, into the pulses of each split configuration, at a pulse
+ * width either side of the longest that fits:
+ *
+ * 		limit - the reference's longest pulse width (uS) that splits: each pulse must end a tooth period before the tooth that
+ * 		fires the next pulse, which can be the longest gap in the pattern (4 x (M + 1) quarter teeth) before it, at the nominal
+ * 		speed. The fit itself uses the filtered tooth period, so the cases are well either side of the limit.
+ * 		pulses - the pulses per cycle the reference expects, the firmware chose (twInjectionPulses) & the injectors delivered
+ * 		on average over the last second, from the injection event callbacks of all four injectors
+ * 		wrong - delivered pulses that weren't one of the split pulse widths (twCylinderPW), e.g. cut short by the next pulse
+ * 		gap - the shortest time from the end of a pulse to the start of the injector's next pulse, in tooth periods
+ *
+ * The firmware must choose the reference's pulses, each injector must deliver them every cycle, every pulse at its full width,
+ * & a split injector must be off for at least a tooth period between its pulses, i.e. it's idle when the next pulse is armed.
+ * The program returns non-zero otherwise.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o split_injection_sim split_injection_sim.c -lm
+ * ./split_injection_sim
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_engine.h"
+
+
+#define RIPPLE 0.01						// peak speed variation, fraction of the mean speed
+#define RUN_TIME 3000000				// uS per case
+#define WINDOW 1000000					// uS at the end of the run the pulses are counted over
+#define CAM_ANGLE 60.0					// engine cycle angle of the camshaft pulse (revolution 0)
+#define HF_PERIOD 5000					// uS
+#define ADVANCE 10.0F					// degrees
+#define MAX_PULSES 512					// pulses recorded per injector
+
+
+typedef struct {
+	const char *name;
+	int pulses;
+	int fraction[CF_MAX_INJECTION_PULSES];	// Parameters 3 splitFraction (%)
+	int angle[CF_MAX_INJECTION_PULSES];		// Parameters 3 splitAngle (0.1 degrees)
+} SplitConfig;
+
+typedef struct {
+	int teeth, missing;					// N-M wheel
+	double rpm;
+	const SplitConfig *split;
+	double pwLimit;						// the pulse width, as a fraction of the reference limit
+} SimCase;
+
+static const SplitConfig threePulses = { "3 at 420/240/60", 3, { 34, 33, 33 }, { 4200, 2400, 600 } };
+static const SplitConfig twoPulses = { "2 at 360/180", 2, { 50, 50, 0 }, { 3600, 1800, 0 } };
+
+static const SimCase cases[] = {
+	{ 36, 1, 3000, &threePulses, 0.9 },
+	{ 36, 1, 3000, &threePulses, 1.1 },
+	{ 36, 1, 6000, &threePulses, 0.9 },
+	{ 36, 1, 6000, &threePulses, 1.1 },
+	{ 60, 2, 6000, &threePulses, 0.9 },
+	{ 60, 2, 6000, &threePulses, 1.1 },
+	{ 36, 1, 6000, &twoPulses, 0.9 },
+	{ 36, 1, 6000, &twoPulses, 1.1 },
+	{ 60, 2, 8000, &twoPulses, 0.5 },
+	{ 60, 2, 8000, &twoPulses, 2.0 },
+};
+
+static double engineRPM;
+static float enginePW;
+static uint32_t nextHF;
+static uint32_t windowStart;
+
+// each injector's pulses recorded in the window (TIM2, uS), & the time it last switched on
+static uint32_t pulseOn[INJECTOR_OUTPUTS][MAX_PULSES], pulseOff[INJECTOR_OUTPUTS][MAX_PULSES];
+static int pulseCount[INJECTOR_OUTPUTS];
+static uint32_t onTime[INJECTOR_OUTPUTS];
+static int injectorOn[INJECTOR_OUTPUTS];
+
+
+// the time (uS) the crankshaft takes to turn from one angle to another (degrees)
+static double turnTime(double from, double to) {
+	double time = 0.0;
+	double step = (to - from) / 16.0;
+	for (int i = 0; i < 16; i++) {
+		double angle = from + (i + 0.5) * step;
+		time += step / (engineRPM * (1.0 + RIPPLE * sin(2.0 * angle * M_PI / 180.0)) * 6.0) * 1E6;
+	}
+	return time;
+}
+
+
+// the injection event callbacks, timing each injector's pulses
+static void recordOn(int channel) {
+	injectorPowerOn(channel);
+	onTime[channel] = TIM2->CNT;
+	injectorOn[channel] = 1;
+}
+
+static void recordOff(int channel) {
+	injectorPowerOff(channel);
+	if ( (injectorOn[channel] != 0) && ((int32_t)(onTime[channel] - windowStart) >= 0) && (pulseCount[channel] < MAX_PULSES) ) {
+		pulseOn[channel][pulseCount[channel]] = onTime[channel];
+		pulseOff[channel][pulseCount[channel]] = TIM2->CNT;
+		pulseCount[channel]++;
+	}
+	injectorOn[channel] = 0;
+}
+
+// the injection events just armed call the recording callbacks
+static void instrument(void) {
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		if (injectionCallback[i][0] == injectorPowerOn) {
+			injectionCallback[i][0] = recordOn;
+		}
+		if (injectionCallback[i][1] == injectorPowerOff) {
+			injectionCallback[i][1] = recordOff;
+		}
+	}
+}
+
+
+// runs the HF task up to the time
+static void runTo(uint32_t time) {
+	while ((int32_t)(nextHF - time) <= 0) {
+		hostRunTo(nextHF);
+		hostHFTask(enginePW, ADVANCE);
+		instrument();
+		nextHF += HF_PERIOD;
+	}
+	hostRunTo(time);
+}
+
+
+// the reference's longest pulse width (uS) that splits, at the nominal speed
+static double referenceLimit(const SimCase *c, double latency) {
+	double usPerDegree = 1E6 / (c->rpm * 6.0);
+	double margin = (4.0 * (c->missing + 1) + 4.0) / 4.0 * 360.0 / c->teeth;
+	int total = 0;
+	for (int k = 0; k < c->split->pulses; k++) {
+		total += c->split->fraction[k];
+	}
+	double fuel = 1E9;
+	for (int k = 0; k < c->split->pulses; k++) {
+		int next = (k + 1) % c->split->pulses;
+		double gap = (c->split->angle[k] - c->split->angle[next]) / 10.0 + (next == 0 ? 720.0 : 0.0);
+		double share = (double)c->split->fraction[k] / total;
+		double limit = ((gap - margin) * usPerDegree - latency) / share;
+		fuel = limit < fuel ? limit : fuel;
+	}
+	return fuel + latency;
+}
+
+
+// runs one case, returns non-zero if it fails
+static int simulate(const SimCase *c) {
+
+	uint32_t start = 0x30000000u;
+	cfPage1.p3.twPattern = 0;
+	cfPage1.p2.twTeeth = c->teeth;
+	cfPage1.p2.twMissingTeeth = c->missing;
+	cfPage1.p2.injectorSequenceReset = 0;
+	cfPage1.p3.outputMode = OUTPUT_MODE_SOFTWARE;
+	cfPage1.p3.pwUpdate = 0;
+	cfPage1.p3.injectionTiming = 0;
+	cfPage1.p3.splitPulses = c->split->pulses;
+	cfPage1.p3.splitRPM = 20000;
+	cfPage1.p3.splitLoad = 0;
+	for (int k = 0; k < CF_MAX_INJECTION_PULSES; k++) {
+		cfPage1.p3.splitFraction[k] = c->split->fraction[k];
+		cfPage1.p3.splitAngle[k] = c->split->angle[k];
+	}
+	double latency = cfPage1.p2.injectorLatency * 1000.0;
+	double limit = referenceLimit(c, latency);
+	int expected = c->pwLimit < 1.0 ? c->split->pulses : 1;
+	engineRPM = c->rpm;
+	enginePW = (float)lrint(limit * c->pwLimit);
+
+	hostStart(start);
+	nextHF = start + HF_PERIOD;
+	windowStart = start + RUN_TIME - WINDOW;
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		pulseCount[i] = 0;
+		injectorOn[i] = 0;
+	}
+
+	double toothAngle = 360.0 / c->teeth;
+	double angle = 0.0, time = 0.0;
+	double camAngle = CAM_ANGLE;
+	while (time < RUN_TIME) {
+		double nextAngle = angle + toothAngle;
+		if (camAngle < nextAngle) {
+			uint32_t camTime = start + (uint32_t)lrint(time + turnTime(angle, camAngle));
+			runTo(camTime);
+			hostCamshaftPulse(camTime);
+			instrument();
+			camAngle += 720.0;
+		}
+		time += turnTime(angle, nextAngle);
+		angle = nextAngle;
+		uint32_t edgeTime = start + (uint32_t)lrint(time);
+		runTo(edgeTime);
+		if ((int)lrint(angle / toothAngle) % c->teeth >= c->missing) {
+			hostCrankshaftPulse(edgeTime);
+			instrument();
+		}
+	}
+
+	// the pulses delivered: each a split pulse width, & the gaps between them
+	double cycles = (WINDOW / 1E6) * c->rpm / 120.0;
+	double toothPeriod = 60E6 / (c->rpm * c->teeth);
+	int delivered = 0, wrong = 0;
+	double gapMin = 1E9;
+	for (int i = 0; i < INJECTOR_OUTPUTS; i++) {
+		delivered += pulseCount[i];
+		for (int p = 0; p < pulseCount[i]; p++) {
+			uint32_t width = pulseOff[i][p] - pulseOn[i][p];
+			int match = 0;
+			for (int k = 0; k < twInjectionPulses; k++) {
+				match |= width == twCylinderPW[0][k];
+			}
+			wrong += match == 0;
+			if (p > 0) {
+				double gap = (int32_t)(pulseOn[i][p] - pulseOff[i][p - 1]) / toothPeriod;
+				gapMin = gap < gapMin ? gap : gapMin;
+			}
+		}
+	}
+	double perCycle = delivered / (INJECTOR_OUTPUTS * cycles);
+
+	char name[40];
+	snprintf(name, sizeof(name), "%d-%d %4.0f RPM, %s", c->teeth, c->missing, c->rpm, c->split->name);
+	printf("%-36s %6.0f %6.0f   %4d %4d %6.2f   %5d   %6.1f\n", name, limit, enginePW, expected, twInjectionPulses, perCycle,
+			wrong, gapMin);
+
+	int failed = (twInjectionPulses != expected) || (fabs(perCycle - expected) > 1.0 / cycles) || (wrong != 0) || (delivered == 0);
+	failed |= (expected > 1) && (gapMin < 1.0 - RIPPLE * 2.0);
+	return failed;
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("                                      limit     PW      pulses / cycle   wrong     gap\n");
+	printf("wheel, speed, split                    (uS)   (uS)    ref  set  delivered        (teeth)\n");
+	for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+		failures += simulate(&cases[c]);
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases where the split differs from the reference, or the pulses weren't delivered in full, each cycle\n",
+				failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,228 @@
+/*
+ *
+ * Host simulation of the crankshaft stall timeout (the stall compare armed at every pulse in trigger_wheel_handler.c, serviced
+ * by the crankshaft interrupt in ecu_services.c).
+ *
+ * The crankshaft turns at a steady speed with compression ripple, with the injectors & coils firing, then stops dead at a random
+ * angle between two tooth edges. The pulses are fed to the firmware's crankshaft interrupt (host/host_engine.h), the HF task
+ * runs every 5 mS & the stall compare on TIM2 CC3 calls the interrupt when it's reached, as on the target:
+ *
+ * 		timeout - mS from the last tooth edge to the stall handler (crankshaftStallLatency), & in tooth periods
+ * 		overdue - mS from the time the next edge was due, had the crankshaft turned on, to the stall handler
+ * 		outputs on - stalls with an injector or coil output on at the stall, i.e. cut by the stall handler
+ *
+ * Each stall must be detected once, without a stall while the crankshaft turns, and clear the RPM at the next HF task. In the
+ * compare output mode the injector & coil outputs on timer channels are simulated, and must be off once the stall is handled
+ * and stay off until the next start. (In the software output mode the outputs are BSRR stores, which the stand-in HAL doesn't
+ * latch, so they're not checked.) The program returns non-zero otherwise.
+ *
+ * The cycles of the stall handler (crankshaftStallCycles) are only meaningful on the target, where DWT->CYCCNT counts; they're
+ * not measured here.
+ *
+ * This is a host program, not part of the firmware build (the firmware is built with USE_HAL_DRIVER defined).
+ *
+ * gcc -O2 -Ihost -I../../Core/Inc -I../global -I../cfg_data -I../utility_functions -I../nvm -I../ecu_main -I../fuel_injection
+ *     -I../auto_afr -I../trigger_wheel_handler -I../auto_idle -I../sensors -I../vvt_controller -I../trigger_decoder
+ *     -I../trigger_logger -I../angle_clock -I../angle_acquisition -I../tooth_correction -I../event_queue -I../scheduler
+ *     -I../ecu_services_f401 -I../async_serial_f401 -o stall_latency_sim stall_latency_sim.c -lm
+ * ./stall_latency_sim
+ *
+ */
+
+
+
+#ifndef USE_HAL_DRIVER
+
+#include <stdio.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <math.h>
+
+#include "host_engine.h"
+
+
+#define RUNS 200						// stalls per case
+#define RUN_REVOLUTIONS 8				// crankshaft revolutions before the stall, plus a random part of a revolution
+#define HF_PERIOD 5000					// uS
+#define STEP 100						// uS, the output check interval after the stall
+#define OFF_TIME 300000					// uS after the stall the outputs are checked for
+#define PW 6000.0F						// injection pulse width (uS)
+#define ADVANCE 10.0F					// degrees
+
+
+typedef struct {
+	const char *name;
+	int teeth, missing;					// N-M wheel
+} SimPattern;
+
+typedef struct {
+	const char *name;
+	double rpm;							// 0 = the cranking threshold (Parameters 1 crankingThreshold)
+	double ripple;						// peak speed variation, fraction of the mean speed
+	int outputMode;						// Parameters 3 outputMode
+} SimCase;
+
+static const SimPattern patterns[] = {
+	{ "36-1", 36, 1 },
+	{ "60-2", 60, 2 },
+};
+
+static const SimCase cases[] = {
+	{ "cranking 250 RPM", 250, 0.20, OUTPUT_MODE_SOFTWARE },
+	{ "cranking threshold", 0, 0.10, OUTPUT_MODE_SOFTWARE },
+	{ "cranking threshold, compare", 0, 0.10, OUTPUT_MODE_COMPARE },
+	{ "running 3000 RPM, compare", 3000, 0.02, OUTPUT_MODE_COMPARE },
+};
+
+static uint32_t simTime = 0x10000000u;
+static uint32_t nextHF;
+
+
+static double uniform(void) {
+	return (double)rand() / RAND_MAX;
+}
+
+
+// the time (uS) the crankshaft takes to turn from one angle to another (degrees)
+static double turnTime(double rpm, double ripple, double from, double to) {
+	double time = 0.0;
+	double step = (to - from) / 16.0;
+	for (int i = 0; i < 16; i++) {
+		double angle = from + (i + 0.5) * step;
+		time += step / (rpm * (1.0 + ripple * sin(2.0 * angle * M_PI / 180.0)) * 6.0) * 1E6;
+	}
+	return time;
+}
+
+
+// runs the HF task up to the time
+static void runTo(uint32_t time) {
+	while ((int32_t)(nextHF - time) <= 0) {
+		hostRunTo(nextHF);
+		hostHFTask(PW, ADVANCE);
+		nextHF += HF_PERIOD;
+	}
+	hostRunTo(time);
+}
+
+
+// the number of injector & coil outputs on timer channels that are on
+static int outputsOn(void) {
+	int on = 0;
+	for (int i = 0; i < INJECTOR_OUTPUTS + COIL_OUTPUTS; i++) {
+		const OutputCompareChannel *oc = i < INJECTOR_OUTPUTS ? &injectorCompare[i] : &coilCompare[i - INJECTOR_OUTPUTS];
+		if (oc->channel != 0) {
+			on += hostOutputLevel(oc->timer, oc->channel);
+		}
+	}
+	return on;
+}
+
+
+// runs the stalls of one case, returns non-zero if it fails
+static int simulate(const SimPattern *p, const SimCase *c) {
+
+	cfPage1.p2.twTeeth = p->teeth;
+	cfPage1.p2.twMissingTeeth = p->missing;
+	cfPage1.p3.outputMode = c->outputMode;
+	hostStart(simTime);
+	nextHF = simTime + HF_PERIOD;
+	int compare = c->outputMode == OUTPUT_MODE_COMPARE;
+	double rpm = c->rpm > 0.0 ? c->rpm : cfPage1.p1.crankingThreshold;
+	double toothAngle = 360.0 / p->teeth;
+
+	int detected = 0, early = 0, outOfSync = 0, stillOn = 0, rpmLeft = 0, cut = 0;
+	double timeoutSum = 0.0, timeoutMax = 0.0, periodsSum = 0.0, periodsMax = 0.0, overdueSum = 0.0, overdueMax = 0.0;
+
+	srand(1);
+	for (int run = 0; run < RUNS; run++) {
+
+		// the crankshaft turns from tooth position 0 & stops between two edges, after a random number of edges
+		uint32_t startTime = simTime;
+		uint32_t stalls = crankshaftStalls;
+		double angle = 0.0, time = 0.0, lastEdge = 0.0, lastPeriod = 0.0;
+		int edges = (int)((RUN_REVOLUTIONS + uniform()) * p->teeth);
+		for (int tooth = 0; tooth < edges; tooth++) {
+			time += turnTime(rpm, c->ripple, angle, angle + toothAngle);
+			angle += toothAngle;
+			if ((tooth + 1) % p->teeth >= p->missing) {
+				lastPeriod = time - lastEdge;
+				lastEdge = time;
+				runTo(startTime + (uint32_t)lrint(time));
+				hostCrankshaftPulse(startTime + (uint32_t)lrint(time));
+			}
+		}
+		early += crankshaftStalls != stalls;
+		outOfSync += triggerWheelInSync == 0;
+		cut += (compare != 0) && (outputsOn() != 0);
+
+		// the next edge, due one tooth or the gap later
+		double nextEdge = time;
+		do {
+			nextEdge += turnTime(rpm, c->ripple, angle, angle + toothAngle);
+			angle += toothAngle;
+		} while ((int)lrint(angle / toothAngle) % p->teeth < p->missing);
+
+		// the stall
+		uint32_t lastEdgeTime = startTime + (uint32_t)lrint(lastEdge);
+		uint32_t end = lastEdgeTime + OFF_TIME;
+		int stalled = 0;
+		for (uint32_t t = lastEdgeTime + STEP; (int32_t)(t - end) <= 0; t += STEP) {
+			runTo(t);
+			if ( (stalled == 0) && (crankshaftStalls != stalls) ) {
+				stalled = 1;
+				detected += crankshaftStalls - stalls == 1;
+				double timeout = crankshaftStallLatency;
+				double overdue = (int32_t)(crankshaftStallPulseTime + crankshaftStallLatency - (startTime + (uint32_t)lrint(nextEdge)));
+				timeoutSum += timeout / 1000.0;
+				timeoutMax = timeout / 1000.0 > timeoutMax ? timeout / 1000.0 : timeoutMax;
+				periodsSum += timeout / lastPeriod;
+				periodsMax = timeout / lastPeriod > periodsMax ? timeout / lastPeriod : periodsMax;
+				overdueSum += overdue / 1000.0;
+				overdueMax = overdue / 1000.0 > overdueMax ? overdue / 1000.0 : overdueMax;
+			}
+			if ( (stalled != 0) && (compare != 0) && (outputsOn() != 0) ) {
+				stillOn++;
+				break;
+			}
+		}
+		rpmLeft += keyData.v.RPM != 0.0F;
+		simTime = end;
+	}
+
+	printf("%-6s %-28s %5d  %6.1f %6.1f  %5.1f %5.1f  %6.1f %6.1f", p->name, c->name, detected,
+			detected > 0 ? timeoutSum / detected : 0.0, timeoutMax, detected > 0 ? periodsSum / detected : 0.0, periodsMax,
+			detected > 0 ? overdueSum / detected : 0.0, overdueMax);
+	if (compare != 0) {
+		printf("  %6d %6d\n", cut, stillOn);
+	}
+	else {
+		printf("  %6s %6s\n", "-", "-");
+	}
+
+	return (detected != RUNS) || (early != 0) || (outOfSync != 0) || (stillOn != 0) || (rpmLeft != 0);
+}
+
+
+int main(void) {
+
+	int failures = 0;
+
+	printf("                                                 timeout      timeout (tooth     overdue      outputs  still\n");
+	printf("                                                   (mS)          periods)          (mS)         on       on\n");
+	printf("wheel  case                         stalls    mean    max   mean   max    mean    max   (stalls) (stalls)\n");
+	for (int p = 0; p < (int)(sizeof(patterns) / sizeof(patterns[0])); p++) {
+		for (int c = 0; c < (int)(sizeof(cases) / sizeof(cases[0])); c++) {
+			failures += simulate(&patterns[p], &cases[c]);
+		}
+	}
+
+	if (failures != 0) {
+		printf("FAIL: %d cases with a stall not detected once, a stall while turning, outputs left on or the RPM not cleared\n", failures);
+		return 1;
+	}
+	printf("PASS\n");
+	return 0;
+}
+
+#endif
@@ -0,0 +1,270 @@
+/*
+ *
+ * Learned tooth angle correction.
+ *
+ * The injection & ignition events are timed from the nearest tooth, assuming the teeth are evenly spaced at 360 / teeth degrees.
+ * Machining errors in the trigger wheel & the sensor's response to the tooth edges put real teeth a degree or more from their
+ * nominal angles. This module learns the angle error of each tooth position & holds it in a table, saved in the EEPROM. The
+ * trigger wheel handler takes the error of the firing tooth off each event's vernier when it builds the event table, so the
+ * correction costs nothing in the crankshaft pulse handler.
+ *
+ * Learning is started by the host ("tc" command). The crankshaft pulse handler records the captured time of each tooth in the
+ * revolution (tcEdge()), and tcUpdate(), called from the HF task, processes each completed revolution outside the interrupt.
+ * The engine speed over the revolution is modelled by a quadratic, fitted through the times of the revolution start tooth at
+ * the start of the previous, current & next revolutions, i.e. the revolution's mean speed & a constant acceleration:
+ *
+ * 		t(x) = t0 + a.x + b.x^2			a = (t1 - t-1) / 2, b = (t1 - 2.t0 + t-1) / 2, x = revolutions from the start tooth
+ *
+ * The angle error of each tooth is the difference between its time & the modelled time at its nominal angle, divided by the
+ * modelled time per degree. Revolutions that change speed by more than 1 / TC_STABILITY, or are slower than TC_MIN_RPM, aren't
+ * used. The errors are averaged over TC_LEARN_REVOLUTIONS revolutions, then the table is replaced & saved by the background
+ * loop (tcService()). If any error exceeds half a tooth spacing, the trigger pattern is probably wrong, so the learned table is
+ * rejected. The revolution start tooth is the reference, so its error is zero, i.e. the TDC angle (Parameters 2) is relative to
+ * the reference tooth as before.
+ *
+ * Speed variation within the revolution from the compression & power strokes is synchronous with the teeth, so it can't be
+ * averaged out & is learned as tooth error. Learning should be run at a steady, high speed with a light load (or on the
+ * overrun), where it's smallest.
+ *
+ * The table is held for one trigger pattern. It's ignored if the pattern changes, until learned again.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "tooth_correction.h"
+#include "trigger_decoder.h"
+#include "cfg_data.h"
+#include "global.h"
+#include "nvm.h"
+#include "utility_functions.h"
+#include "string.h"
+#include "math.h"
+
+
+// number of revolutions averaged
+#define TC_LEARN_REVOLUTIONS 256
+
+// revolutions slower than TC_MIN_RPM aren't used
+#define TC_MIN_RPM 600
+#define TC_MAX_REVOLUTION_TIME (60000000.0F / TC_MIN_RPM)
+
+// revolutions that change speed by more than 1 / TC_STABILITY of the revolution time aren't used
+#define TC_STABILITY 64
+
+volatile tcStateType tcState = TC_IDLE;
+volatile int tcLearnedRevolutions = 0;
+volatile int tcTableValid = 0;
+
+static int tcTeeth = 36;
+static int tcPattern = 0;
+static tcTableStruct tcTable;
+static volatile int tcSavePending = 0;
+
+// tooth times recorded by tcEdge(). Revolution n (the free running revolution count) is recorded in tcToothTime[n & 1], and
+// the time of its start tooth in tcStartTime[n & 3].
+static volatile uint32_t tcToothTime[2][TW_MAX_TEETH];
+static volatile uint32_t tcStartTime[4];
+static volatile uint32_t tcRevolutions = 0;					// number of revolution starts recorded
+static volatile int tcContiguous = 0;						// ...since the decoder was last out of sync
+static volatile int tcStartTooth = 0;						// the revolution start tooth
+
+// learning
+static uint32_t tcRevolutionsN_1 = 0;
+static float tcErrorSum[TW_MAX_TEETH];
+
+
+void tcEdge(uint32_t time, int tooth, int revolutionStart, int inSync) {
+
+	if (inSync == 0) {
+		tcContiguous = 0;
+		return;
+	}
+	if ( (tooth < 0) || (tooth >= tcTeeth) ) {
+		// not on a tooth position
+		return;
+	}
+
+	uint32_t n = tcRevolutions;
+	if (revolutionStart != 0) {
+		tcStartTime[n & 3] = time;
+		tcToothTime[n & 1][tooth] = time;
+		tcStartTooth = tooth;
+		tcRevolutions = n + 1;
+		if (tcContiguous < 3) {
+			tcContiguous++;
+		}
+	}
+	else {
+		tcToothTime[(n - 1) & 1][tooth] = time;
+	}
+}
+
+
+// averages the learned errors & replaces the table, if they're within half a tooth spacing
+static void tcFinishLearning(void) {
+
+	int16_t error[TW_MAX_TEETH];
+	int limit = (180 * TC_ANGLE_SCALE) / tcTeeth;
+
+	for (int tooth = 0; tooth < tcTeeth; tooth++) {
+		float mean = (TC_ANGLE_SCALE * tcErrorSum[tooth]) / (float)tcLearnedRevolutions;
+		int e = (int)(mean + (mean >= 0.0F ? 0.5F : -0.5F));
+		if ( (e > limit) || (e < -limit) ) {
+			tcState = TC_REJECTED;
+			return;
+		}
+		error[tooth] = e;
+	}
+
+	memcpy(tcTable.error, error, sizeof(int16_t) * tcTeeth);
+	tcTable.pattern = tcPattern;
+	tcTable.teeth = tcTeeth;
+	tcTableValid = 1;
+	tcSavePending = 1;
+	tcState = TC_IDLE;
+	twRequestEventTableRebuild();
+}
+
+
+void tcUpdate() {
+
+	static uint32_t times[TW_MAX_TEETH];
+
+	uint32_t n = tcRevolutions;
+	if ( (tcState != TC_LEARNING) || (n == tcRevolutionsN_1) ) {
+		return;
+	}
+	tcRevolutionsN_1 = n;
+
+	// revolution n - 2 is complete, n - 1 is in progress. The start times of n - 3 to n - 1 are needed for the speed model.
+	int contiguous = tcContiguous;
+	int startTooth = tcStartTooth;
+	uint32_t tm1 = tcStartTime[(n - 3) & 3];
+	uint32_t t0 = tcStartTime[(n - 2) & 3];
+	uint32_t t1 = tcStartTime[(n - 1) & 3];
+	memcpy(times, (const void *)tcToothTime[(n - 2) & 1], sizeof(uint32_t) * tcTeeth);
+	if ( (contiguous < 3) || (tcRevolutions != n) ) {
+		// not enough revolutions in sync, or the revolution was overwritten by the next revolution while it was copied
+		return;
+	}
+
+	// the revolution times after & before t0, the speed model & the speed stability
+	float tp = (float)(int32_t)(t1 - t0);
+	float tm = (float)(int32_t)(tm1 - t0);
+	float a = 0.5F * (tp - tm);
+	float b = 0.5F * (tp + tm);
+	if ( (tp > TC_MAX_REVOLUTION_TIME) || (fabsf(tp + tm) * TC_STABILITY > tp) ) {
+		return;
+	}
+
+	for (int tooth = 0; tooth < tcTeeth; tooth++) {
+		if ( (tdToothPresent(tooth) != 0) && (tooth != startTooth) ) {
+			float x = (float)(tooth >= startTooth ? tooth - startTooth : tooth + tcTeeth - startTooth) / (float)tcTeeth;
+			float late = (float)(int32_t)(times[tooth] - t0) - x * (a + b * x);
+			tcErrorSum[tooth] += 360.0F * late / (a + 2.0F * b * x);
+		}
+	}
+
+	if (++tcLearnedRevolutions >= TC_LEARN_REVOLUTIONS) {
+		tcFinishLearning();
+	}
+}
+
+
+void tcService() {
+
+	static tcTableStruct temp;
+
+	if (tcSavePending == 0) {
+		return;
+	}
+	tcSavePending = 0;
+
+	if (TEST_EEPROM_AVAILABLE == 1) {
+		// the table is copied, so it can't change while it's written
+		memcpy(&temp, &tcTable, sizeof(temp));
+		nvEEPROMBlockWrite((uint8_t *)&temp, TOOTH_CORRECTION_NVM_ADDR, sizeof(temp));
+	}
+}
+
+
+// the error is limited to half a tooth spacing, as a restored table isn't range checked
+int tcGetToothError(int tooth) {
+	int limit = (180 * TC_ANGLE_SCALE) / tcTeeth;
+	return (tcTableValid != 0) && (tooth >= 0) && (tooth < tcTeeth) ? limitI(tcTable.error[tooth], -limit, limit) : 0;
+}
+
+
+int tcGetMaxError() {
+	int max = 0;
+	for (int tooth = 0; tooth < tcTeeth; tooth++) {
+		int e = tcGetToothError(tooth);
+		e = e < 0 ? -e : e;
+		if (e > max) {
+			max = e;
+		}
+	}
+	return max;
+}
+
+
+void tcStartLearning() {
+	memset(tcErrorSum, 0, sizeof(tcErrorSum));
+	tcLearnedRevolutions = 0;
+	tcRevolutionsN_1 = tcRevolutions;
+	tcState = TC_LEARNING;
+}
+
+
+void tcClear() {
+	tcState = TC_IDLE;
+	tcTableValid = 0;
+	memset(tcTable.error, 0, sizeof(tcTable.error));
+	// a cleared table isn't restored
+	tcTable.teeth = 0;
+	tcSavePending = 1;
+	twRequestEventTableRebuild();
+}
+
+
+void tcInitialise(int pattern, int teeth) {
+
+	static tcTableStruct temp;
+
+	tcTeeth = limitI(teeth, 1, TW_MAX_TEETH);
+	tcPattern = pattern;
+	tcState = TC_IDLE;
+	tcTableValid = 0;
+	tcContiguous = 0;
+	memset(&tcTable, 0, sizeof(tcTable));
+
+	// the table is only used if it was read with a valid checksum & for the same trigger pattern. Otherwise, there's no
+	// correction & the read / checksum errors are not reported in the ecu status word, as the table may never have been saved.
+	if (TEST_EEPROM_AVAILABLE == 1) {
+		uint32_t statusN_1 = ecuStatus;
+		ecuStatus &= ~(EEPROM_DATA_READ_ERROR | EEPROM_CHECKSUM_ERROR);
+		if ( (nvEEPROMBlockRead((uint8_t *)&temp, TOOTH_CORRECTION_NVM_ADDR, sizeof(temp)) == HAL_OK)
+				&& ((ecuStatus & (EEPROM_DATA_READ_ERROR | EEPROM_CHECKSUM_ERROR)) == 0) && (temp.pattern == pattern) && (temp.teeth == tcTeeth) ) {
+			memcpy(&tcTable, &temp, sizeof(tcTable));
+			tcTableValid = 1;
+		}
+		ecuStatus = statusN_1;
+	}
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 15 Oct 2026 First version.
++++REVISION_HISTORY_ENDS+++*/
@@ -0,0 +1,69 @@
+#ifndef _toothCorrection
+#define _toothCorrection
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <stdint.h>
+#include "trigger_wheel_handler.h"
+
+
+// the tooth angle errors are held in units of 1 / TC_ANGLE_SCALE degrees
+#define TC_ANGLE_SCALE 100
+
+// the learning state
+typedef enum { TC_IDLE, TC_LEARNING, TC_REJECTED } tcStateType;
+
+// the correction table, as held in the EEPROM
+typedef struct {
+	int32_t pattern;					// the trigger pattern & number of tooth positions the table was learned with,
+	int32_t teeth;						// the table is ignored if either doesn't match the current pattern
+	int16_t error[TW_MAX_TEETH];		// the angle error of each tooth position (1 / TC_ANGLE_SCALE degrees), positive if the tooth is late
+} tcTableStruct;
+
+extern volatile tcStateType tcState;
+
+// number of revolutions averaged by the current (or last) learning run
+extern volatile int tcLearnedRevolutions;
+
+// non-zero if the table was learned, or restored from the EEPROM, for the current trigger pattern
+extern volatile int tcTableValid;
+
+// records the time of a crankshaft edge. Called from the crankshaft pulse handler.
+// time - the captured time of the edge (uS), tooth - the tooth index (TD_NO_TOOTH if not on a tooth position),
+// revolutionStart - non-zero on the first tooth of the revolution, inSync - non-zero if the trigger decoder is in sync
+extern void tcEdge(uint32_t time, int tooth, int revolutionStart, int inSync);
+
+// averages the tooth errors of the completed revolutions while learning. Called from the HF task.
+extern void tcUpdate(void);
+
+// saves the table to the EEPROM once learned or cleared. Called from the background loop as the EEPROM write blocks.
+extern void tcService(void);
+
+// returns the angle error of the tooth position (1 / TC_ANGLE_SCALE degrees), 0 if there's no valid table
+extern int tcGetToothError(int tooth);
+
+// returns the largest angle error in the table (1 / TC_ANGLE_SCALE degrees)
+extern int tcGetMaxError(void);
+
+// starts learning the table, the current table is used until the new table is learned
+extern void tcStartLearning(void);
+
+// clears the table & its copy in the EEPROM
+extern void tcClear(void);
+
+// selects the trigger pattern & restores its table from the EEPROM. Called when the trigger wheel is initialised.
+extern void tcInitialise(int pattern, int teeth);
+
+#endif
@@ -0,0 +1,539 @@
+/*
+ *
+ * Generic trigger pattern decoder.
+ *
+ * The trigger pattern is described by the gap preceding each edge (see cfTriggerPatternStruct in cfg_data.h). At initialisation
+ * the gap list is converted into a gap class for each edge - the ratio of the gap to the preceding gap is classed as SHORT,
+ * NORMAL or LONG. At run time, the ratio of the measured period to the previous period is classed in the same way and shifted
+ * into a 32 bit history register (2 bits per edge, i.e. the last 16 edges).
+ *
+ * Edges with a SHORT or LONG class are "key" edges. For each key edge, the shortest gap signature (the classes of the key edge
+ * and the edges immediately before it) that uniquely identifies the key edge within the pattern is found at initialisation.
+ * While out of sync, every SHORT or LONG edge is compared against the key edge signatures. A match is only a candidate position:
+ * the decoder steps through the following edges and checks them as it does in sync, and sync is gained after TD_CONFIRM_EDGES
+ * edges, a key edge & the NORMAL edge after it all match. A mismatch returns to searching from that edge. A key edge must also
+ * have a period, normalised to one tooth spacing, within 1/TD_KEY_TOLERANCE of the previous edge's, so a glitch that happens
+ * to make a SHORT/LONG pair isn't taken as a missing tooth. Hence, sync is gained after the distinctive part of the pattern
+ * has passed the sensor twice, rather than once. The host replay (test_code/decoder_replay.c) measures a mean time to sync
+ * while cranking of 570 crank degrees for 36-1, 310 for 36-2-2-2 & 1488 for 4+1, against 195, 127 & 406 degrees when sync was
+ * gained at the first match, which gave false syncs on noise.
+ *
+ * In sync, the decoder steps through the edge list and checks each measured class against the expected class. A mismatch
+ * is a sync error and the decoder returns to searching.
+ *
+ * Patterns that have no distinctive gaps (e.g. 24+1, where the "+1" tooth is on the camshaft) use a camshaft pulse,
+ * notified by tdCamshaftEdge(), as the cycle reference. The edge after the pulse is the candidate position, confirmed by the
+ * following TD_CONFIRM_EDGES edges.
+ *
+ * Limitation: while the acceptance window is disabled (cranking), a glitch is decoded as a tooth & puts the decoder one edge
+ * ahead until a class mismatch exposes it. On a N-M wheel the NORMAL edges can't expose it, so a glitch can slip the decoder
+ * by up to a revolution before the missing tooth gap loses sync (the replay reports these edges as "slipped"). Events fired
+ * from those edges are early by the glitch's edge.
+ *
+ * In sync, each edge must arrive within an acceptance window: an edge earlier than the expected period (the last tooth period
+ * scaled to the gap before the edge) less the window margin is rejected as noise. A rejected edge isn't decoded, its period
+ * is added to the period of the next edge, so a glitch between two teeth doesn't lose sync. The margin adapts to the tooth
+ * period variation: it's TD_WINDOW_MAD_FACTOR x the mean absolute deviation of the tooth period from the previous tooth period,
+ * limited to 1/8 to 1/2 of the tooth period, starting at 1/2 when sync is gained. The window check is one 32 x 32 bit multiply
+ * & a comparison.
+ * The window is only checked once enabled by tdEnableWindow(), i.e. when the engine is running. While cranking, the crankshaft
+ * slows into each compression & speeds up out of it (and more so at the first firings), so a real tooth can arrive further
+ * ahead than the margin: rejecting it would make the next edge LONG & lose sync. The margin is still learned while the window
+ * is disabled. tdResetSync() disables the window.
+ *
+ * For each edge in the pattern, a histogram of the ratio of the tooth period to the previous tooth period and the number of
+ * rejected edges are recorded, see tdGetHistogram().
+ *
+ * Time taken per edge is bounded: one comparison in sync or while confirming, or at most TD_MAX_KEY_EDGES comparisons while
+ * searching.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "trigger_decoder.h"
+#include "utility_functions.h"
+#include "string.h"
+
+
+// gap classes
+#define TD_GAP_NORMAL	0
+#define TD_GAP_SHORT	1
+#define TD_GAP_LONG		2
+
+// the gap class thresholds, as a ratio to the previous gap: SHORT < 3/5 (0.6), LONG > 8/5 (1.6)
+#define TD_SHORT_NUM	3
+#define TD_LONG_NUM		8
+#define TD_RATIO_DEN	5
+
+// the history register holds 16 gap classes
+#define TD_HISTORY_DEPTH 16
+
+// maximum number of key edges in a pattern
+#define TD_MAX_KEY_EDGES 8
+
+// edge flags
+#define TD_FULL_TOOTH	1
+#define TD_REV_START	2
+
+// the window margin is this multiple of the tooth period mean absolute deviation, the deviation filter TC is 2^TD_MAD_SHIFT edges
+#define TD_WINDOW_MAD_FACTOR	4
+#define TD_MAD_SHIFT			4
+
+// sync is confirmed by this number of edges after the candidate edge (& a key edge, for patterns with key edges)
+#define TD_CONFIRM_EDGES 3
+
+// a key edge's normalised period must be within 1/TD_KEY_TOLERANCE of the previous edge's
+#define TD_KEY_TOLERANCE 4
+
+// an edge isn't rejected if this number of edges in succession have been rejected
+#define TD_MAX_CONSECUTIVE_REJECTS 2
+
+// key edge signature
+typedef struct {
+	int edge;				// the edge index
+	uint32_t signature;		// the expected gap class history at the edge
+	uint32_t mask;			// selects the part of the history needed to uniquely identify the edge
+	int length;				// number of gap classes in the signature
+} tdKeyEdge;
+
+// pattern data, derived from the pattern description at initialisation
+static int tdEdges;
+static int tdCamSync;
+static uint8_t tdEdgeClass[CF_MAX_PATTERN_EDGES];
+static uint8_t tdEdgeGap[CF_MAX_PATTERN_EDGES];
+static uint8_t tdEdgeTooth[CF_MAX_PATTERN_EDGES];
+static uint8_t tdEdgeFlags[CF_MAX_PATTERN_EDGES];
+static uint8_t tdToothMap[CF_MAX_PATTERN_EDGES];
+static uint32_t tdEdgeGapReciprocal[CF_MAX_PATTERN_EDGES];		// 2^16 / gap, normalises the edge period to one tooth spacing
+static int tdMaxGap = 4;										// the longest gap in the pattern (quarter tooth spacings)
+static tdKeyEdge tdKeys[TD_MAX_KEY_EDGES];
+static int tdNumberOfKeys;
+
+// N-M pattern, built from Parameters 2
+static cfTriggerPatternStruct tdMissingToothPattern;
+
+// decoder state
+int tdTeeth = 36;
+volatile int tdInSync = 0;
+static int tdEdgeIndex = 0;
+static uint32_t tdHistory = 0;
+static int tdHistoryLength = 0;
+static uint32_t tdPeriodN_1 = 0;
+static volatile int tdCamPending = 0;
+static int tdConfirmEdges = 0;							// edges left to confirm the candidate position, 0 if searching
+static int tdConfirmKey = 0;							// non-zero once a key edge has confirmed the candidate position
+static uint32_t tdToothPeriodN_1 = 0;					// the previous edge's period normalised to one tooth spacing
+
+// acceptance window state
+static uint32_t tdToothPeriod = 0;						// the last tooth period (normalised to one tooth spacing), 0 if not available
+static uint32_t tdMeanDeviationAcc = 0;					// tooth period mean absolute deviation x 2^TD_MAD_SHIFT
+static uint32_t tdWindowMargin = 0;						// the window margin (uS)
+static uint32_t tdRejectedPeriod = 0;					// the sum of the periods of rejected edges since the last accepted edge
+static int tdConsecutiveRejects = 0;
+static volatile int tdWindowEnabled = 0;				// non-zero if early edges are rejected
+
+// noise rejection statistics
+volatile uint32_t tdRejectedEdges = 0;
+static uint16_t tdHistogram[CF_MAX_PATTERN_EDGES][TD_HISTOGRAM_BINS];
+static uint16_t tdEdgeRejects[CF_MAX_PATTERN_EDGES];
+
+
+// classifies a gap from the ratio of the gap to the previous gap
+static inline int tdClassify(uint32_t gap, uint32_t gapN_1){
+	if (gap * TD_RATIO_DEN < gapN_1 * TD_SHORT_NUM) {
+		return TD_GAP_SHORT;
+	}
+	if (gap * TD_RATIO_DEN > gapN_1 * TD_LONG_NUM) {
+		return TD_GAP_LONG;
+	}
+	return TD_GAP_NORMAL;
+}
+
+
+// returns the expected gap class history of the specified length, ending at the specified edge
+static uint32_t tdSignature(int edge, int length){
+	uint32_t sig = 0;
+	for (int i = length - 1; i >= 0; i--) {
+		int e = edge - i;
+		while (e < 0) {
+			e += tdEdges;
+		}
+		sig = (sig << 2) | tdEdgeClass[e];
+	}
+	return sig;
+}
+
+
+// normalises the period before an edge to one tooth spacing
+static inline uint32_t tdNormalisePeriod(uint32_t period, int edge){
+	return (uint32_t)(((uint64_t)period * tdEdgeGapReciprocal[edge]) >> 14);
+}
+
+
+// updates the histogram & window margin from an accepted edge
+static void tdUpdateWindow(uint32_t toothPeriod){
+
+	if (tdToothPeriod != 0) {
+
+		int32_t deviation = (int32_t)toothPeriod - (int32_t)tdToothPeriod;
+
+		// histogram bins are 1/8 of the tooth period wide, the centre bin is the previous tooth period +/- 1/16
+		int32_t bin = ((deviation * 8) + (int32_t)(tdToothPeriod >> 1) + (int32_t)(tdToothPeriod * (TD_HISTOGRAM_BINS / 2))) / (int32_t)tdToothPeriod;
+		bin = limitI(bin, 0, TD_HISTOGRAM_BINS - 1);
+		if (tdHistogram[tdEdgeIndex][bin] < 0xFFFF) {
+			tdHistogram[tdEdgeIndex][bin]++;
+		}
+
+		tdMeanDeviationAcc += (uint32_t)(deviation < 0 ? -deviation : deviation) - (tdMeanDeviationAcc >> TD_MAD_SHIFT);
+	}
+	else {
+		// the window starts at the maximum margin & adapts from there
+		tdMeanDeviationAcc = (toothPeriod / (2 * TD_WINDOW_MAD_FACTOR)) << TD_MAD_SHIFT;
+	}
+
+	tdToothPeriod = toothPeriod;
+	tdWindowMargin = limitI(TD_WINDOW_MAD_FACTOR * (tdMeanDeviationAcc >> TD_MAD_SHIFT), toothPeriod >> 3, toothPeriod >> 1);
+}
+
+
+// steps to the next edge in the pattern, returns non-zero if the gap class isn't the expected class
+static inline int tdStepEdge(int gapClass, uint32_t period){
+
+	if (++tdEdgeIndex >= tdEdges) {
+		tdEdgeIndex = 0;
+	}
+
+	int mismatch = gapClass != tdEdgeClass[tdEdgeIndex];
+
+	// a key edge's period, normalised to one tooth spacing, must also be close to the previous edge's
+	uint32_t toothPeriod = tdNormalisePeriod(period, tdEdgeIndex);
+	if (tdEdgeClass[tdEdgeIndex] != TD_GAP_NORMAL) {
+		uint32_t deviation = toothPeriod > tdToothPeriodN_1 ? toothPeriod - tdToothPeriodN_1 : tdToothPeriodN_1 - toothPeriod;
+		mismatch |= deviation > tdToothPeriodN_1 / TD_KEY_TOLERANCE;
+	}
+	tdToothPeriodN_1 = toothPeriod;
+
+	// camshaft referenced patterns must see the camshaft pulse before the first edge of the cycle, and only then
+	if (tdCamSync != 0) {
+		mismatch |= (tdEdgeIndex == 0) != (tdCamPending != 0);
+		tdCamPending = 0;
+	}
+
+	return mismatch;
+}
+
+
+// decodes a trigger wheel edge
+void tdProcessEdge(uint32_t period, tdEdgeResult *r){
+
+	int justSynced = 0;
+
+	r->tooth = TD_NO_TOOTH;
+	r->fullTooth = 0;
+	r->gap = 0;
+	r->nextGap = 0;
+	r->revolutionStart = 0;
+	r->syncError = 0;
+	r->rejected = 0;
+
+	// the period from the last accepted edge
+	period += tdRejectedPeriod;
+	r->period = period;
+
+	// the very first edge has no previous period to compare with, a camshaft pulse before it can't be used either
+	if (tdPeriodN_1 == 0) {
+		tdPeriodN_1 = period;
+		tdCamPending = 0;
+		return;
+	}
+
+	// reject an edge that's too early for the next edge in the pattern
+	if ( (tdWindowEnabled != 0) && (tdInSync != 0) && (tdToothPeriod != 0) && (tdConsecutiveRejects < TD_MAX_CONSECUTIVE_REJECTS) ) {
+		int next = tdEdgeIndex + 1 < tdEdges ? tdEdgeIndex + 1 : 0;
+		if (tdNormalisePeriod(period, next) < tdToothPeriod - tdWindowMargin) {
+			tdRejectedPeriod = period;
+			tdConsecutiveRejects++;
+			tdRejectedEdges++;
+			if (tdEdgeRejects[next] < 0xFFFF) {
+				tdEdgeRejects[next]++;
+			}
+			r->rejected = 1;
+			return;
+		}
+	}
+	int afterReject = tdConsecutiveRejects;
+	tdRejectedPeriod = 0;
+	tdConsecutiveRejects = 0;
+
+	// classify this edge and add it to the history
+	int gapClass = tdClassify(period, tdPeriodN_1);
+	tdPeriodN_1 = period;
+	tdHistory = (tdHistory << 2) | gapClass;
+	if (tdHistoryLength < TD_HISTORY_DEPTH) {
+		tdHistoryLength++;
+	}
+
+	if (tdInSync != 0) {
+		if (tdStepEdge(gapClass, period) != 0) {
+			r->syncError = 1;
+			r->errorTooth = tdEdgeTooth[tdEdgeIndex];
+			tdInSync = 0;
+			tdToothPeriod = 0;
+		}
+	}
+	else if (tdConfirmEdges > 0) {
+		// a candidate position is confirmed by the following edges, a mismatch returns to searching from this edge
+		if (tdStepEdge(gapClass, period) != 0) {
+			tdConfirmEdges = 0;
+		}
+		else if (tdConfirmEdges > 1) {
+			tdConfirmEdges--;
+		}
+		else if ( (tdCamSync != 0) || ((tdConfirmKey != 0) && (tdEdgeClass[tdEdgeIndex] == TD_GAP_NORMAL)) ) {
+			tdConfirmEdges = 0;
+			tdInSync = 1;
+			justSynced = 1;
+		}
+		else if (tdEdgeClass[tdEdgeIndex] != TD_GAP_NORMAL) {
+			tdConfirmKey = 1;
+		}
+	}
+
+	if ( (tdInSync == 0) && (tdConfirmEdges == 0) ) {
+
+		if (tdCamSync != 0) {
+			// the edge after the camshaft pulse is the first edge in the cycle
+			if ( (tdCamPending != 0) && (gapClass == tdEdgeClass[0]) ) {
+				tdEdgeIndex = 0;
+				tdConfirmEdges = TD_CONFIRM_EDGES;
+				tdConfirmKey = 0;
+				tdToothPeriodN_1 = tdNormalisePeriod(period, 0);
+			}
+			tdCamPending = 0;
+		}
+		else if (gapClass != TD_GAP_NORMAL) {
+			// search the key edges for a matching gap signature
+			for (int k = 0; k < tdNumberOfKeys; k++) {
+				if ( (tdHistoryLength >= tdKeys[k].length) && ((tdHistory & tdKeys[k].mask) == tdKeys[k].signature) ) {
+					tdEdgeIndex = tdKeys[k].edge;
+					tdConfirmEdges = TD_CONFIRM_EDGES;
+					tdConfirmKey = 0;
+					tdToothPeriodN_1 = tdNormalisePeriod(period, tdEdgeIndex);
+					break;
+				}
+			}
+		}
+	}
+
+	if (tdInSync != 0) {
+		r->tooth = tdEdgeTooth[tdEdgeIndex];
+		r->fullTooth = tdEdgeFlags[tdEdgeIndex] & TD_FULL_TOOTH;
+		r->gap = tdEdgeGap[tdEdgeIndex];
+		r->nextGap = tdEdgeGap[tdEdgeIndex + 1 < tdEdges ? tdEdgeIndex + 1 : 0];
+		// revolutions are only counted once the decoder has been in sync for the whole revolution
+		r->revolutionStart = justSynced == 0 ? tdEdgeFlags[tdEdgeIndex] & TD_REV_START : 0;
+		// if the previous edge was rejected, this period may span the rejected edge so isn't used for the window
+		if (afterReject == 0) {
+			tdUpdateWindow(tdNormalisePeriod(period, tdEdgeIndex));
+		}
+	}
+	else {
+		// best guess while searching
+		r->fullTooth = gapClass == TD_GAP_NORMAL;
+		// no window until back in sync
+		tdToothPeriod = 0;
+	}
+}
+
+
+// returns the number of edges in the trigger pattern
+int tdGetEdges(){
+	return tdEdges;
+}
+
+
+// returns the window margin as a percentage of the tooth period, 0 if the window is disabled
+int tdGetWindowMargin(){
+	uint32_t toothPeriod = tdToothPeriod;
+	return (tdWindowEnabled != 0) && (toothPeriod > 0) ? (int)((tdWindowMargin * 100) / toothPeriod) : 0;
+}
+
+
+// enables or disables the acceptance window
+void tdEnableWindow(int enable){
+	tdWindowEnabled = enable;
+}
+
+
+// copies the histogram & rejected edge count for an edge, returns the tooth index of the edge
+int tdGetHistogram(int edge, uint16_t histogram[TD_HISTOGRAM_BINS], uint16_t *rejects){
+	if ( (edge < 0) || (edge >= tdEdges) ) {
+		return TD_NO_TOOTH;
+	}
+	memcpy(histogram, tdHistogram[edge], sizeof(tdHistogram[edge]));
+	*rejects = tdEdgeRejects[edge];
+	return tdEdgeTooth[edge];
+}
+
+
+// clears the noise rejection statistics
+void tdResetStatistics(){
+	memset(tdHistogram, 0, sizeof(tdHistogram));
+	memset(tdEdgeRejects, 0, sizeof(tdEdgeRejects));
+	tdRejectedEdges = 0;
+}
+
+
+// returns the longest gap between edges in the pattern (quarter tooth spacings)
+int tdGetMaxGap(){
+	return tdMaxGap;
+}
+
+
+// drops sync, the next edge is treated as the first edge after power on. The statistics are kept.
+void tdResetSync(){
+	tdInSync = 0;
+	tdCamPending = 0;
+	tdConfirmEdges = 0;
+	tdHistory = 0;
+	tdHistoryLength = 0;
+	tdPeriodN_1 = 0;
+	tdEdgeIndex = 0;
+	tdToothPeriod = 0;
+	tdMeanDeviationAcc = 0;
+	tdRejectedPeriod = 0;
+	tdConsecutiveRejects = 0;
+	tdWindowEnabled = 0;
+}
+
+
+// returns non-zero if there's a tooth at the tooth position
+int tdToothPresent(int tooth){
+	return (tooth >= 0) && (tooth < tdTeeth) ? tdToothMap[tooth] : 0;
+}
+
+
+// called by the camshaft handler on a camshaft pulse
+void tdCamshaftEdge(){
+	if (tdCamSync != 0) {
+		tdCamPending = 1;
+	}
+}
+
+
+// builds an N-M missing tooth pattern
+static void tdBuildMissingToothPattern(cfTriggerPatternStruct *p, int teeth, int missing){
+	p->teeth = limitI(teeth, 2, CF_MAX_PATTERN_EDGES);
+	missing = limitI(missing, 0, p->teeth - 2);
+	p->nEdges = p->teeth - missing;
+	p->camSync = missing == 0;
+	p->firstTooth = missing;
+	// the first tooth follows the gap, all others are one tooth spacing apart
+	p->gap[0] = 4 * (missing + 1);
+	for (int i = 1; i < p->nEdges; i++) {
+		p->gap[i] = 4;
+	}
+}
+
+
+// selects the trigger pattern & derives the decoder's pattern data
+void tdInitialise(int pattern){
+
+	const cfTriggerPatternStruct *p;
+
+	if ( (pattern > 0) && (pattern <= CF_NUMBER_OF_TRIGGER_PATTERNS) ) {
+		p = &cfTriggerPatterns[pattern - 1];
+	}
+	else {
+		tdBuildMissingToothPattern(&tdMissingToothPattern, cfPage1.p2.twTeeth, cfPage1.p2.twMissingTeeth);
+		p = &tdMissingToothPattern;
+	}
+
+	tdResetSync();
+	tdResetStatistics();
+
+	tdTeeth = limitI(p->teeth, 1, CF_MAX_PATTERN_EDGES);
+	tdEdges = limitI(p->nEdges, 1, CF_MAX_PATTERN_EDGES);
+	tdCamSync = p->camSync;
+
+	// tooth position, gap class & flags for each edge. Positions are in quarter tooth spacings.
+	int position = 4 * p->firstTooth;
+	int revolutionN_1 = -1;
+	memset(tdToothMap, 0, sizeof(tdToothMap));
+	tdMaxGap = 1;
+	for (int i = 0; i < tdEdges; i++) {
+		if (i > 0) {
+			position += p->gap[i];
+		}
+		tdEdgeClass[i] = tdClassify(p->gap[i], p->gap[i > 0 ? i - 1 : tdEdges - 1]);
+		tdEdgeGap[i] = limitI(p->gap[i], 1, 255);
+		tdEdgeGapReciprocal[i] = 65536UL / tdEdgeGap[i];
+		if (tdEdgeGap[i] > tdMaxGap) {
+			tdMaxGap = tdEdgeGap[i];
+		}
+		tdEdgeFlags[i] = p->gap[i] == 4 ? TD_FULL_TOOTH : 0;
+		if ((position & 3) == 0) {
+			// on a tooth position
+			int revolution = position / (4 * tdTeeth);
+			tdEdgeTooth[i] = (position >> 2) % tdTeeth;
+			tdToothMap[tdEdgeTooth[i]] = 1;
+			if (revolution != revolutionN_1) {
+				tdEdgeFlags[i] |= TD_REV_START;
+			}
+			revolutionN_1 = revolution;
+		}
+		else {
+			// an additional tooth between tooth positions
+			tdEdgeTooth[i] = TD_NO_TOOTH;
+		}
+	}
+
+	// find the key edges and the shortest unique gap signature for each
+	tdNumberOfKeys = 0;
+	for (int i = 0; (i < tdEdges) && (tdNumberOfKeys < TD_MAX_KEY_EDGES); i++) {
+		if (tdEdgeClass[i] == TD_GAP_NORMAL) {
+			continue;
+		}
+		for (int length = 1; length <= TD_HISTORY_DEPTH; length++) {
+			uint32_t sig = tdSignature(i, length);
+			int unique = 1;
+			for (int j = 0; j < tdEdges; j++) {
+				if ( (j != i) && (tdSignature(j, length) == sig) ) {
+					unique = 0;
+					break;
+				}
+			}
+			if (unique != 0) {
+				tdKeys[tdNumberOfKeys].edge = i;
+				tdKeys[tdNumberOfKeys].signature = sig;
+				tdKeys[tdNumberOfKeys].mask = length < TD_HISTORY_DEPTH ? (1UL << (2 * length)) - 1 : 0xFFFFFFFFUL;
+				tdKeys[tdNumberOfKeys].length = length;
+				tdNumberOfKeys++;
+				break;
+			}
+		}
+	}
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 15 Oct 2026 First version. Replaces the missing tooth detection in trigger_wheel_handler.
+2) 15 Oct 2026 The gap preceding the edge is returned in tdEdgeResult, used to normalise the edge period to one tooth spacing.
+3) 15 Oct 2026 Adaptive acceptance window rejects early edges as noise. Per-edge period ratio histograms & rejected edge counts added.
+4) 15 Oct 2026 tdResetSync() & tdGetMaxGap() added for the crankshaft stall timeout.
+5) 15 Oct 2026 The gap to the next edge in the pattern is returned in tdEdgeResult, used by the angle clock.
+6) 16 Oct 2026 The acceptance window is only checked once enabled by tdEnableWindow(), i.e. not while cranking.
+7) 16 Oct 2026 A key signature match is confirmed by the following edges before sync is gained, key edge period tolerance added.
++++REVISION_HISTORY_ENDS+++*/
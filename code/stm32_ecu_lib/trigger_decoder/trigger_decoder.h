@@ -0,0 +1,82 @@
+#ifndef _triggerDecoder
+#define _triggerDecoder
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include "cfg_data.h"
+
+
+// tooth index returned when the decoder is not in sync, or the edge is not on a tooth position (e.g. the "+1" tooth)
+#define TD_NO_TOOTH 255
+
+// number of bins in the tooth period ratio histograms. Bins are 1/8 wide, the centre bin is a ratio of 1.
+#define TD_HISTOGRAM_BINS 9
+
+// the result of decoding a single trigger wheel edge
+typedef struct {
+	int tooth;				// tooth index of the edge, TD_NO_TOOTH if not in sync or not on a tooth position
+	int fullTooth;			// non-zero if the edge period spans exactly one tooth spacing, i.e. can be used to measure the tooth period
+	int gap;				// the gap from the previous edge in quarter tooth spacings, 0 if not in sync
+	int nextGap;			// the gap to the next edge in the pattern in quarter tooth spacings, 0 if not in sync
+	int revolutionStart;	// non-zero on the first tooth of each revolution, only set while in sync
+	int syncError;			// non-zero if sync was lost at this edge
+	int errorTooth;			// the expected tooth index when sync was lost
+	int rejected;			// non-zero if the edge was rejected as noise, i.e. arrived before the acceptance window
+	uint32_t period;		// the period (uS) from the last accepted edge, includes the periods of rejected edges
+} tdEdgeResult;
+
+// number of tooth positions per crankshaft revolution for the selected pattern
+extern int tdTeeth;
+
+// set non-zero when the decoder is in sync with the trigger pattern
+extern volatile int tdInSync;
+
+// number of edges rejected as noise since the statistics were reset
+extern volatile uint32_t tdRejectedEdges;
+
+// decodes a trigger wheel edge, the period (uS) is the time from the previous edge
+extern void tdProcessEdge(uint32_t period, tdEdgeResult *r);
+
+// returns non-zero if the tooth position has a tooth, i.e. events can be fired from it
+extern int tdToothPresent(int tooth);
+
+// provides the cycle reference for patterns that use a camshaft pulse for sync
+extern void tdCamshaftEdge(void);
+
+// returns the longest gap between edges in the pattern, in quarter tooth spacings
+extern int tdGetMaxGap(void);
+
+// drops sync after a stall, the next edge is decoded as the first edge after power on
+extern void tdResetSync(void);
+
+// returns the number of edges in the trigger pattern
+extern int tdGetEdges(void);
+
+// returns the acceptance window margin as a percentage of the tooth period, 0 if the window is disabled
+extern int tdGetWindowMargin(void);
+
+// enables the acceptance window, i.e. early edges are rejected as noise. Disabled at initialisation & by tdResetSync().
+extern void tdEnableWindow(int enable);
+
+// copies the tooth period ratio histogram & the number of rejected edges for the edge. Returns the tooth index of the edge.
+extern int tdGetHistogram(int edge, uint16_t histogram[TD_HISTOGRAM_BINS], uint16_t *rejects);
+
+// clears the histograms & rejected edge counts
+extern void tdResetStatistics(void);
+
+// selects the trigger pattern, 0 = N-M missing tooth wheel defined in Parameters 2, otherwise an entry from cfTriggerPatterns
+extern void tdInitialise(int pattern);
+
+#endif
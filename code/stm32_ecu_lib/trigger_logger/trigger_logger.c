@@ -0,0 +1,164 @@
+/*
+ *
+ * Trigger logger.
+ *
+ * Records each crankshaft pulse (the captured time, the camshaft & engine phase state and the trigger decoder's decisions)
+ * into a RAM ring buffer. The crankshaft pulse handler writes each record directly into the next slot of the ring, so the cost
+ * per pulse is a test of tlRecording and four stores. Recording stops once the post trigger pulses have been recorded.
+ *
+ * The logger is armed by the host "tl" command, e.g. tl256,256,4# records 256 pulses either side of the first sync error.
+ * When recording is complete, tlService() sends the log to the host from the background loop:
+ *
+ * >TL:<pre trigger records>,<post trigger records>,<trigger flags>
+ * TL<first record no. in line>:<time>,<tooth>,<flags>,<gap>;<time>,<tooth>,<flags>,<gap>;...		(TL_RECORDS_PER_LINE records per line)
+ * >TL:END
+ *
+ * The trigger record is the first post trigger record.
+ *
+ *
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+
+#include "trigger_logger.h"
+#include "ecu_services.h"
+#include "utility_functions.h"
+#include "string.h"
+#include <stdio.h>
+
+
+#define TL_RECORDS_PER_LINE 8
+#define TL_LINE_LENGTH (TL_RECORDS_PER_LINE * 28 + 16)
+
+typedef enum { TL_IDLE, TL_ARMED, TL_TRIGGERED, TL_COMPLETE, TL_SENDING } tlStateType;
+
+// the log
+static tlRecordType tlBuffer[TL_BUFFER_SIZE];
+static volatile uint32_t tlIndex = 0;				// free running index of the next record
+
+// logger state
+volatile int tlRecording = 0;
+static volatile tlStateType tlState = TL_IDLE;
+static int tlPreTrigger = 0;
+static int tlPostTrigger = 0;
+static int tlTriggerFlags = 0;
+static volatile int tlPostRemaining = 0;
+static volatile uint32_t tlTriggerIndex = 0;
+static volatile uint32_t tlArmIndex = 0;
+
+// send state
+static uint32_t tlSendStart = 0;
+static uint32_t tlSendIndex = 0;
+static uint32_t tlSendEnd = 0;
+static char tlTxBuffer[TL_LINE_LENGTH];
+
+
+// records a crankshaft pulse
+void tlRecord(uint32_t time, int tooth, int flags, int gap){
+
+	if (tlRecording == 0) {
+		return;
+	}
+
+	uint32_t index = tlIndex;
+	tlRecordType *r = &tlBuffer[index & (TL_BUFFER_SIZE - 1)];
+	r->time = time;
+	r->tooth = tooth;
+	r->flags = flags;
+	r->gap = gap;
+	tlIndex = index + 1;
+
+	if (tlState == TL_ARMED) {
+		if ( (tlTriggerFlags == 0) || ((flags & tlTriggerFlags) != 0) ) {
+			tlTriggerIndex = index;
+			tlPostRemaining = tlPostTrigger;
+			tlState = TL_TRIGGERED;
+		}
+	}
+
+	if (tlState == TL_TRIGGERED) {
+		if (--tlPostRemaining <= 0) {
+			// recording complete
+			tlRecording = 0;
+			tlState = TL_COMPLETE;
+		}
+	}
+}
+
+
+// arms the logger
+void tlArm(int preTrigger, int postTrigger, int triggerFlags){
+
+	// stop recording while the parameters are changed
+	tlRecording = 0;
+
+	tlPostTrigger = limitI(postTrigger, 1, TL_BUFFER_SIZE);
+	tlPreTrigger = limitI(preTrigger, 0, TL_BUFFER_SIZE - tlPostTrigger);
+	tlTriggerFlags = triggerFlags;
+	tlArmIndex = tlIndex;
+	tlState = TL_ARMED;
+
+	tlRecording = 1;
+}
+
+
+// sends the log to the host, one line at a time, once recording is complete
+void tlService(){
+
+	// wait for the previous line to be sent
+	if (hostIO.txInProgress != 0) {
+		return;
+	}
+
+	int length = 0;
+
+	switch (tlState) {
+	case TL_COMPLETE: {
+		// the pre trigger records can't pre-date arming the logger
+		uint32_t pre = tlTriggerIndex - tlArmIndex;
+		if (pre > (uint32_t)tlPreTrigger) {
+			pre = tlPreTrigger;
+		}
+		tlSendStart = tlTriggerIndex - pre;
+		tlSendIndex = tlSendStart;
+		tlSendEnd = tlTriggerIndex + tlPostTrigger;
+		length = sprintf(tlTxBuffer, ">TL:%lu,%i,%i\r\n", (unsigned long)pre, tlPostTrigger, tlTriggerFlags);
+		tlState = TL_SENDING;
+		break;
+	}
+	case TL_SENDING:
+		if (tlSendIndex != tlSendEnd) {
+			length = sprintf(tlTxBuffer, "TL%lu:", (unsigned long)(tlSendIndex - tlSendStart));
+			for (int i = 0; (i < TL_RECORDS_PER_LINE) && (tlSendIndex != tlSendEnd); i++) {
+				tlRecordType *r = &tlBuffer[tlSendIndex++ & (TL_BUFFER_SIZE - 1)];
+				length += sprintf(&tlTxBuffer[length], "%s%lu,%u,%u,%u", i > 0 ? ";" : "", (unsigned long)r->time, r->tooth, r->flags, r->gap);
+			}
+			length += sprintf(&tlTxBuffer[length], "\r\n");
+		}
+		else {
+			length = sprintf(tlTxBuffer, ">TL:END\r\n");
+			tlState = TL_IDLE;
+		}
+		break;
+	default:
+		return;
+	}
+
+	hostPrint(tlTxBuffer, length);
+}
+
+
+/*+++REVISION_HISTORY+++
+1) 15 Oct 2026 First version.
+2) 15 Oct 2026 TL_REJECTED flag added for pulses rejected by the trigger decoder.
++++REVISION_HISTORY_ENDS+++*/
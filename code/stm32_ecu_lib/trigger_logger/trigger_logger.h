@@ -0,0 +1,55 @@
+#ifndef _triggerLogger
+#define _triggerLogger
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+#include <stdint.h>
+
+
+// number of records held by the logger, must be a power of 2
+#define TL_BUFFER_SIZE 1024
+
+// record flags, also used to define the trigger condition
+#define TL_IN_SYNC		0x01		// the trigger decoder is in sync
+#define TL_REV_START	0x02		// first tooth of a revolution
+#define TL_SYNC_ERROR	0x04		// sync lost at this tooth
+#define TL_CAM_PULSE	0x08		// a camshaft pulse was received since the previous tooth
+#define TL_ENGINE_REV	0x10		// the engine phase, set in revolution 1 of the engine cycle
+#define TL_FULL_TOOTH	0x20		// the period spans one tooth spacing
+#define TL_REJECTED		0x40		// the pulse was rejected as noise by the trigger decoder
+
+// one record per crankshaft pulse
+typedef struct {
+	uint32_t time;			// the captured pulse time (uS)
+	uint8_t tooth;			// the decoded tooth index, 255 if not in sync or not on a tooth position
+	uint8_t flags;			// TL_xxx flags
+	uint8_t gap;			// the decoded gap from the previous pulse in quarter tooth spacings, 0 if not in sync
+	uint8_t spare;
+} tlRecordType;
+
+// non-zero while the logger is recording
+extern volatile int tlRecording;
+
+// records a crankshaft pulse, called from the crankshaft pulse handler
+extern void tlRecord(uint32_t time, int tooth, int flags, int gap);
+
+// arms the logger. Records pre trigger & post trigger pulses around the first pulse with any of the trigger flags set.
+// If the trigger flags are zero, the logger is triggered immediately.
+extern void tlArm(int preTrigger, int postTrigger, int triggerFlags);
+
+// sends the log to the host once recording is complete, called from the background loop
+extern void tlService(void);
+
+#endif
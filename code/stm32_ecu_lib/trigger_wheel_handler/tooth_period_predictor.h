@@ -0,0 +1,100 @@
+#ifndef _toothPeriodPredictor
+#define _toothPeriodPredictor
+
+/*
+This software/firmware source code or executable program is copyright of
+Just Technology (North West) Ltd (http://www.just-technology.co.uk) 2020
+
+This software/firmware source code or executable program is provided as free software:
+you can redistribute it and/or modify it under the terms of the GNU General Public License
+as published by the Free Software Foundation, either version 3 of the License, or (at your
+option) any later version. The license is available at https://www.gnu.org/licenses/gpl-3.0.html
+
+The software/firmware source code or executable program is distributed in the hope that
+it will be useful, but WITHOUT ANY WARRANTY; without even the implied warranty of MERCHANTABILITY
+or FITNESS FOR A PARTICULAR PURPOSE.
+*/
+
+/*
+ *
+ * Tooth period history & predictor.
+ *
+ * The raw tooth periods, normalised to one tooth spacing, are held in a ring buffer. The crankshaft pulse handler is the only
+ * writer. The history index is only updated after the period is written, so the ring can be read without locks.
+ *
+ * The predictor fits a quadratic through the mean of the last three groups of four periods (i.e. using the first & second
+ * differences) and extrapolates it to the next tooth. Averaging over groups of four reduces the effect of tooth to tooth
+ * variation in the trigger wheel on the prediction.
+ *
+ * The extrapolation assumes the period changes smoothly over the last 12 teeth. While cranking, the compression ripple
+ * changes the period by tens of percent within a cylinder, so the quadratic overshoots each swing: the caller then asks for
+ * the last period instead (see twPredictToothPeriod() in trigger_wheel_handler.c).
+ *
+ * Header only & HAL free, so the host benchmark (test_code/predictor_bench.c) runs the same code as the firmware.
+ *
+ */
+
+#include <stdint.h>
+
+
+#define TP_HISTORY 16					// must be a power of 2
+#define TP_GROUP 4						// number of periods averaged in each group
+#define TP_PREDICTOR_PERIODS (3 * TP_GROUP)
+
+typedef struct {
+	volatile uint32_t period[TP_HISTORY];
+	volatile uint32_t index;			// free running index of the next period to be written
+	volatile int count;					// number of consecutive periods in the history
+} tpHistory;
+
+
+// adds a tooth period to the history
+static inline void tpRecordPeriod(tpHistory *h, uint32_t period){
+	uint32_t index = h->index;
+	h->period[index & (TP_HISTORY - 1)] = period;
+	h->index = index + 1;
+	if (h->count < TP_HISTORY) {
+		h->count++;
+	}
+}
+
+
+// the history starts again, e.g. after a sync error or a stall
+static inline void tpRestart(tpHistory *h){
+	h->count = 0;
+}
+
+
+// returns the last period in the history (uS), 0 if the history is empty
+static inline uint32_t tpLastPeriod(tpHistory *h){
+	return h->count > 0 ? h->period[(h->index - 1) & (TP_HISTORY - 1)] : 0;
+}
+
+
+// predicts the next tooth period from the history (uS). Returns the last period if extrapolate is 0 or there's not enough history.
+static inline uint32_t tpPredictPeriod(tpHistory *h, int extrapolate){
+
+	uint32_t index = h->index;
+	int32_t last = h->period[(index - 1) & (TP_HISTORY - 1)];
+
+	if ( (extrapolate == 0) || (h->count < TP_PREDICTOR_PERIODS) ) {
+		return last;
+	}
+
+	// sum of the most recent (a), previous (b) and oldest (c) group of periods
+	int32_t a = 0, b = 0, c = 0;
+	for (int i = 1; i <= TP_GROUP; i++) {
+		a += h->period[(index - i) & (TP_HISTORY - 1)];
+		b += h->period[(index - i - TP_GROUP) & (TP_HISTORY - 1)];
+		c += h->period[(index - i - 2 * TP_GROUP) & (TP_HISTORY - 1)];
+	}
+
+	// the group means are centred 1.5, 5.5 & 9.5 teeth before the last period. The next period is 1 tooth after the last period.
+	// p(1) = a + (a - b) * 2.5 / 4 + (a - 2b + c) * 2.5 * 6.5 / (2 * 4 * 4), all divided by TP_GROUP
+	int32_t prediction = (a + (5 * (a - b)) / 8 + (65 * (a - 2 * b + c)) / 128) / TP_GROUP;
+
+	// limit the prediction to a plausible change from the last period
+	return prediction < last / 2 ? last / 2 : (prediction > last * 2 ? last * 2 : prediction);
+}
+
+#endif
@@ -23,6 +23,12 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 
 
 #include "trigger_wheel_handler.h"
+#include "trigger_decoder.h"
+#include "trigger_logger.h"
+#include "angle_clock.h"
+#include "angle_acquisition.h"
+#include "tooth_correction.h"
+#include "tooth_period_predictor.h"
 #include "ecu_services.h"
 #include "cfg_data.h"
 #include "utility_functions.h"
@@ -32,85 +38,531 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 
 
 // prototypes
-void injectorPowerOnA(void);
-void injectorPowerOffA(void);
-void injectorPowerOnB(void);
-void injectorPowerOffB(void);
-void injectorPowerOnC(void);
-void injectorPowerOffC(void);
-void injectorPowerOnD(void);
-void injectorPowerOffD(void);
-void injectorPowerOnALL(void);
-void injectorPowerOffALL(void);
-void ignitionPowerOff(void);
+void injectorPowerOn(int channel);
+void injectorPowerOff(int channel);
+void injectorPowerOnALL(int channel);
+void injectorPowerOffALL(int channel);
+void ignitionPowerOn(int channel);
+void ignitionPowerOff(int channel);
 void twSetInjectionTiming(float PW);
 void twSetIgnitionTiming(float advance);
+void twBuildEventTable(int batchInjection);
+static void twSetSplitConfig(void);
 
 // pulse period, excludes the missing pulse period (uS)
 volatile int crankPulsePeriodR = 1E6;
 
-// filtered pulse period, based on crankPulsePeriodR (uS)
+// the captured time of the pulse (uS), set by ecu_services before calling the crankshaft pulse handler
+volatile uint32_t crankPulseTime = 0;
+
+// filtered pulse period, based on crankPulsePeriodR (uS). Used for RPM, the injection & ignition delays use the predicted period.
 volatile int crankPulsePeriodF = 1E6;
 
-static volatile int injectorFiringIndex1 = 0;	// injector firing tooth no. near TDC
-static volatile int injectorFiringIndex2 = 18;	// injector firing tooth no. near TDC + 180
-static float injectorVernier = 0;				// injectorVernier is set by setInjectionAngle() and defines the time from the injectorFiringIndex,
-												// expressed as a fraction of the tooth period. It is used to calculate the absolute timing of the
-												// injector opening, based on the measured tooth period.
-static volatile int injectorDelay = 1;	 		// the fine timing in uS of the start of injection
-static volatile int injectorPW = 2000; 			// Injector pulse width in uS
+static int32_t injectorAngle = 0;				// injector opening angle before each cylinder's TDC, set by setInjectionAngle()
+												// (degrees scaled by 2^16)
+static volatile uint32_t injectorPW = 2000; 	// Injector pulse width in uS
+
+// each cylinder's pulse width of each injection pulse (uS) & advance (degrees scaled by 2^16) with its trims, by position in
+// the firing order, and the pulse widths of batch injection. See Per-cylinder trims & Split injection.
+static volatile uint32_t twCylinderPW[CF_MAX_CYLINDERS][CF_MAX_INJECTION_PULSES];
+static volatile uint32_t twBatchPW[CF_MAX_INJECTION_PULSES];
+static int32_t twCylinderAdvance[CF_MAX_CYLINDERS];
+
+// each cylinder's injection start angle before TDC (degrees scaled by 2^16), by position in the firing order. See End of
+// injection timing.
+static int32_t twInjectionAngle[CF_MAX_CYLINDERS];
+
+// the last pulse armed on each injector channel, see Live pulse width update
+typedef struct {
+	uint32_t start;				// on time of the pulse as armed (crankshaft trigger timer, uS)
+	uint32_t time;				// on time of the pulse, or of its add-on pulse (crankshaft trigger timer, uS)
+	uint32_t width;				// pulse width, or width of its add-on pulse (uS)
+	uint32_t target;			// the cylinder pulse width the pulse delivers, with any add-on pulse (uS)
+	uint8_t cylinder;			// the cylinder's position in the firing order
+	uint8_t pulse;				// injection pulse number
+	uint8_t live;				// non-zero while the pulse can be changed
+} twInjectionRecord;
+
+static twInjectionRecord twInjectionLast[INJECTOR_OUTPUTS];
+
+volatile uint32_t twPWUpdates = 0;
+volatile uint32_t twAddOnPulses = 0;
 
 volatile unsigned int triggerWheelInSync = 0;
 volatile int currentTooth = 0;
 
+// sync error count & the expected tooth at the last sync error, copied to keyData by the HF task so the interrupt doesn't use the FPU
+volatile uint32_t twSyncErrors = 0;
+volatile int twErrorTooth = 0;
+
 
 // trigger wheel configuration variables, set by a call to setTriggerWheelConfig()
+int triggerWheelTeeth;
 int triggerWheelTeethHalf;
-float triggerWheelToothSpacingReciprocal;
-float rpmToTeethPerMillisecond;
 float rpmFromPeriod;
 
-// the index into the injector sequence array
-static volatile int injectorIndex = 0;
+// ignition advance before each cylinder's TDC (degrees scaled by 2^16)
+static int32_t ignitionAdvance = 0;
+
+// the dwell (coil power on to the spark) in quarter tooth periods at the current speed, see Coil dwell
+static int dwellQuarters = 1;
+
+// defines OFF and ON for ignition coil (polarity can be changed by NVM settings)
+GPIO_PinState coilON = GPIO_PIN_SET;
+GPIO_PinState coilOFF = GPIO_PIN_RESET;
+
 
-// injector indexes dedicated to injection timers A & B
-static volatile int injectorIndexA, injectorIndexB,injectorIndexC, injectorIndexD;
+/*
+ * Engine phase.
+ *
+ * The engine cycle (720 degrees) is two crankshaft revolutions, identified by twEngineRevolution (0 = 0 to 360, 1 = 360 to 720).
+ * twEngineRevolution is toggled by the crankshaft pulse handler at the start of each revolution, and latched by the camshaft
+ * pulse handler at each camshaft pulse. The pulse sets the revolution it occurs in: a pulse in the first half of a revolution
+ * (tooth < half the teeth) makes the current revolution 0, a pulse in the second half makes the current revolution 1, so the
+ * next revolution start toggles to revolution 0. Hence revolution 0 is the revolution whose start is within 180 degrees of the
+ * pulse (before or after it), not necessarily the revolution after the pulse.
+ *
+ * The phase is only changed at a camshaft pulse, so the events selected for a revolution can't change part way through the
+ * revolution. The phase is lost if the trigger wheel loses sync or the camshaft pulses stop.
+ *
+ */
 
-// injector sequence - holds the injector control pin numbers
-static int injectorSequence[NUM_INJECTORS];
+typedef enum { TW_PHASE_UNKNOWN, TW_PHASE_SYNC } twPhaseStateType;
 
-// ignition index 1 (near TDC) and index 2 (near TDC+180)
-static volatile int ignitionFiringIndex1 = 0;
-static volatile int ignitionFiringIndex2 = 0;
+static volatile twPhaseStateType twPhaseState = TW_PHASE_UNKNOWN;
 
-// ignition dwell index for near TDC and TDC+180 (defines when coil power is turned on)
-static volatile int dwellIndex1 = 0;
-static volatile int dwellIndex2 = 0;
+// the current revolution of the engine cycle, 0 or 1
+volatile int twEngineRevolution = 0;
 
-// ignition start delay (in uS) provides fine adjustment of the ignition timing
-static volatile int ignitionDelay = 1;
+// the engine cycle angle (0 - 7200 tenths of a degree) of the last camshaft pulse
+volatile int twCamshaftPulseAngle = 0;
 
-// holds the coil pin number for switching power off - this action generates the spark
-static volatile int activeCoil;
+// number of camshaft pulses that disagreed with the engine phase
+volatile unsigned int twPhaseErrors = 0;
 
-// defines OFF and ON for ignition coil (polarity can be changed by NVM settings)
-GPIO_PinState coilON = GPIO_PIN_SET;
-GPIO_PinState coilOFF = GPIO_PIN_RESET;
+// set by the camshaft pulse handler, cleared by the crankshaft pulse handler. Used by the trigger logger.
+static volatile int twCamPulseFlag = 0;
 
-// this flag is set by the camshaft handler to request an injector sequence reset. Set to non-zero resets the sequence.
-volatile int twResetFlag = 0;
+// number of revolutions since the last camshaft pulse, the phase is lost if this exceeds TW_MAX_REVS_WITHOUT_CAM
+static volatile int twRevolutionsWithoutCam = 0;
+#define TW_MAX_REVS_WITHOUT_CAM 2
 
-// the injector reset index number
+// Parameters 2 injectorSequenceReset, < 0 if there's no camshaft sensor, i.e. wasted spark & batch injection only
 static int injectorSequenceReset = 0;
-uint8_t check_ig1=0;
-uint8_t check_ig2=0;
 
-// A filter time constant (nvmPage1.filters.crankshaftPulseFilter) provides a smoothed pulse period, used
-// in next pulse period estimation for detecting a missing pulse. The filter TC is defined as a power of 2 and
-// right/left shifting is used in the filter calc instead of multiply & divide.
+
+/*
+ * Staged sync.
+ *
+ * Events are fired as soon as the crankshaft position is known, rather than waiting for the engine phase:
+ *
+ * TW_SYNC_NONE		the trigger decoder is not in sync, no events are fired
+ * TW_SYNC_CRANK	the crankshaft position is known (from the first edge the decoder is in sync) but the engine phase isn't.
+ * 					Wasted spark (the coils of cylinders 360 degrees apart fire together) & batch injection.
+ * TW_SYNC_FULL		the engine phase is known, sequential injection & ignition. Entered at the first revolution start after
+ * 					the phase is confirmed by a camshaft pulse, so the channels don't change part way through a revolution.
+ * 					Without a camshaft sensor (injector sequence reset < 0) the phase is never known, so the engine stays in
+ * 					TW_SYNC_CRANK.
+ *
+ * A sync error returns to TW_SYNC_NONE, loss of the camshaft pulse returns to TW_SYNC_CRANK. Each change of stage is recorded
+ * with its time in twSyncLog, and the times from the first pulse after a stall to crank sync, the first spark & full sync are
+ * recorded for the cranking start time. test_code/cranking_sync_sim.c runs cranking starts through this & the trigger decoder
+ * on the host: at 250 RPM with 20% ripple, the first spark is 645 crank degrees (438 mS) after the first tooth edge on average,
+ * 828 degrees at most, for a 36-1 wheel, and 655 / 824 degrees for 60-2, with or without a camshaft sensor.
+ *
+ */
+
+volatile twSyncStageType twSyncStage = TW_SYNC_NONE;
+twSyncLogEntry twSyncLog[TW_SYNC_LOG_SIZE];
+volatile uint32_t twSyncLogIndex = 0;
+volatile twStartTimesType twStartTimes;
+static int twStartPending = 1;					// set at a stall, the next pulse is the first pulse of a start
+static uint32_t twStartTime = 0;				// time of the first pulse of the start
+
+
+// changes the sync stage & records the change
+static void twSetSyncStage(twSyncStageType stage){
+	uint32_t index = twSyncLogIndex;
+	twSyncLog[index & (TW_SYNC_LOG_SIZE - 1)].stage = stage;
+	twSyncLog[index & (TW_SYNC_LOG_SIZE - 1)].time = crankPulseTime;
+	twSyncLogIndex = index + 1;
+	twSyncStage = stage;
+
+	if ( (twStartTimes.crankSync == 0) && (stage == TW_SYNC_CRANK) ) {
+		twStartTimes.crankSync = crankPulseTime - twStartTime;
+	}
+	if ( (twStartTimes.fullSync == 0) && (stage == TW_SYNC_FULL) ) {
+		twStartTimes.fullSync = crankPulseTime - twStartTime;
+	}
+}
+
+
+// called when the crankshaft stops, the next start is timed from its first pulse
+void twResetSyncStage(){
+	twSyncStage = TW_SYNC_NONE;
+	twStartPending = 1;
+}
+
+
+/*
+ * Per-tooth event table.
+ *
+ * The injection, dwell and ignition events are held in a table indexed by tooth number. Each tooth has a short list of the
+ * events to be fired when that tooth is detected, so crankshaftPulseHandler() only needs to index the table by the current tooth
+ * rather than test the tooth number against every firing index. The cost of the handler is therefore the same at every tooth and
+ * is bounded by TW_MAX_EVENTS_PER_TOOTH, irrespective of the total number of events configured.
+ *
+ * Two tables are held. The HF task builds the inactive table whenever the timing changes (twUpdateEventTable()) then swaps
+ * the active table pointer. The pointer swap is a single 32 bit write so the crankshaft pulse handler always sees a complete
+ * table. The crankshaft pulse handler has the highest priority, so it can never be pre-empted by the HF task while it's
+ * reading the active table.
+ *
+ * The table covers the engine cycle: the tooth positions of revolution 0 (0 to teeth - 1) then of revolution 1 (teeth to
+ * 2 x teeth - 1), so the events of every cylinder in the firing table (see twSetFiringOrder()) are held at their angle in the
+ * cycle. The handler selects the position from the engine phase (twEngineRevolution). Each event holds its cylinder's injector
+ * or coil channel, and the output callbacks are indexed by the channel, so the handler has no per-cylinder code.
+ *
+ */
+
+#define TW_MAX_EVENTS_PER_TOOTH 6
+#define TW_CYCLE_POSITIONS (2 * TW_MAX_TEETH)
+
+typedef enum { TW_EV_INJECTION, TW_EV_DWELL, TW_EV_SPARK } twEventType;
+
+typedef struct {
+	uint8_t type;				// event type, twEventType
+	uint8_t channel;			// injector or coil channel
+	uint8_t cylinder;			// the cylinder's position in the firing order
+	uint8_t pulse;				// injection pulse number, see Split injection
+	uint32_t vernier;			// fraction of the tooth period (scaled by 2^16) to the start of the event
+} twEvent;
+
+typedef struct {
+	int batchInjection;													// non-zero fires all injectors together (cranking)
+	uint8_t nEvents[TW_CYCLE_POSITIONS];								// number of events on each tooth position
+	twEvent events[TW_CYCLE_POSITIONS][TW_MAX_EVENTS_PER_TOOTH];		// the event list for each tooth position
+} twEventTable;
+
+static twEventTable twEventTables[2];
+static twEventTable * volatile twActiveTable = &twEventTables[0];
+
+// set by twInitialise() to force the event table to be rebuilt
+static int twRebuildRequest = 1;
+
+// verniers are fractions of a tooth period, scaled by 2^TW_VERNIER_SHIFT
+#define TW_VERNIER_SHIFT 16
+#define TW_VERNIER_ONE (1L << TW_VERNIER_SHIFT)
+
+// an event on a missing tooth position is fired from the preceding tooth, so its vernier can exceed one tooth period. A dwell
+// event's vernier is the time to the spark, which can be most of a revolution.
+#define TW_MAX_VERNIER (8 * TW_VERNIER_ONE)
+#define TW_MAX_DWELL_VERNIER (TW_MAX_TEETH * TW_VERNIER_ONE)
+
+
+/*
+ * Tooth period history & predictor, see tooth_period_predictor.h.
+ *
+ * The injection & ignition delays are calculated from a prediction of the next tooth period, rather than the filtered period,
+ * so the delay tracks the crankshaft under hard acceleration or deceleration. Below the cranking threshold or before full sync
+ * (i.e. while cranking & through the first firings), the last tooth period is used instead: the extrapolation overshoots the
+ * compression ripple. Without a camshaft sensor there's no full sync, so the cranking threshold alone applies. At 250 RPM with
+ * 20% ripple, test_code/predictor_bench.c measures a delay error of 4.18 deg max, 1.15 deg rms extrapolated, 2.28 / 0.99 deg
+ * from the filtered period & 2.11 / 0.41 deg from the last period.
+ *
+ */
+
+static tpHistory twPeriodHistory;
+
+// set by the HF task above the cranking threshold, the predictor only extrapolates when set
+static volatile int twPredictorRunning = 0;
+
+
+// predicts the next tooth period from the history (uS)
+static inline uint32_t twPredictToothPeriod(void){
+	return tpPredictPeriod(&twPeriodHistory, (twPredictorRunning != 0) && ((twSyncStage == TW_SYNC_FULL) || (injectorSequenceReset < 0)));
+}
+
+
+/*
+ * Segment & revolution timing.
+ *
+ * The crankshaft pulse handler records the time for each 180 degree segment of the engine cycle (TDC to TDC + 180 and TDC + 180
+ * to the next TDC) and for each complete revolution, using the captured pulse times. Only integer times are recorded in the
+ * interrupt. twUpdateCrankSpeed(), called from the HF task, converts them into RPM & acceleration.
+ *
+ * Segments are numbered 0 to 3 through the engine cycle, segment 0 starts at TDC in engine revolution 0. If the tooth at
+ * TDC + 180 is missing from the trigger pattern, the segment boundary is the next tooth, and the segment angles are adjusted.
+ *
+ * For misfire detection, each cylinder's segment of the engine cycle is also timed: from the cylinder's TDC to the next TDC in
+ * the firing table, i.e. 720 / cylinders degrees for an even firing engine. Each cylinder segment starts at the first tooth
+ * at or after the cylinder's TDC, held in a table of the tooth positions of the engine cycle by twSetCylinderSegments(), so
+ * the handler only indexes the table. The completed cylinder segments are queued, numbered by the cylinder's position in the
+ * firing order.
+ *
+ */
+
+#define TW_SEGMENTS 4
+
+static int twSegmentTooth = 18;								// the tooth at the start of the 2nd segment of each revolution
+static int twSegmentTeeth = 18;								// the number of tooth spacings in the 1st segment of each revolution
+static volatile uint32_t twSegmentTime[TW_SEGMENTS];		// time for each segment (uS)
+static volatile uint32_t twRevolutionTime = 0;				// time for the last complete revolution (uS)
+static volatile int twLastSegment = -1;						// the last segment completed, -1 if none
+static volatile int twPreviousSegment = -1;					// the segment before the last segment, -1 if none
+static uint32_t twSegmentStartTime = 0;
+static uint32_t twRevolutionStartTime = 0;
+static int twSegmentTimingValid = 0;						// non-zero once the start of a segment has been seen in sync
+static int twRevolutionTimingValid = 0;						// non-zero once the start of a revolution has been seen in sync
+
+#define TW_NO_CYLINDER_SEGMENT 0xFF
+
+static uint8_t twCylinderSegmentStart[TW_CYCLE_POSITIONS];	// the cylinder segment starting at each tooth position
+static int twCylinderSegment = -1;							// the cylinder segment in progress, -1 if none
+static uint32_t twCylinderSegmentStartTime = 0;
+
+// Completed cylinder segments are queued for deferred processing (misfire detection), so none are missed when more than one
+// segment completes between HF tasks. The queue is written by the interrupt & read by twReadSegment(), the indices are free running.
+#define TW_SEGMENT_QUEUE_SIZE 16
+static volatile int8_t twSegmentQueueNumber[TW_SEGMENT_QUEUE_SIZE];
+static volatile uint32_t twSegmentQueueTime[TW_SEGMENT_QUEUE_SIZE];
+static volatile uint32_t twSegmentQueueIn = 0;
+static uint32_t twSegmentQueueOut = 0;
+
+
+// adds a segment to the segment queue, called from the crankshaft pulse handler
+static inline void twQueueSegment(int segment, uint32_t time) {
+	int i = twSegmentQueueIn & (TW_SEGMENT_QUEUE_SIZE - 1);
+	twSegmentQueueNumber[i] = segment;
+	twSegmentQueueTime[i] = time;
+	twSegmentQueueIn++;
+}
+
+
+// reads the next segment from the segment queue, returns 0 if the queue is empty. The segment number is TW_SEGMENT_RESTART if
+// segment timing restarted (lost sync or queue overrun), i.e. the segment is not contiguous with the previous segment.
+int twReadSegment(int *segment, uint32_t *time) {
+
+	uint32_t in = twSegmentQueueIn;
+
+	if (in == twSegmentQueueOut) {
+		return 0;
+	}
+
+	if (in - twSegmentQueueOut > TW_SEGMENT_QUEUE_SIZE - 1) {
+		// overrun, skip to the oldest segment that can't be overwritten before it's read
+		twSegmentQueueOut = in - (TW_SEGMENT_QUEUE_SIZE / 2);
+		*segment = TW_SEGMENT_RESTART;
+		*time = 0;
+		return 1;
+	}
+
+	int i = twSegmentQueueOut & (TW_SEGMENT_QUEUE_SIZE - 1);
+	*segment = twSegmentQueueNumber[i];
+	*time = twSegmentQueueTime[i];
+	twSegmentQueueOut++;
+	return 1;
+}
+
+
+/*
+ * Coil dwell.
+ *
+ * The dwell is timed rather than started at a tooth, so the coil charge is the same at every speed. The dwell event is on the
+ * tooth before the start of dwell, and its vernier is the time to the spark. It queues the coil power on (startDwellTimer())
+ * twDwellTarget before the spark time predicted from that tooth. The spark is still timed from its own tooth.
+ *
+ * twDwellTarget is set by the HF task from the dwell table (Parameters 3, dwell time against battery voltage), limited to
+ * TW_MAX_DWELL_DUTY of the time between sparks of the same coil. The event table is rebuilt when the dwell in quarter tooth
+ * periods changes, so the dwell event stays on a tooth before the start of dwell.
+ *
+ * The achieved dwell of each coil, from the power on to the spark (the spark callback, or the compare time in the output
+ * compare mode), is compared with its target at the next power on of the coil.
+ *
+ */
+
+#define TW_MAX_DWELL_DUTY 0.75F
+#define TW_DWELL_MEAN_SHIFT 4				// the error mean filter time constant is 2^TW_DWELL_MEAN_SHIFT dwells
+
+volatile uint32_t twDwellTarget = 4000;
+volatile uint32_t twDwellAchieved = 0;
+volatile int32_t twDwellErrorMean = 0;
+volatile uint32_t twDwellErrorMax = 0;
+volatile uint32_t twDwellCount = 0;
+static int32_t twDwellErrorMeanAcc = 0;
+
+// the shortest angle between sparks of the same coil (degrees scaled by 2^16), set by twSetFiringOrder()
+static int32_t twCoilInterval = 360L << 16;
+
+// the power on time & target of each coil's last dwell, the time of its last spark (crankshaft trigger timer, uS) & whether the
+// last dwell is still to be recorded
+static uint32_t twDwellStart[COIL_OUTPUTS];
+static uint32_t twDwellStartTarget[COIL_OUTPUTS];
+static uint32_t twSparkTime[COIL_OUTPUTS];
+static uint8_t twDwellPending[COIL_OUTPUTS];
+
+
+// records the achieved dwell of the coil's last dwell, if it's sparked
+static inline void twRecordDwell(int coil){
+	if (twDwellPending[coil] == 0) {
+		return;
+	}
+	twDwellPending[coil] = 0;
+	int32_t achieved = (int32_t)(twSparkTime[coil] - twDwellStart[coil]);
+	if (achieved <= 0) {
+		return;
+	}
+	int32_t error = achieved - (int32_t)twDwellStartTarget[coil];
+	uint32_t errorAbs = error >= 0 ? error : -error;
+	twDwellAchieved = achieved;
+	twDwellErrorMeanAcc += error - twDwellErrorMeanAcc / (1 << TW_DWELL_MEAN_SHIFT);
+	twDwellErrorMean = twDwellErrorMeanAcc / (1 << TW_DWELL_MEAN_SHIFT);
+	if (errorAbs > twDwellErrorMax) {
+		twDwellErrorMax = errorAbs;
+	}
+	twDwellCount++;
+}
+
+
+void twResetDwellStatistics(){
+	twDwellAchieved = 0;
+	twDwellErrorMean = 0;
+	twDwellErrorMeanAcc = 0;
+	twDwellErrorMax = 0;
+	twDwellCount = 0;
+}
+
+
+/*
+ * Stall detection.
+ *
+ * At every accepted pulse, the crankshaft pulse handler arms a timer compare (startCrankshaftStallTimer()) at TW_STALL_PERIODS
+ * times the longest gap in the trigger pattern, scaled by the last tooth period, i.e. a pulse is overdue by at least 2 gaps.
+ * Until the tooth period is known (out of sync), the timeout is TW_MAX_STALL_TIMEOUT. If the compare is reached,
+ * crankshaftStallHandler() stops the pending injection & ignition timers, switches the injectors & coils off, then drops sync
+ * & clears the RPM. Hence a coil can't be left in dwell, or an injector open, after the crankshaft stops.
+ *
+ * test_code/stall_latency_sim.c stops the crankshaft dead between two edges on the host: at the cranking threshold (500 RPM) the
+ * outputs are off 22.2 mS at most after the last edge of a 36-1 wheel, 18.5 mS after the next edge was due (20.0 / 17.8 mS for
+ * 60-2). The stall handler's cycles (crankshaftStallCycles) haven't been measured on the target.
+ *
+ */
+
+#define TW_STALL_PERIODS 3
+#define TW_MIN_STALL_TIMEOUT 2000				// uS
+#define TW_MAX_STALL_TIMEOUT 200000				// uS, i.e. a 36-1 wheel down to 30 RPM
+
+
+// returns the stall timeout for the pulse just handled (uS)
+static inline uint32_t twStallTimeout(void){
+	uint32_t period = tpLastPeriod(&twPeriodHistory);
+	if (period == 0) {
+		return TW_MAX_STALL_TIMEOUT;
+	}
+	return limitI((TW_STALL_PERIODS * period * tdGetMaxGap()) / 4, TW_MIN_STALL_TIMEOUT, TW_MAX_STALL_TIMEOUT);
+}
+
+
+// the crankshaft has stopped
+void crankshaftStallHandler(){
+
+	// outputs off first
+	stopIgnInjTimers();
+	injectorPowerReset();
+
+	// a dwell cut short isn't recorded, & no pulse is added to an injection cut short
+	memset(twDwellPending, 0, sizeof(twDwellPending));
+	memset(twInjectionLast, 0, sizeof(twInjectionLast));
+
+	// clear the sync count & sync error count, the HF task clears the RPM
+	triggerWheelInSync = 0;
+	twSyncErrors = 0;
+
+	// the next pulse is the first pulse of a start
+	tdResetSync();
+	twPhaseState = TW_PHASE_UNKNOWN;
+	tpRestart(&twPeriodHistory);
+	if (twCylinderSegment >= 0) {
+		twQueueSegment(TW_SEGMENT_RESTART, 0);
+	}
+	twCylinderSegment = -1;
+	twSegmentTimingValid = 0;
+	twRevolutionTimingValid = 0;
+	twLastSegment = -1;
+	twPreviousSegment = -1;
+	twResetSyncStage();
+	acStop();
+	aqStop();
+}
+
+
+// fires the events at a tooth position of the engine cycle. Injection events are only fired if injection is non-zero.
+static inline void twFireEvents(twEventTable *table, int position, int injection, int batchInjection, uint32_t predictedPeriod,
+		uint32_t crankPulseTime){
+
+	for (int i = 0; i < table->nEvents[position]; i++) {
+
+		twEvent *ev = &table->events[position][i];
+		int channel = ev->channel;
+
+		// convert the vernier into the time of the event (uS), from the captured time of the pulse
+		uint32_t time = crankPulseTime + (uint32_t)(((uint64_t)predictedPeriod * ev->vernier) >> TW_VERNIER_SHIFT);
+
+		switch (ev->type) {
+		case TW_EV_INJECTION:
+			// if running, switch on the cylinder's injector. Otherwise, switch ALL injectors ON simultaneously
+			if (injection == 0) {
+				break;
+			}
+			if (batchInjection == 0) {
+				uint32_t pw = twCylinderPW[ev->cylinder][ev->pulse];
+				startInjectionTimer(channel, time, pw, injectorPowerOn, injectorPowerOff);
+				startInjectorCompare(channel, time, pw);
+				twInjectionRecord *last = &twInjectionLast[channel];
+				last->start = time;
+				last->time = time;
+				last->width = pw;
+				last->target = pw;
+				last->cylinder = ev->cylinder;
+				last->pulse = ev->pulse;
+				last->live = 1;
+			}
+			else {
+				twInjectionLast[channel].live = 0;
+				uint32_t pw = twBatchPW[ev->pulse];
+				startInjectionTimer(channel, time, pw, injectorPowerOnALL, injectorPowerOffALL);
+				startInjectorCompareAll(time, pw);
+			}
+			break;
+		case TW_EV_DWELL:
+			// energise the coil the target dwell before the spark
+			startDwellTimer(channel, time - twDwellTarget, ignitionPowerOn);
+			break;
+		case TW_EV_SPARK:
+		default:
+			// trigger the coil after the ignition delay
+			if (outputMode == OUTPUT_MODE_COMPARE) {
+				// all the coils are on compare channels
+				startCoilCompareSpark(channel, time);
+				twSparkTime[channel] = time;
+			}
+			else {
+				startIgnitionTimer(channel, time, ignitionPowerOff);
+			}
+			if (twStartTimes.firstSpark == 0) {
+				twStartTimes.firstSpark = time - twStartTime;
+			}
+			break;
+		}
+	}
+}
 
 
 // handle a crankshaft trigger wheel pulse. the period provided is in micro-seconds (uS)
+// A filter time constant (nvmPage1.filters.crankshaftPulseFilter) provides a smoothed pulse period. The filter TC is defined as a
+// power of 2 and right/left shifting is used in the filter calc instead of multiply & divide.
+// The trigger pattern is decoded by the trigger decoder (trigger_decoder.c), which provides the tooth index for each pulse.
+
+
 void crankshaftPulseHandler(int crankPulsePeriod) {
 
 	
@@ -124,179 +576,175 @@ void crankshaftPulseHandler(int crankPulsePeriod) {
 	#endif
 
 	static int crankPulsePeriodFN_1 = 0; 				// period N-1 value for filter (uS)
-	static int crankPulsePeriodFtN_1 = 0;				// last filtered value (uS)
-	static int crankPulsePeriodEstimate = 0;			// an estimate of the period to the next pulse (uS)
-	
-	// increment the tooth index
-	currentTooth++;	
-	
-	// if at TDC or TDC + 180, update injection & ignition timing variables
-	if ( (currentTooth == cfPage1.p2.twTeeth) || (currentTooth == triggerWheelTeethHalf) ) {
-		 twSetInjectionTiming(keyData.v.injectorPW);
-		 twSetIgnitionTiming(keyData.v.interpolatedAdvance);
-	}
+	tdEdgeResult edge;
 
+	// decode the pulse
+	tdProcessEdge(crankPulsePeriod, &edge);
 
-	// if at TDC test, for an injector index reset condition
-	if (currentTooth == cfPage1.p2.twTeeth) {
-		// condition #1 - if the injector sequence reset value is < 0, set the index to zero
-		if (injectorSequenceReset < 0){
-			injectorIndex = 0;
+	if (edge.rejected != 0) {
+		// the pulse arrived too early to be a tooth, ignore it. The next pulse's period is from the last accepted pulse.
+		if (tlRecording != 0) {
+			tlRecord(crankPulseTime, TD_NO_TOOTH, TL_REJECTED | TL_IN_SYNC | (twEngineRevolution != 0 ? TL_ENGINE_REV : 0), 0);
 		}
-		// condition #2 - the injector sequence reset value is not -1, so test for receipt of a camshaft position pulse (i.e. twResetFlag > 0)
-		else {
-			if (twResetFlag != 0) {
-				injectorIndex = injectorSequenceReset;
-				twResetFlag = 0;
-			}
+		#if MEASURE_TW_TASKS == 1
+			HAL_GPIO_WritePin(Fan_Control_GPIO_Port, Fan_Control_Pin, GPIO_PIN_RESET);
+		#endif
+		return;
+	}
+	crankPulsePeriod = edge.period;
+
+	if (edge.syncError != 0) {
+		// the pulse didn't match the trigger pattern, so record error
+		twErrorTooth = edge.errorTooth;
+		twSyncErrors++;
+		// the engine phase can't be relied on
+		twPhaseState = TW_PHASE_UNKNOWN;
+		// segment timing starts again
+		if (twCylinderSegment >= 0) {
+			twQueueSegment(TW_SEGMENT_RESTART, 0);
 		}
+		twCylinderSegment = -1;
+		twSegmentTimingValid = 0;
+		twRevolutionTimingValid = 0;
 	}
 
+	// at TDC (the first tooth of the revolution)
+	if (edge.revolutionStart != 0) {
 
-	// if the pulse period is longer than a missing pulse threshold, then the missing tooth is deemed to have just passed the sensor.
-	// the missing pulse threshold is 1.5 x the estimated period
-
-	// test for the missing tooth/pulse AND the current tooth > halfway round the trigger wheel
-	if ( (currentTooth > triggerWheelTeethHalf) && (crankPulsePeriod > (crankPulsePeriodEstimate + (crankPulsePeriodEstimate >> 1))) ) {
-		
-		// missing tooth detected, check to ensure the index is correct
-		if (currentTooth != cfPage1.p2.twTeeth) {
+		// record number of in-sync revolutions
+		triggerWheelInSync++;
 
-			// incorrect index, so record error
-			keyData.v.errorTooth = currentTooth;
-			keyData.v.syncErrors++;
-     
-		}
-		else {
-			// record number of in-sync revolutions
-			triggerWheelInSync++;
+		// step the engine phase to the next revolution
+		twEngineRevolution ^= 1;
+		if (++twRevolutionsWithoutCam > TW_MAX_REVS_WITHOUT_CAM) {
+			twPhaseState = TW_PHASE_UNKNOWN;
 		}
+	}
 
-		// reset the tooth index
-		// the missing tooth index is 0, so this tooth must be 1 (for a 36-1 wheel)
-		// for a 60-2 wheel, the missing teeth indicies are 0 and 1, so this must be set to 2.
-		// i.e. the number of missing teeth
-		currentTooth = cfPage1.p2.twMissingTeeth;
+	// the tooth index, TD_NO_TOOTH if not in sync or the pulse isn't on a tooth position
+	currentTooth = edge.tooth;
 
+	// staged sync
+	if (twStartPending != 0) {
+		twStartPending = 0;
+		twStartTime = crankPulseTime;
+		twStartTimes.crankSync = 0;
+		twStartTimes.firstSpark = 0;
+		twStartTimes.fullSync = 0;
 	}
-	else {
-		// not a missing pulse, so capture the pulse period for use in subsequent calcs
-		// this measurement excludes the missing pulse period
-		crankPulsePeriodR = crankPulsePeriod;
+	if (tdInSync == 0) {
+		if (twSyncStage != TW_SYNC_NONE) {
+			twSetSyncStage(TW_SYNC_NONE);
+		}
+	}
+	else if (twSyncStage == TW_SYNC_NONE) {
+		twSetSyncStage(TW_SYNC_CRANK);
+	}
+	else if (edge.revolutionStart != 0) {
+		int phaseKnown = (twPhaseState == TW_PHASE_SYNC) && (injectorSequenceReset >= 0);
+		if ( (twSyncStage == TW_SYNC_CRANK) && (phaseKnown != 0) ) {
+			twSetSyncStage(TW_SYNC_FULL);
+		}
+		else if ( (twSyncStage == TW_SYNC_FULL) && (phaseKnown == 0) ) {
+			twSetSyncStage(TW_SYNC_CRANK);
+		}
 	}
-	
-	if (triggerWheelInSync > 0) {
-	
-		// Injection ....
-		
-		// set up the timing for the injector pulse if the current tooth is at the defined firing index
-		// user timer A for index1 (near TDC) injection events
-		if ( currentTooth == injectorFiringIndex1 ) {
-		
-			// check if the engine is running (RPM > cranking threshold)
-			// if running, switch on the injector in sequence. Otherwise, switch ALL injectors ON simultaneously
-			if(HAL_GPIO_ReadPin(CMP_SIGNAL_CHECK_GPIO_Port,CMP_SIGNAL_CHECK_Pin) == GPIO_PIN_SET){
-					if (keyData.v.RPM > cfPage1.p1.crankingThreshold) {
-						startInjectionTimerA(injectorDelay, injectorPW, injectorPowerOnA, injectorPowerOffA);
-					}
-					else {
-						startInjectionTimerA(injectorDelay, injectorPW, injectorPowerOnALL, injectorPowerOffALL);
-					}
-			}
-			else{
-					if (keyData.v.RPM > cfPage1.p1.crankingThreshold) {
-						startInjectionTimerA(injectorDelay, injectorPW, injectorPowerOnD, injectorPowerOffD);
-					}
-					else {
-						startInjectionTimerA(injectorDelay, injectorPW, injectorPowerOnALL, injectorPowerOffALL);
-					}
-			
-			}
-			
 
+	// segment & revolution timing
+	if ( (edge.revolutionStart != 0) || ((currentTooth == twSegmentTooth) && (tdInSync != 0)) ) {
+		if (twSegmentTimingValid != 0) {
+			// the segment just completed. At the start of a revolution, it's the 2nd segment of the previous revolution.
+			int segment = edge.revolutionStart != 0 ? 2 * (twEngineRevolution ^ 1) + 1 : 2 * twEngineRevolution;
+			twSegmentTime[segment] = crankPulseTime - twSegmentStartTime;
+			twPreviousSegment = twLastSegment;
+			twLastSegment = segment;
 		}
+		twSegmentStartTime = crankPulseTime;
+		twSegmentTimingValid = 1;
 
-		// user timer B for index2 (near TDC + 180) injection events
-		if ( currentTooth == injectorFiringIndex2 ) {
-			if(HAL_GPIO_ReadPin(CMP_SIGNAL_CHECK_GPIO_Port,CMP_SIGNAL_CHECK_Pin) == GPIO_PIN_SET){
-					if (keyData.v.RPM > cfPage1.p1.crankingThreshold) {
-						startInjectionTimerB(injectorDelay, injectorPW, injectorPowerOnC, injectorPowerOffC);
-					}
-					else {
-						startInjectionTimerB(injectorDelay, injectorPW, injectorPowerOnALL, injectorPowerOffALL);
-					}
+		if (edge.revolutionStart != 0) {
+			if (twRevolutionTimingValid != 0) {
+				twRevolutionTime = crankPulseTime - twRevolutionStartTime;
 			}
-			else{
-					if (keyData.v.RPM > cfPage1.p1.crankingThreshold) {
-						startInjectionTimerB(injectorDelay, injectorPW, injectorPowerOnB, injectorPowerOffB);
-					}
-					else {
-						startInjectionTimerB(injectorDelay, injectorPW, injectorPowerOnALL, injectorPowerOffALL);
-					}
-			
-			}
-		}
-		
-		// Ignition ...
-
-		if (currentTooth == dwellIndex1) {
-			if(HAL_GPIO_ReadPin(CMP_SIGNAL_CHECK_GPIO_Port,CMP_SIGNAL_CHECK_Pin) == GPIO_PIN_SET)
-			// energise COIL A   1
-			HAL_GPIO_WritePin(coilIO[0].port, coilIO[0].pin, coilON);
-			
-			else
-				//energise COIL D   4
-				HAL_GPIO_WritePin(coilIO[3].port, coilIO[3].pin, coilON);
+			twRevolutionStartTime = crankPulseTime;
+			twRevolutionTimingValid = 1;
 		}
+	}
 
-		if (currentTooth == dwellIndex2) {
-			// energise COIL B
-			//HAL_GPIO_WritePin(coilIO[1].port, coilIO[1].pin, coilON);
-			if(HAL_GPIO_ReadPin(CMP_SIGNAL_CHECK_GPIO_Port,CMP_SIGNAL_CHECK_Pin) == GPIO_PIN_SET)
-			// energise COIL C   3
-			HAL_GPIO_WritePin(coilIO[2].port, coilIO[2].pin, coilON);
-			
-			else
-				//energise COIL B   2
-				HAL_GPIO_WritePin(coilIO[1].port, coilIO[1].pin, coilON);
-		}
-			
-		if (currentTooth == ignitionFiringIndex1) {
-			if(HAL_GPIO_ReadPin(CMP_SIGNAL_CHECK_GPIO_Port,CMP_SIGNAL_CHECK_Pin) == GPIO_PIN_SET){
-					check_ig1 = ignitionFiringIndex1;
-					// trigger COIL A
-					activeCoil = 0;
-					startIgnitionTimer(ignitionDelay, ignitionPowerOff);
-			
-			}
-			else {
-					//check_ig1 = ignitionFiringIndex1;
-							// trigger COIL D
-							activeCoil = 3;
-							startIgnitionTimer(ignitionDelay, ignitionPowerOff);
-			
+	// cylinder segment timing, from the tooth position in the engine cycle
+	if ( (tdInSync != 0) && (currentTooth < triggerWheelTeeth) ) {
+		int cylinder = twCylinderSegmentStart[twEngineRevolution == 0 ? currentTooth : currentTooth + triggerWheelTeeth];
+		if (cylinder != TW_NO_CYLINDER_SEGMENT) {
+			if (twCylinderSegment >= 0) {
+				twQueueSegment(twCylinderSegment, crankPulseTime - twCylinderSegmentStartTime);
 			}
-			
+			twCylinderSegment = cylinder;
+			twCylinderSegmentStartTime = crankPulseTime;
 		}
+	}
 
-		if (currentTooth == ignitionFiringIndex2) {
-			
-			if(HAL_GPIO_ReadPin(CMP_SIGNAL_CHECK_GPIO_Port,CMP_SIGNAL_CHECK_Pin) == GPIO_PIN_SET){
-					check_ig2 = ignitionFiringIndex2;
-			// trigger COIL C
-			activeCoil = 2;
-			startIgnitionTimer(ignitionDelay, ignitionPowerOff);
-			
-			}
-			else {
-			//		check_ig2 = ignitionFiringIndex2;
-			// trigger COIL B
-			activeCoil = 1;
-			startIgnitionTimer(ignitionDelay, ignitionPowerOff);
-			
+	if (edge.fullTooth != 0) {
+		// the pulse is one tooth spacing from the previous pulse, so capture the pulse period for use in subsequent calcs
+		// this measurement excludes gap periods (e.g. the missing tooth)
+		crankPulsePeriodR = crankPulsePeriod;
+	}
+
+	// trigger logger
+	if (tlRecording != 0) {
+		tlRecord(crankPulseTime, edge.tooth,
+				(tdInSync != 0 ? TL_IN_SYNC : 0) | (edge.revolutionStart != 0 ? TL_REV_START : 0) | (edge.syncError != 0 ? TL_SYNC_ERROR : 0) |
+				(twCamPulseFlag != 0 ? TL_CAM_PULSE : 0) | (twEngineRevolution != 0 ? TL_ENGINE_REV : 0) | (edge.fullTooth != 0 ? TL_FULL_TOOTH : 0),
+				edge.gap);
+	}
+	twCamPulseFlag = 0;
+
+	// record the tooth period for the predictor, gap periods are normalised to one tooth spacing
+	if (edge.gap > 0) {
+		tpRecordPeriod(&twPeriodHistory, ((uint32_t)crankPulsePeriod * 4) / edge.gap);
+	}
+	else {
+		// not in sync, the history starts again
+		tpRestart(&twPeriodHistory);
+	}
+
+	// the crankshaft has stopped if the next pulse doesn't arrive within the timeout
+	startCrankshaftStallTimer(crankPulseTime, twStallTimeout());
+
+	// lock the angle clock to this pulse
+	acEdge(crankPulseTime, crankPulsePeriod, edge.tooth, edge.gap, edge.nextGap, twEngineRevolution);
+
+	// arm the ADC trigger for any angle synchronous samples before the next pulse
+	aqEdge();
+
+	// record the tooth time for the tooth angle correction
+	tcEdge(crankPulseTime, edge.tooth, edge.revolutionStart, tdInSync);
+	
+	// fire the events listed for this tooth
+	if ( (twSyncStage != TW_SYNC_NONE) && (currentTooth < triggerWheelTeeth) ) {
+
+		twEventTable *table = twActiveTable;
+
+		// the engine phase selects the tooth position in the engine cycle, the same tooth in the other revolution is 360 degrees on
+		int position = twEngineRevolution == 0 ? currentTooth : currentTooth + triggerWheelTeeth;
+		int positionAlt = twEngineRevolution == 0 ? currentTooth + triggerWheelTeeth : currentTooth;
+
+		// until the phase is known, batch injection & wasted spark
+		int wastedSpark = twSyncStage != TW_SYNC_FULL;
+
+		if ( (table->nEvents[position] > 0) || ((wastedSpark != 0) && (table->nEvents[positionAlt] > 0)) ) {
+
+			int batchInjection = (table->batchInjection != 0) || (wastedSpark != 0);
+
+			// the predicted period to the next tooth
+			uint32_t predictedPeriod = twPredictToothPeriod();
+
+			twFireEvents(table, position, 1, batchInjection, predictedPeriod, crankPulseTime);
+
+			// wasted spark, the coils of the cylinders 360 degrees on are fired too
+			if (wastedSpark != 0) {
+				twFireEvents(table, positionAlt, 0, batchInjection, predictedPeriod, crankPulseTime);
 			}
 		}
-		
 	} // end if triggerWheelInSync
 
 	// provide a filtered crankshaft pulse period
@@ -306,11 +754,6 @@ void crankshaftPulseHandler(int crankPulsePeriod) {
 	
 	// normalise the filtered pulse period
 	crankPulsePeriodF = crankPulsePeriodFTemp >> cfPage1.filters.crankshaftPulseFilter;
-
-	// calculate the next pulse period for missing tooth detection
-	// this calculation takes account of accel/decel of the crankshaft		
-	crankPulsePeriodEstimate = 2 * crankPulsePeriodF - crankPulsePeriodFtN_1;
-	crankPulsePeriodFtN_1 = crankPulsePeriodF; 
 	
 	#if MEASURE_TW_TASKS == 1
 		HAL_GPIO_WritePin(Fan_Control_GPIO_Port, Fan_Control_Pin, GPIO_PIN_RESET);
@@ -319,181 +762,351 @@ void crankshaftPulseHandler(int crankPulsePeriod) {
 } // end crankshaftPulse()
 
 
-// this turns the power off to the specified coil - effectively generates the spark
-void ignitionPowerOff(){
-	HAL_GPIO_WritePin(coilIO[activeCoil].port, coilIO[activeCoil].pin, coilOFF);
-}
+// Converts the segment & revolution times into RPM & acceleration. Called from the HF task.
+// Returns the RPM over the last segment, 0 if the segment timing is not available.
+float twUpdateCrankSpeed() {
+
+	int last = twLastSegment;
+	int previous = twPreviousSegment;
+	uint32_t revolutionTime = twRevolutionTime;
 
-// timer A callback - switches an injector ON
-void injectorPowerOnA() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndex]].port, injectorIO[injectorSequence[injectorIndex]].pin, GPIO_PIN_SET);
-   HAL_GPIO_WritePin(injectorIO[0].port, injectorIO[0].pin, GPIO_PIN_SET);
-	// capture the injector index
-	injectorIndexA = injectorIndex;
-	// increment the sequence no and reset if overflow
-	if (++injectorIndex >= NUM_INJECTORS) {
-		injectorIndex = 0;
+	if ( (triggerWheelInSync == 0) || (last < 0) ) {
+		return 0.0F;
 	}
-}
 
-// timer B callback - switches an injector ON
-void injectorPowerOnB() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndex]].port, injectorIO[injectorSequence[injectorIndex]].pin, GPIO_PIN_SET);
-	HAL_GPIO_WritePin(injectorIO[1].port, injectorIO[1].pin, GPIO_PIN_SET);
-	// capture the injector index
-	injectorIndexB = injectorIndex;
-	// increment the sequence no and reset if overflow
-	if (++injectorIndex >= NUM_INJECTORS) {
-		injectorIndex = 0;
-	}	
+	// RPM for each segment, the 1st segment of each revolution spans twSegmentTeeth
+	float segmentRPM[TW_SEGMENTS];
+	for (int i = 0; i < TW_SEGMENTS; i++) {
+		int segmentTeeth = (i & 1) == 0 ? twSegmentTeeth : triggerWheelTeeth - twSegmentTeeth;
+		segmentRPM[i] = twSegmentTime[i] > 0 ? rpmFromPeriod * (float)segmentTeeth / (float)twSegmentTime[i] : 0.0F;
+	}
+	keyData.v.segmentRPM1 = segmentRPM[0];
+	keyData.v.segmentRPM2 = segmentRPM[1];
+	keyData.v.segmentRPM3 = segmentRPM[2];
+	keyData.v.segmentRPM4 = segmentRPM[3];
+
+	keyData.v.revolutionRPM = revolutionTime > 0 ? 60000000.0F / (float)revolutionTime : 0.0F;
+
+	// acceleration from the change in speed over the last two segments, divided by the time between the centres of the segments
+	if ( (previous >= 0) && (twSegmentTime[last] > 0) && (twSegmentTime[previous] > 0) ) {
+		keyData.v.crankAcceleration = (segmentRPM[last] - segmentRPM[previous]) * 2000000.0F / (float)(twSegmentTime[last] + twSegmentTime[previous]);
+	}
+
+	return segmentRPM[last];
 }
-// timer c callback - switches an injector ON
-void injectorPowerOnC() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndex]].port, injectorIO[injectorSequence[injectorIndex]].pin, GPIO_PIN_SET);
-	HAL_GPIO_WritePin(injectorIO[2].port, injectorIO[2].pin, GPIO_PIN_SET);
-	// capture the injector index
-	injectorIndexC = injectorIndex;
-	// increment the sequence no and reset if overflow
-	if (++injectorIndex >= NUM_INJECTORS) {
-		injectorIndex = 0;
+
+
+// returns non-zero if the next tooth has events, i.e. the pulse is angle critical. Used by the DMA capture mode.
+int twNextToothHasEvents() {
+
+	if (tdInSync == 0) {
+		return 0;
+	}
+	if (currentTooth >= triggerWheelTeeth) {
+		// an additional pulse between tooth positions, the next pulse is a tooth
+		return 1;
 	}
+
+	// the next tooth position with a tooth
+	int tooth = currentTooth;
+	do {
+		tooth = tooth + 1 < triggerWheelTeeth ? tooth + 1 : 0;
+	} while ( (tdToothPresent(tooth) == 0) && (tooth != currentTooth) );
+
+	// either revolution, the phase may change at a camshaft pulse & both are fired for wasted spark
+	return (twActiveTable->nEvents[tooth] > 0) || (twActiveTable->nEvents[tooth + triggerWheelTeeth] > 0);
 }
 
-// timer d callback - switches an injector ON
-void injectorPowerOnD() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndex]].port, injectorIO[injectorSequence[injectorIndex]].pin, GPIO_PIN_SET);
-	HAL_GPIO_WritePin(injectorIO[3].port, injectorIO[3].pin, GPIO_PIN_SET);
-	// capture the injector index
-	injectorIndexD= injectorIndex;
-	// increment the sequence no and reset if overflow
-	if (++injectorIndex >= NUM_INJECTORS) {
-		injectorIndex = 0;
-	}	
+
+// handle a camshaft pulse. Latches the engine phase from the crankshaft position at the pulse.
+void camshaftPulseHandler() {
+
+	// camshaft referenced trigger patterns use the pulse as the cycle reference
+	tdCamshaftEdge();
+	twCamPulseFlag = 1;
+
+	// the crankshaft position must be known to determine the phase
+	if (triggerWheelInSync == 0) {
+		twPhaseState = TW_PHASE_UNKNOWN;
+		return;
+	}
+	if (currentTooth >= triggerWheelTeeth) {
+		return;
+	}
+
+	// the revolution that the pulse occurred in
+	int revolution = currentTooth < triggerWheelTeethHalf ? 0 : 1;
+
+	if ( (twPhaseState == TW_PHASE_SYNC) && (revolution != twEngineRevolution) ) {
+		// the pulse disagrees with the phase
+		twPhaseErrors++;
+	}
+
+	if (revolution != twEngineRevolution) {
+		// the segment numbers change with the phase, so segment timing starts again
+		if (twCylinderSegment >= 0) {
+			twQueueSegment(TW_SEGMENT_RESTART, 0);
+		}
+		twCylinderSegment = -1;
+		twSegmentTimingValid = 0;
+	}
+
+	twEngineRevolution = revolution;
+	twCamshaftPulseAngle = (3600 * (revolution * triggerWheelTeeth + currentTooth)) / triggerWheelTeeth;
+	twRevolutionsWithoutCam = 0;
+	twPhaseState = TW_PHASE_SYNC;
 }
 
 
-// timer A callback - switches off injector specified by injectorIndexA
-void injectorPowerOffA() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndexA]].port, injectorIO[injectorSequence[injectorIndexA]].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[0].port, injectorIO[0].pin, GPIO_PIN_RESET);
+// dwell timer callback - turns the power on to the coil channel, recording the achieved dwell of the last spark
+void ignitionPowerOn(int channel){
+	ioWritePin(&coilIO[channel], coilON);
+	startCoilCompareDwell(channel);
+	twRecordDwell(channel);
+	twDwellStart[channel] = CRANKSHAFT_TRIGGER_TIMER->CNT;
+	twDwellStartTarget[channel] = twDwellTarget;
+	twDwellPending[channel] = 1;
 }
 
-// timer B callback - switches off injector specified by injectorIndexB
-void injectorPowerOffB() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndexB]].port, injectorIO[injectorSequence[injectorIndexB]].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[1].port, injectorIO[1].pin, GPIO_PIN_RESET);
+// this turns the power off to the coil channel - effectively generates the spark
+void ignitionPowerOff(int channel){
+	ioWritePin(&coilIO[channel], coilOFF);
+	twSparkTime[channel] = CRANKSHAFT_TRIGGER_TIMER->CNT;
 }
 
-// timer C callback - switches off injector specified by injectorIndexA
-void injectorPowerOffC() {
-	//HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndexC]].port, injectorIO[injectorSequence[injectorIndexC]].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[2].port, injectorIO[2].pin, GPIO_PIN_RESET);
+// injection timer callback - switches the channel's injector ON
+void injectorPowerOn(int channel) {
+	ioWritePin(&injectorIO[channel], GPIO_PIN_SET);
 }
 
-// timer D callback - switches off injector specified by injectorIndexB
-void injectorPowerOffD() {
-  //HAL_GPIO_WritePin(injectorIO[injectorSequence[injectorIndexD]].port, injectorIO[injectorSequence[injectorIndexD]].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[3].port, injectorIO[3].pin, GPIO_PIN_RESET);
+// injection timer callback - switches the channel's injector OFF
+void injectorPowerOff(int channel) {
+	ioWritePin(&injectorIO[channel], GPIO_PIN_RESET);
 }
 
-// switch ALL injectors ON
-void injectorPowerOnALL() {
-//	startInjectionTimer(injectorPW, injectorPowerOffALL);
-	HAL_GPIO_WritePin(injectorIO[0].port, injectorIO[0].pin, GPIO_PIN_SET);
-	HAL_GPIO_WritePin(injectorIO[1].port, injectorIO[1].pin, GPIO_PIN_SET);
-	HAL_GPIO_WritePin(injectorIO[2].port, injectorIO[2].pin, GPIO_PIN_SET);
-	HAL_GPIO_WritePin(injectorIO[3].port, injectorIO[3].pin, GPIO_PIN_SET);
+// switch ALL injectors ON, together
+void injectorPowerOnALL(int channel) {
+	ioWriteGroup(&injectorGroup, GPIO_PIN_SET);
 }
 
-// switch ALL injectors OFF
-void injectorPowerOffALL() {
-	HAL_GPIO_WritePin(injectorIO[0].port, injectorIO[0].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[1].port, injectorIO[1].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[2].port, injectorIO[2].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[3].port, injectorIO[3].pin, GPIO_PIN_RESET);
+// switch ALL injectors OFF, together
+void injectorPowerOffALL(int channel) {
+	ioWriteGroup(&injectorGroup, GPIO_PIN_RESET);
 }
 
 
 // this function converts an angle (referenced at the first missing tooth) to a tooth index number and the proportional distance between teeth (vernier)
 // e.g. for a 36 tooth wheel @ 10 deg spacing, and angle of 42 would give tooth index 4 and a vernier of 0.2
-void angleToIndexAndVernier(float angle, int *index, float *vernier) {
-	// calculate the tooth number from angle
-	*index = angle * triggerWheelToothSpacingReciprocal;
-	// calculate the proportional distance to next tooth
-	*vernier = angle * triggerWheelToothSpacingReciprocal - *index;
+// The angle is in degrees & the vernier a fraction of a tooth spacing, both scaled by 2^16. As for a cast, the index is rounded
+// towards zero, so the vernier of a negative angle is negative. test_code/fixed_point_check.c checks the tooth indices are exact &
+// the verniers within 2^-16 of a tooth, from -720 to 720 degrees.
+void angleToIndexAndVernier(int32_t angle, int *index, int32_t *vernier) {
+	// calculate the tooth position from angle, exact to the nearest 2^-16 tooth spacing below
+	int32_t position = (int32_t)(((int64_t)angle * triggerWheelTeeth) / 360);
+	// the tooth number & the proportional distance to next tooth
+	*index = position / TW_VERNIER_ONE;
+	*vernier = position - *index * TW_VERNIER_ONE;
+}
+
+
+// converts an angle in degrees to the fixed point angle used by angleToIndexAndVernier()
+static inline int32_t twAngleToFixed(float angle) {
+	return (int32_t)(limitF(angle, -720.0F, 720.0F) * 65536.0F);
 }
 
-// sets the angle relative to TDC for injector power on. The power on, or firing time is defined by a tooth number
-// for the TDC and TDC + 180 events and a vernier (time delay) to define the precise angle at a finer resolution than
-// can be achieved by just the tooth number.
-void setInjectionAngle(float injectorAngle) {
-	// calculate the injector firing tooth index and firing vernier
-	int tooth;
-	angleToIndexAndVernier(cfPage1.p2.twTDCAngle - injectorAngle, &tooth, &injectorVernier);
-	injectorFiringIndex1 = tooth;
-	injectorFiringIndex2 = injectorFiringIndex1 + triggerWheelTeethHalf;
+// sets the angle before each cylinder's TDC for injector power on. The event table holds the tooth & vernier (time delay) of
+// each cylinder's injection, which defines the precise angle at a finer resolution than can be achieved by just the tooth number.
+void setInjectionAngle(float angle) {
+	injectorAngle = twAngleToFixed(angle);
 }
 
 
 // de-energise the injectors & coils
 void injectorPowerReset(){
-	HAL_GPIO_WritePin(injectorIO[0].port, injectorIO[0].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[1].port, injectorIO[1].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[2].port, injectorIO[2].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(injectorIO[3].port, injectorIO[3].pin, GPIO_PIN_RESET);
-	HAL_GPIO_WritePin(coilIO[0].port, coilIO[0].pin, coilOFF);
-	HAL_GPIO_WritePin(coilIO[1].port, coilIO[1].pin, coilOFF);
-	HAL_GPIO_WritePin(coilIO[2].port, coilIO[2].pin, coilOFF);
-	HAL_GPIO_WritePin(coilIO[3].port, coilIO[3].pin, coilOFF);
+	ioWriteGroup(&injectorGroup, GPIO_PIN_RESET);
+	ioWriteGroup(&coilGroup, coilOFF);
 }
 
 
 /*
- * There are 4 injector channels. The channels represent the intake strokes of the engine, and are sequenced as follows:
+ * Firing order.
+ *
+ * The cylinders are described by the firing table, built from Parameters 3: the number of cylinders, the firing order & the
+ * injector / coil output of each cylinder. Each cylinder's TDC is an even firing interval (720 / cylinders degrees) after the
+ * previous cylinder in the firing order, plus its TDC offset (odd fire engines). The first cylinder in the firing order is at
+ * TDC (Parameters 2 twTDCAngle) in revolution 0 of the engine cycle, or the cylinder at position injectorSequenceReset (1 to
+ * the number of cylinders, limited to it) if Parameters 2 injectorSequenceReset > 0, as the injector index loaded at the
+ * camshaft pulse before the firing table. The TDC angles are wrapped into the engine cycle (twCycleAngle()), so
+ * twTDCAngle can be 0 to 720 degrees.
  *
- * Channel 	Cylinder	Crankshaft Pos
- *    0			1						About 	 TDC
- *    1			3						About		 TDC + 180
- *    2			4						About 	 TDC
- *    3			2						About 	 TDC + 180
+ * Revolution 0 is set by the camshaft pulse (see Engine phase above). If the camshaft pulse puts the cylinders 360 degrees out
+ * of phase, e.g. a camshaft sensor fitted on the other lobe, the phase is flipped by adding 360 degrees to twTDCAngle, or with
+ * an even number of cylinders by moving injectorSequenceReset on by half the cylinders.
  *
- * The injector channels are defined by the array injectorSequence and the injector ready to be fired is pointed to by injectorIndex.
- * The physical injector is mapped onto the channel by NVM settings in Parameters #2. For multiport fully-sequential applications,
- * the injector channel (and physical injector) is synchronised to the cylinder by a camshaft pulse that determines which cylinder is
- * on its intake stroke.
+ * The injection, dwell & spark events of every cylinder are placed in the event table at their angle in the engine cycle, so
+ * the crankshaft pulse handler has no per-cylinder code. There are INJECTOR_OUTPUTS injectors & COIL_OUTPUTS coils. By default
+ * cylinder n uses output n (wrapping round if there are more cylinders than outputs); cylinderOutputs maps the cylinders onto
+ * the outputs otherwise, e.g. a V8 on 4 outputs pairs the cylinders 360 degrees apart (wasted spark & semi-sequential injection).
  *
- * The channel can be mapped onto a physical injector/cylinder differently to that shown above but it's important
- * to note that the injector firing is always 180 degrees apart for a normal 4 stroke cycle. From this, we can see that in a
- * single injector application, the injector ON period must always be contained in less than 180 degrees of swept crankshaft angle.
- * For multiport applications, it is possible to open the injector for more than 180 degrees - intake valve open timings are often
- * 200 degrees or more. For this reason two different timers are required, one for TDC events and the other for TDC + 180 events.
+ * Fully sequential operation needs the engine phase from the camshaft pulse (see Engine phase above). Until the phase is known,
+ * or if there's no camshaft sensor (Parameters 2 injectorSequenceReset < 0), the events are fired with wasted spark & batch
+ * injection (see Staged sync).
  *
  */
 
-// specifies the physical injector for each channel. Injector specified in the range 1 to NUM_INJECTORS.
-// the injectorSequenceReset value can be -1 (for non-fully sequential operation) or a value between 1 & NUM_INJECTORS
-void setInjectorSequence(int a, int b, int c, int d, int sequenceResetValue){
-	// Injector ID stored as range to 0 to NUM_INJECTORS-1
-	injectorSequence[0] = limitI(a, 1, NUM_INJECTORS) - 1;
-	injectorSequence[1] = limitI(b, 1, NUM_INJECTORS) - 1;
-	injectorSequence[2] = limitI(c, 1, NUM_INJECTORS) - 1;
-	injectorSequence[3] = limitI(d, 1, NUM_INJECTORS) - 1;
-	// if the provided injector sequence reset value is greater than zero, set the internal value to it but within the limits of the injector sequence array size
-	// if less than zero, set the internal value to the same value
-	injectorSequenceReset = sequenceResetValue > 0 ? limitI(sequenceResetValue, 1, NUM_INJECTORS) - 1 : sequenceResetValue;
+typedef struct {
+	int32_t tdcAngle;			// engine cycle angle of the cylinder's TDC (degrees scaled by 2^16)
+	uint8_t cylinder;			// cylinder number, 1 to CF_MAX_CYLINDERS
+	uint8_t injector;			// injector channel
+	uint8_t coil;				// coil channel
+} twCylinderStruct;
+
+int twCylinders = 4;
+static twCylinderStruct twFiringTable[CF_MAX_CYLINDERS];
+
+
+// wraps an angle (degrees scaled by 2^16) into the engine cycle, 0 to 720 degrees
+static inline int32_t twCycleAngle(int32_t angle) {
+	const int32_t cycle = 720L << 16;
+	angle %= cycle;
+	return angle >= 0 ? angle : angle + cycle;
 }
 
-void setTriggerWheelConfig(){
 
-	triggerWheelTeethHalf = cfPage1.p2.twTeeth / 2;
+// finds the tooth position starting each cylinder segment, the first tooth at or after the cylinder's TDC
+static void twSetCylinderSegments(void){
+
+	int positions = 2 * triggerWheelTeeth;
+
+	memset(twCylinderSegmentStart, TW_NO_CYLINDER_SEGMENT, sizeof(twCylinderSegmentStart));
+	for (int i = 0; i < twCylinders; i++) {
+		int position;
+		int32_t vernier;
+		angleToIndexAndVernier(twCycleAngle(twFiringTable[i].tdcAngle), &position, &vernier);
+		if (vernier > 0) {
+			position++;
+		}
+		for (int k = 0; (k < positions) && (tdToothPresent((position % positions) % triggerWheelTeeth) == 0); k++) {
+			position++;
+		}
+		twCylinderSegmentStart[position % positions] = (uint8_t)i;
+	}
+
+	// the segment numbers have changed, segment timing starts again
+	twQueueSegment(TW_SEGMENT_RESTART, 0);
+	twCylinderSegment = -1;
+}
+
+
+// builds the firing table from Parameters 3
+static void twSetFiringOrder(void){
+
+	int cylinders = limitI(cfPage1.p3.cylinders, 1, CF_MAX_CYLINDERS);
+	int order[CF_MAX_CYLINDERS];
+	int used = 0;
+
+	// the firing order, one cylinder per decimal digit with the first cylinder most significant
+	int digits = cfPage1.p3.firingOrder;
+	for (int i = cylinders - 1; i >= 0; i--) {
+		order[i] = digits % 10;
+		digits /= 10;
+		if ( (order[i] >= 1) && (order[i] <= cylinders) ) {
+			used |= 1 << (order[i] - 1);
+		}
+	}
+	if ( (digits != 0) || (used != (1 << cylinders) - 1) ) {
+		// not each cylinder once, fire in cylinder number order
+		for (int i = 0; i < cylinders; i++) {
+			order[i] = i + 1;
+		}
+	}
+
+	// the position in the firing order at twTDCAngle in revolution 0
+	int first = cfPage1.p2.injectorSequenceReset > 0 ? limitI(cfPage1.p2.injectorSequenceReset, 1, cylinders) - 1 : 0;
+
+	for (int i = 0; i < cylinders; i++) {
+
+		int cylinder = order[i];
+		twCylinderStruct *cyl = &twFiringTable[i];
+
+		// the cylinder's output digit, cylinder 1 most significant
+		int output = cfPage1.p3.cylinderOutputs;
+		for (int c = cylinder; c < cylinders; c++) {
+			output /= 10;
+		}
+		output %= 10;
+		output = output > 0 ? output - 1 : cylinder - 1;
+
+		cyl->cylinder = cylinder;
+		cyl->injector = output % INJECTOR_OUTPUTS;
+		cyl->coil = output % COIL_OUTPUTS;
+		cyl->tdcAngle = twCycleAngle(twAngleToFixed(cfPage1.p2.twTDCAngle) + (int32_t)(((int64_t)(i - first) * (720L << 16)) / cylinders)
+				+ (int32_t)(((int64_t)cfPage1.p3.cylinderTDCOffset[cylinder - 1] << 16) / 10));
+	}
+
+	// the shortest angle between sparks of the same coil. Wasted spark also fires each coil 360 degrees after its cylinders.
+	twCoilInterval = 360L << 16;
+	for (int i = 0; i < cylinders; i++) {
+		for (int k = 0; k < cylinders; k++) {
+			if (twFiringTable[k].coil != twFiringTable[i].coil) {
+				continue;
+			}
+			int32_t interval = twCycleAngle(twFiringTable[k].tdcAngle - twFiringTable[i].tdcAngle);
+			if ( (interval > 0) && (interval < twCoilInterval) ) {
+				twCoilInterval = interval;
+			}
+			interval = twCycleAngle(twFiringTable[k].tdcAngle + (360L << 16) - twFiringTable[i].tdcAngle);
+			if ( (interval > 0) && (interval < twCoilInterval) ) {
+				twCoilInterval = interval;
+			}
+		}
+	}
+
+	twCylinders = cylinders;
+	twSetCylinderSegments();
+	twRebuildRequest = 1;
+}
 
-	triggerWheelToothSpacingReciprocal = ((float) cfPage1.p2.twTeeth) / 360.0F;
 
-	// converts RPM to Teeth / milli-second - used to calculate number of dwell teeth for the dwell time
-	rpmToTeethPerMillisecond = ((float) cfPage1.p2.twTeeth) / 60000.0F;
+int twCylinderTDCAngle(int position){
+	if ( (position < 0) || (position >= twCylinders) ) {
+		return 0;
+	}
+	return (int)(((int64_t)twFiringTable[position].tdcAngle * 10 + 32768) >> 16) % 7200;
+}
+
+
+void setTriggerWheelConfig(){
+
+	// the number of tooth positions is defined by the trigger pattern
+	triggerWheelTeeth = limitI(tdTeeth, 2, TW_MAX_TEETH);
+
+	triggerWheelTeethHalf = triggerWheelTeeth / 2;
 
 	// used to convert the pulse period in microseconds to RPM
-	rpmFromPeriod = 60000000.0F / ((float) cfPage1.p2.twTeeth);
+	rpmFromPeriod = 60000000.0F / ((float) triggerWheelTeeth);
+
+	// the segment boundary at TDC + 180 is the first tooth at or after the half way tooth
+	twSegmentTooth = triggerWheelTeethHalf;
+	while ( (tdToothPresent(twSegmentTooth) == 0) && (twSegmentTooth < triggerWheelTeeth - 1) ) {
+		twSegmentTooth++;
+	}
+	twSegmentTeeth = twSegmentTooth;
+	// ...measured from the first tooth of the revolution
+	for (int tooth = 0; (tooth < twSegmentTooth) && (tdToothPresent(tooth) == 0); tooth++) {
+		twSegmentTeeth--;
+	}
+	twQueueSegment(TW_SEGMENT_RESTART, 0);
+	twCylinderSegment = -1;
+	twSegmentTimingValid = 0;
+	twRevolutionTimingValid = 0;
+	twLastSegment = -1;
+	twPreviousSegment = -1;
+
+	acInitialise(triggerWheelTeeth);
+
+	// the tooth angle correction table for the pattern
+	tcInitialise(cfPage1.p3.twPattern, triggerWheelTeeth);
 
 }
 
@@ -502,9 +1115,12 @@ void twInitialise() {
 	// power everything off
 	injectorPowerReset();
 
-	setInjectorSequence(cfPage1.p2.injectorIndex0, cfPage1.p2.injectorIndex1, cfPage1.p2.injectorIndex2, cfPage1.p2.injectorIndex3, cfPage1.p2.injectorSequenceReset);
+	injectorSequenceReset = cfPage1.p2.injectorSequenceReset;
+	tdInitialise(cfPage1.p3.twPattern);
 	setTriggerWheelConfig();
+	twSetFiringOrder();
 	setInjectionAngle(cfPage1.p2.injectorStartAngle);
+	twSetSplitConfig();
 
 	// Set the firing sense for the ignition coils
 	// Note that a high output (SET) from the CPU turns the output transistor ON, a low output (RESET) turns the output transistor OFF.
@@ -520,66 +1136,547 @@ void twInitialise() {
 		coilON = GPIO_PIN_RESET;
 		coilOFF = GPIO_PIN_SET;
 	}
+	twErrorTooth = 0;
+	twSyncErrors = 0;
 	keyData.v.errorTooth = 0;
 	keyData.v.syncErrors = 0;
+
+	// the engine phase is re-established at the next camshaft pulse
+	twPhaseState = TW_PHASE_UNKNOWN;
+	twPhaseErrors = 0;
+
+	// force the event table to be rebuilt on the next timing update
+	twRebuildRequest = 1;
 }
 
 // Sets the injection timing.
 void twSetInjectionTiming(float PW){
 	// set the injector pulse width
-	injectorPW = PW;
-	// calculate the injector delay in uS, using the vernier adjustment
-	injectorDelay = crankPulsePeriodF * injectorVernier;
+	injectorPW = PW > 0.0F ? (uint32_t)PW : 0;
+}
+
+
+// returns the dwell time for the battery voltage (uS), interpolated from the dwell table & held at the end points. A point
+// with no dwell time takes Parameters 2 ignitionDwell.
+static float twDwellFromVoltage(float voltage){
+
+	const int *volts = cfPage1.p3.dwellVoltage;
+	float dwell[CF_DWELL_POINTS];
+	for (int i = 0; i < CF_DWELL_POINTS; i++) {
+		dwell[i] = cfPage1.p3.dwellTime[i] > 0 ? (float)cfPage1.p3.dwellTime[i] : cfPage1.p2.ignitionDwell * 1000.0F;
+	}
+
+	// the table is in tenths of a volt
+	float v = voltage * 10.0F;
+	int i = 1;
+	while ( (i < CF_DWELL_POINTS - 1) && (v > (float)volts[i]) ) {
+		i++;
+	}
+	if (volts[i] <= volts[i - 1]) {
+		return v > (float)volts[i] ? dwell[i] : dwell[i - 1];
+	}
+	float fraction = limitF((v - (float)volts[i - 1]) / (float)(volts[i] - volts[i - 1]), 0.0F, 1.0F);
+	return dwell[i - 1] + fraction * (dwell[i] - dwell[i - 1]);
 }
 
 
-// sets the ignition timing
+// sets the ignition timing & the dwell
 void twSetIgnitionTiming(float advance){
 
-	// convert the ignition angle into a tooth index and vernier
-	float ignitionVernier;
-	int ignitionTooth;
-	angleToIndexAndVernier(cfPage1.p2.twTDCAngle - advance, &ignitionTooth, &ignitionVernier);
-	ignitionFiringIndex1 = ignitionTooth;
-	ignitionFiringIndex2 = ignitionFiringIndex1 + triggerWheelTeethHalf;
+	ignitionAdvance = twAngleToFixed(advance);
+
+	// the dwell for the battery voltage, limited to TW_MAX_DWELL_DUTY of the time between sparks of the same coil
+	float dwell = twDwellFromVoltage(keyData.v.voltage2);
+	int period = crankPulsePeriodF;
+	if (period > 0) {
+		float coilIntervalTeeth = ((float)twCoilInterval * (float)triggerWheelTeeth) / (360.0F * 65536.0F);
+		dwell = limitF(dwell, 0.0F, TW_MAX_DWELL_DUTY * coilIntervalTeeth * (float)period);
+
+		// the dwell in quarter tooth periods, rounded up with at least a quarter tooth to spare for acceleration
+		dwellQuarters = limitI((int)(dwell * 4.0F / (float)period) + 2, 1, 4 * TW_MAX_TEETH);
+	}
+	twDwellTarget = dwell > 0.0F ? (uint32_t)dwell : 0;
+}
+
+
+/*
+ * Per-cylinder trims.
+ *
+ * Each cylinder's pulse width & advance are trimmed by the fuel & spark trim tables (cfPage1.fuelTrim & sparkTrim, by
+ * cylinder number), interpolated by the HF task for the RPM & load (MAP). The trim axes span the VE map axes, with
+ * CF_TRIM_SIZE_RPM & CF_TRIM_SIZE_LOAD evenly spaced points. The fuel trim scales the pulse width less the injector latency,
+ * i.e. it's a change in the fuel delivered.
+ *
+ * The trimmed fuel is split into the pulse widths of each injection pulse (see Split injection), held by position in the firing
+ * order, so the crankshaft pulse handler reads the pulse width of an injection event's cylinder & pulse with one indexed load.
+ * The trimmed advance places each cylinder's spark in the event table, so it costs the handler nothing. Batch injection
+ * (cranking & until the engine phase is known) opens all the injectors together, so it uses the untrimmed pulse width.
+ *
+ */
+
+// bilinear interpolation of a trim table, from the lower cell indices & the fractions of the cell
+static inline float twTrimLookup(float trim[CF_TRIM_SIZE_LOAD][CF_TRIM_SIZE_RPM], int r1, int l1, float rf, float lf){
+	float t1 = trim[l1][r1] + rf * (trim[l1][r1 + 1] - trim[l1][r1]);
+	float t2 = trim[l1 + 1][r1] + rf * (trim[l1 + 1][r1 + 1] - trim[l1 + 1][r1]);
+	return t1 + lf * (t2 - t1);
+}
+
+
+// each cylinder's fuel (the pulse width less the injector latency) with its trim (uS), by position in the firing order
+static float twCylinderFuel[CF_MAX_CYLINDERS];
+
+// sets each cylinder's trimmed fuel & advance. Returns non-zero if any cylinder's advance has changed.
+static int twSetCylinderTrims(void){
+
+	// the position on the trim axes, held at the ends
+	float rpmSpan = (float)(VE_MAP_SIZE_RPM - 1) * cfPage1.p2.rpmAxisDelta;
+	float loadSpan = (float)(VE_MAP_SIZE_LOAD - 1) * cfPage1.p2.loadAxisDelta;
+	float r = rpmSpan > 0.0F ? (keyData.v.RPM - cfPage1.p2.rpmAxisStart) * (float)(CF_TRIM_SIZE_RPM - 1) / rpmSpan : 0.0F;
+	float l = loadSpan > 0.0F ? (keyData.v.MAP - cfPage1.p2.loadAxisStart) * (float)(CF_TRIM_SIZE_LOAD - 1) / loadSpan : 0.0F;
+	r = limitF(r, 0.0F, (float)(CF_TRIM_SIZE_RPM - 1));
+	l = limitF(l, 0.0F, (float)(CF_TRIM_SIZE_LOAD - 1));
+	int r1 = limitI((int)r, 0, CF_TRIM_SIZE_RPM - 2);
+	int l1 = limitI((int)l, 0, CF_TRIM_SIZE_LOAD - 2);
+
+	// the part of the pulse width that delivers fuel, i.e. less the injector latency
+	float pw = (float)injectorPW;
+	float fuel = limitF(pw - cfPage1.p2.injectorLatency * 1000.0F, 0.0F, pw);
+
+	int changed = 0;
+	for (int i = 0; i < twCylinders; i++) {
+		int cylinder = twFiringTable[i].cylinder - 1;
+
+		twCylinderFuel[i] = fuel * (1.0F + 0.01F * twTrimLookup(cfPage1.fuelTrim[cylinder], r1, l1, r - (float)r1, l - (float)l1));
+
+		int32_t advance = ignitionAdvance + twAngleToFixed(twTrimLookup(cfPage1.sparkTrim[cylinder], r1, l1, r - (float)r1, l - (float)l1));
+		if (advance != twCylinderAdvance[i]) {
+			twCylinderAdvance[i] = advance;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+
+/*
+ * Split injection.
+ *
+ * Below Parameters 3 splitRPM & splitLoad (e.g. cranking & light load) the fuel can be split across up to
+ * CF_MAX_INJECTION_PULSES pulses per cycle, each started at its own angle before TDC (splitAngle) and delivering its share of
+ * the fuel (splitFraction). Each pulse pays the injector latency, i.e. its pulse width is the latency + the cylinder's trimmed
+ * fuel x the pulse's share.
+ *
+ * Each pulse is an injection event in the event table holding its pulse number, and the pulse widths are held by cylinder &
+ * pulse, so a pulse costs the crankshaft pulse handler the same as an unsplit injection & the handler is still bounded by
+ * TW_MAX_EVENTS_PER_TOOTH.
+ *
+ * The pulses of a cylinder are timed one after another by its injector channel's timer (& compare). The HF task only splits
+ * the injection if every pulse ends at least a tooth period before the tooth that fires the next pulse, allowing for the
+ * longest gap in the trigger pattern as an event on a missing tooth is fired from the preceding tooth. The channel is then
+ * always idle when the next pulse is armed. Otherwise the injection isn't split until the pulses fit. The host simulation
+ * (test_code/split_injection_sim.c) checks the fit against a reference either side of the longest pulse width that splits, &
+ * that every pulse is delivered in full.
+ *
+ */
+
+static int twSplitPulses = 1;									// pulses when split, 1 if the split isn't configured
+static float twSplitFraction[CF_MAX_INJECTION_PULSES];			// each pulse's share of the fuel
+static int32_t twSplitAngle[CF_MAX_INJECTION_PULSES];			// each pulse's angle before TDC (degrees scaled by 2^16)
+static int twInjectionPulses = 1;								// the injection pulses per cycle in the event table
+
+
+// sets the split injection from Parameters 3. The shares are normalised, the split isn't used if they're all zero.
+static void twSetSplitConfig(void){
+
+	int pulses = limitI(cfPage1.p3.splitPulses, 1, CF_MAX_INJECTION_PULSES);
+	int total = 0;
+	for (int k = 0; k < pulses; k++) {
+		total += limitI(cfPage1.p3.splitFraction[k], 0, 100);
+	}
+	twSplitPulses = total > 0 ? pulses : 1;
+	for (int k = 0; k < twSplitPulses; k++) {
+		twSplitFraction[k] = total > 0 ? (float)limitI(cfPage1.p3.splitFraction[k], 0, 100) / (float)total : 1.0F;
+		twSplitAngle[k] = twAngleToFixed((float)cfPage1.p3.splitAngle[k] * 0.1F);
+	}
+}
+
+
+// returns non-zero if each pulse ends at least a tooth period before the tooth that fires the next pulse, the last pulse
+// before the first pulse of the next cycle. The pulse widths are the longest of any cylinder (uS).
+static int twSplitPulsesFit(int pulses, const float *pw){
+
+	int period = crankPulsePeriodF;
+	if (period <= 0) {
+		return 0;
+	}
+	// the next pulse's tooth can be the longest gap in the pattern before the pulse, in quarter tooth spacings
+	float margin = (float)(tdGetMaxGap() + 4);
+	for (int k = 0; k < pulses; k++) {
+		int next = (k + 1) % pulses;
+		float angle = (float)(twSplitAngle[k] - twSplitAngle[next]) / 65536.0F + (next == 0 ? 720.0F : 0.0F);
+		float quarters = (angle * (float)triggerWheelTeeth * 4.0F) / 360.0F - (pw[k] * 4.0F) / (float)period;
+		if (quarters < margin) {
+			return 0;
+		}
+	}
+	return 1;
+}
+
+
+// splits each cylinder's trimmed fuel, & the batch injection fuel, into the pulse widths of the injection pulses. Sets the
+// pulses per cycle for the event table.
+static void twSetInjectionPulses(void){
+
+	// the pulse width less the fuel is the latency, or the whole pulse width if it's shorter than the latency
+	float pw = (float)injectorPW;
+	float fuel = limitF(pw - cfPage1.p2.injectorLatency * 1000.0F, 0.0F, pw);
+	float latency = pw - fuel;
+
+	int pulses = 1;
+	if ( (twSplitPulses > 1) && (keyData.v.RPM < (float)cfPage1.p3.splitRPM)
+			&& ( (cfPage1.p3.splitLoad <= 0) || (keyData.v.MAP < (float)cfPage1.p3.splitLoad) ) ) {
+
+		// the longest pulse width of each pulse, for the fit
+		float maxFuel = fuel;
+		for (int i = 0; i < twCylinders; i++) {
+			maxFuel = twCylinderFuel[i] > maxFuel ? twCylinderFuel[i] : maxFuel;
+		}
+		float pwMax[CF_MAX_INJECTION_PULSES];
+		for (int k = 0; k < twSplitPulses; k++) {
+			pwMax[k] = latency + maxFuel * twSplitFraction[k];
+		}
+		pulses = twSplitPulsesFit(twSplitPulses, pwMax) != 0 ? twSplitPulses : 1;
+	}
+
+	for (int k = 0; k < pulses; k++) {
+		float fraction = pulses > 1 ? twSplitFraction[k] : 1.0F;
+		twBatchPW[k] = (uint32_t)(latency + fuel * fraction);
+		for (int i = 0; i < twCylinders; i++) {
+			float pulsePW = latency + twCylinderFuel[i] * fraction;
+			twCylinderPW[i][k] = pulsePW > 0.0F ? (uint32_t)pulsePW : 0;
+		}
+	}
+	twInjectionPulses = pulses;
+}
+
+
+/*
+ * Live pulse width update.
+ *
+ * An injection pulse's width is set when it's armed, at its tooth, so a pulse width that changes afterwards (e.g. a sharp
+ * throttle tip-in) would otherwise only reach the cylinder's next cycle. With Parameters 3 pwUpdate set, the HF task follows
+ * the new pulse width with each injector channel's last pulse, after the pulse widths are set:
+ *
+ * 	- a pulse that's still to start or is in flight has its end moved (setInjectionEnd()), to extend or truncate it. A new end
+ * 	  that has already passed switches the injector off at once.
+ * 	- a pulse that has ended gets an add-on pulse from now for the extra fuel (+ the injector latency), if that's at least
+ * 	  pwAddOnMin. The add-on is cut short to end by pwAddOnAngle before TDC (e.g. the intake valve closing), the deadline
+ * 	  worked out from the pulse's start angle at the filtered tooth period. Fuel can't be taken back, so a shorter pulse width
+ * 	  is left.
+ *
+ * The crankshaft pulse handler records each pulse as it's armed (twInjectionLast), so it costs the handler a few stores. Batch
+ * injection isn't updated. The number of pulses moved & added are counted in twPWUpdates & twAddOnPulses. The host simulation
+ * (test_code/live_update_sim.c) steps the pulse width around an armed pulse, in flight (truncated, extended & switched off at
+ * once) & after it has ended (with & without an add-on pulse, & an add-on cut short by the deadline), in both output modes.
+ *
+ */
+
+// moves the end of each injector channel's last pulse to its cylinder's new pulse width, or adds a pulse for the extra fuel
+static void twUpdateInjections(void){
+
+	if (cfPage1.p3.pwUpdate == 0) {
+		return;
+	}
+	uint32_t latency = (uint32_t)limitF(cfPage1.p2.injectorLatency * 1000.0F, 0.0F, 1.0E5F);
+	int32_t addOnMin = cfPage1.p3.pwAddOnMin > 0 ? cfPage1.p3.pwAddOnMin : 1;
+
+	// the add-on deadline is this long after the start of each cylinder's injection pulses (uS)
+	float usPerDegree = ((float)crankPulsePeriodF * (float)triggerWheelTeeth) / 360.0F;
+	float addOnAngle = (float)cfPage1.p3.pwAddOnAngle * 0.1F;
+	uint32_t addOnDeadline[CF_MAX_CYLINDERS][CF_MAX_INJECTION_PULSES];
+	for (int i = 0; i < twCylinders; i++) {
+		for (int k = 0; k < CF_MAX_INJECTION_PULSES; k++) {
+			int32_t start = twInjectionPulses > 1 ? twSplitAngle[k] : twInjectionAngle[i];
+			float angle = (float)twCycleAngle(start - (int32_t)(addOnAngle * 65536.0F)) / 65536.0F;
+			addOnDeadline[i][k] = (uint32_t)(angle * usPerDegree);
+		}
+	}
 
-	// convert the ignition vernier to a time delay in microseconds
-	ignitionDelay = crankPulsePeriodF * ignitionVernier;
+	for (int channel = 0; channel < INJECTOR_OUTPUTS; channel++) {
+
+		// the record is also written by the crankshaft pulse handler
+		uint32_t primask = __get_PRIMASK();
+		__disable_irq();
+
+		twInjectionRecord *last = &twInjectionLast[channel];
+		if (last->live != 0) {
+			int32_t delta = (int32_t)(twCylinderPW[last->cylinder][last->pulse] - last->target);
+			uint32_t width = (int32_t)last->width + delta > 0 ? (uint32_t)((int32_t)last->width + delta) : 0;
+			uint32_t now = CRANKSHAFT_TRIGGER_TIMER->CNT;
+			uint32_t deadline = last->start + addOnDeadline[last->cylinder][last->pulse];
+			int32_t remaining = (int32_t)(deadline - now);
+			if (last->time != last->start) {
+				// an add-on pulse still ends by the deadline
+				int32_t limit = (int32_t)(deadline - last->time);
+				width = (int32_t)width < limit ? width : (limit > 0 ? (uint32_t)limit : 0);
+			}
 
-	// calculate tooth indexes required to achieve the specified dwell (power on time)
-	int dwellTeeth = keyData.v.RPM * rpmToTeethPerMillisecond * cfPage1.p2.ignitionDwell;
+			if (delta == 0) {
+				// no change
+			}
+			else if ( (width != last->width) && (setInjectionEnd(channel, last->time + width) != 0) ) {
+				last->target += (int32_t)(width - last->width);
+				last->width = width;
+				twPWUpdates++;
+			}
+			else if (remaining - (int32_t)latency < addOnMin) {
+				// too late for an add-on pulse
+				last->live = 0;
+			}
+			else if ( (delta >= addOnMin) && ((int32_t)(now - (last->time + last->width)) >= 0) ) {
+				int32_t fuel = delta < remaining - (int32_t)latency ? delta : remaining - (int32_t)latency;
+				uint32_t addOn = (uint32_t)fuel + latency;
+				startInjectionTimer(channel, now, addOn, injectorPowerOn, injectorPowerOff);
+				startInjectorCompare(channel, now, addOn);
+				last->time = now;
+				last->width = addOn;
+				last->target += fuel;
+				twAddOnPulses++;
+			}
+		}
 
-	if (dwellTeeth < 1) {
-		// must be at least 1
-		dwellTeeth = 1;
+		__set_PRIMASK(primask);
 	}
+}
+
+
+/*
+ * End of injection timing.
+ *
+ * With Parameters 3 injectionTiming set to TW_INJECTION_TIMING_EOI, each cylinder's injection ends at eoiAngle before TDC
+ * rather than starting at a fixed angle, so the end of injection doesn't drift later as the pulse width grows. The HF task
+ * works out each cylinder's start angle from its pulse width at the predicted tooth period, and the event table holds the
+ * start as the tooth & vernier, as for a fixed start angle. So there's no extra work in the crankshaft pulse handler.
+ *
+ * The event table is only rebuilt for the end of injection when a cylinder's start angle has moved by TW_EOI_REBUILD_ANGLE,
+ * so the end of injection is within that of the target at a steady speed. Split injection uses the pulses' start angles.
+ *
+ */
+
+#define TW_INJECTION_TIMING_SOI		0
+#define TW_INJECTION_TIMING_EOI		1
+
+#define TW_EOI_REBUILD_ANGLE		(TW_VERNIER_ONE / 4)		// degrees scaled by 2^16
+
+// sets each cylinder's injection start angle. Returns non-zero if any has changed enough to rebuild the event table.
+static int twSetInjectionAngles(void){
+
+	int eoi = (cfPage1.p3.injectionTiming == TW_INJECTION_TIMING_EOI) && (twInjectionPulses == 1);
+	float degreesPerUs = 0.0F;
+	if (eoi != 0) {
+		uint32_t period = twPredictToothPeriod();
+		period = period > 0 ? period : (uint32_t)crankPulsePeriodF;
+		degreesPerUs = 360.0F / ((float)period * (float)triggerWheelTeeth);
+	}
+	float eoiAngle = limitF((float)cfPage1.p3.eoiAngle * 0.1F, 0.0F, 720.0F);
+
+	int changed = 0;
+	for (int i = 0; i < twCylinders; i++) {
+		int32_t angle = injectorAngle;
+		int32_t threshold = 0;
+		if (eoi != 0) {
+			// the start is the pulse width before the end, less than a cycle
+			float pwAngle = limitF((float)twCylinderPW[i][0] * degreesPerUs, 0.0F, 719.0F);
+			angle = twCycleAngle((int32_t)((eoiAngle + pwAngle) * 65536.0F));
+			threshold = TW_EOI_REBUILD_ANGLE;
+		}
+		int32_t difference = twCycleAngle(angle - twInjectionAngle[i] + (360L << 16)) - (360L << 16);
+		if ( (difference > threshold) || (difference < -threshold) || ((difference != 0) && (eoi == 0)) ) {
+			twInjectionAngle[i] = angle;
+			changed = 1;
+		}
+	}
+	return changed;
+}
+
+
+// returns the learned angle error of the tooth as a vernier, i.e. a fraction of the tooth spacing scaled by 2^16. The error is
+// limited to half a tooth spacing, so the product can't overflow.
+static inline int32_t twToothErrorVernier(int tooth){
+	return ((int32_t)tcGetToothError(tooth) * triggerWheelTeeth * TW_VERNIER_ONE) / (360 * TC_ANGLE_SCALE);
+}
 
-	// calculate dwell index
-	int dwellIndex = ignitionFiringIndex1 - dwellTeeth;
 
-	if (dwellIndex < 0) {
-		// can't be negative
-		dwellIndex += cfPage1.p2.twTeeth;
+// adds an event to the event list of the tooth position (0 to 2 x teeth - 1) in the specified table
+static void twAddEvent(twEventTable *table, int position, twEventType type, int channel, int cylinder, int pulse,
+		int32_t vernier){
+	// the learned angle error of the firing tooth is taken off the vernier, i.e. the delay is from the tooth's actual angle.
+	// If the tooth position is missing from the trigger pattern, or the event is before the actual angle of the tooth, fire the
+	// event from the preceding tooth, a tooth period later.
+	int positions = 2 * triggerWheelTeeth;
+	int32_t correction = 0;
+	for (int i = 0; (i < positions) && (position >= 0); i++) {
+		int tooth = position % triggerWheelTeeth;
+		if (tdToothPresent(tooth) != 0) {
+			correction = twToothErrorVernier(tooth);
+			if (vernier >= correction) {
+				break;
+			}
+		}
+		position = position > 0 ? position - 1 : positions - 1;
+		vernier += TW_VERNIER_ONE;
+	}
+	vernier -= correction;
+	if ( (position >= 0) && (position < TW_CYCLE_POSITIONS) && (table->nEvents[position] < TW_MAX_EVENTS_PER_TOOTH) ) {
+		twEvent *ev = &table->events[position][table->nEvents[position]++];
+		ev->type = type;
+		ev->channel = channel;
+		ev->cylinder = cylinder;
+		ev->pulse = pulse;
+		ev->vernier = (uint32_t)limitI(vernier, 0, type == TW_EV_DWELL ? TW_MAX_DWELL_VERNIER : TW_MAX_VERNIER);
 	}
+}
+
+
+// Builds the inactive event table from the firing table & the current injection & ignition timing (each cylinder's trimmed
+// advance), then makes it the active table. The injection events are added first, then dwell & spark, in firing order.
+void twBuildEventTable(int batchInjection){
 
-	// update working variables (making sure its not zero as there's no event at zero - it's the missing tooth)
-	// if zero, set to the event before the missing tooth, e.g. 35 for a 36 tooth wheel
-	dwellIndex1 = dwellIndex != 0 ? dwellIndex : cfPage1.p2.twTeeth - 1;
+	twEventTable *table = (twActiveTable == &twEventTables[0]) ? &twEventTables[1] : &twEventTables[0];
+	int positions = 2 * triggerWheelTeeth;
+	int position;
+	int32_t vernier;
 
-	// calculate dwell index 2
-	dwellIndex += triggerWheelTeethHalf;
+	memset(table->nEvents, 0, sizeof(table->nEvents));
+	table->batchInjection = batchInjection;
 
-	if (dwellIndex >= cfPage1.p2.twTeeth) {
-		// make sure it doesn't overflow
-		dwellIndex -= cfPage1.p2.twTeeth;
+	// injection, the cylinder's injection angle before its TDC, or each pulse's angle if the injection is split
+	for (int i = 0; i < twCylinders; i++) {
+		for (int k = 0; k < twInjectionPulses; k++) {
+			int32_t angle = twInjectionPulses > 1 ? twSplitAngle[k] : twInjectionAngle[i];
+			angleToIndexAndVernier(twCycleAngle(twFiringTable[i].tdcAngle - angle), &position, &vernier);
+			twAddEvent(table, position, TW_EV_INJECTION, twFiringTable[i].injector, i, k, vernier);
+		}
+	}
+
+	// ignition - the dwell event is on the tooth at least dwellQuarters quarter tooth periods before the spark, its vernier is
+	// the time to the spark
+	int32_t dwellVernier = dwellQuarters * (TW_VERNIER_ONE / 4);
+	for (int i = 0; i < twCylinders; i++) {
+		angleToIndexAndVernier(twCycleAngle(twFiringTable[i].tdcAngle - twCylinderAdvance[i]), &position, &vernier);
+		int teeth = vernier >= dwellVernier ? 0 : (dwellVernier - vernier + TW_VERNIER_ONE - 1) / TW_VERNIER_ONE;
+		int dwellPosition = (position - teeth % positions + positions) % positions;
+		twAddEvent(table, dwellPosition, TW_EV_DWELL, twFiringTable[i].coil, i, 0, vernier + teeth * TW_VERNIER_ONE);
+		twAddEvent(table, position, TW_EV_SPARK, twFiringTable[i].coil, i, 0, vernier);
 	}
 
-	// copy across, making sure its not zero
-	dwellIndex2 = dwellIndex != 0 ? dwellIndex : cfPage1.p2.twTeeth - 1;
+	// swap the tables
+	twActiveTable = table;
+}
+
+
+// forces the event table to be rebuilt on the next timing update, e.g. after the tooth angle correction table has changed
+void twRequestEventTableRebuild(){
+	twRebuildRequest = 1;
+}
+
+
+// Called from the HF task to update the injection & ignition timing. The event table is only
+// rebuilt if the timing has changed since the last update.
+void twUpdateEventTable(float PW, float advance){
+
+	static int dwellQuartersN_1 = -1, batchInjectionN_1 = -1, injectionPulsesN_1 = -1;
+
+	twSetInjectionTiming(PW);
+	twSetIgnitionTiming(advance);
+	int advanceChanged = twSetCylinderTrims();
+	twSetInjectionPulses();
+	int injectionChanged = twSetInjectionAngles();
+	twUpdateInjections();
+
+	// if running, the injectors are fired in sequence. Otherwise, ALL injectors are fired simultaneously
+	int batchInjection = keyData.v.RPM > cfPage1.p1.crankingThreshold ? 0 : 1;
+
+	// the trigger decoder's acceptance window is only used once running, not through the cranking speed ripple
+	tdEnableWindow( (batchInjection == 0) && (triggerWheelInSync != 0) );
+
+	// likewise, the tooth period predictor only extrapolates once running
+	twPredictorRunning = batchInjection == 0 ? 1 : 0;
+
+	if ( (twRebuildRequest != 0) || (advanceChanged != 0) || (injectionChanged != 0) || (dwellQuarters != dwellQuartersN_1)
+			|| (batchInjection != batchInjectionN_1) || (twInjectionPulses != injectionPulsesN_1) ) {
+
+		twBuildEventTable(batchInjection);
+
+		dwellQuartersN_1 = dwellQuarters;
+		batchInjectionN_1 = batchInjection;
+		injectionPulsesN_1 = twInjectionPulses;
+		twRebuildRequest = 0;
+	}
 }
 
 
 /*+++REVISION_HISTORY+++
 1) 11 May 2021 Included "global.h"
 2) 19 May 2021 Fixes error in setTriggerWheelConfig() - parameters are no longer required.
+3) 15 Oct 2026 Injection, dwell & ignition events held in a per-tooth event table, rebuilt by the HF task via twUpdateEventTable().
+   Timing is no longer recalculated in the crankshaft pulse handler at TDC & TDC + 180.
+4) 15 Oct 2026 Missing tooth detection replaced by the trigger decoder, supports the trigger patterns defined in cfg_data.
+   The number of teeth is taken from the selected pattern (triggerWheelTeeth). Events on missing tooth positions fire from the preceding tooth.
+5) 15 Oct 2026 camshaftPulseHandler() added. The engine phase is latched at each camshaft pulse (captured on TIM2 CH2) and the injector
+   & coil channels are selected from it. The camshaft signal is no longer read in the crankshaft pulse handler. twResetFlag is set from the phase.
+6) 15 Oct 2026 Tooth period history ring buffer added. Injection & ignition delays use a predicted tooth period (first & second difference
+   extrapolation) instead of the filtered period. The filtered period is only used for RPM.
+7) 15 Oct 2026 crankPulseLatency & twNextToothHasEvents() added for the DMA crankshaft pulse capture mode.
+8) 15 Oct 2026 Each crankshaft pulse is recorded by the trigger logger while it's armed. crankPulseTime added.
+9) 15 Oct 2026 180 degree segment & revolution timing added. twUpdateCrankSpeed() provides segment RPM, revolution RPM & acceleration.
+10) 15 Oct 2026 Completed segments are queued for the misfire detector, read with twReadSegment().
+11) 15 Oct 2026 Pulses rejected as noise by the trigger decoder's acceptance window are ignored.
+12) 15 Oct 2026 Staged sync: events fire with wasted spark & batch injection from the first in-sync pulse, sequential once the
+    engine phase is confirmed. Stage changes & cranking start times recorded.
+13) 15 Oct 2026 Stall timeout armed at every pulse, crankshaftStallHandler() cuts the outputs & drops sync when it expires.
+14) 15 Oct 2026 No floating point in interrupt context: fixed point angle to tooth & vernier conversion, sync errors counted in
+    twSyncErrors/twErrorTooth & copied to keyData by the HF task, camshaft pulse angle in tenths of a degree. Dwell teeth are the
+    dwell time / filtered tooth period, rpmToTeethPerMillisecond removed.
+15) 15 Oct 2026 The angle clock is locked to each in-sync pulse. Event delays are timed from the captured pulse time, replaces
+    crankPulseLatency.
+16) 15 Oct 2026 Tooth times recorded for the tooth angle correction. The learned error of the firing tooth is taken off each event's
+    vernier when the event table is built. twRequestEventTableRebuild() added.
+17) 15 Oct 2026 The crank angle synchronous ADC samples are armed at each pulse & stopped at a stall.
+18) 15 Oct 2026 Injector & coil edges also armed on the timer compares, for the output compare output mode.
+19) 16 Oct 2026 Table driven firing sequence for 1 to CF_MAX_CYLINDERS cylinders. The firing table is built from Parameters 3 and
+    the event table covers the engine cycle (2 x teeth positions), each event holding its cylinder's injector or coil channel.
+    Wasted spark fires the ignition events of the other revolution. The injector sequence (injectorIndex, setInjectorSequence(),
+    twResetFlag) & the per-channel injector callbacks are replaced by channel indexed callbacks. twCylinderTDCAngle() added.
+20) 16 Oct 2026 Injectors & coils switched by BSRR stores (ioWritePin() & ioWriteGroup()) rather than HAL_GPIO_WritePin().
+21) 16 Oct 2026 Events timed at absolute times from the captured pulse time (32 bit), rather than 16 bit delays from now. The
+    interrupt & DMA decode latency no longer has to be taken off.
+22) 16 Oct 2026 Time domain dwell: the dwell event queues the coil power on the target dwell before the predicted spark time,
+    rather than switching the coil on at a tooth. The dwell is from the battery voltage dwell table (Parameters 3), limited to
+    TW_MAX_DWELL_DUTY of the coil's spark interval. Achieved dwell statistics added, twResetDwellStatistics().
+23) 16 Oct 2026 Per-cylinder fuel & spark trims, interpolated by the HF task into each cylinder's pulse width (read by the
+    injection event's cylinder) & advance (placed in the event table).
+24) 16 Oct 2026 Split injection: below splitRPM & splitLoad the fuel is split across up to CF_MAX_INJECTION_PULSES angle
+    positioned pulses per cycle (Parameters 3), each an injection event timed by the cylinder's injector channel. The split is
+    only used while each pulse ends a tooth period before the next pulse's tooth.
+25) 16 Oct 2026 Live pulse width update: the HF task moves the end of each injector channel's armed or in-flight pulse to the
+    new pulse width, or adds a pulse for the extra fuel after the pulse has ended, up to pwAddOnAngle (Parameters 3).
+26) 16 Oct 2026 End of injection timing (Parameters 3 injectionTiming): the HF task sets each cylinder's injection start angle
+    from eoiAngle & its pulse width at the predicted tooth period, placed in the event table as the tooth & vernier.
+27) 16 Oct 2026 The trigger decoder's acceptance window is enabled by the HF task above the cranking threshold only.
+28) 16 Oct 2026 Misfire segments are timed per cylinder, from the first tooth at or after each cylinder's TDC (firing table) to
+    the next cylinder's, & queued by the cylinder's position in the firing order. The 180 degree segments are only used for
+    the segment RPM.
+29) 16 Oct 2026 Engine phase comment corrected: a camshaft pulse sets the revolution it occurs in.
+30) 16 Oct 2026 Tooth period predictor moved to tooth_period_predictor.h (shared with the host benchmark). The last tooth period is
+    used below the cranking threshold & before full sync.
+31) 16 Oct 2026 Without a camshaft sensor (Parameters 2 injectorSequenceReset < 0) the engine stays in TW_SYNC_CRANK (wasted spark
+    & batch injection), as the engine phase is never known. The predictor then extrapolates above the cranking threshold.
+32) 16 Oct 2026 Stall detection comment gives the stall latency from the host simulation (test_code/stall_latency_sim.c).
+33) 16 Oct 2026 angleToIndexAndVernier() comment refers to the host check of the fixed point conversions.
+34) 16 Oct 2026 Parameters 2 injectorSequenceReset > 0 is the position in the firing order at TDC in revolution 0 (limited to the
+    number of cylinders), as the injector index it loaded before the firing table. Firing order comment documents the cam phase
+    flip (twTDCAngle + 360 degrees).
+35) 16 Oct 2026 Split injection comment refers to the host simulation of the fit (test_code/split_injection_sim.c).
+36) 16 Oct 2026 Live pulse width update comment refers to the host simulation (test_code/live_update_sim.c).
 +++REVISION_HISTORY_ENDS+++*/
@@ -16,30 +16,113 @@ or FITNESS FOR A PARTICULAR PURPOSE.
 */
 
 
+#include <stdint.h>
 
-#define NUM_INJECTORS 4
+// maximum number of teeth on the trigger wheel, sets the size of the per-tooth event table
+#define TW_MAX_TEETH 120
 
-// teeth half, set at initialisation
+// number of teeth & teeth half, set at initialisation
+extern int triggerWheelTeeth;
 extern int triggerWheelTeethHalf;
 
-// conversion factors, set at initialisation
-extern float rpmToTeethPerMillisecond;
+// conversion factor, set at initialisation
 extern float rpmFromPeriod;
 
 // information on trigger wheel performance
 extern volatile int crankPulsePeriodF;
 extern volatile unsigned int triggerWheelInSync;
 
+// sync error count & the expected tooth at the last sync error, copied to keyData by the HF task
+extern volatile uint32_t twSyncErrors;
+extern volatile int twErrorTooth;
+
 // handles the crankshaft trigger wheel pulse
 extern void crankshaftPulseHandler(int crankPulsePeriod);
 
+// cuts the outputs & drops sync when the crankshaft stops, called by ecu_services when the stall timeout expires
+extern void crankshaftStallHandler(void);
+
+// the captured time of the pulse (uS), set by ecu_services
+extern volatile uint32_t crankPulseTime;
+
+// updates the segment RPM, revolution RPM & crankshaft acceleration in keyData, returns the RPM over the last 180 degree segment. Called from the HF task.
+extern float twUpdateCrankSpeed(void);
+
+// segment number returned by twReadSegment() when segment timing restarts
+#define TW_SEGMENT_RESTART -1
+
+// reads the next completed cylinder segment (the cylinder's position in the firing order, 0 to twCylinders - 1) & its time (uS),
+// returns 0 if there are no more segments. Called from the HF task.
+extern int twReadSegment(int *segment, uint32_t *time);
+
+// returns non-zero if the next tooth has injection or ignition events
+extern int twNextToothHasEvents(void);
+
 // switches off the injectors & coils
 extern void injectorPowerReset(void);
 
 // initialise tw software
 extern void twInitialise(void);
 
-// this flag is set by the camshaft handler to request an injector sequence reset. Set to non-zero resets the sequence.
-extern volatile int twResetFlag;
+// updates the injection & ignition timing, rebuilding the per-tooth event table if required. Called from the HF task.
+extern void twUpdateEventTable(float PW, float advance);
+
+// forces the event table to be rebuilt on the next timing update
+extern void twRequestEventTableRebuild(void);
+
+// handles the camshaft pulse
+extern void camshaftPulseHandler(void);
+
+// the number of cylinders, from Parameters 3
+extern int twCylinders;
+
+// returns the engine cycle angle of TDC (tenths of a degree, 0 - 7199) of the cylinder at the position in the firing order
+extern int twCylinderTDCAngle(int position);
+
+// coil dwell, see trigger_wheel_handler.c: the target dwell (uS), set by the HF task from the battery voltage, the last achieved
+// dwell (uS), the mean (signed) & maximum (absolute) achieved dwell error (uS) & the number of dwells recorded
+extern volatile uint32_t twDwellTarget;
+extern volatile uint32_t twDwellAchieved;
+extern volatile int32_t twDwellErrorMean;
+extern volatile uint32_t twDwellErrorMax;
+extern volatile uint32_t twDwellCount;
+extern void twResetDwellStatistics(void);
+
+// live pulse width update, see trigger_wheel_handler.c: the number of armed or in-flight pulses moved & add-on pulses added
+extern volatile uint32_t twPWUpdates;
+extern volatile uint32_t twAddOnPulses;
+
+// engine phase, the current revolution of the engine cycle (0 or 1), set from the camshaft pulse
+extern volatile int twEngineRevolution;
+
+// staged sync, see trigger_wheel_handler.c
+typedef enum { TW_SYNC_NONE, TW_SYNC_CRANK, TW_SYNC_FULL } twSyncStageType;
+
+// number of sync stage changes held in the log, must be a power of 2
+#define TW_SYNC_LOG_SIZE 8
+
+typedef struct {
+	uint32_t time;				// the pulse time of the stage change (uS)
+	uint32_t stage;				// the new stage, twSyncStageType
+} twSyncLogEntry;
+
+// times from the first crankshaft pulse of the last start (uS), 0 until reached
+typedef struct {
+	uint32_t crankSync;			// to the crankshaft position being known
+	uint32_t firstSpark;		// to the first spark
+	uint32_t fullSync;			// to the engine phase being confirmed
+} twStartTimesType;
+
+extern volatile twSyncStageType twSyncStage;
+extern twSyncLogEntry twSyncLog[TW_SYNC_LOG_SIZE];
+extern volatile uint32_t twSyncLogIndex;				// free running index of the next log entry
+extern volatile twStartTimesType twStartTimes;
+
+// resets the sync stage when the crankshaft stops, the next start is timed from its first pulse
+extern void twResetSyncStage(void);
+
+// engine cycle angle (0 - 7200 tenths of a degree) of the last camshaft pulse & number of camshaft pulses that disagreed with the engine phase
+extern volatile int twCamshaftPulseAngle;
+extern volatile unsigned int twPhaseErrors;
 
 #endif